@@ -0,0 +1,146 @@
+#pragma once
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Common.h"
+#include "YBaseLib/ConditionVariable.h"
+#include "YBaseLib/Mutex.h"
+#include "YBaseLib/ReferenceCounted.h"
+
+class AsyncFile;
+class ThreadPool;
+
+// backend used to service asynchronous requests
+enum ASYNC_FILE_BACKEND
+{
+  ASYNC_FILE_BACKEND_DEFAULT,     // io_uring where available, otherwise the thread pool
+  ASYNC_FILE_BACKEND_IO_URING,    // linux io_uring only, open fails if unavailable
+  ASYNC_FILE_BACKEND_THREAD_POOL, // blocking pread/pwrite on pool threads
+};
+
+// a single in-flight read or write. the caller owns one reference, the file owns another until completion.
+// requests do not reference their file, so the file must outlive any request which is still waited on.
+class AsyncFileRequest : public ReferenceCounted
+{
+  friend class AsyncFile;
+
+public:
+  AsyncFile* GetFile() const { return m_pFile; }
+  void* GetBuffer() const { return m_pBuffer; }
+  uint64 GetOffset() const { return m_offset; }
+  uint32 GetLength() const { return m_length; }
+  bool IsWrite() const { return m_isWrite; }
+
+  // completion state. result is the number of bytes transferred, or a negative errno on failure. only valid once
+  // WaitForCompletion has returned.
+  bool IsCompleted() const { return m_completed; }
+  bool IsSuccessful() const { return (m_completed && m_result >= 0); }
+  int32 GetResult() const { return m_result; }
+
+  // blocks until the request has completed, returning true if it transferred any data or hit end of file.
+  bool WaitForCompletion();
+
+private:
+  AsyncFileRequest(AsyncFile* pFile, void* pBuffer, uint32 length, uint64 offset, bool isWrite);
+  ~AsyncFileRequest();
+
+  AsyncFile* m_pFile;
+  void* m_pBuffer;
+  uint64 m_offset;
+  uint32 m_length;
+  bool m_isWrite;
+  volatile bool m_completed;
+  int32 m_result;
+
+  // bytes already moved by earlier submissions, when io_uring completed the request short
+  uint32 m_transferred;
+};
+
+// positional asynchronous file access. requests are independent of each other and carry their own offset, so
+// there is no file pointer and any number of requests (up to the queue depth) can be outstanding at once.
+class AsyncFile : public ReferenceCounted
+{
+  friend class AsyncFileRequest;
+  friend class AsyncFileThreadPoolWorkItem;
+
+public:
+  // opens a file. openMode takes BYTESTREAM_OPEN_READ/WRITE/CREATE/TRUNCATE/CREATE_PATH.
+  // if pThreadPool is null and the thread pool backend is used, a private pool is created.
+  static AsyncFile* Open(const char* fileName, uint32 openMode, uint32 queueDepth = 32,
+                         ASYNC_FILE_BACKEND backend = ASYNC_FILE_BACKEND_DEFAULT, ThreadPool* pThreadPool = nullptr);
+
+  ASYNC_FILE_BACKEND GetBackend() const { return m_backend; }
+  uint32 GetQueueDepth() const { return m_queueDepth; }
+  uint32 GetPendingRequestCount() const { return m_pendingRequests; }
+
+  // current size of the file on disk
+  uint64 GetSize() const;
+
+  // queues a read or write. the buffer must remain valid until the request completes. if the queue is full,
+  // blocks until a slot becomes available. returns null if the request could not be submitted.
+  AsyncFileRequest* ReadAsync(void* pBuffer, uint32 length, uint64 offset);
+  AsyncFileRequest* WriteAsync(const void* pBuffer, uint32 length, uint64 offset);
+
+  // synchronous helpers built on the above
+  int32 Read(void* pBuffer, uint32 length, uint64 offset);
+  int32 Write(const void* pBuffer, uint32 length, uint64 offset);
+
+  // blocks until every outstanding request has completed
+  void WaitForAllRequests();
+
+  // flushes file data to stable storage
+  bool Flush();
+
+private:
+  AsyncFile(ASYNC_FILE_BACKEND backend, uint32 queueDepth);
+  ~AsyncFile();
+
+  bool InitializeIOUring();
+  void ShutdownIOUring();
+
+  AsyncFileRequest* Submit(void* pBuffer, uint32 length, uint64 offset, bool isWrite);
+  bool SubmitIOUring(AsyncFileRequest* pRequest);
+  void CompleteRequest(AsyncFileRequest* pRequest, int32 result);
+
+  // waits for the given request, or until no more than maxPendingRequests remain if pRequest is null.
+  // m_lock must be held.
+  void WaitLocked(AsyncFileRequest* pRequest, uint32 maxPendingRequests = 0);
+  uint32 ReapIOUringCompletions();
+
+  ASYNC_FILE_BACKEND m_backend;
+  uint32 m_queueDepth;
+  uint32 m_pendingRequests;
+
+#if defined(Y_PLATFORM_WINDOWS)
+  void* m_hFile;
+#else
+  int m_fd;
+#endif
+
+  ThreadPool* m_pThreadPool;
+  bool m_ownsThreadPool;
+
+  Mutex m_lock;
+  ConditionVariable m_completionCondition;
+  bool m_reaping;
+
+  // io_uring state
+  int m_ringFd;
+  void* m_pSQRing;
+  void* m_pCQRing;
+  void* m_pSQEs;
+  size_t m_SQRingSize;
+  size_t m_CQRingSize;
+  size_t m_SQEsSize;
+  volatile uint32* m_pSQHead;
+  volatile uint32* m_pSQTail;
+  uint32 m_SQMask;
+  uint32* m_pSQArray;
+  volatile uint32* m_pCQHead;
+  volatile uint32* m_pCQTail;
+  uint32 m_CQMask;
+  void* m_pCQEs;
+};
+
+// read-only stream over an async file which keeps up to chunkCount reads of chunkSize bytes in flight ahead of the
+// read position. intended for sequential scans; seeking discards the read-ahead window and restarts it.
+ByteStream* AsyncFile_CreateSequentialReadStream(AsyncFile* pFile, uint32 chunkSize = 256 * 1024,
+                                                 uint32 chunkCount = 8);
@@ -101,6 +101,10 @@ public:
   void WriteBytes(const void* src, uint32 len);
   bool SafeWriteBytes(const void* src, uint32 len);
 
+  // writes several buffers with a single call to the stream, no endian conversion is done
+  void WriteVector(const void** ppBuffers, const uint32* pBufferLengths, uint32 numBuffers);
+  bool SafeWriteVector(const void** ppBuffers, const uint32* pBufferLengths, uint32 numBuffers);
+
   // reads a user-specified type from the stream, no endian conversion is done.
   template<typename T>
   void WriteType(const T* v)
@@ -180,6 +184,9 @@ protected:
   // internal function that reads the actual data from the stream, and does error checking
   void InternalWriteBytes(const void* pSource, uint32 cbSource);
   bool SafeInternalWriteBytes(const void* pSource, uint32 cbSource);
+  void InternalWriteVector(const void** ppBuffers, const uint32* pBufferLengths, uint32 numBuffers);
+  bool SafeInternalWriteVector(const void** ppBuffers, const uint32* pBufferLengths, uint32 numBuffers);
+  bool InternalWriteSizePrefixedString(const char* str, uint32 len);
 
   ByteStream* m_pStream;
   ENDIAN_TYPE m_eStreamByteOrder;
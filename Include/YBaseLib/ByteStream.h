@@ -15,6 +15,8 @@ enum BYTESTREAM_OPEN_MODE
   BYTESTREAM_OPEN_ATOMIC_UPDATE = 64, //
   BYTESTREAM_OPEN_SEEKABLE = 128,
   BYTESTREAM_OPEN_STREAMED = 256,
+  BYTESTREAM_OPEN_DURABLE = 512,       // atomic update: sync the data and the directory entry before Commit returns
+  BYTESTREAM_OPEN_GROUP_COMMIT = 1024, // atomic update: as DURABLE, but concurrent commits share directory syncs
 };
 
 // interface class used by readers, writers, etc.
@@ -41,6 +43,11 @@ public:
   // write bytes to this stream, optionally returning the number of bytes written.
   virtual bool Write2(const void* pSource, uint32 ByteCount, uint32* pNumberOfBytesWritten = nullptr) = 0;
 
+  // scatter/gather variants of Read and Write. the buffers are transferred in order, as if by consecutive calls, and
+  // the total number of bytes transferred is returned. the default implementation loops over Read/Write.
+  virtual uint32 ReadV(void** ppBuffers, const uint32* pBufferLengths, uint32 numBuffers);
+  virtual uint32 WriteV(const void** ppBuffers, const uint32* pBufferLengths, uint32 numBuffers);
+
   // seeks to the specified position in the stream
   // if seek failed, returns false.
   virtual bool SeekAbsolute(uint64 Offset) = 0;
@@ -62,6 +69,14 @@ public:
   // if the file was opened in atomic update mode, commits the file and replaces the temporary file
   virtual bool Commit() = 0;
 
+  // if the stream is backed by addressable memory, returns a pointer to the start of its contents (GetSize() bytes),
+  // otherwise null. lets copies read the source in place instead of through an intermediate buffer.
+  virtual const byte* GetMemoryBasePointer() const { return nullptr; }
+
+  // if the stream is backed by an OS file, flushes any buffered data and returns the descriptor, otherwise -1.
+  // the descriptor's own offset is not kept in sync with the stream position, so use positional calls on it.
+  virtual int GetFileDescriptor() { return -1; }
+
   // state accessors
   inline bool InErrorState() const { return m_errorState; }
   inline void SetErrorState() { m_errorState = true; }
@@ -125,6 +140,7 @@ public:
   virtual bool Flush() override;
   virtual bool Commit() override;
   virtual bool Discard() override;
+  virtual const byte* GetMemoryBasePointer() const override;
 
 private:
   byte* m_pMemory;
@@ -155,6 +171,7 @@ public:
   virtual bool Flush() override;
   virtual bool Commit() override;
   virtual bool Discard() override;
+  virtual const byte* GetMemoryBasePointer() const override;
 
 private:
   const byte* m_pMemory;
@@ -185,6 +202,7 @@ public:
   virtual bool Flush() override;
   virtual bool Commit() override;
   virtual bool Discard() override;
+  virtual const byte* GetMemoryBasePointer() const override;
 
 private:
   void Grow(uint32 MinimumGrowth);
@@ -200,6 +218,30 @@ private:
 // opens a local file-based stream. fills in error if passed, and returns false if the file cannot be opened.
 bool ByteStream_OpenFileStream(const char* FileName, uint32 OpenMode, ByteStream** ppReturnPointer);
 
+// opens a read-only stream over a memory-mapped file. GetMemoryBasePointer() returns the mapping, so consumers which
+// understand it can use the file's contents in place. the file must not be truncated while the stream is open.
+bool ByteStream_OpenMappedFileStream(const char* FileName, ByteStream** ppReturnPointer);
+
+// process-wide counters for commits of atomic-update file streams.
+// latency bucket i counts commits which took less than 2^i microseconds, the last bucket counts anything slower.
+#define BYTESTREAM_COMMIT_LATENCY_BUCKETS 24
+struct BYTESTREAM_COMMIT_STATISTICS
+{
+  uint64 CommitCount;
+  uint64 FailedCommitCount;
+  uint64 FileSyncCount;
+  uint64 DirectorySyncCount;
+  uint64 TotalLatencyMicroseconds;
+  uint64 MaxLatencyMicroseconds;
+  uint64 LatencyBuckets[BYTESTREAM_COMMIT_LATENCY_BUCKETS];
+};
+void ByteStream_GetCommitStatistics(BYTESTREAM_COMMIT_STATISTICS* pStatistics);
+void ByteStream_ResetCommitStatistics();
+
+// with BYTESTREAM_OPEN_GROUP_COMMIT, the first commit of a group waits this long for others to join before syncing.
+// commits arriving while a sync is in progress always join the next group, so zero (the default) still batches.
+void ByteStream_SetGroupCommitWindow(uint32 milliseconds);
+
 // memory byte stream, caller is responsible for management, therefore it can be located on either the stack or on the
 // heap.
 MemoryByteStream* ByteStream_CreateMemoryStream(void* pMemory, uint32 Size);
@@ -30,9 +30,14 @@ struct Y_CPUID_RESULT
   bool SupportsSSE5A;
   bool SupportsAVX;
   bool SupportsAES;
+  bool SupportsPCLMULQDQ;
   bool SupportsHTT;
   bool Supports3DNow;
   bool Supports3DNow2;
+
+  // ARMv8 optional extensions
+  bool SupportsARMCRC32;
+  bool SupportsARMPMULL;
 };
 
 void Y_ReadCPUID(Y_CPUID_RESULT* pResult);
@@ -4,6 +4,16 @@
 class ByteStream;
 class String;
 
+enum CRC32_IMPLEMENTATION
+{
+  CRC32_IMPLEMENTATION_SLICING_BY_8, // portable table-driven, eight bytes per step
+  CRC32_IMPLEMENTATION_PCLMULQDQ,    // x86 carry-less multiply folding, 64 bytes per step
+  CRC32_IMPLEMENTATION_ARMV8,        // ARMv8 crc32 instructions
+  CRC32_IMPLEMENTATION_COUNT,
+};
+
+// The zip/zlib crc32 (reflected polynomial 0xEDB88320), so values can be compared with zlib's crc32() and the CRCs
+// stored in zip archives. The fastest implementation the CPU supports is picked the first time a CRC is computed.
 class CRC32
 {
 public:
@@ -16,6 +26,24 @@ public:
   bool HashStreamPartial(ByteStream* pStream, uint64 count);
   void Reset();
 
+  // appends the CRC of another run of bytes, which was computed separately from a start of zero
+  void Combine(uint32 crc, uint64 len);
+
+  // continues crc over len bytes at buf, as crc32(crc, buf, len) does
+  static uint32 ComputeBuffer(uint32 crc, const void* buf, size_t len);
+
+  // returns the CRC of A followed by B, given the CRCs of A and B and the length of B. lets large buffers be split into
+  // chunks which are hashed in parallel and then merged, as zlib's crc32_combine does.
+  static uint32 CombineCRC(uint32 crcA, uint32 crcB, uint64 lenB);
+
+  static CRC32_IMPLEMENTATION GetImplementation();
+  static bool IsImplementationAvailable(CRC32_IMPLEMENTATION implementation);
+  static const char* GetImplementationName(CRC32_IMPLEMENTATION implementation);
+
+  // for testing and benchmarking, computes with a particular implementation. it must be available.
+  static uint32 ComputeBufferWithImplementation(CRC32_IMPLEMENTATION implementation, uint32 crc, const void* buf,
+                                                size_t len);
+
 private:
   uint32 m_currentCRC;
 };
@@ -42,15 +42,23 @@ public:
   // When finished, call FlushBytes(length).
   bool GetReadPointer(const void** ppReadPointer, size_t* pByteCount) const;
 
-  // Frees up buffer space.
+  // Frees up buffer space. May span both regions returned by GetReadRegions.
   void MoveReadPointer(size_t byteCount);
 
+  // Obtains pointers to all of the data in the buffer, in order, for vectored writes. Returns the number of regions
+  // filled (0-2). When finished, call MoveReadPointer(length).
+  uint32 GetReadRegions(const void** ppRegions, size_t* pRegionSizes) const;
+
   // Obtains a pointer to the start of writable data with at least byteCount bytes, contiguously.
   bool GetWritePointer(void** ppWritePointer, size_t* pByteCount);
 
-  // After writing to ppWritePointer, moves it forward.
+  // After writing to ppWritePointer, moves it forward. May span both regions returned by GetWriteRegions.
   void MoveWritePointer(size_t byteCount);
 
+  // Obtains pointers to all of the free space in the buffer, in order, for vectored reads. Returns the number of
+  // regions filled (0-2). After writing, call MoveWritePointer(length).
+  uint32 GetWriteRegions(void** ppRegions, size_t* pRegionSizes) const;
+
 private:
   // backed storage
   byte* m_pBuffer;
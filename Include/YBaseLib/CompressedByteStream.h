@@ -0,0 +1,149 @@
+#pragma once
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Common.h"
+#include "YBaseLib/CompressionCodec.h"
+#include "YBaseLib/PODArray.h"
+
+// Write-only decorator which compresses everything written to it into the base stream, starting at the base stream's
+// position when it was created. The compressed stream is ended by Finish() or Commit(), or when the stream is released
+// without having been discarded.
+//
+// With a restart interval, the codec is reset every restartInterval bytes of input, so each piece can be decompressed
+// without the ones before it, and a table of where the pieces start is written after the compressed data. These
+// streams are read back with ByteStream_OpenSeekableDecompressingStream, which can seek by starting at the nearest
+// piece. Smaller intervals make seeks cheaper at the cost of compression ratio.
+class CompressingByteStream : public ByteStream
+{
+public:
+  CompressingByteStream(ByteStream* pBaseStream, CompressionCodecStream* pCompressor, COMPRESSION_CODEC codec,
+                        uint32 restartInterval);
+  virtual ~CompressingByteStream();
+
+  ByteStream* GetBaseStream() const { return m_pBaseStream; }
+  COMPRESSION_CODEC GetCodec() const { return m_codec; }
+  uint32 GetRestartInterval() const { return m_restartInterval; }
+
+  // bytes written to the base stream so far, including output still buffered here
+  uint64 GetCompressedSize() const { return m_compressedSize + m_outputBytes; }
+
+  // ends the compressed stream and writes out the restart table, if any. the base stream is not committed.
+  bool Finish();
+
+  virtual bool ReadByte(byte* pDestByte) override;
+  virtual uint32 Read(void* pDestination, uint32 ByteCount) override;
+  virtual bool Read2(void* pDestination, uint32 ByteCount, uint32* pNumberOfBytesRead /* = nullptr */) override;
+  virtual bool WriteByte(byte SourceByte) override;
+  virtual uint32 Write(const void* pSource, uint32 ByteCount) override;
+  virtual bool Write2(const void* pSource, uint32 ByteCount, uint32* pNumberOfBytesWritten /* = nullptr */) override;
+  virtual bool SeekAbsolute(uint64 Offset) override;
+  virtual bool SeekRelative(int64 Offset) override;
+  virtual bool SeekToEnd() override;
+  virtual uint64 GetSize() const override;
+  virtual uint64 GetPosition() const override;
+
+  // writes out the compressed data produced so far and flushes the base stream. input the codec is still holding on
+  // to is not forced out, as that would cost compression ratio.
+  virtual bool Flush() override;
+
+  // finishes the stream, then commits the base stream
+  virtual bool Commit() override;
+
+  // abandons the stream, and discards the base stream
+  virtual bool Discard() override;
+
+private:
+  bool FlushOutputBuffer();
+  bool CompressInput(const byte* pInput, uint32 inputSize, bool finish);
+
+  ByteStream* m_pBaseStream;
+  CompressionCodecStream* m_pCompressor;
+  COMPRESSION_CODEC m_codec;
+  uint32 m_restartInterval;
+
+  // compressed offset of the start of each piece, relative to the start of the compressed data
+  PODArray<uint64> m_restartPoints;
+  uint32 m_pieceInputSize;
+
+  uint64 m_position;
+  uint64 m_compressedSize;
+  uint32 m_outputBytes;
+  bool m_finished;
+  bool m_discarded;
+
+  byte m_outputBuffer[32768];
+};
+
+// Read-only decorator which decompresses the base stream on the fly, starting at the base stream's position when it
+// was created. Streams made of several pieces, as written with a restart interval, are read back to back.
+//
+// Forward seeks decompress and discard. Backward seeks reset the decompressor and start again from the nearest
+// restart point at or before the target, or from the start of the data if there is no restart table, so they need a
+// seekable base stream. The uncompressed size is only known up front with a restart table; otherwise GetSize()
+// returns zero until the end of the data has been reached.
+class DecompressingByteStream : public ByteStream
+{
+public:
+  DecompressingByteStream(ByteStream* pBaseStream, CompressionCodecStream* pDecompressor, COMPRESSION_CODEC codec,
+                          uint64 compressedSize, uint64 uncompressedSize, uint32 restartInterval,
+                          const uint64* pRestartPoints, uint32 restartPointCount);
+  virtual ~DecompressingByteStream();
+
+  ByteStream* GetBaseStream() const { return m_pBaseStream; }
+  COMPRESSION_CODEC GetCodec() const { return m_codec; }
+  uint32 GetRestartInterval() const { return m_restartInterval; }
+  uint32 GetRestartPointCount() const { return m_restartPoints.GetSize(); }
+
+  virtual bool ReadByte(byte* pDestByte) override;
+  virtual uint32 Read(void* pDestination, uint32 ByteCount) override;
+  virtual bool Read2(void* pDestination, uint32 ByteCount, uint32* pNumberOfBytesRead /* = nullptr */) override;
+  virtual bool WriteByte(byte SourceByte) override;
+  virtual uint32 Write(const void* pSource, uint32 ByteCount) override;
+  virtual bool Write2(const void* pSource, uint32 ByteCount, uint32* pNumberOfBytesWritten /* = nullptr */) override;
+  virtual bool SeekAbsolute(uint64 Offset) override;
+  virtual bool SeekRelative(int64 Offset) override;
+  virtual bool SeekToEnd() override;
+  virtual uint64 GetSize() const override;
+  virtual uint64 GetPosition() const override;
+  virtual bool Flush() override;
+  virtual bool Commit() override;
+  virtual bool Discard() override;
+
+private:
+  bool FillInputBuffer();
+  bool RestartAt(uint32 restartPointIndex);
+  bool Skip(uint64 byteCount);
+
+  ByteStream* m_pBaseStream;
+  CompressionCodecStream* m_pDecompressor;
+  COMPRESSION_CODEC m_codec;
+  uint64 m_baseOffset;
+
+  // 0xFFFFFFFFFFFFFFFF when not known, in which case the data runs to the end of the base stream
+  uint64 m_compressedSize;
+  uint64 m_compressedPosition;
+  uint64 m_size;
+
+  uint32 m_restartInterval;
+  PODArray<uint64> m_restartPoints;
+
+  uint64 m_position;
+  uint32 m_inputPosition;
+  uint32 m_inputBytes;
+  bool m_endOfPiece;
+  bool m_endOfStream;
+
+  byte m_inputBuffer[32768];
+};
+
+// wraps pBaseStream in a compressing stream. the new stream takes a reference to the base stream. returns null if the
+// codec is not available. a restart interval of zero writes a plain compressed stream, readable by any decompressor.
+CompressingByteStream* ByteStream_CreateCompressingStream(ByteStream* pBaseStream, COMPRESSION_CODEC codec,
+                                                          uint32 compressionLevel, uint32 restartInterval = 0);
+
+// wraps pBaseStream in a decompressing stream, which reads until the end of the base stream. the new stream takes a
+// reference to the base stream. returns null if the codec is not available.
+DecompressingByteStream* ByteStream_CreateDecompressingStream(ByteStream* pBaseStream, COMPRESSION_CODEC codec);
+
+// opens a stream written with a restart interval, by reading the restart table from the end of pBaseStream. the codec
+// is recorded in the table. returns null if the table is missing or damaged, or the codec is not available.
+DecompressingByteStream* ByteStream_OpenSeekableDecompressingStream(ByteStream* pBaseStream);
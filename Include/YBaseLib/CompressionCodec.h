@@ -0,0 +1,59 @@
+#pragma once
+#include "YBaseLib/Common.h"
+
+// the codecs are only available when the library they wrap is built in: HAVE_ZLIB, HAVE_ZSTD and HAVE_LZ4.
+enum COMPRESSION_CODEC
+{
+  COMPRESSION_CODEC_DEFLATE, // raw deflate, as stored in zip archives
+  COMPRESSION_CODEC_ZSTD,    // zstandard frames
+  COMPRESSION_CODEC_LZ4,     // lz4 frames, without the frame's own checksums
+  COMPRESSION_CODEC_COUNT,
+};
+
+enum COMPRESSION_CODEC_RESULT
+{
+  COMPRESSION_CODEC_RESULT_OK,
+  COMPRESSION_CODEC_RESULT_STREAM_END,
+  COMPRESSION_CODEC_RESULT_ERROR,
+};
+
+// an incremental compressor or decompressor, used the same way as a z_stream. each call to Process consumes input
+// and produces output, advancing the pointers and decrementing the sizes past what was used. a call which can't make
+// any progress (no input left when more is needed, or no output space) returns an error, as inflate does.
+class CompressionCodecStream
+{
+public:
+  virtual ~CompressionCodecStream() {}
+
+  // compressors: with finish set, the end of the stream is written once all input is consumed, and STREAM_END is
+  // returned once it has all been output. decompressors ignore finish, and return STREAM_END at the end of the data.
+  virtual COMPRESSION_CODEC_RESULT Process(const byte** ppInput, uint32* pInputSize, byte** ppOutput,
+                                           uint32* pOutputSize, bool finish) = 0;
+
+  // returns the stream to its initial state, ready to start a new stream with the same settings. the codec's state is
+  // reused rather than reallocated, so this is much cheaper than creating a new stream.
+  virtual bool Reset() = 0;
+};
+
+namespace CompressionCodec {
+
+bool IsAvailable(COMPRESSION_CODEC codec);
+const char* GetName(COMPRESSION_CODEC codec);
+
+// levels are the codec's own, and are clamped to its range: deflate 1-9, zstd 1-22, lz4 0-12 (3 and up use lz4hc).
+uint32 GetDefaultCompressionLevel(COMPRESSION_CODEC codec);
+uint32 GetMaxCompressionLevel(COMPRESSION_CODEC codec);
+
+// return null if the codec is not available
+CompressionCodecStream* CreateCompressor(COMPRESSION_CODEC codec, uint32 compressionLevel);
+CompressionCodecStream* CreateDecompressor(COMPRESSION_CODEC codec);
+
+// buffer helpers, as in ZLibHelpers. the output of WriteCompressedDataToBuffer is the same as a compressor stream's.
+uint32 GetCompressedBufferUpperBounds(COMPRESSION_CODEC codec, uint32 cbSourceBuffer, uint32 compressionLevel);
+bool WriteCompressedDataToBuffer(COMPRESSION_CODEC codec, void* pDestinationBuffer, uint32 cbDestinationBuffer,
+                                 uint32* pCompressedSize, const void* pSourceBuffer, uint32 cbSourceBuffer,
+                                 uint32 compressionLevel);
+bool ReadCompressedDataFromBuffer(COMPRESSION_CODEC codec, void* pDestinationBuffer, uint32 cbDestinationBuffer,
+                                  uint32* pDecompressedSize, const void* pSourceBuffer, uint32 cbSourceBuffer);
+
+} // namespace CompressionCodec
@@ -0,0 +1,76 @@
+#pragma once
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Common.h"
+#include "YBaseLib/ConditionVariable.h"
+#include "YBaseLib/Mutex.h"
+
+class ThreadPool;
+
+// Read-only decorator which reads ahead of the consumer on a worker thread, so that decoding the data and fetching
+// the next part of it overlap. Once wrapped, the base stream must not be accessed directly, as the worker reads from
+// it concurrently. Forward seeks into already-fetched data are free; any other seek drains the worker, seeks the base
+// stream and discards the window, so the base stream only ever sees sequential reads and the seeks the caller makes.
+class PrefetchingByteStream : public ByteStream
+{
+  friend class PrefetchingByteStreamFillWorkItem;
+
+public:
+  // if pThreadPool is null, a single-thread pool is created for this stream.
+  PrefetchingByteStream(ByteStream* pBaseStream, uint32 chunkSize, uint32 chunkCount, ThreadPool* pThreadPool);
+  virtual ~PrefetchingByteStream();
+
+  ByteStream* GetBaseStream() const { return m_pBaseStream; }
+  uint32 GetChunkSize() const { return m_chunkSize; }
+  uint32 GetChunkCount() const { return m_chunkCount; }
+
+  virtual bool ReadByte(byte* pDestByte) override;
+  virtual uint32 Read(void* pDestination, uint32 ByteCount) override;
+  virtual bool Read2(void* pDestination, uint32 ByteCount, uint32* pNumberOfBytesRead /* = nullptr */) override;
+  virtual bool WriteByte(byte SourceByte) override;
+  virtual uint32 Write(const void* pSource, uint32 ByteCount) override;
+  virtual bool Write2(const void* pSource, uint32 ByteCount, uint32* pNumberOfBytesWritten /* = nullptr */) override;
+  virtual bool SeekAbsolute(uint64 Offset) override;
+  virtual bool SeekRelative(int64 Offset) override;
+  virtual bool SeekToEnd() override;
+  virtual uint64 GetSize() const override;
+  virtual uint64 GetPosition() const override;
+  virtual bool Flush() override;
+  virtual bool Commit() override;
+  virtual bool Discard() override;
+
+private:
+  // called on the worker, fills free chunks until the window is full, end of stream, or a stop is requested
+  void FillChunks();
+
+  // m_lock must be held for these
+  void StartFillerLocked();
+  void StopFillerLocked();
+  void AdvanceChunkLocked();
+
+  ByteStream* m_pBaseStream;
+  ThreadPool* m_pThreadPool;
+  bool m_ownsThreadPool;
+
+  uint32 m_chunkSize;
+  uint32 m_chunkCount;
+  byte** m_ppChunkBuffers;
+  uint32* m_pChunkSizes;
+
+  Mutex m_lock;
+  ConditionVariable m_condition;
+
+  // window state, protected by m_lock. chunks [m_headChunk, m_headChunk + m_filledChunks) hold data.
+  uint32 m_headChunk;
+  uint32 m_filledChunks;
+  uint32 m_headChunkPosition;
+  uint64 m_position;
+  uint64 m_fetchPosition;
+  uint64 m_size;
+  bool m_fillerActive;
+  bool m_stopRequested;
+  bool m_endOfStream;
+};
+
+// wraps pBaseStream in a prefetching stream. the new stream takes a reference to the base stream.
+PrefetchingByteStream* ByteStream_CreatePrefetchingStream(ByteStream* pBaseStream, uint32 chunkSize = 64 * 1024,
+                                                          uint32 chunkCount = 4, ThreadPool* pThreadPool = nullptr);
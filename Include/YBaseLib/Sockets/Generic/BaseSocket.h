@@ -9,7 +9,7 @@ class SocketMultiplexer;
 class BaseSocket : public ReferenceCounted
 {
 public:
-  BaseSocket() {}
+  BaseSocket() : m_eventLoopIndex(0) {}
   virtual ~BaseSocket() {}
 
   virtual void Close() = 0;
@@ -18,6 +18,9 @@ private:
   virtual void OnReadEvent() = 0;
   virtual void OnWriteEvent() = 0;
 
+  // Event loop the multiplexer fires this socket's events on, assigned when it is opened.
+  uint32 m_eventLoopIndex;
+
   // Ugly, but needed in order to call the events.
   friend SocketMultiplexer;
 };
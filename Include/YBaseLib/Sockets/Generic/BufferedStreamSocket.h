@@ -1,5 +1,5 @@
 #pragma once
-#include "YBaseLib/CircularBuffer.h"
+#include "YBaseLib/Sockets/SocketBufferPool.h"
 #include "YBaseLib/Sockets/StreamSocket.h"
 
 #ifdef Y_SOCKET_IMPLEMENTATION_GENERIC
@@ -7,6 +7,7 @@
 class BufferedStreamSocket : public StreamSocket
 {
 public:
+  // The sizes are limits, buffer memory is only borrowed from the multiplexer's pool while data is pending.
   BufferedStreamSocket(size_t receiveBufferSize = 16384, size_t sendBufferSize = 16384);
   virtual ~BufferedStreamSocket();
 
@@ -15,22 +16,91 @@ public:
   size_t Write(const void* pBuffer, size_t bufferSize);
   size_t WriteVector(const void** ppBuffers, const size_t* pBufferLengths, size_t numBuffers);
 
+  // Writes all of the buffers, or nothing if the send buffer couldn't take whatever the socket doesn't, so that a
+  // message is never cut short. Returns false if nothing was written.
+  bool TryWriteVector(const void** ppBuffers, const size_t* pBufferLengths, size_t numBuffers);
+
+  // Between these, writes are only buffered, then sent together with as few calls as possible. Nests.
+  void BeginSendBatch();
+  void EndSendBatch();
+
+  // Sent directly when nothing is buffered, otherwise queued behind the buffered data.
+  uint64 SendFile(ByteStream* pStream, uint64 offset, uint64 length);
+  size_t WriteZeroCopy(const void* pBuffer, size_t bufferSize, bool* pCompletionPending, uint32* pCompletionID);
+
+  // Descriptors go with the first byte, so can only be sent once everything buffered before them has gone. Writes all
+  // of the buffer as TryWriteVector does, returning zero if nothing was sent.
+  size_t WriteWithFileDescriptors(const void* pBuffer, size_t bufferSize, const int* pFileDescriptors, uint32 count);
+
   // Access to read buffer.
   bool AcquireReadBuffer(const void** ppBuffer, size_t* pBytesAvailable);
   void ReleaseReadBuffer(size_t bytesConsumed);
 
+  // As AcquireReadBuffer, but obtains up to maxBuffers contiguous runs of the buffered data, in order. Returns the
+  // number obtained, zero if there is nothing buffered. Release with ReleaseReadBuffer.
+  uint32 AcquireReadBuffers(const void** ppBuffers, size_t* pBufferSizes, uint32 maxBuffers);
+
+  size_t GetReceiveBufferSize() const { return m_receiveBuffer.GetMaxSize(); }
+  size_t GetSendBufferSize() const { return m_sendBuffer.GetMaxSize(); }
+
+  // Flow control. Once the send queue reaches the high watermark, or a write comes up short, the socket isn't writable
+  // until the queue has drained to the low watermark, when OnWritable is called. By default the high watermark is the
+  // send buffer size, so only short writes block, and the low watermark half of it. Nothing blocks on an empty queue,
+  // except a descriptor write the socket refused, which waits for the socket itself to become writable.
+  void SetSendWatermarks(size_t highWatermark, size_t lowWatermark);
+  bool IsWritable() const { return (m_connected && !m_sendBlocked); }
+
+  // Bytes queued in the send buffer now, the most there have been, and the total that has passed through it rather
+  // than going straight to the socket.
+  size_t GetQueuedSendBytes() const { return m_sendBuffer.GetSize(); }
+  size_t GetPeakQueuedSendBytes() const { return m_peakQueuedSendBytes; }
+  uint64 GetTotalQueuedSendBytes() const { return m_totalQueuedSendBytes; }
+
 protected:
   virtual void OnConnected() override;
   virtual void OnDisconnected(Error* pError) override;
   virtual void OnRead() override;
 
+  // Called with the socket lock held, from whichever thread drained the queue, normally the event loop's. OnWritable
+  // once a blocked socket is down to its low watermark, OnSendBufferDrained whenever everything queued has been handed
+  // to the socket, after OnWritable if both apply and it didn't queue more.
+  virtual void OnWritable();
+  virtual void OnSendBufferDrained();
+
 private:
   virtual void OnReadEvent() override;
   virtual void OnWriteEvent() override;
 
+  // Registers for reads, and writes if there is anything buffered to send. Also re-arms pending events.
+  void UpdateNotificationMask();
+
+  // Called after bytes are taken from the receive buffer.
+  void OnReceiveBufferConsumed();
+
+  // Sends as much of the send buffer as the socket takes, then calls the flow control callbacks. Returns false if the
+  // socket was closed.
+  bool FlushSendBuffer();
+
+  // Updates the queue statistics after bytes are added to the send buffer, blocking the socket if it's reached the
+  // high watermark, or the caller couldn't queue everything.
+  void OnSendBufferWritten(size_t bytesQueued, bool shortWrite);
+
 private:
-  CircularBuffer m_receiveBuffer;
-  CircularBuffer m_sendBuffer;
+  SocketBufferQueue m_receiveBuffer;
+  SocketBufferQueue m_sendBuffer;
+
+  // Set when a read event stopped because the receive buffer filled, rather than because the socket was drained.
+  bool m_receiveBufferFull;
+
+  // Nesting depth of BeginSendBatch.
+  uint32 m_sendBatchDepth;
+
+  // Flow control and send queue statistics.
+  size_t m_sendHighWatermark;
+  size_t m_sendLowWatermark;
+  bool m_sendBlocked;
+  size_t m_peakQueuedSendBytes;
+  uint64 m_totalQueuedSendBytes;
 };
 
 #endif // #ifdef Y_SOCKET_IMPLEMENTATION_GENERIC
\ No newline at end of file
@@ -0,0 +1,98 @@
+#pragma once
+#include "YBaseLib/Error.h"
+#include "YBaseLib/RecursiveMutex.h"
+#include "YBaseLib/Sockets/BaseSocket.h"
+#include "YBaseLib/Sockets/Common.h"
+#include "YBaseLib/Sockets/SocketAddress.h"
+
+#ifdef Y_SOCKET_IMPLEMENTATION_GENERIC
+
+// A bound UDP socket. Received datagrams are read in batches, up to MAX_BATCH_SIZE per system call where the platform
+// has recvmmsg, into a ring of packet buffers allocated once per socket, and handed to OnPackets. Sends go out
+// immediately, batched with sendmmsg; there's no send queue, so a full socket buffer shows up as a short count.
+class DatagramSocket : public BaseSocket
+{
+public:
+  static const uint32 MAX_BATCH_SIZE = 64;
+
+  struct Packet
+  {
+    const void* pData;
+    size_t Length;
+
+    // Destination when sending, source when received.
+    const SocketAddress* pAddress;
+  };
+
+  // Datagrams longer than maxPacketSize are truncated on receive.
+  DatagramSocket(uint32 maxPacketSize = 2048, uint32 batchSize = MAX_BATCH_SIZE);
+  virtual ~DatagramSocket();
+
+  virtual void Close() override final;
+
+  // Accessors
+  const SocketAddress* GetLocalAddress() const { return &m_localAddress; }
+  bool IsOpen() const { return (m_fileDescriptor != INVALID_SOCKET); }
+  uint64 GetPacketsReceived() const { return m_packetsReceived; }
+  uint64 GetReceiveCalls() const { return m_receiveCalls; }
+  uint64 GetPacketsSent() const { return m_packetsSent; }
+  uint64 GetSendCalls() const { return m_sendCalls; }
+
+  // Sends one datagram. Returns false if the socket buffer is full, or the send failed.
+  bool SendTo(const void* pData, size_t length, const SocketAddress* pAddress);
+
+  // Sends datagrams in order, up to MAX_BATCH_SIZE per system call. Returns the number sent, which is short if the
+  // socket buffer filled or a send failed.
+  uint32 SendMultiple(const Packet* pPackets, uint32 count);
+
+  // Sends a buffer as consecutive datagrams of segmentSize bytes to one address, the last possibly shorter. With
+  // segmentation offload the kernel splits it, so up to MAX_BATCH_SIZE datagrams go in one call and one pass through
+  // the stack, otherwise it's sent as SendMultiple would. Returns the number of datagrams sent.
+  uint32 SendSegmented(const void* pData, size_t length, uint32 segmentSize, const SocketAddress* pAddress);
+
+  // Lets the kernel coalesce runs of equal-sized datagrams from one sender into a single receive. They're split again
+  // before OnPackets, so only the number of calls changes. Enlarges the receive buffers to hold a coalesced run.
+  // Returns false if the platform doesn't support it.
+  bool EnableReceiveOffload();
+
+protected:
+  // Datagrams received, valid only for the call, on the socket's event loop thread. The default calls OnPacket.
+  virtual void OnPackets(const Packet* pPackets, uint32 count);
+  virtual void OnPacket(const void* pData, size_t length, const SocketAddress* pAddress);
+
+private:
+  struct ReceiveRing;
+
+  virtual void OnReadEvent() override final;
+  virtual void OnWriteEvent() override final;
+
+  bool InitializeSocket(SocketMultiplexer* pMultiplexer, SOCKET fileDescriptor, Error* pError);
+
+  // Reads one batch into the ring and hands it on, returning the number of receives, or zero if there was nothing.
+  uint32 ReceiveBatch();
+
+  static ReceiveRing* CreateReceiveRing(uint32 slotCount, uint32 slotSize);
+  static void DestroyReceiveRing(ReceiveRing* pRing);
+
+  SocketMultiplexer* m_pMultiplexer;
+  SocketAddress m_localAddress;
+  RecursiveMutex m_lock;
+  SOCKET m_fileDescriptor;
+
+  // Receive buffers and headers, allocated once and reused by every read.
+  ReceiveRing* m_pReceiveRing;
+  uint32 m_maxPacketSize;
+  uint32 m_batchSize;
+
+  bool m_receiveOffload;
+  bool m_sendOffloadUnsupported;
+
+  uint64 m_packetsReceived;
+  uint64 m_receiveCalls;
+  uint64 m_packetsSent;
+  uint64 m_sendCalls;
+
+  friend SocketMultiplexer;
+};
+
+#endif // Y_SOCKET_IMPLEMENTATION_GENERIC
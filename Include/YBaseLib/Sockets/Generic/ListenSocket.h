@@ -4,6 +4,7 @@
 #include "YBaseLib/Sockets/Common.h"
 #include "YBaseLib/Sockets/SocketAddress.h"
 #include "YBaseLib/Sockets/SocketMultiplexer.h"
+#include "YBaseLib/Sockets/SocketTimer.h"
 
 #ifdef Y_SOCKET_IMPLEMENTATION_GENERIC
 
@@ -22,10 +23,24 @@ public:
   virtual void Close() override final;
 
 private:
+  // Accepts again after accept() failed for lack of descriptors or memory, as no further edge may come until then.
+  class AcceptRetryTimer : public SocketTimer
+  {
+  public:
+    AcceptRetryTimer(ListenSocket* pSocket) : m_pSocket(pSocket) {}
+
+  protected:
+    virtual void OnTimer() override;
+
+  private:
+    ListenSocket* m_pSocket;
+  };
+
   virtual void OnReadEvent() override final;
   virtual void OnWriteEvent() override final;
 
 private:
+  AcceptRetryTimer m_acceptRetryTimer;
   SocketMultiplexer* m_pMultiplexer;
   SocketMultiplexer::CreateStreamSocketCallback m_acceptCallback;
   SocketAddress m_localAddress;
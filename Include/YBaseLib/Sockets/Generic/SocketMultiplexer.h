@@ -7,14 +7,17 @@
 #include "YBaseLib/ReferenceCounted.h"
 #include "YBaseLib/Sockets/Common.h"
 #include "YBaseLib/Sockets/SocketAddress.h"
+#include "YBaseLib/Sockets/SocketTimer.h"
 #include "YBaseLib/Thread.h"
 
 #ifdef Y_SOCKET_IMPLEMENTATION_GENERIC
 
 class BaseSocket;
+class SocketBufferPool;
 class ListenSocket;
 class StreamSocket;
 class BufferedStreamSocket;
+class DatagramSocket;
 
 class SocketMultiplexer
 {
@@ -23,107 +26,244 @@ public:
   {
     EventType_Read = (1 << 0),
     EventType_Write = (1 << 1),
+
+    // Not an event, a flag for sockets whose handlers read/write until the call would block. The backend is then
+    // free to report only changes in readiness, which is what makes epoll cheap with many connections.
+    EventType_EdgeTriggered = (1 << 2),
     NumEventTypes
   };
 
   typedef StreamSocket* (*CreateStreamSocketCallback)();
+  typedef DatagramSocket* (*CreateDatagramSocketCallback)();
   friend BaseSocket;
   friend ListenSocket;
   friend StreamSocket;
   friend BufferedStreamSocket;
+  friend DatagramSocket;
 
 public:
   virtual ~SocketMultiplexer();
 
   // Access the type of multiplexer
-  SOCKET_MULTIPLEXER_TYPE GetType() const { return SOCKET_MULTIPLEXER_TYPE_GENERIC; }
+  SOCKET_MULTIPLEXER_TYPE GetType() const { return m_type; }
+
+  // Best type for this platform: epoll on linux, otherwise generic.
+  static SOCKET_MULTIPLEXER_TYPE GetDefaultType();
 
-  // Factory method.
-  static SocketMultiplexer* Create(Error* pError);
+  // Factory method. Fails if the type is not supported on this platform.
+  static SocketMultiplexer* Create(Error* pError, SOCKET_MULTIPLEXER_TYPE type = GetDefaultType());
 
-  // Public interface
+  // Public interface. Unix domain addresses may also be sequenced packet sockets, a listening path must not exist.
   template<class T>
-  ListenSocket* CreateListenSocket(const SocketAddress* pAddress, Error* pError);
+  ListenSocket* CreateListenSocket(const SocketAddress* pAddress, Error* pError,
+                                   SOCKET_STREAM_TYPE streamType = SOCKET_STREAM_TYPE_STREAM);
+  template<class T>
+  T* ConnectStreamSocket(const SocketAddress* pAddress, Error* pError,
+                         SOCKET_STREAM_TYPE streamType = SOCKET_STREAM_TYPE_STREAM);
+
+  // Create a pair of connected unix domain sockets, which can pass file descriptors between processes once one end
+  // has been handed to a child. Not supported on Windows.
+  template<class T1, class T2>
+  bool CreateStreamSocketPair(T1** ppFirstSocket, T2** ppSecondSocket, Error* pError,
+                              SOCKET_STREAM_TYPE streamType = SOCKET_STREAM_TYPE_STREAM);
+
+  // Create a UDP socket bound to the address, use port zero for any port.
   template<class T>
-  T* ConnectStreamSocket(const SocketAddress* pAddress, Error* pError);
+  T* CreateDatagramSocket(const SocketAddress* pBindAddress, Error* pError);
 
-  // Create worker threads, set threadCount to 0 for implementation-specific value.
+  // Create worker threads, each running its own event loop, set threadCount to 0 for one per CPU thread. Sockets
+  // opened afterwards are spread across the loops round-robin, including connections accepted by a listen socket.
   uint32 CreateWorkerThreads(uint32 threadCount = 0);
 
-  // Stop worker threads.
+  // Stop worker threads. Sockets and timers on the other loops are moved to the first, which PollEvents runs, and new
+  // sockets go there too until worker threads are created again. Don't open sockets while it runs.
   void StopWorkerThreads();
 
+  // Number of event loops, at least one.
+  uint32 GetEventLoopCount() const { return m_eventLoopCount; }
+
+  // Buffered sockets borrow their buffers from here while they have data pending. Exposed for its statistics.
+  SocketBufferPool* GetBufferPool() const { return m_pBufferPool; }
+
+  // Schedule a timer to fire after the given delay, on the event loop of pSocket, or the first loop without one. A
+  // timer which is already scheduled is moved. Timers are kept to the millisecond.
+  void ScheduleTimer(SocketTimer* pTimer, uint32 milliseconds, BaseSocket* pSocket = nullptr);
+
+  // Cancel a scheduled timer. Returns false if it wasn't scheduled, or has already been taken to fire, in which case
+  // OnTimer may still be running on the loop thread.
+  bool CancelTimer(SocketTimer* pTimer);
+
   // Close all sockets on this multiplexer.
   void CloseAll();
 
-  // Poll for events, set to Y_UINT32_MAX for infinite pause
+  // Poll for events on the first event loop, for use without worker threads. Set to Y_UINT32_MAX for infinite pause.
   void PollEvents(uint32 milliseconds);
 
 protected:
   // Internal interface
   ListenSocket* InternalCreateListenSocket(const SocketAddress* pAddress, CreateStreamSocketCallback callback,
-                                           Error* pError);
+                                           SOCKET_STREAM_TYPE streamType, Error* pError);
   StreamSocket* InternalConnectStreamSocket(const SocketAddress* pAddress, CreateStreamSocketCallback callback,
-                                            Error* pError);
+                                            SOCKET_STREAM_TYPE streamType, Error* pError);
+  bool InternalCreateStreamSocketPair(CreateStreamSocketCallback firstCallback,
+                                      CreateStreamSocketCallback secondCallback, SOCKET_STREAM_TYPE streamType,
+                                      StreamSocket** ppFirstSocket, StreamSocket** ppSecondSocket, Error* pError);
+  DatagramSocket* InternalCreateDatagramSocket(const SocketAddress* pBindAddress,
+                                               CreateDatagramSocketCallback callback, Error* pError);
 
 private:
+  struct BoundSocket;
+  struct EventLoop;
+
   // Hide the constructor.
-  SocketMultiplexer();
+  SocketMultiplexer(SOCKET_MULTIPLEXER_TYPE type);
 
-  // Tracking of open sockets.
+  // Tracking of open sockets. Adding a socket also assigns it to an event loop.
   void AddOpenSocket(BaseSocket* pSocket);
   void RemoveOpenSocket(BaseSocket* pSocket);
 
-  // Register for notifications
+  // Register for notifications, on the socket's event loop.
   void SetNotificationMask(BaseSocket* pSocket, SOCKET fileDescriptor, uint32 mask);
 
-private:
-  // We store the fd in the struct to avoid the cache miss reading the object.
-  struct BoundSocket
-  {
-    BaseSocket* pSocket;
-    uint32 EventMask;
-    SOCKET FileDescriptor;
-  };
-  MemArray<BoundSocket> m_boundSockets;
-  Mutex m_boundSocketLock;
+  // Event loops.
+  EventLoop* CreateEventLoop(Error* pError);
+  void DestroyEventLoop(EventLoop* pEventLoop);
+  void PollEventLoop(EventLoop* pEventLoop, uint32 milliseconds);
 
-  // Open socket list
-  PODArray<BaseSocket*> m_openSockets;
-  Mutex m_openSocketLock;
+  // Per-backend implementations.
+  void SetNotificationMaskSelect(EventLoop* pEventLoop, BaseSocket* pSocket, SOCKET fileDescriptor, uint32 mask);
+  void SetNotificationMaskEpoll(EventLoop* pEventLoop, BaseSocket* pSocket, SOCKET fileDescriptor, uint32 mask);
+  void PollEventsSelect(EventLoop* pEventLoop, uint32 milliseconds);
+  void PollEventsEpoll(EventLoop* pEventLoop, uint32 milliseconds);
+
+  // Fire events for sockets collected by a poll, and drop the references taken when they were collected.
+  void FireEvents(const BoundSocket* pTriggeredSockets, uint32 nTriggeredSockets);
 
-  // Wakeup when sleeping with no sockets.
-  Event m_wakeupEvent;
+  // Fire the timers which have expired on a loop.
+  void FireTimers(EventLoop* pEventLoop);
+
+  // Interrupt a poll in progress.
+  void Wakeup(EventLoop* pEventLoop);
+
+  // Re-registers every socket and timer of a loop on another. Neither may be polled while it runs.
+  void MoveEventLoopContents(EventLoop* pFromEventLoop, EventLoop* pToEventLoop);
+
+  // Timer clock, in milliseconds.
+  static uint64 GetTimerTick();
 
 private:
-  // Worker thread
+  // Worker thread, one per event loop.
   class WorkerThread : public Thread
   {
     friend SocketMultiplexer;
 
   public:
-    WorkerThread(SocketMultiplexer* pThis);
+    WorkerThread(SocketMultiplexer* pThis, EventLoop* pEventLoop);
     virtual int ThreadEntryPoint() override final;
 
   private:
     SocketMultiplexer* m_pThis;
+    EventLoop* m_pEventLoop;
     volatile bool m_stopFlag;
   };
-  WorkerThread* m_pWorkerThread;
+
+  // We store the fd in the struct to avoid the cache miss reading the object.
+  struct BoundSocket
+  {
+    BaseSocket* pSocket;
+    uint32 EventMask;
+    SOCKET FileDescriptor;
+  };
+
+  // Each event loop has its own poller and thread. A socket stays on the loop it was assigned when opened, so its
+  // events are only ever fired from one thread.
+  struct EventLoop
+  {
+    uint32 Index;
+    Mutex BoundSocketLock;
+
+    // Generic: list of sockets to pass to select.
+    MemArray<BoundSocket> BoundSockets;
+
+    // Epoll: the registrations live in the kernel, this maps descriptors back to sockets, indexed by descriptor.
+    // An event is only dispatched if the socket is still registered when the batch is processed, as it may have
+    // been closed since the wait returned.
+    MemArray<BoundSocket> SocketsByFileDescriptor;
+    int EpollFileDescriptor;
+    int WakeupFileDescriptor;
+
+    // Wakeup when sleeping with no sockets, on platforms without the wakeup eventfd. Signalled through Wakeup().
+    Event WakeupEvent;
+
+    // Timers fired on this loop. PollDeadline is the tick the current poll ends at, scheduling an earlier timer
+    // wakes the loop so the poll can be shortened.
+    Mutex TimerLock;
+    SocketTimerWheel TimerWheel;
+    uint64 PollDeadline;
+
+    WorkerThread* pWorkerThread;
+  };
+
+  SOCKET_MULTIPLEXER_TYPE m_type;
+
+  // Loops are only ever added, so sockets can index them without a lock.
+  static const uint32 MAX_EVENT_LOOPS = 64;
+  EventLoop* m_eventLoops[MAX_EVENT_LOOPS];
+  volatile uint32 m_eventLoopCount;
+  volatile uint32 m_nextEventLoop;
+
+  // Loops new sockets are handed out to, all of them while worker threads run, otherwise only the first.
+  volatile uint32 m_activeEventLoopCount;
+  Mutex m_eventLoopLock;
+
+  // Open socket list
+  PODArray<BaseSocket*> m_openSockets;
+  Mutex m_openSocketLock;
+
+  // Shared by all buffered sockets, which each hold a reference.
+  SocketBufferPool* m_pBufferPool;
 };
 
 template<class T>
-ListenSocket* SocketMultiplexer::CreateListenSocket(const SocketAddress* pAddress, Error* pError)
+ListenSocket* SocketMultiplexer::CreateListenSocket(const SocketAddress* pAddress, Error* pError,
+                                                    SOCKET_STREAM_TYPE streamType /* = SOCKET_STREAM_TYPE_STREAM */)
 {
   CreateStreamSocketCallback callback = []() -> StreamSocket* { return new T(); };
-  return InternalCreateListenSocket(pAddress, callback, pError);
+  return InternalCreateListenSocket(pAddress, callback, streamType, pError);
 }
 
 template<class T>
-T* SocketMultiplexer::ConnectStreamSocket(const SocketAddress* pAddress, Error* pError)
+T* SocketMultiplexer::ConnectStreamSocket(const SocketAddress* pAddress, Error* pError,
+                                          SOCKET_STREAM_TYPE streamType /* = SOCKET_STREAM_TYPE_STREAM */)
 {
   CreateStreamSocketCallback callback = []() -> StreamSocket* { return new T(); };
-  return static_cast<T*>(InternalConnectStreamSocket(pAddress, callback, pError));
+  return static_cast<T*>(InternalConnectStreamSocket(pAddress, callback, streamType, pError));
+}
+
+template<class T1, class T2>
+bool SocketMultiplexer::CreateStreamSocketPair(T1** ppFirstSocket, T2** ppSecondSocket, Error* pError,
+                                               SOCKET_STREAM_TYPE streamType /* = SOCKET_STREAM_TYPE_STREAM */)
+{
+  CreateStreamSocketCallback firstCallback = []() -> StreamSocket* { return new T1(); };
+  CreateStreamSocketCallback secondCallback = []() -> StreamSocket* { return new T2(); };
+  StreamSocket* pFirstSocket;
+  StreamSocket* pSecondSocket;
+  if (!InternalCreateStreamSocketPair(firstCallback, secondCallback, streamType, &pFirstSocket, &pSecondSocket,
+                                      pError))
+  {
+    return false;
+  }
+
+  *ppFirstSocket = static_cast<T1*>(pFirstSocket);
+  *ppSecondSocket = static_cast<T2*>(pSecondSocket);
+  return true;
+}
+
+template<class T>
+T* SocketMultiplexer::CreateDatagramSocket(const SocketAddress* pBindAddress, Error* pError)
+{
+  CreateDatagramSocketCallback callback = []() -> DatagramSocket* { return new T(); };
+  return static_cast<T*>(InternalCreateDatagramSocket(pBindAddress, callback, pError));
 }
 
 #endif // Y_SOCKET_IMPLEMENTATION_GENERIC
@@ -1,5 +1,6 @@
 #pragma once
 #include "YBaseLib/Error.h"
+#include "YBaseLib/PODArray.h"
 #include "YBaseLib/RecursiveMutex.h"
 #include "YBaseLib/Sockets/BaseSocket.h"
 #include "YBaseLib/Sockets/Common.h"
@@ -7,6 +8,7 @@
 
 #ifdef Y_SOCKET_IMPLEMENTATION_GENERIC
 
+class ByteStream;
 class ListenSocket;
 class BufferedStreamSocket;
 
@@ -19,27 +21,65 @@ public:
   virtual void Close() override final;
 
   // Accessors
+  SocketMultiplexer* GetMultiplexer() const { return m_pMultiplexer; }
   const SocketAddress* GetLocalAddress() const { return &m_localAddress; }
   const SocketAddress* GetRemoteAddress() const { return &m_remoteAddress; }
   bool IsConnected() const { return m_connected; }
 
   // Read/write
   size_t Read(void* pBuffer, size_t bufferSize);
+  size_t ReadVector(void** ppBuffers, const size_t* pBufferLengths, size_t numBuffers);
   size_t Write(const void* pBuffer, size_t bufferSize);
   size_t WriteVector(const void** ppBuffers, const size_t* pBufferLengths, size_t numBuffers);
 
+  // Sends length bytes of a stream starting at offset, leaving the stream's position alone. File-backed streams are
+  // sent by the kernel straight from the page cache, memory-backed streams straight from memory. Returns the number of
+  // bytes sent, which as with Write can be fewer if the socket would block.
+  uint64 SendFile(ByteStream* pStream, uint64 offset, uint64 length);
+
+  // Sends a buffer without the kernel copying it, which pays off for large buffers. Returns the number of bytes sent,
+  // as Write does. If the kernel still references the buffer afterwards, sets *pCompletionPending, and the buffer must
+  // not be modified or freed until OnZeroCopyCompleted() reports *pCompletionID. Small buffers, and platforms without
+  // zero-copy sends, are copied as Write does and never left pending.
+  size_t WriteZeroCopy(const void* pBuffer, size_t bufferSize, bool* pCompletionPending, uint32* pCompletionID);
+
+  // Unix domain sockets only: sends a buffer with up to MAX_PASSED_FILE_DESCRIPTORS descriptors attached, which the
+  // peer receives as duplicates along with the first byte, so they can be closed here afterwards. Returns the number
+  // of bytes sent as Write does, the descriptors having gone only if that isn't zero.
+  size_t WriteWithFileDescriptors(const void* pBuffer, size_t bufferSize, const int* pFileDescriptors, uint32 count);
+
+  // Descriptors received over a unix domain socket, oldest first. They're queued as the bytes sent with them come in,
+  // so are here by the time those bytes are read. A taken descriptor belongs to the caller, any left are closed when
+  // the socket is destroyed. Take returns -1 if there are none.
+  uint32 GetReceivedFileDescriptorCount() const { return m_receivedFileDescriptors.GetSize(); }
+  int TakeReceivedFileDescriptor();
+
+  static const uint32 MAX_PASSED_FILE_DESCRIPTORS = 16;
+
 protected:
   virtual void OnConnected();
   virtual void OnDisconnected(Error* pError);
   virtual void OnRead();
 
+  // Zero-copy sends firstCompletionID to lastCompletionID inclusive are done with their buffers. IDs wrap around.
+  virtual void OnZeroCopyCompleted(uint32 firstCompletionID, uint32 lastCompletionID);
+
 private:
   virtual void OnReadEvent() override;
   virtual void OnWriteEvent() override;
 
+  // Takes ownership of the descriptor, which is closed if this fails.
   bool InitializeSocket(SocketMultiplexer* pMultiplexer, SOCKET fileDescriptor, Error* pError);
   void CloseWithError();
 
+  // Reads zero-copy completions from the socket's error queue, if any sends are outstanding.
+  void ProcessZeroCopyCompletions();
+
+#ifndef Y_PLATFORM_WINDOWS
+  // Receive for unix domain sockets, which queues any descriptors passed along with the data.
+  ssize_t ReceiveWithFileDescriptors(iovec* pVectors, uint32 numVectors);
+#endif
+
 private:
   SocketMultiplexer* m_pMultiplexer;
   SocketAddress m_localAddress;
@@ -48,6 +88,21 @@ private:
   SOCKET m_fileDescriptor;
   bool m_connected;
 
+  // Set by subclasses which read until the socket would block, so can be notified edge-triggered. OnRead handlers
+  // are user code which may leave data behind, so plain stream sockets are level-triggered.
+  bool m_edgeTriggered;
+
+  // Zero-copy sends. SO_ZEROCOPY is enabled by the first large send, and dropped again if the kernel reports that it
+  // had to copy anyway. IDs are handed out as the kernel does, one per successful send.
+  bool m_zeroCopyTried;
+  bool m_zeroCopyEnabled;
+  uint32 m_nextZeroCopyID;
+  uint32 m_zeroCopyOutstanding;
+
+  // Unix domain sockets receive with recvmsg, so descriptors passed with the data aren't lost.
+  bool m_unixDomain;
+  PODArray<int> m_receivedFileDescriptors;
+
   // Ugly, but needed in order to call the events.
   friend SocketMultiplexer;
   friend ListenSocket;
@@ -0,0 +1,72 @@
+#pragma once
+#include "YBaseLib/PODArray.h"
+#include "YBaseLib/Sockets/BufferedStreamSocket.h"
+
+// A buffered socket which sends and receives whole messages, framed either with a length prefix or by a delimiter.
+// Messages are parsed straight out of the receive buffer and handed to OnMessage in place when they're contiguous
+// there, only messages which straddle buffer chunks are copied. Both ends have to use the same framing.
+class MessageStreamSocket : public BufferedStreamSocket
+{
+public:
+  static const uint32 MAX_DELIMITER_LENGTH = 8;
+
+  // The receive buffer has to hold a whole frame, so limits the message size.
+  MessageStreamSocket(size_t receiveBufferSize = 65536, size_t sendBufferSize = 65536);
+  virtual ~MessageStreamSocket();
+
+  // Framing, set from the subclass constructor. The default is a 4-byte big-endian length prefix, prefixes can also be
+  // 1 or 2 bytes. Delimited messages must not contain the delimiter, which isn't checked on send.
+  void SetLengthPrefixFraming(uint32 prefixLength, bool bigEndian = true);
+  void SetDelimiterFraming(const void* pDelimiter, uint32 delimiterLength);
+
+  // Received messages longer than this close the connection. By default, and at most, whatever fits in the receive
+  // buffer along with its framing.
+  void SetMaxMessageSize(uint32 maxMessageSize) { m_maxMessageSize = maxMessageSize; }
+  uint32 GetMaxMessageSize() const;
+
+  // Sends a message, whole or not at all. Returns false if the send buffer hasn't room for whatever the socket doesn't
+  // take, the message is too long for the length prefix, or the socket isn't connected.
+  bool SendMessage(const void* pMessage, size_t length);
+
+  // Sends messages in order, batched into as few system calls as the send buffer allows. Returns the number sent,
+  // stopping at the first one which couldn't be.
+  uint32 SendMessages(const void** ppMessages, const size_t* pLengths, uint32 count);
+
+protected:
+  // A complete message, without its prefix or delimiter. The data is only valid for the call. Messages sent from here
+  // go out together once every message received so far has been handled. Don't Read from the socket directly.
+  virtual void OnMessage(const void* pMessage, size_t length) = 0;
+
+private:
+  struct ReceivedData;
+
+  virtual void OnRead() override final;
+
+  // Finds the frame starting at offset in the received data, setting the payload range and the frame end. Returns
+  // false if it isn't all there yet, setting *pFrameEnd to where a delimiter search can resume, or sets *pInvalid if
+  // it never will be.
+  bool ParseFrame(ReceivedData* pData, size_t offset, size_t searchOffset, size_t* pPayloadOffset,
+                  size_t* pPayloadLength, size_t* pFrameEnd, bool* pInvalid) const;
+
+  // Builds the length prefix for a message, returning its length, or zero if the length doesn't fit.
+  uint32 EncodeLengthPrefix(size_t length, byte* pPrefix) const;
+
+  enum FramingMode
+  {
+    FramingMode_LengthPrefix,
+    FramingMode_Delimiter,
+  };
+
+  FramingMode m_framingMode;
+  uint32 m_prefixLength;
+  bool m_prefixBigEndian;
+  byte m_delimiter[MAX_DELIMITER_LENGTH];
+  uint32 m_delimiterLength;
+  uint32 m_maxMessageSize;
+
+  // How far into an incomplete delimited frame has already been searched, so it isn't searched again.
+  size_t m_delimiterSearchOffset;
+
+  // Messages which straddle buffer chunks are put together here.
+  PODArray<byte> m_assemblyBuffer;
+};
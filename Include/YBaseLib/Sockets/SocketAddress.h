@@ -10,7 +10,8 @@ struct SocketAddress
     Type_IPv4,
     Type_IPv6,
     Type_NamedPipe,
-    Type_SharedMemory
+    Type_SharedMemory,
+    Type_Unix
   };
 
   // constructors/operators
@@ -22,7 +23,10 @@ struct SocketAddress
   Type GetType() const { return m_type; }
   const void* GetData() const { return m_data; }
 
-  // parse interface
+  // length of the sockaddr in GetData(), as passed to bind/connect
+  uint32 GetLength() const { return m_length; }
+
+  // parse interface. unix addresses are a path and ignore the port, on linux a leading '@' is the abstract namespace.
   static bool Parse(Type type, const char* address, uint32 port, SocketAddress* pOutAddress);
 
   // resolve interface
@@ -38,6 +42,7 @@ struct SocketAddress
 
 private:
   Type m_type;
+  uint32 m_length;
   byte m_data[128];
 };
 
@@ -0,0 +1,120 @@
+#pragma once
+#include "YBaseLib/Common.h"
+#include "YBaseLib/Mutex.h"
+#include "YBaseLib/ReferenceCounted.h"
+
+// Fixed-size buffer chunks shared between the sockets of a multiplexer, so that connections only hold buffer memory
+// while they have data pending. Chunks which are given back are kept for reuse, up to a limit, the rest are freed.
+class SocketBufferPool : public ReferenceCounted
+{
+public:
+  // The data follows the header.
+  struct Chunk
+  {
+    Chunk* pNext;
+    uint32 Start;
+    uint32 End;
+
+    byte* GetData() { return reinterpret_cast<byte*>(this + 1); }
+    const byte* GetData() const { return reinterpret_cast<const byte*>(this + 1); }
+  };
+
+  struct Statistics
+  {
+    uint32 ChunkSize;
+    uint32 ChunksInUse;
+    uint32 PeakChunksInUse;
+    uint32 ChunksFree;
+    uint64 BorrowCount;
+  };
+
+  static const uint32 DEFAULT_CHUNK_SIZE = 4096;
+  static const uint32 DEFAULT_MAX_FREE_CHUNKS = 1024;
+
+  SocketBufferPool(uint32 chunkSize = DEFAULT_CHUNK_SIZE, uint32 maxFreeChunks = DEFAULT_MAX_FREE_CHUNKS);
+
+  uint32 GetChunkSize() const { return m_chunkSize; }
+
+  // Takes an empty chunk, allocating one if none are free.
+  Chunk* BorrowChunk();
+
+  // Gives a chunk back.
+  void ReturnChunk(Chunk* pChunk);
+
+  // Frees every chunk which isn't in use.
+  void Trim();
+
+  // Occupancy, as of the call.
+  void GetStatistics(Statistics* pStatistics) const;
+
+protected:
+  virtual ~SocketBufferPool();
+
+private:
+  uint32 m_chunkSize;
+  uint32 m_maxFreeChunks;
+
+  // Free chunks are linked through pNext.
+  Chunk* m_pFreeChunks;
+  uint32 m_freeChunkCount;
+
+  uint32 m_chunksInUse;
+  uint32 m_peakChunksInUse;
+  uint64 m_borrowCount;
+  mutable Mutex m_lock;
+};
+
+// A FIFO of bytes held in chunks borrowed from a pool, up to a maximum size. Chunks are borrowed as data is added and
+// returned once it has been consumed, so an empty queue holds no memory. Not thread-safe, the socket's lock covers it.
+class SocketBufferQueue
+{
+  DeclareNonCopyable(SocketBufferQueue);
+
+public:
+  SocketBufferQueue(size_t maxSize);
+  ~SocketBufferQueue();
+
+  // Sets the pool to borrow from, before anything is added. The queue holds a reference to it.
+  void SetPool(SocketBufferPool* pPool);
+
+  size_t GetMaxSize() const { return m_maxSize; }
+  size_t GetSize() const { return m_size; }
+  size_t GetSpace() const { return m_maxSize - m_size; }
+
+  // Appends as much of the data as fits, returning the number of bytes added.
+  size_t Write(const void* pSource, size_t byteCount);
+
+  // Removes up to byteCount bytes from the front, returning the number of bytes read.
+  size_t Read(void* pDestination, size_t byteCount);
+
+  // Obtains the contiguous run of data at the front. When finished, call MoveReadPointer(length).
+  bool GetReadPointer(const void** ppReadPointer, size_t* pByteCount) const;
+
+  // Obtains up to maxRegions contiguous runs of data from the front, for vectored sends. Returns the number filled.
+  uint32 GetReadRegions(const void** ppRegions, size_t* pRegionSizes, uint32 maxRegions) const;
+
+  // Consumes bytes from the front, returning drained chunks to the pool.
+  void MoveReadPointer(size_t byteCount);
+
+  // Obtains up to maxRegions runs of free space at the back, covering up to maxBytes, borrowing chunks for them. For
+  // vectored receives. Returns the number filled. MoveWritePointer must be called afterwards, even with zero.
+  uint32 GetWriteRegions(void** ppRegions, size_t* pRegionSizes, uint32 maxRegions, size_t maxBytes);
+
+  // Commits bytes written to the regions from GetWriteRegions, and returns any borrowed chunks which weren't used.
+  void MoveWritePointer(size_t byteCount);
+
+  // Returns all chunks to the pool, discarding the data.
+  void Clear();
+
+private:
+  // Returns the empty chunks after the last one holding data.
+  void ReturnUnusedChunks();
+
+  SocketBufferPool* m_pPool;
+
+  // Every chunk before the one being written to is full, and any after it are empty.
+  SocketBufferPool::Chunk* m_pHead;
+  SocketBufferPool::Chunk* m_pTail;
+  size_t m_maxSize;
+  size_t m_size;
+};
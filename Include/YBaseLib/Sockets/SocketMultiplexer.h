@@ -3,13 +3,20 @@
 
 enum SOCKET_MULTIPLEXER_TYPE
 {
-  SOCKET_MULTIPLEXER_TYPE_GENERIC,
-  // SOCKET_MULTIPLEXER_TYPE_EPOLL,
+  SOCKET_MULTIPLEXER_TYPE_GENERIC, // select(), limited to FD_SETSIZE descriptors
+  SOCKET_MULTIPLEXER_TYPE_EPOLL,   // linux epoll, with persistent registration
   // SOCKET_MULTIPLEXER_TYPE_KQUEUE,
   // SOCKET_MULTIPLEXER_TYPE_IOCP,
   NUM_SOCKET_MULTIPLEXER_TYPES
 };
 
+enum SOCKET_STREAM_TYPE
+{
+  SOCKET_STREAM_TYPE_STREAM,    // byte stream, TCP or unix domain
+  SOCKET_STREAM_TYPE_SEQPACKET, // unix domain only, keeps message boundaries and each Read returns at most one message
+  NUM_SOCKET_STREAM_TYPES
+};
+
 #if defined(Y_SOCKET_IMPLEMENTATION_GENERIC)
 #include "YBaseLib/Sockets/Generic/SocketMultiplexer.h"
 #else
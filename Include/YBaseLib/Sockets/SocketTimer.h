@@ -0,0 +1,94 @@
+#pragma once
+#include "YBaseLib/Common.h"
+
+class SocketMultiplexer;
+class SocketTimerWheel;
+
+// A one-shot timer, scheduled with SocketMultiplexer::ScheduleTimer. OnTimer is called on the event loop thread of
+// the socket it was scheduled for. It must be cancelled before it is destroyed, and may be rescheduled from OnTimer.
+class SocketTimer
+{
+  DeclareNonCopyable(SocketTimer);
+  friend SocketMultiplexer;
+  friend SocketTimerWheel;
+
+public:
+  SocketTimer();
+  virtual ~SocketTimer();
+
+  // Scheduled and not yet fired. Only a hint when the timer is used from more than one thread.
+  bool IsScheduled() const { return m_scheduled; }
+
+protected:
+  virtual void OnTimer() = 0;
+
+private:
+  // Links in the wheel slot it's placed in.
+  SocketTimer* m_pNext;
+  SocketTimer* m_pPrev;
+  uint64 m_deadline;
+  uint32 m_eventLoopIndex;
+  uint32 m_wheelLevel;
+  uint32 m_wheelSlot;
+  volatile bool m_scheduled;
+};
+
+// Hierarchical timing wheel: four levels of 256 slots, each slot of a level covering a whole turn of the level below,
+// so deadlines up to 2^32 ticks out are placed directly and anything later waits in an overflow list. Scheduling and
+// cancelling are a link/unlink. Timers in the higher levels are moved down as the current tick reaches their slot, so
+// each timer is moved at most once per level. Not thread-safe, the event loop's timer lock covers it.
+class SocketTimerWheel
+{
+  DeclareNonCopyable(SocketTimerWheel);
+
+public:
+  SocketTimerWheel(uint64 currentTick = 0);
+  ~SocketTimerWheel();
+
+  uint64 GetCurrentTick() const { return m_currentTick; }
+  uint32 GetTimerCount() const { return m_timerCount; }
+
+  // Drops every timer and restarts the wheel at currentTick.
+  void Reset(uint64 currentTick);
+
+  // Places a timer which isn't scheduled. Deadlines already passed fire on the next pop.
+  void Schedule(SocketTimer* pTimer, uint64 deadline);
+
+  // Removes a scheduled timer.
+  void Cancel(SocketTimer* pTimer);
+
+  // Advances towards currentTick, returning the next timer whose deadline has passed, unscheduled, or nullptr once
+  // there are none. Timers come out in deadline order, give or take timers sharing a tick.
+  SocketTimer* PopExpiredTimer(uint64 currentTick);
+
+  // Removes any one timer regardless of its deadline, which is left as it was, or returns nullptr once there are none.
+  // Used to move timers to another wheel.
+  SocketTimer* PopAnyTimer();
+
+  // The tick by which PopExpiredTimer has to be called again, which is at or before the nearest deadline.
+  // Y_UINT64_MAX with no timers.
+  uint64 GetNextWakeupTick() const;
+
+private:
+  static const uint32 LEVEL_COUNT = 4;
+  static const uint32 SLOT_BITS = 8;
+  static const uint32 SLOT_COUNT = 1 << SLOT_BITS;
+  static const uint32 SLOT_MASK = SLOT_COUNT - 1;
+  static const uint32 OVERFLOW_LEVEL = LEVEL_COUNT;
+
+  SocketTimer** GetListHead(uint32 level, uint32 slot);
+  void Place(SocketTimer* pTimer);
+  void Unlink(SocketTimer* pTimer);
+
+  // Moves the timers of each level whose slot starts at the current tick down the wheel.
+  void Cascade();
+
+  // First occupied slot at or after startSlot in a level.
+  bool FindOccupiedSlot(uint32 level, uint32 startSlot, uint32* pSlot) const;
+
+  uint64 m_currentTick;
+  uint32 m_timerCount;
+  SocketTimer* m_pSlots[LEVEL_COUNT][SLOT_COUNT];
+  uint64 m_occupiedSlots[LEVEL_COUNT][SLOT_COUNT / 64];
+  SocketTimer* m_pOverflowTimers;
+};
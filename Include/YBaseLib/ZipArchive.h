@@ -3,11 +3,55 @@
 
 #ifdef HAVE_ZLIB
 #include "YBaseLib/CIStringHashTable.h"
+#include "YBaseLib/CompressionCodec.h"
+#include "YBaseLib/ConditionVariable.h"
 #include "YBaseLib/FileSystem.h"
+#include "YBaseLib/Mutex.h"
+#include "YBaseLib/PODArray.h"
+#include "YBaseLib/ProgressCallbacks.h"
 #include "YBaseLib/String.h"
 #include "YBaseLib/Timestamp.h"
 
 class ByteStream;
+class ThreadPool;
+class ZipArchiveCompressionBlock;
+class ZipArchiveInflateIndex;
+struct ZipArchivePendingWrite;
+struct ZipArchiveExtractEntry;
+struct ZIP_ARCHIVE_LOCAL_FILE_HEADER;
+
+// receives the entries extracted by ZipArchive::ExtractAll/ExtractMatching. both methods are called on the
+// extracting thread, so implementations don't need to be thread-safe, but the returned stream is written to from a
+// worker thread while other entries are being opened and closed.
+class ZipArchiveExtractSink
+{
+public:
+  virtual ~ZipArchiveExtractSink() {}
+
+  // called in archive order. sets *ppStream to the stream to write the entry's data to, or null to skip the entry.
+  // returning false counts the entry as failed.
+  virtual bool OpenEntry(const char* filename, const FILESYSTEM_STAT_DATA* pStatData, ByteStream** ppStream) = 0;
+
+  // called in completion order, once all of the entry's data has been written. success is false if the entry was
+  // corrupt or the stream rejected a write. the stream is released by the caller afterwards. returns false if the
+  // entry could not be finalized.
+  virtual bool CloseEntry(const char* filename, ByteStream* pStream, bool success) = 0;
+};
+
+// writes extracted entries to files under a directory, creating subdirectories as needed. files are written with
+// atomic updates, so an entry which fails does not leave a partial file behind. entries with absolute paths or
+// parent directory references are skipped.
+class ZipArchiveDirectoryExtractSink : public ZipArchiveExtractSink
+{
+public:
+  ZipArchiveDirectoryExtractSink(const char* basePath) : m_basePath(basePath) {}
+
+  virtual bool OpenEntry(const char* filename, const FILESYSTEM_STAT_DATA* pStatData, ByteStream** ppStream) override;
+  virtual bool CloseEntry(const char* filename, ByteStream* pStream, bool success) override;
+
+private:
+  String m_basePath;
+};
 
 class ZipArchive
 {
@@ -15,21 +59,60 @@ class ZipArchive
   friend class ZipArchiveStreamedWriteByteStream;
   friend class ZipArchiveBufferedReadByteStream;
   friend class ZipArchiveBufferedWriteByteStream;
+  friend class ZipArchiveCompressionBlock;
+  friend struct ZipArchivePendingWrite;
+  friend struct ZipArchiveExtractEntry;
 
 public:
   ~ZipArchive();
 
   const bool IsWritable() const { return (m_pWriteStream != NULL); }
+  const bool IsIndexed() const { return (m_pCentralDirectory != NULL); }
+  const bool IsAppending() const { return m_appendMode; }
 
   // archive operations
   bool StatFile(const char* filename, FILESYSTEM_STAT_DATA* pStatData) const;
   bool FindFiles(const char* path, const char* pattern, uint32 flags, FileSystem::FindResultsArray* pResults) const;
-  ByteStream* OpenFile(const char* filename, uint32 openMode, uint32 compressionLevel = 6);
+
+  // compressionLevel is in the codec's range, 0 stores the entry uncompressed. deflate entries can be read by any zip
+  // tool, zstd entries by those supporting zip 6.3, and lz4 entries only by this library.
+  ByteStream* OpenFile(const char* filename, uint32 openMode, uint32 compressionLevel = 6,
+                       COMPRESSION_CODEC codec = COMPRESSION_CODEC_DEFLATE);
+
   bool DeleteFile(const char* filename);
 
   // copy a file from another zip archive
   bool CopyFile(ZipArchive* pOtherArchive, const char* filename);
 
+  // extracts every entry to pSink. entry data is read in archive order using large sequential reads, and inflated on
+  // pThreadPool's workers if one is given, otherwise on the calling thread. returns false if any entry failed or the
+  // operation was cancelled, entries which were already closed successfully are left in the sink.
+  bool ExtractAll(ZipArchiveExtractSink* pSink, ThreadPool* pThreadPool = NULL,
+                  ProgressCallbacks* pProgressCallbacks = ProgressCallbacks::NullProgressCallback);
+
+  // as ExtractAll, for the entries whose full path matches the wildcard pattern, eg "textures/*.png".
+  bool ExtractMatching(const char* pattern, ZipArchiveExtractSink* pSink, ThreadPool* pThreadPool = NULL,
+                       ProgressCallbacks* pProgressCallbacks = ProgressCallbacks::NullProgressCallback);
+
+  // compresses writes on a thread pool. buffered writes are compressed concurrently once their stream is released,
+  // and deflate entries larger than blockSize (buffered or streamed) are split into blocks which are deflated in
+  // parallel and joined into a single deflate stream. entries are still written to the archive in the order they were
+  // closed. entries using other codecs are compressed whole, and streamed ones on the writing thread.
+  // pass null to compress on the calling thread again.
+  void SetCompressionThreadPool(ThreadPool* pThreadPool, uint32 blockSize = 128 * 1024);
+
+  // when the archive's read stream is memory-backed (eg ByteStream_OpenMappedFileStream), stored entries are opened as
+  // views directly over the archive's memory instead of being copied. their CRC is checked as the data is read, unless
+  // disabled here, in which case the view also exposes its memory through GetMemoryBasePointer(). enabled by default.
+  void SetVerifyStoredEntryCRC(bool enabled) { m_verifyStoredEntryCRC = enabled; }
+
+  // streamed reads of deflate entries seek through an index of inflate checkpoints, one every interval bytes of
+  // decompressed data, so a seek costs at most about one interval of inflating. an entry's index is built the first
+  // time a seek needs it, only as far as that seek goes, and is kept until the next commit. each checkpoint holds a
+  // 32KB window, so the index costs around 3% of the entry's size at the default of 1MB. zero disables it, and
+  // backward seeks start again from the beginning of the entry. seeks in stored entries never need an index.
+  void SetSeekCheckpointInterval(uint32 interval) { m_seekCheckpointInterval = interval; }
+
   // upgrades a read-only archive to a read-write archive by providing a new write stream.
   bool UpgradeToWritableArchive(ByteStream* pWriteStream);
 
@@ -39,8 +122,18 @@ public:
 
   // discard all changes.
   // this function will remove the write stream, UpgradeToWritableArchive must be called before it can be re-called
+  // in append mode the archive stays writable, and if entries were already appended, the committed central directory
+  // is appended again so that it is the last thing in the stream.
   bool DiscardChanges();
 
+  // bytes in the committed archive which are not referenced by its central directory, ie replaced or deleted entries
+  // and superseded central directories left behind by appending. approximate, extra fields count as reclaimable.
+  uint64 GetReclaimableBytes() const;
+
+  // rewrites the committed archive into pNewStream without the reclaimable space, and continues from it. there must be
+  // no uncommitted changes. in append mode pNewStream must be readable as well, and further commits append to it.
+  bool Compact(ByteStream* pNewStream);
+
   // opens a new archive
   static ZipArchive* CreateArchive(ByteStream* pWriteStream);
 
@@ -50,11 +143,39 @@ public:
   // opens the archive read-write.
   static ZipArchive* OpenArchiveReadWrite(ByteStream* pReadStream, ByteStream* pWriteStream);
 
-  // todo: defragment methods
+  // opens the archive read-only without building a file table. the central directory is kept in its on-disk form
+  // (in place if the stream is memory-backed, eg ByteStream_OpenMappedFileStream, otherwise as one copy) and indexed
+  // by a sorted table of name hashes, so opening costs one pass over the directory and 8 bytes per entry. entry
+  // metadata is decoded when a file is looked up. the archive cannot be upgraded to a writable one.
+  static ZipArchive* OpenArchiveIndexed(ByteStream* pReadStream);
+
+  // opens the archive for in-place appending. pStream must be seekable and opened for both reading and writing, and
+  // not as an atomic update. CommitChanges appends new entries and a new central directory after the existing data
+  // rather than rewriting every entry, so small updates cost the size of the change plus the directory. the space
+  // used by replaced entries is reclaimed with Compact. an empty stream starts a new archive. commits are not atomic,
+  // a failure part-way through can leave the end record out of reach of readers.
+  static ZipArchive* OpenArchiveForAppend(ByteStream* pStream);
 
 private:
   ZipArchive(ByteStream* pReadStream, ByteStream* pWriteStream);
   bool ParseZip();
+  bool ParseIndex();
+
+  // parallel compression
+  ZipArchiveCompressionBlock* SubmitCompressionBlock(uint32 compressionMethod, uint32 compressionLevel,
+                                                     const byte* pInput, uint32 inputSize, const byte* pDictionary,
+                                                     uint32 dictionarySize, bool lastBlock, byte* pOwnedMemory);
+  bool IsCompressionBlockCompleted(ZipArchiveCompressionBlock* pBlock);
+  void WaitForCompressionBlock(ZipArchiveCompressionBlock* pBlock);
+  void QueuePendingWrite(ZipArchivePendingWrite* pPendingWrite);
+  void WritePendingWrites(bool waitForCompletion);
+  bool WritePendingWrite(ZipArchivePendingWrite* pPendingWrite);
+  void DiscardPendingWrites();
+
+  // seek checkpoints, keyed by the stream and offset of the entry's data
+  ZipArchiveInflateIndex* GetInflateIndex(ByteStream* pStream, uint64 dataOffset,
+                                          const ZIP_ARCHIVE_LOCAL_FILE_HEADER* pLocalFileHeader);
+  void ClearInflateIndexes();
 
   ByteStream* m_pReadStream;
   ByteStream* m_pWriteStream;
@@ -63,6 +184,13 @@ private:
   uint32 m_nOpenBufferedReads;
   uint32 m_nOpenBufferedWrites;
 
+  ThreadPool* m_pCompressionThreadPool;
+  uint32 m_compressionBlockSize;
+  Mutex m_compressionLock;
+  ConditionVariable m_compressionCondition;
+  PODArray<ZipArchivePendingWrite*> m_pendingWrites;
+  uint64 m_pendingWriteBytes;
+
   struct FileEntry
   {
     String FileName;
@@ -80,8 +208,53 @@ private:
   FileHashTable m_readFileHashTable;
   FileHashTable m_writeFileHashTable;
 
+  // index-only mode, records are located by their offset into m_pCentralDirectory
+  struct IndexEntry
+  {
+    HashType NameHash;
+    uint32 RecordOffset;
+  };
+
+  const byte* m_pCentralDirectory;
+  byte* m_pOwnedCentralDirectory;
+  uint32 m_centralDirectorySize;
+  PODArray<IndexEntry> m_index;
+
+  bool m_verifyStoredEntryCRC;
+
+  uint32 m_seekCheckpointInterval;
+  PODArray<ZipArchiveInflateIndex*> m_inflateIndexes;
+
+  // append mode, the read and write streams are the same stream. m_appendCommittedSize is its size at the last commit.
+  bool m_appendMode;
+  uint64 m_appendCommittedSize;
+
+  static int CompareIndexEntries(const IndexEntry* pLeft, const IndexEntry* pRight);
+  void DecodeIndexedEntry(uint32 recordOffset, FileEntry* pFileEntry) const;
+  static void ReadIndexedEntryLocation(const byte* pRecord, uint64* pOffsetToFileHeader, uint64* pCompressedSize,
+                                       uint64* pDecompressedSize);
+
+  // finds a non-deleted entry from the read stream. in index-only mode it is decoded into *pIndexedEntry.
+  const FileEntry* FindCommittedFileEntry(const char* filename, FileEntry* pIndexedEntry) const;
+
   uint32 FindFilesInTable(const FileHashTable& fileTable, const char* path, const char* pattern, uint32 flags,
                           FileSystem::FindResultsArray* pResults) const;
+  uint32 FindFilesInIndex(const char* path, const char* pattern, uint32 flags,
+                          FileSystem::FindResultsArray* pResults) const;
+  bool AddFindResult(const FileEntry* pFileEntry, const char* path, uint32 pathLength, const char* pattern,
+                     uint32 flags, FileSystem::FindResultsArray* pResults) const;
+
+  // reads and validates the local header at the stream's position against the central directory, leaving the stream
+  // at the start of the entry's data
+  static bool ReadLocalFileHeader(ByteStream* pStream, const FileEntry* pFileEntry,
+                                  ZIP_ARCHIVE_LOCAL_FILE_HEADER* pLocalFileHeader);
+
+  // bulk extraction, pattern is null for all entries
+  bool ExtractFiles(const char* pattern, ZipArchiveExtractSink* pSink, ThreadPool* pThreadPool,
+                    ProgressCallbacks* pProgressCallbacks);
+
+  // extracts an entry which is too large to buffer through a streamed reader, on the calling thread
+  bool ExtractEntryStreamed(const ZipArchiveExtractEntry* pEntry, ZipArchiveExtractSink* pSink);
 };
 
 #endif // HAVE_ZLIB
@@ -0,0 +1,783 @@
+#include "YBaseLib/AsyncFile.h"
+#include "YBaseLib/Assert.h"
+#include "YBaseLib/FileSystem.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/Memory.h"
+#include "YBaseLib/ThreadPool.h"
+#include <cerrno>
+#include <cstring>
+#if defined(Y_PLATFORM_WINDOWS)
+#include "YBaseLib/Windows/WindowsHeaders.h"
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+#if defined(Y_PLATFORM_LINUX) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+Log_SetChannel(AsyncFile);
+
+// buffers handed out by the sequential stream are aligned to this, so they are usable with O_DIRECT
+static const uint32 ASYNC_FILE_BUFFER_ALIGNMENT = 4096;
+
+// work item used by the thread pool backend, performs a single blocking pread/pwrite
+class AsyncFileThreadPoolWorkItem : public ThreadPoolWorkItem
+{
+public:
+  AsyncFileThreadPoolWorkItem(AsyncFileRequest* pRequest) : m_pRequest(pRequest) { m_pRequest->AddRef(); }
+  ~AsyncFileThreadPoolWorkItem() { m_pRequest->Release(); }
+
+protected:
+  virtual int32 ProcessWork() override
+  {
+    AsyncFile* pFile = m_pRequest->GetFile();
+    byte* pBuffer = reinterpret_cast<byte*>(m_pRequest->GetBuffer());
+    uint64 offset = m_pRequest->GetOffset();
+    uint32 remaining = m_pRequest->GetLength();
+    uint32 transferred = 0;
+
+    // loop until the full length is transferred, a positional read only comes back short at end of file
+    while (remaining > 0)
+    {
+#if defined(Y_PLATFORM_WINDOWS)
+      OVERLAPPED overlapped;
+      Y_memzero(&overlapped, sizeof(overlapped));
+      overlapped.Offset = (DWORD)(offset & 0xFFFFFFFF);
+      overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+      DWORD bytesTransferred = 0;
+      BOOL result = (m_pRequest->IsWrite()) ?
+                      WriteFile((HANDLE)pFile->m_hFile, pBuffer, remaining, &bytesTransferred, &overlapped) :
+                      ReadFile((HANDLE)pFile->m_hFile, pBuffer, remaining, &bytesTransferred, &overlapped);
+      if (!result)
+      {
+        DWORD error = GetLastError();
+        if (error == ERROR_HANDLE_EOF)
+          break;
+
+        return (transferred > 0) ? (int32)transferred : -(int32)error;
+      }
+#else
+      ssize_t bytesTransferred = (m_pRequest->IsWrite()) ? pwrite(pFile->m_fd, pBuffer, remaining, (off_t)offset) :
+                                                             pread(pFile->m_fd, pBuffer, remaining, (off_t)offset);
+      if (bytesTransferred < 0)
+      {
+        if (errno == EINTR)
+          continue;
+
+        return (transferred > 0) ? (int32)transferred : -errno;
+      }
+#endif
+
+      if (bytesTransferred == 0)
+        break;
+
+      pBuffer += bytesTransferred;
+      offset += (uint64)bytesTransferred;
+      transferred += (uint32)bytesTransferred;
+      remaining -= (uint32)bytesTransferred;
+    }
+
+    return (int32)transferred;
+  }
+
+  virtual void OnCompleted() override
+  {
+    AsyncFile* pFile = m_pRequest->GetFile();
+    pFile->m_lock.Lock();
+    pFile->CompleteRequest(m_pRequest, GetReturnValue());
+    pFile->m_completionCondition.WakeAll();
+    pFile->m_lock.Unlock();
+  }
+
+private:
+  AsyncFileRequest* m_pRequest;
+};
+
+AsyncFileRequest::AsyncFileRequest(AsyncFile* pFile, void* pBuffer, uint32 length, uint64 offset, bool isWrite)
+  : m_pFile(pFile), m_pBuffer(pBuffer), m_offset(offset), m_length(length), m_isWrite(isWrite), m_completed(false),
+    m_result(0), m_transferred(0)
+{
+}
+
+AsyncFileRequest::~AsyncFileRequest() {}
+
+bool AsyncFileRequest::WaitForCompletion()
+{
+  // always taken, so the result written by the completing thread is visible here
+  m_pFile->m_lock.Lock();
+  m_pFile->WaitLocked(this);
+  bool result = (m_result >= 0);
+  m_pFile->m_lock.Unlock();
+  return result;
+}
+
+AsyncFile::AsyncFile(ASYNC_FILE_BACKEND backend, uint32 queueDepth)
+  : m_backend(backend), m_queueDepth(queueDepth), m_pendingRequests(0), m_pThreadPool(nullptr),
+    m_ownsThreadPool(false), m_reaping(false), m_ringFd(-1), m_pSQRing(nullptr), m_pCQRing(nullptr),
+    m_pSQEs(nullptr), m_SQRingSize(0), m_CQRingSize(0), m_SQEsSize(0), m_pSQHead(nullptr), m_pSQTail(nullptr),
+    m_SQMask(0), m_pSQArray(nullptr), m_pCQHead(nullptr), m_pCQTail(nullptr), m_CQMask(0), m_pCQEs(nullptr)
+{
+#if defined(Y_PLATFORM_WINDOWS)
+  m_hFile = INVALID_HANDLE_VALUE;
+#else
+  m_fd = -1;
+#endif
+}
+
+AsyncFile::~AsyncFile()
+{
+  WaitForAllRequests();
+  ShutdownIOUring();
+
+  if (m_ownsThreadPool)
+    delete m_pThreadPool;
+
+#if defined(Y_PLATFORM_WINDOWS)
+  if (m_hFile != INVALID_HANDLE_VALUE)
+    CloseHandle((HANDLE)m_hFile);
+#else
+  if (m_fd >= 0)
+    close(m_fd);
+#endif
+}
+
+AsyncFile* AsyncFile::Open(const char* fileName, uint32 openMode, uint32 queueDepth /* = 32 */,
+                           ASYNC_FILE_BACKEND backend /* = ASYNC_FILE_BACKEND_DEFAULT */,
+                           ThreadPool* pThreadPool /* = nullptr */)
+{
+  DebugAssert(queueDepth > 0);
+
+#ifndef HAVE_IO_URING
+  if (backend == ASYNC_FILE_BACKEND_IO_URING)
+  {
+    Log_ErrorPrintf("AsyncFile::Open: io_uring is not supported on this platform");
+    return nullptr;
+  }
+#endif
+
+  if (openMode & BYTESTREAM_OPEN_CREATE_PATH)
+  {
+    PathString directoryName;
+    FileSystem::BuildPathRelativeToFile(directoryName, fileName, "", true, false);
+    if (directoryName.GetLength() > 0 && !FileSystem::DirectoryExists(directoryName))
+      FileSystem::CreateDirectory(directoryName, true);
+  }
+
+  AsyncFile* pFile = new AsyncFile(backend, queueDepth);
+
+#if defined(Y_PLATFORM_WINDOWS)
+  DWORD desiredAccess = 0;
+  if (openMode & BYTESTREAM_OPEN_READ)
+    desiredAccess |= GENERIC_READ;
+  if (openMode & BYTESTREAM_OPEN_WRITE)
+    desiredAccess |= GENERIC_WRITE;
+
+  DWORD creationDisposition;
+  if (openMode & BYTESTREAM_OPEN_CREATE)
+    creationDisposition = (openMode & BYTESTREAM_OPEN_TRUNCATE) ? CREATE_ALWAYS : OPEN_ALWAYS;
+  else
+    creationDisposition = (openMode & BYTESTREAM_OPEN_TRUNCATE) ? TRUNCATE_EXISTING : OPEN_EXISTING;
+
+  pFile->m_hFile = (void*)CreateFileA(fileName, desiredAccess, FILE_SHARE_READ, nullptr, creationDisposition,
+                                      FILE_ATTRIBUTE_NORMAL, nullptr);
+  if ((HANDLE)pFile->m_hFile == INVALID_HANDLE_VALUE)
+  {
+    pFile->Release();
+    return nullptr;
+  }
+#else
+  int flags;
+  if ((openMode & (BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_WRITE)) == (BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_WRITE))
+    flags = O_RDWR;
+  else if (openMode & BYTESTREAM_OPEN_WRITE)
+    flags = O_WRONLY;
+  else
+    flags = O_RDONLY;
+
+  if (openMode & BYTESTREAM_OPEN_CREATE)
+    flags |= O_CREAT;
+  if (openMode & BYTESTREAM_OPEN_TRUNCATE)
+    flags |= O_TRUNC;
+
+  pFile->m_fd = open(fileName, flags | O_CLOEXEC, 0644);
+  if (pFile->m_fd < 0)
+  {
+    pFile->Release();
+    return nullptr;
+  }
+#endif
+
+  if (backend != ASYNC_FILE_BACKEND_THREAD_POOL)
+  {
+    if (pFile->InitializeIOUring())
+    {
+      pFile->m_backend = ASYNC_FILE_BACKEND_IO_URING;
+    }
+    else if (backend == ASYNC_FILE_BACKEND_IO_URING)
+    {
+      Log_ErrorPrintf("AsyncFile::Open: io_uring initialization failed");
+      pFile->Release();
+      return nullptr;
+    }
+    else
+    {
+      pFile->m_backend = ASYNC_FILE_BACKEND_THREAD_POOL;
+    }
+  }
+
+  if (pFile->m_backend == ASYNC_FILE_BACKEND_THREAD_POOL)
+  {
+    if (pThreadPool != nullptr)
+    {
+      pFile->m_pThreadPool = pThreadPool;
+    }
+    else
+    {
+      // blocking workers, so more threads than cores is fine, but there's no point exceeding the queue depth
+      pFile->m_pThreadPool = new ThreadPool(Min(queueDepth, (uint32)8));
+      pFile->m_ownsThreadPool = true;
+    }
+  }
+
+  return pFile;
+}
+
+uint64 AsyncFile::GetSize() const
+{
+#if defined(Y_PLATFORM_WINDOWS)
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx((HANDLE)m_hFile, &size))
+    return 0;
+
+  return (uint64)size.QuadPart;
+#else
+  struct stat st;
+  if (fstat(m_fd, &st) < 0)
+    return 0;
+
+  return (uint64)st.st_size;
+#endif
+}
+
+AsyncFileRequest* AsyncFile::ReadAsync(void* pBuffer, uint32 length, uint64 offset)
+{
+  return Submit(pBuffer, length, offset, false);
+}
+
+AsyncFileRequest* AsyncFile::WriteAsync(const void* pBuffer, uint32 length, uint64 offset)
+{
+  return Submit(const_cast<void*>(pBuffer), length, offset, true);
+}
+
+int32 AsyncFile::Read(void* pBuffer, uint32 length, uint64 offset)
+{
+  AsyncFileRequest* pRequest = ReadAsync(pBuffer, length, offset);
+  if (pRequest == nullptr)
+    return -1;
+
+  pRequest->WaitForCompletion();
+  int32 result = pRequest->GetResult();
+  pRequest->Release();
+  return result;
+}
+
+int32 AsyncFile::Write(const void* pBuffer, uint32 length, uint64 offset)
+{
+  AsyncFileRequest* pRequest = WriteAsync(pBuffer, length, offset);
+  if (pRequest == nullptr)
+    return -1;
+
+  pRequest->WaitForCompletion();
+  int32 result = pRequest->GetResult();
+  pRequest->Release();
+  return result;
+}
+
+void AsyncFile::WaitForAllRequests()
+{
+  m_lock.Lock();
+  WaitLocked(nullptr, 0);
+  m_lock.Unlock();
+}
+
+bool AsyncFile::Flush()
+{
+  WaitForAllRequests();
+
+#if defined(Y_PLATFORM_WINDOWS)
+  return (FlushFileBuffers((HANDLE)m_hFile) != FALSE);
+#elif defined(Y_PLATFORM_LINUX)
+  return (fdatasync(m_fd) == 0);
+#else
+  return (fsync(m_fd) == 0);
+#endif
+}
+
+AsyncFileRequest* AsyncFile::Submit(void* pBuffer, uint32 length, uint64 offset, bool isWrite)
+{
+  AsyncFileRequest* pRequest = new AsyncFileRequest(this, pBuffer, length, offset, isWrite);
+
+  // the file holds a reference until the request completes
+  pRequest->AddRef();
+
+  m_lock.Lock();
+  if (m_pendingRequests >= m_queueDepth)
+    WaitLocked(nullptr, m_queueDepth - 1);
+
+  m_pendingRequests++;
+
+  if (m_backend == ASYNC_FILE_BACKEND_IO_URING)
+  {
+    if (!SubmitIOUring(pRequest))
+    {
+      m_pendingRequests--;
+      m_lock.Unlock();
+      pRequest->Release();
+      pRequest->Release();
+      return nullptr;
+    }
+
+    m_lock.Unlock();
+  }
+  else
+  {
+    m_lock.Unlock();
+
+    AsyncFileThreadPoolWorkItem* pWorkItem = new AsyncFileThreadPoolWorkItem(pRequest);
+    m_pThreadPool->EnqueueWorkItem(pWorkItem);
+    pWorkItem->Release();
+  }
+
+  return pRequest;
+}
+
+void AsyncFile::CompleteRequest(AsyncFileRequest* pRequest, int32 result)
+{
+  DebugAssert(m_pendingRequests > 0);
+  pRequest->m_result = result;
+  pRequest->m_completed = true;
+  m_pendingRequests--;
+  pRequest->Release();
+}
+
+void AsyncFile::WaitLocked(AsyncFileRequest* pRequest, uint32 maxPendingRequests /* = 0 */)
+{
+  for (;;)
+  {
+    if ((pRequest != nullptr) ? pRequest->m_completed : (m_pendingRequests <= maxPendingRequests))
+      return;
+
+#ifdef HAVE_IO_URING
+    if (m_backend == ASYNC_FILE_BACKEND_IO_URING && !m_reaping)
+    {
+      // only one thread sits in the kernel at a time, the rest wait on the condition variable for it to reap.
+      // anything left unsubmitted by a failed enter in SubmitIOUring is picked up here too.
+      m_reaping = true;
+      m_lock.Unlock();
+
+      int result = (int)syscall(__NR_io_uring_enter, m_ringFd, m_SQMask + 1, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+      int error = errno;
+
+      m_lock.Lock();
+      if (result < 0 && error != EINTR && error != EAGAIN && error != EBUSY)
+        Log_ErrorPrintf("AsyncFile::WaitLocked: io_uring_enter failed: %d", error);
+
+      ReapIOUringCompletions();
+      m_reaping = false;
+      m_completionCondition.WakeAll();
+      continue;
+    }
+#endif
+
+    m_completionCondition.SleepAndRelease(&m_lock);
+  }
+}
+
+#ifdef HAVE_IO_URING
+
+bool AsyncFile::InitializeIOUring()
+{
+  io_uring_params params;
+  Y_memzero(&params, sizeof(params));
+
+  int ringFd = (int)syscall(__NR_io_uring_setup, m_queueDepth, &params);
+  if (ringFd < 0)
+  {
+    Log_DevPrintf("AsyncFile::InitializeIOUring: io_uring_setup failed: %d", errno);
+    return false;
+  }
+
+  m_ringFd = ringFd;
+  m_SQRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32);
+  m_CQRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  m_SQEsSize = params.sq_entries * sizeof(io_uring_sqe);
+
+  // newer kernels map both rings with one mapping
+  bool singleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (singleMapping)
+    m_SQRingSize = m_CQRingSize = Max(m_SQRingSize, m_CQRingSize);
+
+  m_pSQRing = mmap(nullptr, m_SQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                   IORING_OFF_SQ_RING);
+  if (m_pSQRing == MAP_FAILED)
+  {
+    m_pSQRing = nullptr;
+    ShutdownIOUring();
+    return false;
+  }
+
+  if (singleMapping)
+  {
+    m_pCQRing = m_pSQRing;
+  }
+  else
+  {
+    m_pCQRing = mmap(nullptr, m_CQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                     IORING_OFF_CQ_RING);
+    if (m_pCQRing == MAP_FAILED)
+    {
+      m_pCQRing = nullptr;
+      ShutdownIOUring();
+      return false;
+    }
+  }
+
+  m_pSQEs = mmap(nullptr, m_SQEsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+  if (m_pSQEs == MAP_FAILED)
+  {
+    m_pSQEs = nullptr;
+    ShutdownIOUring();
+    return false;
+  }
+
+  byte* pSQRing = reinterpret_cast<byte*>(m_pSQRing);
+  m_pSQHead = reinterpret_cast<uint32*>(pSQRing + params.sq_off.head);
+  m_pSQTail = reinterpret_cast<uint32*>(pSQRing + params.sq_off.tail);
+  m_SQMask = *reinterpret_cast<uint32*>(pSQRing + params.sq_off.ring_mask);
+  m_pSQArray = reinterpret_cast<uint32*>(pSQRing + params.sq_off.array);
+
+  byte* pCQRing = reinterpret_cast<byte*>(m_pCQRing);
+  m_pCQHead = reinterpret_cast<uint32*>(pCQRing + params.cq_off.head);
+  m_pCQTail = reinterpret_cast<uint32*>(pCQRing + params.cq_off.tail);
+  m_CQMask = *reinterpret_cast<uint32*>(pCQRing + params.cq_off.ring_mask);
+  m_pCQEs = pCQRing + params.cq_off.cqes;
+
+  // plain READ/WRITE opcodes need 5.6, older kernels get the thread pool instead
+  const uint32 probeOpCount = 64;
+  byte probeBuffer[sizeof(io_uring_probe) + probeOpCount * sizeof(io_uring_probe_op)];
+  Y_memzero(probeBuffer, sizeof(probeBuffer));
+  io_uring_probe* pProbe = reinterpret_cast<io_uring_probe*>(probeBuffer);
+  if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, pProbe, probeOpCount) < 0 ||
+      pProbe->last_op < IORING_OP_WRITE || !(pProbe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) ||
+      !(pProbe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED))
+  {
+    Log_DevPrintf("AsyncFile::InitializeIOUring: kernel does not support IORING_OP_READ/WRITE");
+    ShutdownIOUring();
+    return false;
+  }
+
+  return true;
+}
+
+void AsyncFile::ShutdownIOUring()
+{
+  if (m_pSQEs != nullptr)
+    munmap(m_pSQEs, m_SQEsSize);
+  if (m_pCQRing != nullptr && m_pCQRing != m_pSQRing)
+    munmap(m_pCQRing, m_CQRingSize);
+  if (m_pSQRing != nullptr)
+    munmap(m_pSQRing, m_SQRingSize);
+  if (m_ringFd >= 0)
+    close(m_ringFd);
+
+  m_pSQEs = nullptr;
+  m_pCQRing = nullptr;
+  m_pSQRing = nullptr;
+  m_ringFd = -1;
+}
+
+bool AsyncFile::SubmitIOUring(AsyncFileRequest* pRequest)
+{
+  // the queue depth is never larger than the ring, so a slot is always free here
+  uint32 tail = *m_pSQTail;
+  uint32 index = tail & m_SQMask;
+  DebugAssert((tail - __atomic_load_n(m_pSQHead, __ATOMIC_ACQUIRE)) <= m_SQMask);
+
+  io_uring_sqe* pSQE = reinterpret_cast<io_uring_sqe*>(m_pSQEs) + index;
+  Y_memzero(pSQE, sizeof(io_uring_sqe));
+  pSQE->opcode = (pRequest->IsWrite()) ? IORING_OP_WRITE : IORING_OP_READ;
+  pSQE->fd = m_fd;
+  pSQE->addr = (uint64)(uintptr_t)pRequest->GetBuffer() + pRequest->m_transferred;
+  pSQE->len = pRequest->GetLength() - pRequest->m_transferred;
+  pSQE->off = pRequest->GetOffset() + pRequest->m_transferred;
+  pSQE->user_data = (uint64)(uintptr_t)pRequest;
+  m_pSQArray[index] = index;
+  __atomic_store_n(m_pSQTail, tail + 1, __ATOMIC_RELEASE);
+
+  // the kernel clamps to_submit to what is actually queued, so passing the ring size flushes everything
+  int result;
+  do
+  {
+    result = (int)syscall(__NR_io_uring_enter, m_ringFd, m_SQMask + 1, 0, 0, nullptr, 0);
+  } while (result < 0 && errno == EINTR);
+
+  // the sqe is already published so it can't be taken back, a failed enter is retried by the next waiter
+  if (result < 0 && errno != EAGAIN && errno != EBUSY)
+    Log_ErrorPrintf("AsyncFile::SubmitIOUring: io_uring_enter failed: %d", errno);
+
+  return true;
+}
+
+uint32 AsyncFile::ReapIOUringCompletions()
+{
+  uint32 head = *m_pCQHead;
+  uint32 tail = __atomic_load_n(m_pCQTail, __ATOMIC_ACQUIRE);
+  uint32 count = 0;
+
+  for (; head != tail; head++, count++)
+  {
+    const io_uring_cqe* pCQE = reinterpret_cast<const io_uring_cqe*>(m_pCQEs) + (head & m_CQMask);
+    AsyncFileRequest* pRequest = reinterpret_cast<AsyncFileRequest*>((uintptr_t)pCQE->user_data);
+    int32 result = pCQE->res;
+
+    // like the thread pool loop, a short transfer is continued from where it stopped, only zero bytes is end of file.
+    // the request keeps its queue slot, so there's always room in the ring to resubmit it.
+    if (result > 0 && (pRequest->m_transferred + (uint32)result) < pRequest->GetLength())
+    {
+      pRequest->m_transferred += (uint32)result;
+      SubmitIOUring(pRequest);
+      continue;
+    }
+
+    if (result >= 0)
+      result += (int32)pRequest->m_transferred;
+    else if (pRequest->m_transferred > 0)
+      result = (int32)pRequest->m_transferred;
+
+    CompleteRequest(pRequest, result);
+  }
+
+  __atomic_store_n(m_pCQHead, head, __ATOMIC_RELEASE);
+  return count;
+}
+
+#else
+
+bool AsyncFile::InitializeIOUring()
+{
+  return false;
+}
+
+void AsyncFile::ShutdownIOUring() {}
+
+bool AsyncFile::SubmitIOUring(AsyncFileRequest* pRequest)
+{
+  return false;
+}
+
+uint32 AsyncFile::ReapIOUringCompletions()
+{
+  return 0;
+}
+
+#endif
+
+class AsyncFileSequentialReadStream : public ByteStream
+{
+  struct Chunk
+  {
+    byte* pBuffer;
+    AsyncFileRequest* pRequest;
+    uint64 offset;
+  };
+
+public:
+  AsyncFileSequentialReadStream(AsyncFile* pFile, uint32 chunkSize, uint32 chunkCount)
+    : m_pFile(pFile), m_chunkSize(chunkSize), m_chunkCount(chunkCount), m_headChunk(0), m_windowChunks(0),
+      m_position(0), m_nextReadOffset(0)
+  {
+    m_pFile->AddRef();
+    m_size = m_pFile->GetSize();
+
+    m_pChunks = new Chunk[m_chunkCount];
+    for (uint32 i = 0; i < m_chunkCount; i++)
+    {
+      m_pChunks[i].pBuffer = reinterpret_cast<byte*>(Y_aligned_malloc(m_chunkSize, ASYNC_FILE_BUFFER_ALIGNMENT));
+      m_pChunks[i].pRequest = nullptr;
+      m_pChunks[i].offset = 0;
+    }
+  }
+
+  ~AsyncFileSequentialReadStream()
+  {
+    DrainWindow();
+
+    for (uint32 i = 0; i < m_chunkCount; i++)
+      Y_aligned_free(m_pChunks[i].pBuffer);
+
+    delete[] m_pChunks;
+    m_pFile->Release();
+  }
+
+  virtual bool ReadByte(byte* pDestByte) override { return (Read(pDestByte, 1) == 1); }
+
+  virtual uint32 Read(void* pDestination, uint32 ByteCount) override
+  {
+    byte* pDestinationBytes = reinterpret_cast<byte*>(pDestination);
+    uint32 bytesRead = 0;
+
+    while (bytesRead < ByteCount && m_position < m_size)
+    {
+      if (m_windowChunks == 0)
+      {
+        m_nextReadOffset = m_position - (m_position % m_chunkSize);
+        FillWindow();
+      }
+
+      Chunk& chunk = m_pChunks[m_headChunk];
+      if (!chunk.pRequest->WaitForCompletion())
+      {
+        Log_ErrorPrintf("AsyncFileSequentialReadStream::Read: read at %llu failed: %d",
+                        (unsigned long long)chunk.offset, chunk.pRequest->GetResult());
+        SetErrorState();
+        break;
+      }
+
+      // reads are only short at end of file, so the file was truncated underneath us
+      uint32 chunkBytes = (uint32)chunk.pRequest->GetResult();
+      if (chunkBytes < chunk.pRequest->GetLength() && (chunk.offset + chunkBytes) < m_size)
+        m_size = chunk.offset + chunkBytes;
+
+      uint32 chunkPosition = (uint32)(m_position - chunk.offset);
+      if (chunkPosition >= chunkBytes)
+        break;
+
+      uint32 copySize = Min(ByteCount - bytesRead, chunkBytes - chunkPosition);
+      std::memcpy(pDestinationBytes + bytesRead, chunk.pBuffer + chunkPosition, copySize);
+      bytesRead += copySize;
+      m_position += copySize;
+
+      // recycle the chunk once consumed, and immediately put it back in flight
+      if ((chunkPosition + copySize) == chunkBytes)
+      {
+        PopChunk();
+        FillWindow();
+      }
+    }
+
+    return bytesRead;
+  }
+
+  virtual bool Read2(void* pDestination, uint32 ByteCount, uint32* pNumberOfBytesRead /* = nullptr */) override
+  {
+    uint32 r = Read(pDestination, ByteCount);
+    if (pNumberOfBytesRead != nullptr)
+      *pNumberOfBytesRead = r;
+
+    return (r == ByteCount);
+  }
+
+  virtual bool WriteByte(byte SourceByte) override { return false; }
+  virtual uint32 Write(const void* pSource, uint32 ByteCount) override { return 0; }
+  virtual bool Write2(const void* pSource, uint32 ByteCount, uint32* pNumberOfBytesWritten /* = nullptr */) override
+  {
+    return false;
+  }
+
+  virtual bool SeekAbsolute(uint64 Offset) override
+  {
+    if (Offset > m_size)
+      return false;
+
+    // forward seeks inside the window just retire the chunks we skipped, anything else restarts it
+    if (m_windowChunks > 0 && Offset >= m_pChunks[m_headChunk].offset && Offset < m_nextReadOffset)
+    {
+      while (m_windowChunks > 0 && Offset >= (m_pChunks[m_headChunk].offset + m_chunkSize))
+        PopChunk();
+      FillWindow();
+    }
+    else
+    {
+      DrainWindow();
+    }
+
+    m_position = Offset;
+    return true;
+  }
+
+  virtual bool SeekRelative(int64 Offset) override
+  {
+    if (Offset < 0 && (uint64)-Offset > m_position)
+      return false;
+
+    return SeekAbsolute((uint64)((int64)m_position + Offset));
+  }
+
+  virtual bool SeekToEnd() override { return SeekAbsolute(m_size); }
+  virtual uint64 GetSize() const override { return m_size; }
+  virtual uint64 GetPosition() const override { return m_position; }
+  virtual bool Flush() override { return false; }
+  virtual bool Commit() override { return false; }
+  virtual bool Discard() override { return false; }
+
+private:
+  void FillWindow()
+  {
+    while (m_windowChunks < m_chunkCount && m_nextReadOffset < m_size)
+    {
+      Chunk& chunk = m_pChunks[(m_headChunk + m_windowChunks) % m_chunkCount];
+      DebugAssert(chunk.pRequest == nullptr);
+      chunk.offset = m_nextReadOffset;
+      chunk.pRequest = m_pFile->ReadAsync(chunk.pBuffer, m_chunkSize, chunk.offset);
+      if (chunk.pRequest == nullptr)
+        break;
+
+      m_nextReadOffset += m_chunkSize;
+      m_windowChunks++;
+    }
+  }
+
+  void PopChunk()
+  {
+    Chunk& chunk = m_pChunks[m_headChunk];
+
+    // the buffer is still owned by the kernel until the read finishes
+    chunk.pRequest->WaitForCompletion();
+    chunk.pRequest->Release();
+    chunk.pRequest = nullptr;
+
+    m_headChunk = (m_headChunk + 1) % m_chunkCount;
+    m_windowChunks--;
+  }
+
+  void DrainWindow()
+  {
+    while (m_windowChunks > 0)
+      PopChunk();
+  }
+
+  AsyncFile* m_pFile;
+  Chunk* m_pChunks;
+  uint32 m_chunkSize;
+  uint32 m_chunkCount;
+  uint32 m_headChunk;
+  uint32 m_windowChunks;
+  uint64 m_position;
+  uint64 m_nextReadOffset;
+  uint64 m_size;
+};
+
+ByteStream* AsyncFile_CreateSequentialReadStream(AsyncFile* pFile, uint32 chunkSize /* = 256 * 1024 */,
+                                                 uint32 chunkCount /* = 8 */)
+{
+  DebugAssert(chunkSize > 0 && chunkCount > 0);
+  return new AsyncFileSequentialReadStream(pFile, chunkSize, chunkCount);
+}
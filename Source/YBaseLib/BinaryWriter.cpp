@@ -103,6 +103,51 @@ bool BinaryWriter::SafeInternalWriteBytes(const void* pSource, uint32 cbSource)
   return false;
 }
 
+void BinaryWriter::InternalWriteVector(const void** ppBuffers, const uint32* pBufferLengths, uint32 numBuffers)
+{
+  if (m_errorState)
+    return;
+
+  SafeInternalWriteVector(ppBuffers, pBufferLengths, numBuffers);
+}
+
+bool BinaryWriter::SafeInternalWriteVector(const void** ppBuffers, const uint32* pBufferLengths, uint32 numBuffers)
+{
+  uint32 totalLength = 0;
+  for (uint32 i = 0; i < numBuffers; i++)
+    totalLength += pBufferLengths[i];
+
+  if (totalLength == 0 || m_pStream->WriteV(ppBuffers, pBufferLengths, numBuffers) == totalLength)
+    return true;
+
+  if (!m_ignoreErrors)
+    m_errorState = true;
+
+  return false;
+}
+
+void BinaryWriter::WriteVector(const void** ppBuffers, const uint32* pBufferLengths, uint32 numBuffers)
+{
+  InternalWriteVector(ppBuffers, pBufferLengths, numBuffers);
+}
+
+bool BinaryWriter::SafeWriteVector(const void** ppBuffers, const uint32* pBufferLengths, uint32 numBuffers)
+{
+  return SafeInternalWriteVector(ppBuffers, pBufferLengths, numBuffers);
+}
+
+bool BinaryWriter::InternalWriteSizePrefixedString(const char* str, uint32 len)
+{
+  // prefix and contents go to the stream together
+  uint32 prefix = len;
+  if (m_eStreamByteOrder != Y_HOST_ENDIAN_TYPE)
+    Y_byteswap_uint32(&prefix);
+
+  const void* buffers[2] = {&prefix, str};
+  const uint32 bufferLengths[2] = {sizeof(prefix), len};
+  return SafeInternalWriteVector(buffers, bufferLengths, (len > 0) ? 2 : 1);
+}
+
 void BinaryWriter::WriteCString(const String& str)
 {
   if (str.GetLength() > 0)
@@ -236,62 +281,35 @@ bool BinaryWriter::SafeWriteFixedString(const char* str, uint32 len, uint32 fixe
 
 void BinaryWriter::WriteSizePrefixedString(const String& str)
 {
-  uint32 strLength = str.GetLength();
-  WriteUInt32(strLength);
-  if (strLength > 0)
-    InternalWriteBytes(str.GetCharArray(), strLength);
+  if (!m_errorState)
+    InternalWriteSizePrefixedString(str.GetCharArray(), str.GetLength());
 }
 
 void BinaryWriter::WriteSizePrefixedString(const char* str)
 {
-  uint32 strLength = Y_strlen(str);
-  WriteUInt32(strLength);
-  if (strLength > 0)
-    InternalWriteBytes(str, strLength);
+  if (!m_errorState)
+    InternalWriteSizePrefixedString(str, Y_strlen(str));
 }
 
 void BinaryWriter::WriteSizePrefixedString(const char* str, uint32 len)
 {
-  WriteUInt32(len);
-  if (len > 0)
-    InternalWriteBytes(str, len);
+  if (!m_errorState)
+    InternalWriteSizePrefixedString(str, len);
 }
 
 bool BinaryWriter::SafeWriteSizePrefixedString(const String& str)
 {
-  uint32 strLength = str.GetLength();
-
-  if (!SafeWriteUInt32(strLength))
-    return false;
-
-  if (strLength > 0)
-    return SafeInternalWriteBytes(str.GetCharArray(), strLength);
-  else
-    return true;
+  return InternalWriteSizePrefixedString(str.GetCharArray(), str.GetLength());
 }
 
 bool BinaryWriter::SafeWriteSizePrefixedString(const char* str)
 {
-  uint32 strLength = Y_strlen(str);
-
-  if (!SafeWriteUInt32(strLength))
-    return false;
-
-  if (strLength > 0)
-    return SafeInternalWriteBytes(str, strLength);
-  else
-    return true;
+  return InternalWriteSizePrefixedString(str, Y_strlen(str));
 }
 
 bool BinaryWriter::SafeWriteSizePrefixedString(const char* str, uint32 len)
 {
-  if (!SafeWriteUInt32(len))
-    return false;
-
-  if (len > 0)
-    return SafeInternalWriteBytes(str, len);
-  else
-    return true;
+  return InternalWriteSizePrefixedString(str, len);
 }
 
 // endian-specific
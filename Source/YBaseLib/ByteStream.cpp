@@ -1,8 +1,14 @@
 #include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Array.h"
 #include "YBaseLib/Assert.h"
+#include "YBaseLib/ConditionVariable.h"
 #include "YBaseLib/Log.h"
 #include "YBaseLib/Memory.h"
+#include "YBaseLib/Mutex.h"
+#include "YBaseLib/MutexLock.h"
 #include "YBaseLib/String.h"
+#include "YBaseLib/Thread.h"
+#include "YBaseLib/Timer.h"
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
@@ -12,12 +18,129 @@
 #include <io.h>
 #include <share.h>
 #else
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#if defined(Y_PLATFORM_LINUX)
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
 #endif
 
 Log_SetChannel(ByteStream);
 
+uint32 ByteStream::ReadV(void** ppBuffers, const uint32* pBufferLengths, uint32 numBuffers)
+{
+  uint32 totalBytesRead = 0;
+  for (uint32 i = 0; i < numBuffers; i++)
+  {
+    uint32 bytesRead = Read(ppBuffers[i], pBufferLengths[i]);
+    totalBytesRead += bytesRead;
+    if (bytesRead != pBufferLengths[i])
+      break;
+  }
+
+  return totalBytesRead;
+}
+
+uint32 ByteStream::WriteV(const void** ppBuffers, const uint32* pBufferLengths, uint32 numBuffers)
+{
+  uint32 totalBytesWritten = 0;
+  for (uint32 i = 0; i < numBuffers; i++)
+  {
+    uint32 bytesWritten = Write(ppBuffers[i], pBufferLengths[i]);
+    totalBytesWritten += bytesWritten;
+    if (bytesWritten != pBufferLengths[i])
+      break;
+  }
+
+  return totalBytesWritten;
+}
+
+#if defined(Y_PLATFORM_POSIX)
+
+// vectored transfers smaller than this go through the stdio buffer, which is cheaper than flushing it for a syscall
+static const uint32 BYTESTREAM_VECTORED_IO_THRESHOLD = 16384;
+
+// performs a vectored read or write on a descriptor, restarting after partial transfers. if offset is negative, the
+// descriptor's own offset is used (needed for O_APPEND, where pwritev ignores the offset on linux).
+static uint32 FileVectoredIO(int fd, void* const* ppBuffers, const uint32* pBufferLengths, uint32 numBuffers,
+                             int64 offset, bool isWrite, bool* pErrorOccurred)
+{
+  static const uint32 MAX_IOVECS = 64;
+  iovec iov[MAX_IOVECS];
+  uint32 totalTransferred = 0;
+  uint32 bufferIndex = 0;
+  uint32 bufferOffset = 0;
+  *pErrorOccurred = false;
+
+  while (bufferIndex < numBuffers)
+  {
+    uint32 iovCount = 0;
+    uint32 requested = 0;
+    for (uint32 i = bufferIndex; i < numBuffers && iovCount < MAX_IOVECS; i++)
+    {
+      uint32 skip = (i == bufferIndex) ? bufferOffset : 0;
+      iov[iovCount].iov_base = reinterpret_cast<byte*>(ppBuffers[i]) + skip;
+      iov[iovCount].iov_len = pBufferLengths[i] - skip;
+      requested += pBufferLengths[i] - skip;
+      iovCount++;
+    }
+
+    ssize_t result;
+    if (offset >= 0)
+    {
+      result = (isWrite) ? pwritev(fd, iov, (int)iovCount, (off_t)(offset + totalTransferred)) :
+                           preadv(fd, iov, (int)iovCount, (off_t)(offset + totalTransferred));
+    }
+    else
+    {
+      result = (isWrite) ? writev(fd, iov, (int)iovCount) : readv(fd, iov, (int)iovCount);
+    }
+
+    if (result < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      *pErrorOccurred = true;
+      break;
+    }
+
+    // a short read is end of file
+    totalTransferred += (uint32)result;
+    if (result == 0 || (!isWrite && (uint32)result < requested))
+      break;
+
+    // advance through the buffers, possibly stopping part-way through one
+    uint32 consumed = (uint32)result;
+    while (consumed > 0)
+    {
+      uint32 remainingInBuffer = pBufferLengths[bufferIndex] - bufferOffset;
+      if (consumed < remainingInBuffer)
+      {
+        bufferOffset += consumed;
+        break;
+      }
+
+      consumed -= remainingInBuffer;
+      bufferIndex++;
+      bufferOffset = 0;
+    }
+
+    // skip over empty buffers so they don't produce a zero-length call
+    while (bufferIndex < numBuffers && pBufferLengths[bufferIndex] == 0)
+      bufferIndex++;
+  }
+
+  return totalTransferred;
+}
+
+#endif
+
 class FileByteStream : public ByteStream
 {
 public:
@@ -245,15 +368,246 @@ public:
 
   virtual bool Discard() override { return false; }
 
+#if defined(Y_PLATFORM_POSIX)
+
+  virtual uint32 ReadV(void** ppBuffers, const uint32* pBufferLengths, uint32 numBuffers) override
+  {
+    if (m_errorState)
+      return 0;
+
+    uint64 totalLength = 0;
+    for (uint32 i = 0; i < numBuffers; i++)
+      totalLength += pBufferLengths[i];
+    if (totalLength < BYTESTREAM_VECTORED_IO_THRESHOLD)
+      return ByteStream::ReadV(ppBuffers, pBufferLengths, numBuffers);
+
+    // drop the stdio read-ahead, then read straight into the caller's buffers at the logical position
+    fflush(m_pFile);
+    off_t position = ftello(m_pFile);
+
+    bool errorOccurred;
+    uint32 bytesRead =
+      FileVectoredIO(fileno(m_pFile), ppBuffers, pBufferLengths, numBuffers, position, false, &errorOccurred);
+
+    fseeko(m_pFile, position + (off_t)bytesRead, SEEK_SET);
+    if (errorOccurred)
+      m_errorState = true;
+
+    return bytesRead;
+  }
+
+  virtual uint32 WriteV(const void** ppBuffers, const uint32* pBufferLengths, uint32 numBuffers) override
+  {
+    if (m_errorState)
+      return 0;
+
+    uint64 totalLength = 0;
+    for (uint32 i = 0; i < numBuffers; i++)
+      totalLength += pBufferLengths[i];
+    if (totalLength < BYTESTREAM_VECTORED_IO_THRESHOLD)
+      return ByteStream::WriteV(ppBuffers, pBufferLengths, numBuffers);
+
+    // anything already buffered has to reach the file first to keep the ordering
+    if (fflush(m_pFile) != 0)
+    {
+      m_errorState = true;
+      return 0;
+    }
+
+    int fd = fileno(m_pFile);
+    bool appendMode = (fcntl(fd, F_GETFL) & O_APPEND) != 0;
+    off_t position = (appendMode) ? -1 : ftello(m_pFile);
+
+    bool errorOccurred;
+    uint32 bytesWritten = FileVectoredIO(fd, const_cast<void* const*>(ppBuffers), pBufferLengths, numBuffers,
+                                         position, true, &errorOccurred);
+
+    if (appendMode)
+      fseeko(m_pFile, 0, SEEK_END);
+    else
+      fseeko(m_pFile, position + (off_t)bytesWritten, SEEK_SET);
+
+    if (errorOccurred || bytesWritten != totalLength)
+      m_errorState = true;
+
+    return bytesWritten;
+  }
+
+#endif
+
+  virtual int GetFileDescriptor() override
+  {
+    // for read streams this also moves the descriptor to the logical position, dropping read-ahead
+    fflush(m_pFile);
+#if defined(Y_PLATFORM_WINDOWS)
+    return _fileno(m_pFile);
+#else
+    return fileno(m_pFile);
+#endif
+  }
+
 protected:
   FILE* m_pFile;
 };
 
+static Mutex s_commitStatisticsLock;
+static BYTESTREAM_COMMIT_STATISTICS s_commitStatistics;
+
+static void RecordCommitStatistics(double milliseconds, bool fileSynced, bool succeeded)
+{
+  uint64 microseconds = (uint64)(milliseconds * 1000.0);
+  uint32 bucket = 0;
+  while (bucket < (BYTESTREAM_COMMIT_LATENCY_BUCKETS - 1) && microseconds >= ((uint64)1 << bucket))
+    bucket++;
+
+  MutexLock lock(s_commitStatisticsLock);
+  s_commitStatistics.CommitCount++;
+  s_commitStatistics.FailedCommitCount += (succeeded) ? 0 : 1;
+  s_commitStatistics.FileSyncCount += (fileSynced) ? 1 : 0;
+  s_commitStatistics.TotalLatencyMicroseconds += microseconds;
+  s_commitStatistics.MaxLatencyMicroseconds = Max(s_commitStatistics.MaxLatencyMicroseconds, microseconds);
+  s_commitStatistics.LatencyBuckets[bucket]++;
+}
+
+void ByteStream_GetCommitStatistics(BYTESTREAM_COMMIT_STATISTICS* pStatistics)
+{
+  MutexLock lock(s_commitStatisticsLock);
+  std::memcpy(pStatistics, &s_commitStatistics, sizeof(s_commitStatistics));
+}
+
+void ByteStream_ResetCommitStatistics()
+{
+  MutexLock lock(s_commitStatisticsLock);
+  Y_memzero(&s_commitStatistics, sizeof(s_commitStatistics));
+}
+
+static bool SyncFileData(FILE* pFile)
+{
+#if defined(Y_PLATFORM_WINDOWS)
+  return (FlushFileBuffers(reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(pFile)))) != FALSE);
+#elif defined(Y_PLATFORM_OSX)
+  return (fsync(fileno(pFile)) == 0);
+#else
+  return (fdatasync(fileno(pFile)) == 0);
+#endif
+}
+
+#if !defined(Y_PLATFORM_WINDOWS)
+
+// a rename isn't durable until the directory containing it has been synced
+static bool SyncDirectory(const String& directoryName)
+{
+  int fd = open(directoryName, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  // some filesystems can't sync directories, there is nothing more we can do for those
+  bool result = (fsync(fd) == 0 || errno == EINVAL);
+  close(fd);
+
+  MutexLock lock(s_commitStatisticsLock);
+  s_commitStatistics.DirectorySyncCount++;
+  return result;
+}
+
+struct GroupCommitBatch
+{
+  Array<String> DirectoryNames;
+  uint32 MemberCount;
+  bool Completed;
+  bool Result;
+};
+
+static Mutex s_groupCommitLock;
+static ConditionVariable s_groupCommitCondition;
+static GroupCommitBatch* s_pOpenGroupCommitBatch = nullptr;
+static bool s_groupCommitSyncInProgress = false;
+static uint32 s_groupCommitWindow = 0;
+
+// joins the open batch, or starts one. the first member of a batch syncs every directory in it on behalf of the rest,
+// and only one batch syncs at a time, so commits arriving while a sync is running all share the next one.
+static bool GroupCommitSyncDirectory(const String& directoryName)
+{
+  s_groupCommitLock.Lock();
+
+  GroupCommitBatch* pBatch = s_pOpenGroupCommitBatch;
+  bool isLeader = (pBatch == nullptr);
+  if (isLeader)
+  {
+    pBatch = new GroupCommitBatch();
+    pBatch->MemberCount = 0;
+    pBatch->Completed = false;
+    pBatch->Result = false;
+    s_pOpenGroupCommitBatch = pBatch;
+  }
+
+  pBatch->MemberCount++;
+
+  uint32 directoryIndex = 0;
+  while (directoryIndex < pBatch->DirectoryNames.GetSize() && pBatch->DirectoryNames[directoryIndex] != directoryName)
+    directoryIndex++;
+  if (directoryIndex == pBatch->DirectoryNames.GetSize())
+    pBatch->DirectoryNames.Add(directoryName);
+
+  if (isLeader)
+  {
+    if (s_groupCommitWindow > 0)
+    {
+      s_groupCommitLock.Unlock();
+      Thread::Sleep(s_groupCommitWindow);
+      s_groupCommitLock.Lock();
+    }
+
+    while (s_groupCommitSyncInProgress)
+      s_groupCommitCondition.SleepAndRelease(&s_groupCommitLock);
+
+    // close the batch, nothing else can be added to it now
+    s_pOpenGroupCommitBatch = nullptr;
+    s_groupCommitSyncInProgress = true;
+    s_groupCommitLock.Unlock();
+
+    bool result = true;
+    for (uint32 i = 0; i < pBatch->DirectoryNames.GetSize(); i++)
+      result &= SyncDirectory(pBatch->DirectoryNames[i]);
+
+    s_groupCommitLock.Lock();
+    s_groupCommitSyncInProgress = false;
+    pBatch->Completed = true;
+    pBatch->Result = result;
+    s_groupCommitCondition.WakeAll();
+  }
+  else
+  {
+    while (!pBatch->Completed)
+      s_groupCommitCondition.SleepAndRelease(&s_groupCommitLock);
+  }
+
+  bool result = pBatch->Result;
+  if ((--pBatch->MemberCount) == 0)
+    delete pBatch;
+
+  s_groupCommitLock.Unlock();
+  return result;
+}
+
+#endif
+
+void ByteStream_SetGroupCommitWindow(uint32 milliseconds)
+{
+#if !defined(Y_PLATFORM_WINDOWS)
+  MutexLock lock(s_groupCommitLock);
+  s_groupCommitWindow = milliseconds;
+#endif
+}
+
 class AtomicUpdatedFileByteStream : public FileByteStream
 {
 public:
-  AtomicUpdatedFileByteStream(FILE* pFile, const char* originalFileName, const char* temporaryFileName)
-    : FileByteStream(pFile), m_committed(false), m_discarded(false), m_originalFileName(originalFileName),
+  AtomicUpdatedFileByteStream(FILE* pFile, const char* originalFileName, const char* temporaryFileName,
+                              uint32 openMode)
+    : FileByteStream(pFile), m_committed(false), m_discarded(false),
+      m_durable((openMode & (BYTESTREAM_OPEN_DURABLE | BYTESTREAM_OPEN_GROUP_COMMIT)) != 0),
+      m_groupCommit((openMode & BYTESTREAM_OPEN_GROUP_COMMIT) != 0), m_originalFileName(originalFileName),
       m_temporaryFileName(temporaryFileName)
   {
   }
@@ -301,11 +655,23 @@ public:
     if (m_committed)
       return Flush();
 
+    Timer commitTimer;
     fflush(m_pFile);
 
+    // the data has to be on disk before the rename, otherwise a crash can leave the new name with no contents
+    if (m_durable && !SyncFileData(m_pFile))
+    {
+      Log_WarningPrintf("AtomicUpdatedFileByteStream::Commit(): Failed to sync temporary file '%s'",
+                        m_temporaryFileName.GetCharArray());
+      m_discarded = true;
+      RecordCommitStatistics(commitTimer.GetTimeMilliseconds(), false, false);
+      return false;
+    }
+
 #ifdef Y_PLATFORM_WINDOWS
     // move the atomic file name to the original file name
-    if (!MoveFileExA(m_temporaryFileName, m_originalFileName, MOVEFILE_REPLACE_EXISTING))
+    DWORD moveFlags = MOVEFILE_REPLACE_EXISTING | ((m_durable) ? MOVEFILE_WRITE_THROUGH : 0);
+    if (!MoveFileExA(m_temporaryFileName, m_originalFileName, moveFlags))
     {
       Log_WarningPrintf("AtomicUpdatedFileByteStream::Commit(): Failed to rename temporary file '%s' to '%s'",
                         m_temporaryFileName.GetCharArray(), m_originalFileName.GetCharArray());
@@ -315,6 +681,8 @@ public:
     {
       m_committed = true;
     }
+
+    bool result = m_committed;
 #else
     // move the atomic file name to the original file name
     if (rename(m_temporaryFileName, m_originalFileName) < 0)
@@ -327,9 +695,22 @@ public:
     {
       m_committed = true;
     }
+
+    bool result = m_committed;
+    if (m_committed && m_durable)
+    {
+      String directoryName(GetDirectoryName());
+      result = (m_groupCommit) ? GroupCommitSyncDirectory(directoryName) : SyncDirectory(directoryName);
+      if (!result)
+      {
+        Log_WarningPrintf("AtomicUpdatedFileByteStream::Commit(): Failed to sync directory '%s'",
+                          directoryName.GetCharArray());
+      }
+    }
 #endif
 
-    return (!m_discarded);
+    RecordCommitStatistics(commitTimer.GetTimeMilliseconds(), m_durable, result);
+    return result;
   }
 
   virtual bool Discard() override
@@ -340,8 +721,21 @@ public:
   }
 
 private:
+  String GetDirectoryName() const
+  {
+    int32 separatorPosition = Max(m_originalFileName.RFind('/'), m_originalFileName.RFind('\\'));
+    if (separatorPosition < 0)
+      return String(".");
+    else if (separatorPosition == 0)
+      return String("/");
+    else
+      return m_originalFileName.SubString(0, separatorPosition);
+  }
+
   bool m_committed;
   bool m_discarded;
+  bool m_durable;
+  bool m_groupCommit;
   String m_originalFileName;
   String m_temporaryFileName;
 };
@@ -560,6 +954,11 @@ bool MemoryByteStream::Discard()
   return false;
 }
 
+const byte* MemoryByteStream::GetMemoryBasePointer() const
+{
+  return m_pMemory;
+}
+
 ReadOnlyMemoryByteStream::ReadOnlyMemoryByteStream(const void* pMemory, uint32 MemSize)
 {
   m_iPosition = 0;
@@ -671,6 +1070,11 @@ bool ReadOnlyMemoryByteStream::Discard()
   return false;
 }
 
+const byte* ReadOnlyMemoryByteStream::GetMemoryBasePointer() const
+{
+  return m_pMemory;
+}
+
 GrowableMemoryByteStream::GrowableMemoryByteStream(void* pInitialMem, uint32 InitialMemSize)
 {
   m_iPosition = 0;
@@ -812,6 +1216,11 @@ bool GrowableMemoryByteStream::Discard()
   return false;
 }
 
+const byte* GrowableMemoryByteStream::GetMemoryBasePointer() const
+{
+  return m_pMemory;
+}
+
 void GrowableMemoryByteStream::Grow(uint32 MinimumGrowth)
 {
   uint32 NewSize = Max(m_iMemorySize + MinimumGrowth, m_iMemorySize * 2);
@@ -991,7 +1400,8 @@ bool ByteStream_OpenFileStream(const char* fileName, uint32 openMode, ByteStream
     }
 
     // create the stream pointer
-    AtomicUpdatedFileByteStream* pStream = new AtomicUpdatedFileByteStream(pTemporaryFile, fileName, temporaryFileName);
+    AtomicUpdatedFileByteStream* pStream =
+      new AtomicUpdatedFileByteStream(pTemporaryFile, fileName, temporaryFileName, openMode);
 
     // do we need to copy the existing file into this one?
     if (!(openMode & BYTESTREAM_OPEN_TRUNCATE))
@@ -1173,7 +1583,8 @@ bool ByteStream_OpenFileStream(const char* fileName, uint32 openMode, ByteStream
       return false;
 
     // create the stream pointer
-    AtomicUpdatedFileByteStream* pStream = new AtomicUpdatedFileByteStream(pTemporaryFile, fileName, temporaryFileName);
+    AtomicUpdatedFileByteStream* pStream =
+      new AtomicUpdatedFileByteStream(pTemporaryFile, fileName, temporaryFileName, openMode);
 
     // do we need to copy the existing file into this one?
     if (!(openMode & BYTESTREAM_OPEN_TRUNCATE))
@@ -1225,6 +1636,185 @@ bool ByteStream_OpenFileStream(const char* fileName, uint32 openMode, ByteStream
 
 #endif
 
+// read-only view of a whole file mapped into the address space
+class MappedFileByteStream : public ByteStream
+{
+public:
+#if defined(Y_PLATFORM_WINDOWS)
+  MappedFileByteStream(HANDLE hFile, HANDLE hMapping, const byte* pMemory, uint64 size)
+    : m_hFile(hFile), m_hMapping(hMapping), m_pMemory(pMemory), m_size(size), m_position(0)
+  {
+  }
+
+  virtual ~MappedFileByteStream()
+  {
+    if (m_pMemory != nullptr)
+      UnmapViewOfFile(m_pMemory);
+    if (m_hMapping != NULL)
+      CloseHandle(m_hMapping);
+    CloseHandle(m_hFile);
+  }
+#else
+  MappedFileByteStream(const byte* pMemory, uint64 size) : m_pMemory(pMemory), m_size(size), m_position(0) {}
+
+  virtual ~MappedFileByteStream()
+  {
+    if (m_pMemory != nullptr)
+      munmap(const_cast<byte*>(m_pMemory), (size_t)m_size);
+  }
+#endif
+
+  virtual bool ReadByte(byte* pDestByte) override
+  {
+    if (m_position < m_size)
+    {
+      *pDestByte = m_pMemory[m_position++];
+      return true;
+    }
+
+    return false;
+  }
+
+  virtual uint32 Read(void* pDestination, uint32 ByteCount) override
+  {
+    uint32 sz = (uint32)Min((uint64)ByteCount, m_size - m_position);
+    if (sz > 0)
+    {
+      std::memcpy(pDestination, m_pMemory + m_position, sz);
+      m_position += sz;
+    }
+
+    return sz;
+  }
+
+  virtual bool Read2(void* pDestination, uint32 ByteCount, uint32* pNumberOfBytesRead /* = nullptr */) override
+  {
+    uint32 r = Read(pDestination, ByteCount);
+    if (pNumberOfBytesRead != nullptr)
+      *pNumberOfBytesRead = r;
+
+    return (r == ByteCount);
+  }
+
+  virtual bool WriteByte(byte SourceByte) override { return false; }
+  virtual uint32 Write(const void* pSource, uint32 ByteCount) override { return 0; }
+  virtual bool Write2(const void* pSource, uint32 ByteCount, uint32* pNumberOfBytesWritten /* = nullptr */) override
+  {
+    return false;
+  }
+
+  virtual bool SeekAbsolute(uint64 Offset) override
+  {
+    if (Offset > m_size)
+      return false;
+
+    m_position = Offset;
+    return true;
+  }
+
+  virtual bool SeekRelative(int64 Offset) override
+  {
+    if ((Offset < 0 && (uint64)-Offset > m_position) || (Offset > 0 && (uint64)Offset > (m_size - m_position)))
+      return false;
+
+    m_position = (uint64)((int64)m_position + Offset);
+    return true;
+  }
+
+  virtual bool SeekToEnd() override
+  {
+    m_position = m_size;
+    return true;
+  }
+
+  virtual uint64 GetSize() const override { return m_size; }
+  virtual uint64 GetPosition() const override { return m_position; }
+  virtual bool Flush() override { return false; }
+  virtual bool Commit() override { return false; }
+  virtual bool Discard() override { return false; }
+  virtual const byte* GetMemoryBasePointer() const override { return m_pMemory; }
+
+private:
+#if defined(Y_PLATFORM_WINDOWS)
+  HANDLE m_hFile;
+  HANDLE m_hMapping;
+#endif
+  const byte* m_pMemory;
+  uint64 m_size;
+  uint64 m_position;
+};
+
+#if defined(Y_PLATFORM_WINDOWS)
+
+bool ByteStream_OpenMappedFileStream(const char* fileName, ByteStream** ppReturnPointer)
+{
+  HANDLE hFile = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (hFile == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(hFile, &fileSize))
+  {
+    CloseHandle(hFile);
+    return false;
+  }
+
+  // empty files can't be mapped, but are still valid streams
+  if (fileSize.QuadPart == 0)
+  {
+    *ppReturnPointer = new MappedFileByteStream(hFile, NULL, nullptr, 0);
+    return true;
+  }
+
+  HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+  const void* pMemory = (hMapping != NULL) ? MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+  if (pMemory == nullptr)
+  {
+    if (hMapping != NULL)
+      CloseHandle(hMapping);
+    CloseHandle(hFile);
+    return false;
+  }
+
+  *ppReturnPointer = new MappedFileByteStream(hFile, hMapping, (const byte*)pMemory, (uint64)fileSize.QuadPart);
+  return true;
+}
+
+#else
+
+bool ByteStream_OpenMappedFileStream(const char* fileName, ByteStream** ppReturnPointer)
+{
+  int fd = open(fileName, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat s;
+  if (fstat(fd, &s) < 0 || (uint64)(size_t)s.st_size != (uint64)s.st_size)
+  {
+    close(fd);
+    return false;
+  }
+
+  // empty files can't be mapped, but are still valid streams
+  void* pMemory = nullptr;
+  if (s.st_size > 0)
+  {
+    pMemory = mmap(nullptr, (size_t)s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (pMemory == MAP_FAILED)
+    {
+      close(fd);
+      return false;
+    }
+  }
+
+  // the mapping keeps the file alive
+  close(fd);
+  *ppReturnPointer = new MappedFileByteStream((const byte*)pMemory, (uint64)s.st_size);
+  return true;
+}
+
+#endif
+
 MemoryByteStream* ByteStream_CreateMemoryStream(void* pMemory, uint32 Size)
 {
   DebugAssert(pMemory != nullptr && Size > 0);
@@ -1252,77 +1842,170 @@ GrowableMemoryByteStream* ByteStream_CreateGrowableMemoryStream()
   return new GrowableMemoryByteStream(nullptr, 0);
 }
 
-bool ByteStream_CopyStream(ByteStream* pDestinationStream, ByteStream* pSourceStream)
-{
-  const uint32 chunkSize = 4096;
-  byte chunkData[chunkSize];
+// buffered copies go through a heap buffer this size, large enough that per-call overhead in the streams is noise
+static const uint32 BYTESTREAM_COPY_BUFFER_SIZE = 256 * 1024;
+static const uint32 BYTESTREAM_COPY_BUFFER_ALIGNMENT = 4096;
 
-  uint64 oldSourcePosition = pSourceStream->GetPosition();
-  if (!pSourceStream->SeekAbsolute(0) || !pDestinationStream->SeekAbsolute(0))
-    return false;
+#if defined(Y_PLATFORM_LINUX)
 
-  bool success = false;
-  for (;;)
+// copies between two descriptors at explicit offsets without the data entering userspace. returns the number of bytes
+// copied, which may be short if neither copy_file_range nor sendfile is usable for this pair, the caller finishes
+// the remainder with a buffered copy.
+static uint64 KernelCopyFileData(int sourceFd, uint64 sourceOffset, int destinationFd, uint64 destinationOffset,
+                                 uint64 byteCount)
+{
+  uint64 copied = 0;
+  bool useCopyFileRange = true;
+  bool destinationPositioned = false;
+
+  while (copied < byteCount)
   {
-    uint32 nBytes = pSourceStream->Read(chunkData, chunkSize);
-    if (nBytes == 0)
+    size_t chunkSize = (size_t)Min(byteCount - copied, (uint64)0x40000000);
+    ssize_t result;
+
+#if defined(__NR_copy_file_range)
+    if (useCopyFileRange)
     {
-      success = true;
-      break;
+      loff_t inOffset = (loff_t)(sourceOffset + copied);
+      loff_t outOffset = (loff_t)(destinationOffset + copied);
+      result = (ssize_t)syscall(__NR_copy_file_range, sourceFd, &inOffset, destinationFd, &outOffset, chunkSize, 0);
+      if (result < 0 && errno != EINTR)
+      {
+        // older kernel, cross-filesystem before 5.3, or an append-only destination. try sendfile instead.
+        useCopyFileRange = false;
+        continue;
+      }
+    }
+    else
+#endif
+    {
+      // sendfile reads at an explicit offset but writes at the destination's own offset
+      if (!destinationPositioned)
+      {
+        if (lseek(destinationFd, (off_t)(destinationOffset + copied), SEEK_SET) < 0)
+          break;
+        destinationPositioned = true;
+      }
+
+      off_t inOffset = (off_t)(sourceOffset + copied);
+      result = sendfile(destinationFd, sourceFd, &inOffset, chunkSize);
+      if (result < 0 && errno != EINTR)
+        break;
     }
 
-    if (pDestinationStream->Write(chunkData, nBytes) != nBytes)
+    if (result < 0)
+      continue;
+    if (result == 0)
       break;
+
+    copied += (uint64)result;
   }
 
-  return (pSourceStream->SeekAbsolute(oldSourcePosition) && success);
+  return copied;
 }
 
-bool ByteStream_AppendStream(ByteStream* pSourceStream, ByteStream* pDestinationStream)
-{
-  const uint32 chunkSize = 4096;
-  byte chunkData[chunkSize];
+#endif
 
-  uint64 oldSourcePosition = pSourceStream->GetPosition();
-  if (!pSourceStream->SeekAbsolute(0))
-    return false;
+// copies up to byteCount bytes from the current position of the source to the current position of the destination,
+// using the cheapest path the pair of streams allows. returns the number of bytes copied; *pWriteFailed is set if the
+// copy stopped early because of the destination rather than the end of the source.
+static uint64 CopyStreamData(ByteStream* pSourceStream, ByteStream* pDestinationStream, uint64 byteCount,
+                             bool* pWriteFailed)
+{
+  uint64 copied = 0;
+  *pWriteFailed = false;
 
-  bool success = false;
-  for (;;)
+  // memory-backed source: hand the destination the source memory directly, one memcpy for memory destinations
+  const byte* pSourceMemory = pSourceStream->GetMemoryBasePointer();
+  if (pSourceMemory != nullptr)
   {
-    uint32 nBytes = pSourceStream->Read(chunkData, chunkSize);
-    if (nBytes == 0)
+    uint64 sourcePosition = pSourceStream->GetPosition();
+    uint64 sourceSize = pSourceStream->GetSize();
+    uint64 toCopy = (sourcePosition < sourceSize) ? Min(byteCount, sourceSize - sourcePosition) : 0;
+    while (copied < toCopy)
     {
-      success = true;
-      break;
+      uint32 chunkSize = (uint32)Min(toCopy - copied, (uint64)0x40000000);
+      uint32 bytesWritten = pDestinationStream->Write(pSourceMemory + sourcePosition + copied, chunkSize);
+      copied += bytesWritten;
+      if (bytesWritten != chunkSize)
+      {
+        *pWriteFailed = true;
+        break;
+      }
     }
 
-    if (pDestinationStream->Write(chunkData, nBytes) != nBytes)
-      break;
+    pSourceStream->SeekAbsolute(sourcePosition + copied);
+    return copied;
   }
 
-  return (pSourceStream->SeekAbsolute(oldSourcePosition) && success);
-}
+#if defined(Y_PLATFORM_LINUX)
+  // file to file: let the kernel move the data, or share extents on filesystems which support reflinks
+  int sourceFd = pSourceStream->GetFileDescriptor();
+  int destinationFd = (sourceFd >= 0) ? pDestinationStream->GetFileDescriptor() : -1;
+  if (sourceFd >= 0 && destinationFd >= 0)
+  {
+    uint64 sourcePosition = pSourceStream->GetPosition();
+    uint64 sourceSize = pSourceStream->GetSize();
+    uint64 destinationPosition = pDestinationStream->GetPosition();
+    uint64 toCopy = (sourcePosition < sourceSize) ? Min(byteCount, sourceSize - sourcePosition) : 0;
 
-uint32 ByteStream_CopyBytes(ByteStream* pSourceStream, uint32 byteCount, ByteStream* pDestinationStream)
-{
-  const uint32 chunkSize = 4096;
-  byte chunkData[chunkSize];
+    copied = KernelCopyFileData(sourceFd, sourcePosition, destinationFd, destinationPosition, toCopy);
+    if (copied > 0)
+    {
+      pSourceStream->SeekAbsolute(sourcePosition + copied);
+      pDestinationStream->SeekAbsolute(destinationPosition + copied);
+    }
 
-  uint32 remaining = byteCount;
-  while (remaining > 0)
+    if (copied == toCopy)
+      return copied;
+  }
+#endif
+
+  byte* pBuffer = (byte*)Y_aligned_malloc(BYTESTREAM_COPY_BUFFER_SIZE, BYTESTREAM_COPY_BUFFER_ALIGNMENT);
+  while (copied < byteCount)
   {
-    uint32 toCopy = Min(remaining, chunkSize);
-    uint32 bytesRead = pSourceStream->Read(chunkData, toCopy);
+    uint32 toRead = (uint32)Min(byteCount - copied, (uint64)BYTESTREAM_COPY_BUFFER_SIZE);
+    uint32 bytesRead = pSourceStream->Read(pBuffer, toRead);
     if (bytesRead == 0)
       break;
 
-    uint32 bytesWritten = pDestinationStream->Write(chunkData, bytesRead);
-    if (bytesWritten == 0)
+    uint32 bytesWritten = pDestinationStream->Write(pBuffer, bytesRead);
+    copied += bytesWritten;
+    if (bytesWritten != bytesRead)
+    {
+      *pWriteFailed = true;
       break;
-
-    remaining -= bytesWritten;
+    }
   }
+  Y_aligned_free(pBuffer);
+
+  return copied;
+}
+
+bool ByteStream_CopyStream(ByteStream* pDestinationStream, ByteStream* pSourceStream)
+{
+  uint64 oldSourcePosition = pSourceStream->GetPosition();
+  if (!pSourceStream->SeekAbsolute(0) || !pDestinationStream->SeekAbsolute(0))
+    return false;
+
+  bool writeFailed;
+  CopyStreamData(pSourceStream, pDestinationStream, 0xFFFFFFFFFFFFFFFFULL, &writeFailed);
+  return (pSourceStream->SeekAbsolute(oldSourcePosition) && !writeFailed);
+}
 
-  return byteCount - remaining;
+bool ByteStream_AppendStream(ByteStream* pSourceStream, ByteStream* pDestinationStream)
+{
+  uint64 oldSourcePosition = pSourceStream->GetPosition();
+  if (!pSourceStream->SeekAbsolute(0))
+    return false;
+
+  bool writeFailed;
+  CopyStreamData(pSourceStream, pDestinationStream, 0xFFFFFFFFFFFFFFFFULL, &writeFailed);
+  return (pSourceStream->SeekAbsolute(oldSourcePosition) && !writeFailed);
+}
+
+uint32 ByteStream_CopyBytes(ByteStream* pSourceStream, uint32 byteCount, ByteStream* pDestinationStream)
+{
+  bool writeFailed;
+  return (uint32)CopyStreamData(pSourceStream, pDestinationStream, byteCount, &writeFailed);
 }
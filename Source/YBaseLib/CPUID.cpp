@@ -62,6 +62,7 @@ static void CPUID_ReadCPUData(Y_CPUID_RESULT* pResult)
   pResult->SupportsSSE42 = CheckBit(data[2], 20);
   pResult->SupportsSSE41 = CheckBit(data[2], 19);
   pResult->SupportsSSSE3 = CheckBit(data[2], 9);
+  pResult->SupportsPCLMULQDQ = CheckBit(data[2], 1);
   pResult->SupportsSSE3 = CheckBit(data[2], 0);
   pResult->SupportsHTT = CheckBit(data[3], 28);
   pResult->SupportsSSE2 = CheckBit(data[3], 26);
@@ -106,6 +107,37 @@ static void CPUID_ReadCPUData(Y_CPUID_RESULT* pResult)
   Y_strncpy(pResult->BrandString, sizeof(pResult->BrandString), "ARM");
 }
 
+#elif defined(Y_CPU_AARCH64)
+
+#if defined(Y_PLATFORM_LINUX) || defined(Y_PLATFORM_ANDROID)
+#include <sys/auxv.h>
+#ifndef HWCAP_PMULL
+#define HWCAP_PMULL (1 << 4)
+#endif
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+static void CPUID_ReadCPUData(Y_CPUID_RESULT* pResult)
+{
+  Y_strncpy(pResult->VendorString, sizeof(pResult->VendorString), "ARM");
+  Y_strncpy(pResult->BrandString, sizeof(pResult->BrandString), "AArch64");
+
+#if defined(Y_PLATFORM_LINUX) || defined(Y_PLATFORM_ANDROID)
+  unsigned long hwcap = getauxval(AT_HWCAP);
+  pResult->SupportsARMCRC32 = ((hwcap & HWCAP_CRC32) != 0);
+  pResult->SupportsARMPMULL = ((hwcap & HWCAP_PMULL) != 0);
+#elif defined(Y_PLATFORM_WINDOWS)
+  pResult->SupportsARMCRC32 = (IsProcessorFeaturePresent(PF_ARM_V8_CRC32_INSTRUCTIONS_AVAILABLE) != FALSE);
+  pResult->SupportsARMPMULL = (IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE) != FALSE);
+#elif defined(Y_PLATFORM_OSX)
+  // every apple arm64 cpu has both
+  pResult->SupportsARMCRC32 = true;
+  pResult->SupportsARMPMULL = true;
+#endif
+}
+
 #elif defined(Y_PLATFORM_HTML5)
 
 static void CPUID_ReadCPUData(Y_CPUID_RESULT* pResult)
@@ -239,6 +271,12 @@ static void CPUID_GenerateSummaryString(Y_CPUID_RESULT* pResult)
     CONCAT_FMT("SSE4.2/");
   if (pResult->SupportsAVX)
     CONCAT_FMT("AVX/");
+  if (pResult->SupportsPCLMULQDQ)
+    CONCAT_FMT("PCLMULQDQ/");
+  if (pResult->SupportsARMCRC32)
+    CONCAT_FMT("CRC32/");
+  if (pResult->SupportsARMPMULL)
+    CONCAT_FMT("PMULL/");
 
   // remove trailing / if present
   uint32 len = Y_strlen(pResult->SummaryString);
@@ -1,20 +1,316 @@
 #include "YBaseLib/CRC32.h"
+#include "YBaseLib/Assert.h"
 #include "YBaseLib/ByteStream.h"
+#include "YBaseLib/CPUID.h"
+#include "YBaseLib/Memory.h"
 #include "YBaseLib/String.h"
+#include <cstring>
 
-static uint32 Crc32_ComputeBuf(uint32 inCrc32, const void* buf, size_t bufLen);
+#if (defined(Y_CPU_X86) || defined(Y_CPU_X64)) && (defined(Y_COMPILER_GCC) || defined(Y_COMPILER_CLANG))
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#define CRC32_HAS_PCLMULQDQ 1
+#define CRC32_PCLMULQDQ_TARGET __attribute__((target("pclmul,sse2")))
+#elif (defined(Y_CPU_X86) || defined(Y_CPU_X64)) && defined(Y_COMPILER_MSVC)
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#define CRC32_HAS_PCLMULQDQ 1
+#define CRC32_PCLMULQDQ_TARGET
+#endif
+
+#if defined(Y_CPU_AARCH64) && defined(Y_COMPILER_CLANG)
+#include <arm_acle.h>
+#define CRC32_HAS_ARMV8 1
+#define CRC32_ARMV8_TARGET __attribute__((target("crc")))
+#elif defined(Y_CPU_AARCH64) && defined(Y_COMPILER_GCC)
+#include <arm_acle.h>
+#define CRC32_HAS_ARMV8 1
+#define CRC32_ARMV8_TARGET __attribute__((target("+crc")))
+#elif defined(Y_CPU_AARCH64) && defined(Y_COMPILER_MSVC)
+#include <intrin.h>
+#define CRC32_HAS_ARMV8 1
+#define CRC32_ARMV8_TARGET
+#endif
+
+// reflected form of the zip/zlib polynomial
+static const uint32 CRC32_POLYNOMIAL = 0xEDB88320;
+
+// slicing-by-8 tables: s_crc32Tables[k][n] is the CRC of byte n followed by k zero bytes. filled in by Crc32State,
+// which every implementation is reached through.
+static uint32 s_crc32Tables[8][256];
+
+typedef uint32 (*Crc32Function)(uint32 crc, const byte* pData, size_t length);
+
+static uint32 Crc32_ComputeSlicingBy8(uint32 crc, const byte* pData, size_t length)
+{
+  crc = ~crc;
+
+  // byte at a time until aligned, so the eight byte loads don't straddle cache lines
+  while (length > 0 && (reinterpret_cast<uintptr_t>(pData) & 7) != 0)
+  {
+    crc = (crc >> 8) ^ s_crc32Tables[0][(crc ^ *pData++) & 0xFF];
+    length--;
+  }
+
+  // the loads are assembled from bytes so this works on either endianness, compilers turn them into single loads
+  while (length >= 8)
+  {
+    uint32 one = crc ^ ((uint32)pData[0] | ((uint32)pData[1] << 8) | ((uint32)pData[2] << 16) |
+                        ((uint32)pData[3] << 24));
+    uint32 two = (uint32)pData[4] | ((uint32)pData[5] << 8) | ((uint32)pData[6] << 16) | ((uint32)pData[7] << 24);
+    crc = s_crc32Tables[7][one & 0xFF] ^ s_crc32Tables[6][(one >> 8) & 0xFF] ^ s_crc32Tables[5][(one >> 16) & 0xFF] ^
+          s_crc32Tables[4][one >> 24] ^ s_crc32Tables[3][two & 0xFF] ^ s_crc32Tables[2][(two >> 8) & 0xFF] ^
+          s_crc32Tables[1][(two >> 16) & 0xFF] ^ s_crc32Tables[0][two >> 24];
+    pData += 8;
+    length -= 8;
+  }
+
+  while (length > 0)
+  {
+    crc = (crc >> 8) ^ s_crc32Tables[0][(crc ^ *pData++) & 0xFF];
+    length--;
+  }
+
+  return ~crc;
+}
+
+#ifdef CRC32_HAS_PCLMULQDQ
+
+// Folds 64 bytes at a time with carry-less multiplies, then Barrett-reduces to 32 bits. From Intel's "Fast CRC
+// Computation for Generic Polynomials Using PCLMULQDQ Instruction", with the bit-reflected constants for the zip
+// polynomial. length must be at least 64 and a multiple of 16, and the crc is passed and returned without the
+// pre/post inversion.
+CRC32_PCLMULQDQ_TARGET static uint32 Crc32_FoldPCLMULQDQ(uint32 crc, const byte* pData, size_t length)
+{
+  ALIGN_DECL(16) static const uint64 k1k2[2] = {0x0154442bd4ULL, 0x01c6e41596ULL};
+  ALIGN_DECL(16) static const uint64 k3k4[2] = {0x01751997d0ULL, 0x00ccaa009eULL};
+  ALIGN_DECL(16) static const uint64 k5k0[2] = {0x0163cd6124ULL, 0x0000000000ULL};
+  ALIGN_DECL(16) static const uint64 poly[2] = {0x01db710641ULL, 0x01f7011641ULL};
+
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+  x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 0x00));
+  x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 0x10));
+  x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 0x20));
+  x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+  x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+  pData += 64;
+  length -= 64;
+
+  // four independent folds per iteration, which keeps the multiplier busy
+  while (length >= 64)
+  {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+    y5 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 0x00));
+    y6 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 0x10));
+    y7 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 0x20));
+    y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 0x30));
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+    pData += 64;
+    length -= 64;
+  }
+
+  // fold the four lanes into one
+  x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  // remaining 16 byte blocks
+  while (length >= 16)
+  {
+    x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData));
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    pData += 16;
+    length -= 16;
+  }
+
+  // 128 bits down to 64
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x1 = _mm_srli_si128(x1, 8);
+  x1 = _mm_xor_si128(x1, x2);
+  x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, x3);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // barrett reduction to 32 bits
+  x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+  x2 = _mm_and_si128(x1, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+  x2 = _mm_and_si128(x2, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // the result is in the second dword. shifted down rather than extracted, which would need SSE4.1.
+  return (uint32)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+
+static uint32 Crc32_ComputePCLMULQDQ(uint32 crc, const byte* pData, size_t length)
+{
+  if (length >= 64)
+  {
+    size_t foldLength = length & ~(size_t)15;
+    crc = ~Crc32_FoldPCLMULQDQ(~crc, pData, foldLength);
+    pData += foldLength;
+    length -= foldLength;
+  }
+
+  return Crc32_ComputeSlicingBy8(crc, pData, length);
+}
+
+#endif // CRC32_HAS_PCLMULQDQ
+
+#ifdef CRC32_HAS_ARMV8
+
+CRC32_ARMV8_TARGET static uint32 Crc32_ComputeARMv8(uint32 crc, const byte* pData, size_t length)
+{
+  crc = ~crc;
+
+  while (length > 0 && (reinterpret_cast<uintptr_t>(pData) & 7) != 0)
+  {
+    crc = __crc32b(crc, *pData++);
+    length--;
+  }
+
+  while (length >= 8)
+  {
+    uint64 value;
+    std::memcpy(&value, pData, sizeof(value));
+    crc = __crc32d(crc, value);
+    pData += 8;
+    length -= 8;
+  }
+
+  while (length > 0)
+  {
+    crc = __crc32b(crc, *pData++);
+    length--;
+  }
+
+  return ~crc;
+}
+
+#endif // CRC32_HAS_ARMV8
+
+// multiplies two polynomials modulo the crc polynomial, in the reflected representation (x^0 in the top bit)
+static uint32 Crc32_MultiplyModP(uint32 a, uint32 b)
+{
+  uint32 m = 1u << 31;
+  uint32 p = 0;
+  for (;;)
+  {
+    if (a & m)
+    {
+      p ^= b;
+      if ((a & (m - 1)) == 0)
+        break;
+    }
+
+    m >>= 1;
+    b = (b & 1) ? ((b >> 1) ^ CRC32_POLYNOMIAL) : (b >> 1);
+  }
+
+  return p;
+}
+
+// set up once, on the first CRC computed
+struct Crc32State
+{
+  // x^(2^n) mod P, for shifting a crc past runs of zeros in combine
+  uint32 PowerTable[32];
+
+  bool Available[CRC32_IMPLEMENTATION_COUNT];
+  Crc32Function Functions[CRC32_IMPLEMENTATION_COUNT];
+  CRC32_IMPLEMENTATION Implementation;
+
+  Crc32State()
+  {
+    for (uint32 i = 0; i < 256; i++)
+    {
+      uint32 crc = i;
+      for (uint32 j = 0; j < 8; j++)
+        crc = (crc & 1) ? ((crc >> 1) ^ CRC32_POLYNOMIAL) : (crc >> 1);
+
+      s_crc32Tables[0][i] = crc;
+    }
+    for (uint32 k = 1; k < 8; k++)
+    {
+      for (uint32 i = 0; i < 256; i++)
+        s_crc32Tables[k][i] = (s_crc32Tables[k - 1][i] >> 8) ^ s_crc32Tables[0][s_crc32Tables[k - 1][i] & 0xFF];
+    }
+
+    PowerTable[0] = 1u << 30; // x^1
+    for (uint32 i = 1; i < countof(PowerTable); i++)
+      PowerTable[i] = Crc32_MultiplyModP(PowerTable[i - 1], PowerTable[i - 1]);
+
+    Y_CPUID_RESULT cpuid;
+    Y_ReadCPUID(&cpuid);
+
+    Y_memzero(Available, sizeof(Available));
+    Y_memzero(Functions, sizeof(Functions));
+    Available[CRC32_IMPLEMENTATION_SLICING_BY_8] = true;
+    Functions[CRC32_IMPLEMENTATION_SLICING_BY_8] = Crc32_ComputeSlicingBy8;
+    Implementation = CRC32_IMPLEMENTATION_SLICING_BY_8;
+
+#ifdef CRC32_HAS_PCLMULQDQ
+    if (cpuid.SupportsPCLMULQDQ && cpuid.SupportsSSE2)
+    {
+      Available[CRC32_IMPLEMENTATION_PCLMULQDQ] = true;
+      Functions[CRC32_IMPLEMENTATION_PCLMULQDQ] = Crc32_ComputePCLMULQDQ;
+      Implementation = CRC32_IMPLEMENTATION_PCLMULQDQ;
+    }
+#endif
+
+#ifdef CRC32_HAS_ARMV8
+    if (cpuid.SupportsARMCRC32)
+    {
+      Available[CRC32_IMPLEMENTATION_ARMV8] = true;
+      Functions[CRC32_IMPLEMENTATION_ARMV8] = Crc32_ComputeARMv8;
+      Implementation = CRC32_IMPLEMENTATION_ARMV8;
+    }
+#endif
+  }
+};
+
+static const Crc32State& GetCrc32State()
+{
+  static const Crc32State state;
+  return state;
+}
 
 CRC32::CRC32(uint32 start /*= 0*/) : m_currentCRC(start) {}
 
 void CRC32::HashBytes(const void* buf, size_t len)
 {
-  m_currentCRC = Crc32_ComputeBuf(m_currentCRC, buf, len);
+  m_currentCRC = ComputeBuffer(m_currentCRC, buf, len);
 }
 
 void CRC32::HashString(const String& str)
 {
   if (str.GetLength() > 0)
-    m_currentCRC = Crc32_ComputeBuf(m_currentCRC, str.GetCharArray(), str.GetLength());
+    m_currentCRC = ComputeBuffer(m_currentCRC, str.GetCharArray(), str.GetLength());
 }
 
 bool CRC32::HashStream(ByteStream* pStream, bool seekToStart /* = false */, bool restorePosition /* = false */)
@@ -32,19 +328,37 @@ bool CRC32::HashStream(ByteStream* pStream, bool seekToStart /* = false */, bool
 
 bool CRC32::HashStreamPartial(ByteStream* pStream, uint64 count)
 {
-  static const uint32 BUFFER_SIZE = 1024;
-  byte buffer[BUFFER_SIZE];
+  // memory-backed streams are hashed in place
+  const byte* pMemory = pStream->GetMemoryBasePointer();
+  if (pMemory != nullptr)
+  {
+    uint64 position = pStream->GetPosition();
+    if (count > pStream->GetSize() || position > pStream->GetSize() - count)
+      return false;
+
+    m_currentCRC = ComputeBuffer(m_currentCRC, pMemory + position, (size_t)count);
+    return pStream->SeekAbsolute(position + count);
+  }
+
+  // large enough that the hash, not the per-read overhead, dominates
+  static const uint32 BUFFER_SIZE = 65536;
+  byte* pBuffer = new byte[BUFFER_SIZE];
+  bool result = true;
   while (count > 0)
   {
     uint32 readCount = (count > BUFFER_SIZE) ? BUFFER_SIZE : (uint32)count;
-    if (!pStream->Read2(buffer, readCount))
-      return false;
+    if (!pStream->Read2(pBuffer, readCount))
+    {
+      result = false;
+      break;
+    }
 
-    m_currentCRC = Crc32_ComputeBuf(m_currentCRC, buffer, readCount);
+    m_currentCRC = ComputeBuffer(m_currentCRC, pBuffer, readCount);
     count -= readCount;
   }
 
-  return true;
+  delete[] pBuffer;
+  return result;
 }
 
 void CRC32::Reset()
@@ -52,49 +366,56 @@ void CRC32::Reset()
   m_currentCRC = 0;
 }
 
-// http://csbruce.com/software/crc32.c
-static uint32 Crc32_ComputeBuf(uint32 inCrc32, const void* buf, size_t bufLen)
-{
-  static const unsigned long crcTable[256] = {
-    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3, 0x0EDB8832,
-    0x79DCB8A4, 0xE0D5E91E, 0x97D2D988, 0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
-    0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7, 0x136C9856, 0x646BA8C0, 0xFD62F97A,
-    0x8A65C9EC, 0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
-    0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940, 0x32D86CE3,
-    0x45DF5C75, 0xDCD60DCF, 0xABD13D59, 0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
-    0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924, 0x2F6F7C87, 0x58684C11, 0xC1611DAB,
-    0xB6662D3D, 0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
-    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01, 0x6B6B51F4,
-    0x1C6C6162, 0x856530D8, 0xF262004E, 0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
-    0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65, 0x4DB26158, 0x3AB551CE, 0xA3BC0074,
-    0xD4BB30E2, 0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
-    0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086, 0x5768B525,
-    0x206F85B3, 0xB966D409, 0xCE61E49F, 0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
-    0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A, 0xEAD54739, 0x9DD277AF, 0x04DB2615,
-    0x73DC1683, 0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
-    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7, 0xFED41B76,
-    0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC, 0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
-    0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B, 0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6,
-    0x41047A60, 0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
-    0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7,
-    0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D, 0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
-    0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38, 0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7,
-    0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
-    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45, 0xA00AE278,
-    0xD70DD2EE, 0x4E048354, 0x3903B3C2, 0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
-    0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9, 0xBDBDF21C, 0xCABAC28A, 0x53B39330,
-    0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
-    0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D};
-  unsigned long crc32;
-  unsigned char* byteBuf;
-  size_t i;
-
-  /** accumulate crc32 for buffer **/
-  crc32 = inCrc32 ^ 0xFFFFFFFF;
-  byteBuf = (unsigned char*)buf;
-  for (i = 0; i < bufLen; i++)
+void CRC32::Combine(uint32 crc, uint64 len)
+{
+  m_currentCRC = CombineCRC(m_currentCRC, crc, len);
+}
+
+uint32 CRC32::ComputeBuffer(uint32 crc, const void* buf, size_t len)
+{
+  const Crc32State& state = GetCrc32State();
+  return state.Functions[state.Implementation](crc, reinterpret_cast<const byte*>(buf), len);
+}
+
+uint32 CRC32::CombineCRC(uint32 crcA, uint32 crcB, uint64 lenB)
+{
+  // crc(A+B) = crcA * x^(8 * lenB) + crcB, mod P. the power is built from the squares table, one bit of lenB at a time,
+  // starting at x^8 since the length is in bytes.
+  const Crc32State& state = GetCrc32State();
+  uint32 power = 1u << 31; // x^0
+  uint32 k = 3;
+  while (lenB > 0)
   {
-    crc32 = (crc32 >> 8) ^ crcTable[(crc32 ^ byteBuf[i]) & 0xFF];
+    if (lenB & 1)
+      power = Crc32_MultiplyModP(state.PowerTable[k & 31], power);
+
+    lenB >>= 1;
+    k++;
   }
-  return (crc32 ^ 0xFFFFFFFF);
+
+  return Crc32_MultiplyModP(power, crcA) ^ crcB;
+}
+
+CRC32_IMPLEMENTATION CRC32::GetImplementation()
+{
+  return GetCrc32State().Implementation;
+}
+
+bool CRC32::IsImplementationAvailable(CRC32_IMPLEMENTATION implementation)
+{
+  return (implementation < CRC32_IMPLEMENTATION_COUNT && GetCrc32State().Available[implementation]);
+}
+
+const char* CRC32::GetImplementationName(CRC32_IMPLEMENTATION implementation)
+{
+  static const char* names[CRC32_IMPLEMENTATION_COUNT] = {"slicing-by-8", "PCLMULQDQ", "ARMv8"};
+  return (implementation < CRC32_IMPLEMENTATION_COUNT) ? names[implementation] : "unknown";
+}
+
+uint32 CRC32::ComputeBufferWithImplementation(CRC32_IMPLEMENTATION implementation, uint32 crc, const void* buf,
+                                              size_t len)
+{
+  const Crc32State& state = GetCrc32State();
+  DebugAssert(implementation < CRC32_IMPLEMENTATION_COUNT && state.Available[implementation]);
+  return state.Functions[implementation](crc, reinterpret_cast<const byte*>(buf), len);
 }
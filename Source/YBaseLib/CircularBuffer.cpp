@@ -97,6 +97,14 @@ bool CircularBuffer::GetReadPointer(const void** ppReadPointer, size_t* pByteCou
 
 void CircularBuffer::MoveReadPointer(size_t byteCount)
 {
+  // running past the end of A continues into B, which is renamed to A once A is consumed
+  size_t bytesInA = m_pRegionATail - m_pRegionAHead;
+  if (byteCount > bytesInA && m_pRegionBTail != nullptr)
+  {
+    MoveReadPointer(bytesInA);
+    byteCount -= bytesInA;
+  }
+
   DebugAssert(byteCount <= static_cast<size_t>(m_pRegionATail - m_pRegionAHead));
 
   // walk all over the bytes - only in debug mode
@@ -126,6 +134,25 @@ void CircularBuffer::MoveReadPointer(size_t byteCount)
   }
 }
 
+uint32 CircularBuffer::GetReadRegions(const void** ppRegions, size_t* pRegionSizes) const
+{
+  uint32 regionCount = 0;
+  if (m_pRegionATail != m_pRegionAHead)
+  {
+    ppRegions[regionCount] = m_pRegionAHead;
+    pRegionSizes[regionCount] = m_pRegionATail - m_pRegionAHead;
+    regionCount++;
+  }
+  if (m_pRegionBTail != nullptr && m_pRegionBTail != m_pBuffer)
+  {
+    ppRegions[regionCount] = m_pBuffer;
+    pRegionSizes[regionCount] = m_pRegionBTail - m_pBuffer;
+    regionCount++;
+  }
+
+  return regionCount;
+}
+
 bool CircularBuffer::GetWritePointer(void** ppWritePointer, size_t* pByteCount)
 {
   size_t requiredBytes = *pByteCount;
@@ -182,12 +209,52 @@ void CircularBuffer::MoveWritePointer(size_t byteCount)
   }
   else
   {
-    // add to A size
-    DebugAssert(byteCount <= static_cast<size_t>(m_pBuffer + m_bufferSize - m_pRegionATail));
-    m_pRegionATail += byteCount;
+    // add to A size, anything past the end of the buffer was written to the start and becomes B
+    size_t spaceA = (m_pBuffer + m_bufferSize) - m_pRegionATail;
+    if (byteCount > spaceA)
+    {
+      DebugAssert((byteCount - spaceA) <= static_cast<size_t>(m_pRegionAHead - m_pBuffer));
+      m_pRegionATail += spaceA;
+      m_pRegionBTail = m_pBuffer + (byteCount - spaceA);
+    }
+    else
+    {
+      m_pRegionATail += byteCount;
+    }
   }
 }
 
+uint32 CircularBuffer::GetWriteRegions(void** ppRegions, size_t* pRegionSizes) const
+{
+  // once B exists, the only free space is between it and A
+  if (m_pRegionBTail != nullptr)
+  {
+    if (m_pRegionAHead == m_pRegionBTail)
+      return 0;
+
+    ppRegions[0] = m_pRegionBTail;
+    pRegionSizes[0] = m_pRegionAHead - m_pRegionBTail;
+    return 1;
+  }
+
+  // otherwise after A, then before it, where B would go
+  uint32 regionCount = 0;
+  if (m_pRegionATail != (m_pBuffer + m_bufferSize))
+  {
+    ppRegions[regionCount] = m_pRegionATail;
+    pRegionSizes[regionCount] = (m_pBuffer + m_bufferSize) - m_pRegionATail;
+    regionCount++;
+  }
+  if (m_pRegionAHead != m_pBuffer)
+  {
+    ppRegions[regionCount] = m_pBuffer;
+    pRegionSizes[regionCount] = m_pRegionAHead - m_pBuffer;
+    regionCount++;
+  }
+
+  return regionCount;
+}
+
 bool CircularBuffer::Read(void* pDestination, size_t byteCount)
 {
   if (byteCount > GetBufferUsed())
@@ -217,21 +284,21 @@ bool CircularBuffer::Write(const void* pSource, size_t byteCount)
   if (byteCount > GetBufferSpace())
     return false;
 
+  // fill the space after A before wrapping around, so all of the free space is usable
+  void* pRegions[2];
+  size_t regionSizes[2];
+  uint32 regionCount = GetWriteRegions(pRegions, regionSizes);
   const byte* pSourcePtr = reinterpret_cast<const byte*>(pSource);
-  while (byteCount > 0)
+  size_t bytesRemaining = byteCount;
+  for (uint32 i = 0; i < regionCount && bytesRemaining > 0; i++)
   {
-    void* pWritePointer;
-    size_t availableBytes;
-    if (!GetWritePointer(&pWritePointer, &availableBytes))
-      Panic("Buffer failed mid-write.");
-
     // copy data
-    size_t copyCount = Min(byteCount, availableBytes);
-    std::memcpy(pWritePointer, pSourcePtr, copyCount);
-    MoveWritePointer(copyCount);
+    size_t copyCount = Min(bytesRemaining, regionSizes[i]);
+    std::memcpy(pRegions[i], pSourcePtr, copyCount);
     pSourcePtr += copyCount;
-    byteCount -= copyCount;
+    bytesRemaining -= copyCount;
   }
 
+  MoveWritePointer(byteCount);
   return true;
 }
@@ -0,0 +1,529 @@
+#include "YBaseLib/CompressedByteStream.h"
+#include "YBaseLib/Assert.h"
+#include "YBaseLib/BinaryReader.h"
+#include "YBaseLib/BinaryWriter.h"
+#include "YBaseLib/Log.h"
+#include <cstring>
+Log_SetChannel(CompressedByteStream);
+
+// the restart table follows the compressed data: one uint64 compressed offset per piece, then this footer. everything
+// is little-endian.
+//   uint64 UncompressedSize
+//   uint64 CompressedSize      - size of the compressed data, which ends where the table starts
+//   uint32 RestartInterval
+//   uint32 RestartPointCount
+//   uint32 Codec
+//   uint32 Signature
+static const uint32 RESTART_TABLE_FOOTER_SIZE = 32;
+static const uint32 RESTART_TABLE_SIGNATURE = 0x54524359; // 'YCRT'
+
+static const uint64 UNKNOWN_SIZE = 0xFFFFFFFFFFFFFFFFULL;
+
+CompressingByteStream::CompressingByteStream(ByteStream* pBaseStream, CompressionCodecStream* pCompressor,
+                                             COMPRESSION_CODEC codec, uint32 restartInterval)
+  : m_pBaseStream(pBaseStream), m_pCompressor(pCompressor), m_codec(codec), m_restartInterval(restartInterval),
+    m_pieceInputSize(0), m_position(0), m_compressedSize(0), m_outputBytes(0), m_finished(false), m_discarded(false)
+{
+  m_pBaseStream->AddRef();
+
+  // the first piece starts with the data
+  if (m_restartInterval > 0)
+    m_restartPoints.Add(0);
+}
+
+CompressingByteStream::~CompressingByteStream()
+{
+  if (!m_finished && !m_discarded && !m_errorState)
+    Finish();
+
+  delete m_pCompressor;
+  m_pBaseStream->Release();
+}
+
+bool CompressingByteStream::FlushOutputBuffer()
+{
+  if (m_outputBytes == 0)
+    return true;
+
+  if (m_pBaseStream->Write(m_outputBuffer, m_outputBytes) != m_outputBytes)
+  {
+    SetErrorState();
+    return false;
+  }
+
+  m_compressedSize += (uint64)m_outputBytes;
+  m_outputBytes = 0;
+  return true;
+}
+
+bool CompressingByteStream::CompressInput(const byte* pInput, uint32 inputSize, bool finish)
+{
+  for (;;)
+  {
+    if (m_outputBytes == sizeof(m_outputBuffer) && !FlushOutputBuffer())
+      return false;
+
+    byte* pOutput = m_outputBuffer + m_outputBytes;
+    uint32 outputRemaining = sizeof(m_outputBuffer) - m_outputBytes;
+    COMPRESSION_CODEC_RESULT result = m_pCompressor->Process(&pInput, &inputSize, &pOutput, &outputRemaining, finish);
+    m_outputBytes = sizeof(m_outputBuffer) - outputRemaining;
+
+    if (result == COMPRESSION_CODEC_RESULT_STREAM_END)
+    {
+      return true;
+    }
+    else if (result == COMPRESSION_CODEC_RESULT_ERROR)
+    {
+      SetErrorState();
+      return false;
+    }
+
+    // without finish, we're done once the codec has taken all the input
+    if (!finish && inputSize == 0)
+      return true;
+  }
+}
+
+bool CompressingByteStream::Finish()
+{
+  if (m_finished)
+    return !m_errorState;
+  if (m_errorState || m_discarded)
+    return false;
+
+  m_finished = true;
+  if (!CompressInput(nullptr, 0, true) || !FlushOutputBuffer())
+    return false;
+
+  if (m_restartInterval > 0)
+  {
+    BinaryWriter binaryWriter(m_pBaseStream, ENDIAN_TYPE_LITTLE);
+    bool result = true;
+    for (uint32 i = 0; i < m_restartPoints.GetSize(); i++)
+      result &= binaryWriter.SafeWriteUInt64(m_restartPoints[i]);
+
+    result &= (binaryWriter.SafeWriteUInt64(m_position) && binaryWriter.SafeWriteUInt64(m_compressedSize) &&
+               binaryWriter.SafeWriteUInt32(m_restartInterval) &&
+               binaryWriter.SafeWriteUInt32(m_restartPoints.GetSize()) &&
+               binaryWriter.SafeWriteUInt32((uint32)m_codec) && binaryWriter.SafeWriteUInt32(RESTART_TABLE_SIGNATURE));
+
+    if (!result)
+    {
+      SetErrorState();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool CompressingByteStream::ReadByte(byte* pDestByte)
+{
+  return false;
+}
+
+uint32 CompressingByteStream::Read(void* pDestination, uint32 ByteCount)
+{
+  return 0;
+}
+
+bool CompressingByteStream::Read2(void* pDestination, uint32 ByteCount, uint32* pNumberOfBytesRead /* = nullptr */)
+{
+  if (pNumberOfBytesRead != nullptr)
+    *pNumberOfBytesRead = 0;
+
+  return false;
+}
+
+bool CompressingByteStream::WriteByte(byte SourceByte)
+{
+  return (Write(&SourceByte, 1) == 1);
+}
+
+uint32 CompressingByteStream::Write(const void* pSource, uint32 ByteCount)
+{
+  if (m_errorState || m_finished || m_discarded)
+    return 0;
+
+  const byte* pInput = reinterpret_cast<const byte*>(pSource);
+  uint32 remaining = ByteCount;
+  while (remaining > 0)
+  {
+    uint32 chunkSize = remaining;
+    if (m_restartInterval > 0)
+    {
+      // the next piece is only started once there's input for it, so the stream never ends with an empty piece
+      if (m_pieceInputSize == m_restartInterval)
+      {
+        if (!CompressInput(nullptr, 0, true))
+          break;
+
+        if (!m_pCompressor->Reset())
+        {
+          SetErrorState();
+          break;
+        }
+
+        m_restartPoints.Add(GetCompressedSize());
+        m_pieceInputSize = 0;
+      }
+
+      chunkSize = Min(chunkSize, m_restartInterval - m_pieceInputSize);
+    }
+
+    if (!CompressInput(pInput, chunkSize, false))
+      break;
+
+    pInput += chunkSize;
+    remaining -= chunkSize;
+    m_pieceInputSize += chunkSize;
+    m_position += (uint64)chunkSize;
+  }
+
+  return ByteCount - remaining;
+}
+
+bool CompressingByteStream::Write2(const void* pSource, uint32 ByteCount,
+                                   uint32* pNumberOfBytesWritten /* = nullptr */)
+{
+  uint32 r = Write(pSource, ByteCount);
+  if (pNumberOfBytesWritten != nullptr)
+    *pNumberOfBytesWritten = r;
+
+  return (r == ByteCount);
+}
+
+bool CompressingByteStream::SeekAbsolute(uint64 Offset)
+{
+  return (Offset == m_position);
+}
+
+bool CompressingByteStream::SeekRelative(int64 Offset)
+{
+  return (Offset == 0);
+}
+
+bool CompressingByteStream::SeekToEnd()
+{
+  return true;
+}
+
+uint64 CompressingByteStream::GetSize() const
+{
+  return m_position;
+}
+
+uint64 CompressingByteStream::GetPosition() const
+{
+  return m_position;
+}
+
+bool CompressingByteStream::Flush()
+{
+  if (m_errorState)
+    return false;
+
+  return (FlushOutputBuffer() && m_pBaseStream->Flush());
+}
+
+bool CompressingByteStream::Commit()
+{
+  return (Finish() && m_pBaseStream->Commit());
+}
+
+bool CompressingByteStream::Discard()
+{
+  m_discarded = true;
+  return m_pBaseStream->Discard();
+}
+
+DecompressingByteStream::DecompressingByteStream(ByteStream* pBaseStream, CompressionCodecStream* pDecompressor,
+                                                 COMPRESSION_CODEC codec, uint64 compressedSize,
+                                                 uint64 uncompressedSize, uint32 restartInterval,
+                                                 const uint64* pRestartPoints, uint32 restartPointCount)
+  : m_pBaseStream(pBaseStream), m_pDecompressor(pDecompressor), m_codec(codec),
+    m_baseOffset(pBaseStream->GetPosition()), m_compressedSize(compressedSize), m_compressedPosition(0),
+    m_size(uncompressedSize), m_restartInterval(restartInterval), m_position(0), m_inputPosition(0), m_inputBytes(0),
+    m_endOfPiece(false), m_endOfStream(false)
+{
+  DebugAssert(restartInterval == 0 || restartPointCount > 0);
+  m_pBaseStream->AddRef();
+  m_restartPoints.AddRange(pRestartPoints, restartPointCount);
+}
+
+DecompressingByteStream::~DecompressingByteStream()
+{
+  delete m_pDecompressor;
+  m_pBaseStream->Release();
+}
+
+bool DecompressingByteStream::FillInputBuffer()
+{
+  uint32 readSize = (uint32)Min((uint64)sizeof(m_inputBuffer), m_compressedSize - m_compressedPosition);
+  m_inputPosition = 0;
+  m_inputBytes = (readSize > 0) ? m_pBaseStream->Read(m_inputBuffer, readSize) : 0;
+  m_compressedPosition += (uint64)m_inputBytes;
+  return (m_inputBytes > 0);
+}
+
+bool DecompressingByteStream::RestartAt(uint32 restartPointIndex)
+{
+  uint64 compressedOffset = (m_restartPoints.GetSize() > 0) ? m_restartPoints[restartPointIndex] : 0;
+  if (!m_pBaseStream->SeekAbsolute(m_baseOffset + compressedOffset) || !m_pDecompressor->Reset())
+    return false;
+
+  m_compressedPosition = compressedOffset;
+  m_position = (uint64)restartPointIndex * (uint64)m_restartInterval;
+  m_inputPosition = 0;
+  m_inputBytes = 0;
+  m_endOfPiece = false;
+  m_endOfStream = false;
+  return true;
+}
+
+bool DecompressingByteStream::Skip(uint64 byteCount)
+{
+  byte discardBuffer[4096];
+  while (byteCount > 0)
+  {
+    uint32 readSize = (uint32)Min(byteCount, (uint64)sizeof(discardBuffer));
+    uint32 bytesRead = Read(discardBuffer, readSize);
+    byteCount -= (uint64)bytesRead;
+    if (bytesRead != readSize)
+      return false;
+  }
+
+  return true;
+}
+
+bool DecompressingByteStream::ReadByte(byte* pDestByte)
+{
+  return (Read(pDestByte, 1) == 1);
+}
+
+uint32 DecompressingByteStream::Read(void* pDestination, uint32 ByteCount)
+{
+  byte* pOutput = reinterpret_cast<byte*>(pDestination);
+  uint32 outputRemaining = ByteCount;
+  while (outputRemaining > 0 && !m_endOfStream && !m_errorState)
+  {
+    if (m_inputPosition == m_inputBytes)
+      FillInputBuffer();
+
+    if (m_endOfPiece)
+    {
+      // another piece follows if there's any data left, otherwise that was the end of the stream
+      if (m_inputPosition == m_inputBytes)
+      {
+        m_endOfStream = true;
+        m_size = m_position;
+        break;
+      }
+
+      if (!m_pDecompressor->Reset())
+      {
+        SetErrorState();
+        break;
+      }
+
+      m_endOfPiece = false;
+    }
+
+    const byte* pInput = m_inputBuffer + m_inputPosition;
+    uint32 inputRemaining = m_inputBytes - m_inputPosition;
+    uint32 outputBefore = outputRemaining;
+    COMPRESSION_CODEC_RESULT result =
+      m_pDecompressor->Process(&pInput, &inputRemaining, &pOutput, &outputRemaining, false);
+    m_inputPosition = m_inputBytes - inputRemaining;
+    m_position += (uint64)(outputBefore - outputRemaining);
+
+    if (result == COMPRESSION_CODEC_RESULT_STREAM_END)
+    {
+      m_endOfPiece = true;
+    }
+    else if (result == COMPRESSION_CODEC_RESULT_ERROR)
+    {
+      // corrupt data, or the input running out part way through a piece
+      Log_ErrorPrintf("DecompressingByteStream::Read: Failed to decompress %s data at compressed offset %llu",
+                      CompressionCodec::GetName(m_codec),
+                      (unsigned long long)(m_compressedPosition - (m_inputBytes - m_inputPosition)));
+      SetErrorState();
+      break;
+    }
+  }
+
+  return ByteCount - outputRemaining;
+}
+
+bool DecompressingByteStream::Read2(void* pDestination, uint32 ByteCount, uint32* pNumberOfBytesRead /* = nullptr */)
+{
+  uint32 r = Read(pDestination, ByteCount);
+  if (pNumberOfBytesRead != nullptr)
+    *pNumberOfBytesRead = r;
+
+  return (r == ByteCount);
+}
+
+bool DecompressingByteStream::WriteByte(byte SourceByte)
+{
+  return false;
+}
+
+uint32 DecompressingByteStream::Write(const void* pSource, uint32 ByteCount)
+{
+  return 0;
+}
+
+bool DecompressingByteStream::Write2(const void* pSource, uint32 ByteCount,
+                                     uint32* pNumberOfBytesWritten /* = nullptr */)
+{
+  if (pNumberOfBytesWritten != nullptr)
+    *pNumberOfBytesWritten = 0;
+
+  return false;
+}
+
+bool DecompressingByteStream::SeekAbsolute(uint64 Offset)
+{
+  if (Offset == m_position)
+    return true;
+  if (m_size != UNKNOWN_SIZE && Offset > m_size)
+    return false;
+
+  // start again from the restart point at or before the target if it's behind us, or past the piece we're in
+  uint32 restartPointIndex = 0;
+  if (m_restartInterval > 0)
+    restartPointIndex = (uint32)Min(Offset / m_restartInterval, (uint64)(m_restartPoints.GetSize() - 1));
+
+  uint64 restartPosition = (uint64)restartPointIndex * (uint64)m_restartInterval;
+  if ((Offset < m_position || restartPosition > m_position) && !RestartAt(restartPointIndex))
+    return false;
+
+  return Skip(Offset - m_position);
+}
+
+bool DecompressingByteStream::SeekRelative(int64 Offset)
+{
+  if (Offset < 0 && (uint64)-Offset > m_position)
+    return false;
+
+  return SeekAbsolute((uint64)((int64)m_position + Offset));
+}
+
+bool DecompressingByteStream::SeekToEnd()
+{
+  if (m_size != UNKNOWN_SIZE)
+    return SeekAbsolute(m_size);
+
+  // size isn't known until we get there
+  while (Skip(0xFFFFFFFFULL))
+    ;
+
+  return (m_endOfStream && !m_errorState);
+}
+
+uint64 DecompressingByteStream::GetSize() const
+{
+  return (m_size != UNKNOWN_SIZE) ? m_size : 0;
+}
+
+uint64 DecompressingByteStream::GetPosition() const
+{
+  return m_position;
+}
+
+bool DecompressingByteStream::Flush()
+{
+  return false;
+}
+
+bool DecompressingByteStream::Commit()
+{
+  return false;
+}
+
+bool DecompressingByteStream::Discard()
+{
+  return false;
+}
+
+CompressingByteStream* ByteStream_CreateCompressingStream(ByteStream* pBaseStream, COMPRESSION_CODEC codec,
+                                                          uint32 compressionLevel, uint32 restartInterval /* = 0 */)
+{
+  CompressionCodecStream* pCompressor = CompressionCodec::CreateCompressor(codec, compressionLevel);
+  if (pCompressor == nullptr)
+    return nullptr;
+
+  return new CompressingByteStream(pBaseStream, pCompressor, codec, restartInterval);
+}
+
+DecompressingByteStream* ByteStream_CreateDecompressingStream(ByteStream* pBaseStream, COMPRESSION_CODEC codec)
+{
+  CompressionCodecStream* pDecompressor = CompressionCodec::CreateDecompressor(codec);
+  if (pDecompressor == nullptr)
+    return nullptr;
+
+  return new DecompressingByteStream(pBaseStream, pDecompressor, codec, UNKNOWN_SIZE, UNKNOWN_SIZE, 0, nullptr, 0);
+}
+
+DecompressingByteStream* ByteStream_OpenSeekableDecompressingStream(ByteStream* pBaseStream)
+{
+  uint64 streamSize = pBaseStream->GetSize();
+  if (streamSize < RESTART_TABLE_FOOTER_SIZE || !pBaseStream->SeekAbsolute(streamSize - RESTART_TABLE_FOOTER_SIZE))
+    return nullptr;
+
+  BinaryReader binaryReader(pBaseStream, ENDIAN_TYPE_LITTLE);
+  uint64 uncompressedSize, compressedSize;
+  uint32 restartInterval, restartPointCount, codec, signature;
+  if (!binaryReader.SafeReadUInt64(&uncompressedSize) || !binaryReader.SafeReadUInt64(&compressedSize) ||
+      !binaryReader.SafeReadUInt32(&restartInterval) || !binaryReader.SafeReadUInt32(&restartPointCount) ||
+      !binaryReader.SafeReadUInt32(&codec) || !binaryReader.SafeReadUInt32(&signature))
+  {
+    return nullptr;
+  }
+
+  // every piece but the last is full, and the last has at least one byte unless the stream is empty
+  uint64 expectedRestartPointCount = (uncompressedSize + restartInterval - 1) / Max(restartInterval, 1u);
+  uint64 tableSize = (uint64)restartPointCount * sizeof(uint64) + RESTART_TABLE_FOOTER_SIZE;
+  if (signature != RESTART_TABLE_SIGNATURE || codec >= COMPRESSION_CODEC_COUNT || restartInterval == 0 ||
+      restartPointCount != Max(expectedRestartPointCount, (uint64)1) || tableSize > streamSize ||
+      compressedSize > streamSize - tableSize)
+  {
+    Log_ErrorPrintf("ByteStream_OpenSeekableDecompressingStream: Restart table is missing or corrupted");
+    return nullptr;
+  }
+
+  uint64 dataOffset = streamSize - tableSize - compressedSize;
+  PODArray<uint64> restartPoints;
+  restartPoints.Resize(restartPointCount);
+  if (!pBaseStream->SeekAbsolute(dataOffset + compressedSize))
+    return nullptr;
+
+  for (uint32 i = 0; i < restartPointCount; i++)
+  {
+    if (!binaryReader.SafeReadUInt64(&restartPoints[i]) || restartPoints[i] >= Max(compressedSize, (uint64)1) ||
+        (i > 0 && restartPoints[i] <= restartPoints[i - 1]) || (i == 0 && restartPoints[i] != 0))
+    {
+      Log_ErrorPrintf("ByteStream_OpenSeekableDecompressingStream: Restart table is missing or corrupted");
+      return nullptr;
+    }
+  }
+
+  CompressionCodecStream* pDecompressor = CompressionCodec::CreateDecompressor((COMPRESSION_CODEC)codec);
+  if (pDecompressor == nullptr)
+  {
+    Log_ErrorPrintf("ByteStream_OpenSeekableDecompressingStream: Codec '%s' is not available",
+                    CompressionCodec::GetName((COMPRESSION_CODEC)codec));
+    return nullptr;
+  }
+
+  if (!pBaseStream->SeekAbsolute(dataOffset))
+  {
+    delete pDecompressor;
+    return nullptr;
+  }
+
+  return new DecompressingByteStream(pBaseStream, pDecompressor, (COMPRESSION_CODEC)codec, compressedSize,
+                                     uncompressedSize, restartInterval, restartPoints.GetBasePointer(),
+                                     restartPointCount);
+}
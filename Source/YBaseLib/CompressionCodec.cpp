@@ -0,0 +1,602 @@
+#include "YBaseLib/CompressionCodec.h"
+#include "YBaseLib/Assert.h"
+#include "YBaseLib/Memory.h"
+#include <cstring>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#if Y_COMPILER_MSVC
+#pragma comment(lib, "zdll.lib")
+#endif
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#if Y_COMPILER_MSVC
+#pragma comment(lib, "libzstd.lib")
+#endif
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#if Y_COMPILER_MSVC
+#pragma comment(lib, "liblz4.lib")
+#endif
+#endif
+
+#ifdef HAVE_ZLIB
+
+class DeflateCompressionCodecStream : public CompressionCodecStream
+{
+public:
+  DeflateCompressionCodecStream(bool compress) : m_compress(compress), m_initialized(false)
+  {
+    Y_memzero(&m_zStream, sizeof(m_zStream));
+  }
+
+  ~DeflateCompressionCodecStream()
+  {
+    if (m_initialized)
+    {
+      if (m_compress)
+        deflateEnd(&m_zStream);
+      else
+        inflateEnd(&m_zStream);
+    }
+  }
+
+  bool Initialize(uint32 compressionLevel)
+  {
+    if (m_compress)
+      m_initialized = (deflateInit2(&m_zStream, (int)compressionLevel, Z_DEFLATED, -MAX_WBITS, 8,
+                                    Z_DEFAULT_STRATEGY) == Z_OK);
+    else
+      m_initialized = (inflateInit2(&m_zStream, -MAX_WBITS) == Z_OK);
+
+    return m_initialized;
+  }
+
+  virtual COMPRESSION_CODEC_RESULT Process(const byte** ppInput, uint32* pInputSize, byte** ppOutput,
+                                           uint32* pOutputSize, bool finish) override
+  {
+    m_zStream.next_in = (Bytef*)*ppInput;
+    m_zStream.avail_in = *pInputSize;
+    m_zStream.next_out = (Bytef*)*ppOutput;
+    m_zStream.avail_out = *pOutputSize;
+
+    int err = (m_compress) ? deflate(&m_zStream, (finish) ? Z_FINISH : Z_NO_FLUSH) : inflate(&m_zStream, Z_NO_FLUSH);
+
+    *ppInput = (const byte*)m_zStream.next_in;
+    *pInputSize = m_zStream.avail_in;
+    *ppOutput = (byte*)m_zStream.next_out;
+    *pOutputSize = m_zStream.avail_out;
+
+    // Z_BUF_ERROR is zlib's no-progress result
+    if (err == Z_STREAM_END)
+      return COMPRESSION_CODEC_RESULT_STREAM_END;
+    else if (err == Z_OK)
+      return COMPRESSION_CODEC_RESULT_OK;
+    else
+      return COMPRESSION_CODEC_RESULT_ERROR;
+  }
+
+  virtual bool Reset() override
+  {
+    if (m_compress)
+      return (deflateReset(&m_zStream) == Z_OK);
+    else
+      return (inflateReset(&m_zStream) == Z_OK);
+  }
+
+private:
+  z_stream m_zStream;
+  bool m_compress;
+  bool m_initialized;
+};
+
+#endif // HAVE_ZLIB
+
+#ifdef HAVE_ZSTD
+
+class ZstdCompressorStream : public CompressionCodecStream
+{
+public:
+  ZstdCompressorStream() : m_pContext(ZSTD_createCCtx()) {}
+  ~ZstdCompressorStream() { ZSTD_freeCCtx(m_pContext); }
+
+  bool Initialize(uint32 compressionLevel)
+  {
+    return (m_pContext != NULL &&
+            !ZSTD_isError(ZSTD_CCtx_setParameter(m_pContext, ZSTD_c_compressionLevel, (int)compressionLevel)));
+  }
+
+  virtual COMPRESSION_CODEC_RESULT Process(const byte** ppInput, uint32* pInputSize, byte** ppOutput,
+                                           uint32* pOutputSize, bool finish) override
+  {
+    ZSTD_inBuffer input = {*ppInput, *pInputSize, 0};
+    ZSTD_outBuffer output = {*ppOutput, *pOutputSize, 0};
+    size_t remaining = ZSTD_compressStream2(m_pContext, &output, &input, (finish) ? ZSTD_e_end : ZSTD_e_continue);
+
+    *ppInput += input.pos;
+    *pInputSize -= (uint32)input.pos;
+    *ppOutput += output.pos;
+    *pOutputSize -= (uint32)output.pos;
+
+    if (ZSTD_isError(remaining))
+      return COMPRESSION_CODEC_RESULT_ERROR;
+    else if (finish && remaining == 0)
+      return COMPRESSION_CODEC_RESULT_STREAM_END;
+    else if (input.pos == 0 && output.pos == 0)
+      return COMPRESSION_CODEC_RESULT_ERROR;
+    else
+      return COMPRESSION_CODEC_RESULT_OK;
+  }
+
+  virtual bool Reset() override
+  {
+    return !ZSTD_isError(ZSTD_CCtx_reset(m_pContext, ZSTD_reset_session_only));
+  }
+
+private:
+  ZSTD_CCtx* m_pContext;
+};
+
+class ZstdDecompressorStream : public CompressionCodecStream
+{
+public:
+  ZstdDecompressorStream() : m_pContext(ZSTD_createDCtx()) {}
+  ~ZstdDecompressorStream() { ZSTD_freeDCtx(m_pContext); }
+
+  bool Initialize() { return (m_pContext != NULL); }
+
+  virtual COMPRESSION_CODEC_RESULT Process(const byte** ppInput, uint32* pInputSize, byte** ppOutput,
+                                           uint32* pOutputSize, bool finish) override
+  {
+    ZSTD_inBuffer input = {*ppInput, *pInputSize, 0};
+    ZSTD_outBuffer output = {*ppOutput, *pOutputSize, 0};
+    size_t hint = ZSTD_decompressStream(m_pContext, &output, &input);
+
+    *ppInput += input.pos;
+    *pInputSize -= (uint32)input.pos;
+    *ppOutput += output.pos;
+    *pOutputSize -= (uint32)output.pos;
+
+    // a zero hint is the end of the frame
+    if (ZSTD_isError(hint))
+      return COMPRESSION_CODEC_RESULT_ERROR;
+    else if (hint == 0)
+      return COMPRESSION_CODEC_RESULT_STREAM_END;
+    else if (input.pos == 0 && output.pos == 0)
+      return COMPRESSION_CODEC_RESULT_ERROR;
+    else
+      return COMPRESSION_CODEC_RESULT_OK;
+  }
+
+  virtual bool Reset() override
+  {
+    return !ZSTD_isError(ZSTD_DCtx_reset(m_pContext, ZSTD_reset_session_only));
+  }
+
+private:
+  ZSTD_DCtx* m_pContext;
+};
+
+#endif // HAVE_ZSTD
+
+#ifdef HAVE_LZ4
+
+// input is fed to lz4 in pieces of this size, so the staging buffer's worst case is bounded
+static const uint32 LZ4_COMPRESSOR_INPUT_CHUNK_SIZE = 64 * 1024;
+
+static void GetLZ4Preferences(LZ4F_preferences_t* pPreferences, uint32 compressionLevel)
+{
+  Y_memzero(pPreferences, sizeof(LZ4F_preferences_t));
+  pPreferences->frameInfo.blockSizeID = LZ4F_max64KB;
+  pPreferences->frameInfo.blockMode = LZ4F_blockLinked;
+  pPreferences->frameInfo.contentChecksumFlag = LZ4F_noContentChecksum;
+  pPreferences->compressionLevel = (int)compressionLevel;
+}
+
+// LZ4F_compressUpdate needs room for the worst case of its input up front, so output goes through a staging buffer
+// which is drained into whatever space the caller provides
+class LZ4CompressorStream : public CompressionCodecStream
+{
+public:
+  LZ4CompressorStream()
+    : m_pContext(NULL), m_pStagingBuffer(NULL), m_stagingBufferSize(0), m_stagingPosition(0), m_stagingBytes(0),
+      m_begun(false), m_ended(false)
+  {
+  }
+
+  ~LZ4CompressorStream()
+  {
+    if (m_pContext != NULL)
+      LZ4F_freeCompressionContext(m_pContext);
+
+    delete[] m_pStagingBuffer;
+  }
+
+  bool Initialize(uint32 compressionLevel)
+  {
+    if (LZ4F_isError(LZ4F_createCompressionContext(&m_pContext, LZ4F_VERSION)))
+    {
+      m_pContext = NULL;
+      return false;
+    }
+
+    GetLZ4Preferences(&m_preferences, compressionLevel);
+    m_stagingBufferSize =
+      (uint32)LZ4F_compressBound(LZ4_COMPRESSOR_INPUT_CHUNK_SIZE, &m_preferences) + LZ4F_HEADER_SIZE_MAX;
+    m_pStagingBuffer = new byte[m_stagingBufferSize];
+    return true;
+  }
+
+  virtual COMPRESSION_CODEC_RESULT Process(const byte** ppInput, uint32* pInputSize, byte** ppOutput,
+                                           uint32* pOutputSize, bool finish) override
+  {
+    bool madeProgress = false;
+    for (;;)
+    {
+      // drain whatever lz4 has already produced first
+      if (m_stagingBytes > 0)
+      {
+        uint32 copySize = Min(m_stagingBytes, *pOutputSize);
+        std::memcpy(*ppOutput, m_pStagingBuffer + m_stagingPosition, copySize);
+        *ppOutput += copySize;
+        *pOutputSize -= copySize;
+        m_stagingPosition += copySize;
+        m_stagingBytes -= copySize;
+        madeProgress |= (copySize > 0);
+        if (m_stagingBytes > 0)
+          break;
+      }
+
+      size_t result;
+      if (!m_begun)
+      {
+        result = LZ4F_compressBegin(m_pContext, m_pStagingBuffer, m_stagingBufferSize, &m_preferences);
+        m_begun = true;
+      }
+      else if (*pInputSize > 0)
+      {
+        uint32 chunkSize = Min(*pInputSize, LZ4_COMPRESSOR_INPUT_CHUNK_SIZE);
+        result = LZ4F_compressUpdate(m_pContext, m_pStagingBuffer, m_stagingBufferSize, *ppInput, chunkSize, NULL);
+        *ppInput += chunkSize;
+        *pInputSize -= chunkSize;
+        madeProgress = true;
+      }
+      else if (finish && !m_ended)
+      {
+        result = LZ4F_compressEnd(m_pContext, m_pStagingBuffer, m_stagingBufferSize, NULL);
+        m_ended = true;
+      }
+      else
+      {
+        break;
+      }
+
+      if (LZ4F_isError(result))
+        return COMPRESSION_CODEC_RESULT_ERROR;
+
+      m_stagingPosition = 0;
+      m_stagingBytes = (uint32)result;
+    }
+
+    if (m_ended && m_stagingBytes == 0)
+      return COMPRESSION_CODEC_RESULT_STREAM_END;
+
+    return (madeProgress) ? COMPRESSION_CODEC_RESULT_OK : COMPRESSION_CODEC_RESULT_ERROR;
+  }
+
+  // LZ4F_compressBegin reinitializes the context, so the next frame just has to be started
+  virtual bool Reset() override
+  {
+    m_stagingPosition = 0;
+    m_stagingBytes = 0;
+    m_begun = false;
+    m_ended = false;
+    return true;
+  }
+
+private:
+  LZ4F_cctx* m_pContext;
+  LZ4F_preferences_t m_preferences;
+  byte* m_pStagingBuffer;
+  uint32 m_stagingBufferSize;
+  uint32 m_stagingPosition;
+  uint32 m_stagingBytes;
+  bool m_begun;
+  bool m_ended;
+};
+
+class LZ4DecompressorStream : public CompressionCodecStream
+{
+public:
+  LZ4DecompressorStream() : m_pContext(NULL) {}
+
+  ~LZ4DecompressorStream()
+  {
+    if (m_pContext != NULL)
+      LZ4F_freeDecompressionContext(m_pContext);
+  }
+
+  bool Initialize()
+  {
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&m_pContext, LZ4F_VERSION)))
+    {
+      m_pContext = NULL;
+      return false;
+    }
+
+    return true;
+  }
+
+  virtual COMPRESSION_CODEC_RESULT Process(const byte** ppInput, uint32* pInputSize, byte** ppOutput,
+                                           uint32* pOutputSize, bool finish) override
+  {
+    size_t inputSize = *pInputSize;
+    size_t outputSize = *pOutputSize;
+    size_t hint = LZ4F_decompress(m_pContext, *ppOutput, &outputSize, *ppInput, &inputSize, NULL);
+
+    *ppInput += inputSize;
+    *pInputSize -= (uint32)inputSize;
+    *ppOutput += outputSize;
+    *pOutputSize -= (uint32)outputSize;
+
+    // a zero hint is the end of the frame
+    if (LZ4F_isError(hint))
+      return COMPRESSION_CODEC_RESULT_ERROR;
+    else if (hint == 0)
+      return COMPRESSION_CODEC_RESULT_STREAM_END;
+    else if (inputSize == 0 && outputSize == 0)
+      return COMPRESSION_CODEC_RESULT_ERROR;
+    else
+      return COMPRESSION_CODEC_RESULT_OK;
+  }
+
+  virtual bool Reset() override
+  {
+    LZ4F_resetDecompressionContext(m_pContext);
+    return true;
+  }
+
+private:
+  LZ4F_dctx* m_pContext;
+};
+
+#endif // HAVE_LZ4
+
+namespace CompressionCodec {
+
+bool IsAvailable(COMPRESSION_CODEC codec)
+{
+  switch (codec)
+  {
+#ifdef HAVE_ZLIB
+    case COMPRESSION_CODEC_DEFLATE:
+      return true;
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESSION_CODEC_ZSTD:
+      return true;
+#endif
+#ifdef HAVE_LZ4
+    case COMPRESSION_CODEC_LZ4:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+const char* GetName(COMPRESSION_CODEC codec)
+{
+  static const char* codecNames[COMPRESSION_CODEC_COUNT] = {"deflate", "zstd", "lz4"};
+  return ((uint32)codec < COMPRESSION_CODEC_COUNT) ? codecNames[codec] : "unknown";
+}
+
+uint32 GetDefaultCompressionLevel(COMPRESSION_CODEC codec)
+{
+  static const uint32 defaultLevels[COMPRESSION_CODEC_COUNT] = {6, 3, 1};
+  return ((uint32)codec < COMPRESSION_CODEC_COUNT) ? defaultLevels[codec] : 0;
+}
+
+uint32 GetMaxCompressionLevel(COMPRESSION_CODEC codec)
+{
+  static const uint32 maxLevels[COMPRESSION_CODEC_COUNT] = {9, 22, 12};
+  return ((uint32)codec < COMPRESSION_CODEC_COUNT) ? maxLevels[codec] : 0;
+}
+
+// deflate 0 would store and zstd 0 means its default, so neither is let through
+static uint32 ClampCompressionLevel(COMPRESSION_CODEC codec, uint32 compressionLevel)
+{
+  static const uint32 minLevels[COMPRESSION_CODEC_COUNT] = {1, 1, 0};
+  uint32 minLevel = ((uint32)codec < COMPRESSION_CODEC_COUNT) ? minLevels[codec] : 0;
+  return Max(minLevel, Min(compressionLevel, GetMaxCompressionLevel(codec)));
+}
+
+CompressionCodecStream* CreateCompressor(COMPRESSION_CODEC codec, uint32 compressionLevel)
+{
+  compressionLevel = ClampCompressionLevel(codec, compressionLevel);
+  switch (codec)
+  {
+#ifdef HAVE_ZLIB
+    case COMPRESSION_CODEC_DEFLATE:
+    {
+      DeflateCompressionCodecStream* pStream = new DeflateCompressionCodecStream(true);
+      if (pStream->Initialize(compressionLevel))
+        return pStream;
+
+      delete pStream;
+      return NULL;
+    }
+#endif
+
+#ifdef HAVE_ZSTD
+    case COMPRESSION_CODEC_ZSTD:
+    {
+      ZstdCompressorStream* pStream = new ZstdCompressorStream();
+      if (pStream->Initialize(compressionLevel))
+        return pStream;
+
+      delete pStream;
+      return NULL;
+    }
+#endif
+
+#ifdef HAVE_LZ4
+    case COMPRESSION_CODEC_LZ4:
+    {
+      LZ4CompressorStream* pStream = new LZ4CompressorStream();
+      if (pStream->Initialize(compressionLevel))
+        return pStream;
+
+      delete pStream;
+      return NULL;
+    }
+#endif
+
+    default:
+      return NULL;
+  }
+}
+
+CompressionCodecStream* CreateDecompressor(COMPRESSION_CODEC codec)
+{
+  switch (codec)
+  {
+#ifdef HAVE_ZLIB
+    case COMPRESSION_CODEC_DEFLATE:
+    {
+      DeflateCompressionCodecStream* pStream = new DeflateCompressionCodecStream(false);
+      if (pStream->Initialize(0))
+        return pStream;
+
+      delete pStream;
+      return NULL;
+    }
+#endif
+
+#ifdef HAVE_ZSTD
+    case COMPRESSION_CODEC_ZSTD:
+    {
+      ZstdDecompressorStream* pStream = new ZstdDecompressorStream();
+      if (pStream->Initialize())
+        return pStream;
+
+      delete pStream;
+      return NULL;
+    }
+#endif
+
+#ifdef HAVE_LZ4
+    case COMPRESSION_CODEC_LZ4:
+    {
+      LZ4DecompressorStream* pStream = new LZ4DecompressorStream();
+      if (pStream->Initialize())
+        return pStream;
+
+      delete pStream;
+      return NULL;
+    }
+#endif
+
+    default:
+      return NULL;
+  }
+}
+
+uint32 GetCompressedBufferUpperBounds(COMPRESSION_CODEC codec, uint32 cbSourceBuffer, uint32 compressionLevel)
+{
+  compressionLevel = ClampCompressionLevel(codec, compressionLevel);
+  switch (codec)
+  {
+#ifdef HAVE_ZLIB
+    case COMPRESSION_CODEC_DEFLATE:
+    {
+      z_stream zStream;
+      Y_memzero(&zStream, sizeof(zStream));
+      if (deflateInit2(&zStream, (int)compressionLevel, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return cbSourceBuffer * 2 + 64;
+
+      uint32 nBytes = (uint32)deflateBound(&zStream, cbSourceBuffer);
+      deflateEnd(&zStream);
+      return nBytes;
+    }
+#endif
+
+#ifdef HAVE_ZSTD
+    case COMPRESSION_CODEC_ZSTD:
+      return (uint32)ZSTD_compressBound(cbSourceBuffer);
+#endif
+
+#ifdef HAVE_LZ4
+    case COMPRESSION_CODEC_LZ4:
+    {
+      LZ4F_preferences_t preferences;
+      GetLZ4Preferences(&preferences, compressionLevel);
+      return (uint32)LZ4F_compressFrameBound(cbSourceBuffer, &preferences);
+    }
+#endif
+
+    default:
+      return 0;
+  }
+}
+
+bool WriteCompressedDataToBuffer(COMPRESSION_CODEC codec, void* pDestinationBuffer, uint32 cbDestinationBuffer,
+                                 uint32* pCompressedSize, const void* pSourceBuffer, uint32 cbSourceBuffer,
+                                 uint32 compressionLevel)
+{
+  CompressionCodecStream* pCompressor = CreateCompressor(codec, compressionLevel);
+  if (pCompressor == NULL)
+    return false;
+
+  const byte* pInput = reinterpret_cast<const byte*>(pSourceBuffer);
+  uint32 inputSize = cbSourceBuffer;
+  byte* pOutput = reinterpret_cast<byte*>(pDestinationBuffer);
+  uint32 outputSize = cbDestinationBuffer;
+  COMPRESSION_CODEC_RESULT result;
+  do
+  {
+    result = pCompressor->Process(&pInput, &inputSize, &pOutput, &outputSize, true);
+  } while (result == COMPRESSION_CODEC_RESULT_OK);
+
+  delete pCompressor;
+  if (result != COMPRESSION_CODEC_RESULT_STREAM_END)
+    return false;
+
+  if (pCompressedSize != NULL)
+    *pCompressedSize = cbDestinationBuffer - outputSize;
+
+  return true;
+}
+
+bool ReadCompressedDataFromBuffer(COMPRESSION_CODEC codec, void* pDestinationBuffer, uint32 cbDestinationBuffer,
+                                  uint32* pDecompressedSize, const void* pSourceBuffer, uint32 cbSourceBuffer)
+{
+  CompressionCodecStream* pDecompressor = CreateDecompressor(codec);
+  if (pDecompressor == NULL)
+    return false;
+
+  const byte* pInput = reinterpret_cast<const byte*>(pSourceBuffer);
+  uint32 inputSize = cbSourceBuffer;
+  byte* pOutput = reinterpret_cast<byte*>(pDestinationBuffer);
+  uint32 outputSize = cbDestinationBuffer;
+  COMPRESSION_CODEC_RESULT result;
+  do
+  {
+    result = pDecompressor->Process(&pInput, &inputSize, &pOutput, &outputSize, true);
+  } while (result == COMPRESSION_CODEC_RESULT_OK);
+
+  delete pDecompressor;
+  if (result != COMPRESSION_CODEC_RESULT_STREAM_END)
+    return false;
+
+  if (pDecompressedSize != NULL)
+    *pDecompressedSize = cbDestinationBuffer - outputSize;
+
+  return true;
+}
+
+} // namespace CompressionCodec
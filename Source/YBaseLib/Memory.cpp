@@ -590,7 +590,7 @@ bool Y_bitscanforward(uint64 mask, uint64* index)
   if (mask == 0)
     return false;
 
-  *index = __builtin_ctz(mask);
+  *index = __builtin_ctzll(mask);
   return true;
 #else
   if ((uint32)mask != 0)
@@ -622,7 +622,7 @@ bool Y_bitscanreverse(uint64 mask, uint64* index)
   if (mask == 0)
     return false;
 
-  *index = 63u - __builtin_clz(mask);
+  *index = 63u - __builtin_clzll(mask);
   return true;
 #else
   if ((uint32)(mask >> 32) != 0)
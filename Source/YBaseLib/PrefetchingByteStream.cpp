@@ -0,0 +1,294 @@
+#include "YBaseLib/PrefetchingByteStream.h"
+#include "YBaseLib/Assert.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/Memory.h"
+#include "YBaseLib/MutexLock.h"
+#include "YBaseLib/ThreadPool.h"
+#include <cstring>
+Log_SetChannel(PrefetchingByteStream);
+
+class PrefetchingByteStreamFillWorkItem : public ThreadPoolWorkItem
+{
+public:
+  PrefetchingByteStreamFillWorkItem(PrefetchingByteStream* pStream) : m_pStream(pStream) {}
+
+protected:
+  virtual int32 ProcessWork() override
+  {
+    m_pStream->FillChunks();
+    return 0;
+  }
+
+private:
+  PrefetchingByteStream* m_pStream;
+};
+
+PrefetchingByteStream::PrefetchingByteStream(ByteStream* pBaseStream, uint32 chunkSize, uint32 chunkCount,
+                                             ThreadPool* pThreadPool)
+  : m_pBaseStream(pBaseStream), m_pThreadPool(pThreadPool), m_ownsThreadPool(false), m_chunkSize(chunkSize),
+    m_chunkCount(chunkCount), m_headChunk(0), m_filledChunks(0), m_headChunkPosition(0), m_fillerActive(false),
+    m_stopRequested(false), m_endOfStream(false)
+{
+  DebugAssert(chunkSize > 0 && chunkCount > 0);
+  m_pBaseStream->AddRef();
+
+  if (m_pThreadPool == nullptr)
+  {
+    m_pThreadPool = new ThreadPool(1);
+    m_ownsThreadPool = true;
+  }
+
+  m_ppChunkBuffers = new byte*[m_chunkCount];
+  m_pChunkSizes = new uint32[m_chunkCount];
+  for (uint32 i = 0; i < m_chunkCount; i++)
+  {
+    m_ppChunkBuffers[i] = new byte[m_chunkSize];
+    m_pChunkSizes[i] = 0;
+  }
+
+  // size is sampled once, as the worker may be inside the base stream when it's asked for
+  m_position = m_fetchPosition = m_pBaseStream->GetPosition();
+  m_size = m_pBaseStream->GetSize();
+}
+
+PrefetchingByteStream::~PrefetchingByteStream()
+{
+  m_lock.Lock();
+  StopFillerLocked();
+  m_lock.Unlock();
+
+  if (m_ownsThreadPool)
+    delete m_pThreadPool;
+
+  for (uint32 i = 0; i < m_chunkCount; i++)
+    delete[] m_ppChunkBuffers[i];
+  delete[] m_pChunkSizes;
+  delete[] m_ppChunkBuffers;
+
+  m_pBaseStream->Release();
+}
+
+void PrefetchingByteStream::FillChunks()
+{
+  m_lock.Lock();
+
+  while (!m_stopRequested && !m_endOfStream && m_filledChunks < m_chunkCount)
+  {
+    // the consumer never touches chunks outside the filled range, so the read itself can happen unlocked
+    uint32 chunkIndex = (m_headChunk + m_filledChunks) % m_chunkCount;
+    m_lock.Unlock();
+
+    uint32 bytesRead = m_pBaseStream->Read(m_ppChunkBuffers[chunkIndex], m_chunkSize);
+
+    m_lock.Lock();
+    m_pChunkSizes[chunkIndex] = bytesRead;
+    m_fetchPosition += bytesRead;
+    if (bytesRead < m_chunkSize)
+    {
+      m_endOfStream = true;
+      if (m_pBaseStream->InErrorState())
+        SetErrorState();
+    }
+
+    if (bytesRead > 0)
+      m_filledChunks++;
+
+    m_condition.WakeAll();
+  }
+
+  m_fillerActive = false;
+  m_condition.WakeAll();
+  m_lock.Unlock();
+}
+
+void PrefetchingByteStream::StartFillerLocked()
+{
+  if (m_fillerActive || m_endOfStream || m_filledChunks == m_chunkCount)
+    return;
+
+  m_fillerActive = true;
+
+  PrefetchingByteStreamFillWorkItem* pWorkItem = new PrefetchingByteStreamFillWorkItem(this);
+  m_pThreadPool->EnqueueWorkItem(pWorkItem);
+  pWorkItem->Release();
+}
+
+void PrefetchingByteStream::StopFillerLocked()
+{
+  m_stopRequested = true;
+  while (m_fillerActive)
+    m_condition.SleepAndRelease(&m_lock);
+  m_stopRequested = false;
+}
+
+void PrefetchingByteStream::AdvanceChunkLocked()
+{
+  DebugAssert(m_filledChunks > 0);
+  m_headChunk = (m_headChunk + 1) % m_chunkCount;
+  m_headChunkPosition = 0;
+  m_filledChunks--;
+}
+
+bool PrefetchingByteStream::ReadByte(byte* pDestByte)
+{
+  return (Read(pDestByte, 1) == 1);
+}
+
+uint32 PrefetchingByteStream::Read(void* pDestination, uint32 ByteCount)
+{
+  byte* pDestinationBytes = reinterpret_cast<byte*>(pDestination);
+  uint32 bytesRead = 0;
+
+  m_lock.Lock();
+  while (bytesRead < ByteCount)
+  {
+    if (m_filledChunks == 0)
+    {
+      StartFillerLocked();
+      while (m_filledChunks == 0 && m_fillerActive)
+        m_condition.SleepAndRelease(&m_lock);
+
+      if (m_filledChunks == 0)
+        break;
+    }
+
+    // copy out of the head chunk without holding the lock, the worker won't write to it
+    uint32 chunkIndex = m_headChunk;
+    uint32 chunkPosition = m_headChunkPosition;
+    uint32 copySize = Min(ByteCount - bytesRead, m_pChunkSizes[chunkIndex] - chunkPosition);
+    m_lock.Unlock();
+
+    std::memcpy(pDestinationBytes + bytesRead, m_ppChunkBuffers[chunkIndex] + chunkPosition, copySize);
+    bytesRead += copySize;
+
+    m_lock.Lock();
+    m_position += copySize;
+    m_headChunkPosition += copySize;
+    if (m_headChunkPosition == m_pChunkSizes[chunkIndex])
+    {
+      // hand the chunk back to the worker as soon as possible
+      AdvanceChunkLocked();
+      StartFillerLocked();
+    }
+  }
+  m_lock.Unlock();
+
+  return bytesRead;
+}
+
+bool PrefetchingByteStream::Read2(void* pDestination, uint32 ByteCount, uint32* pNumberOfBytesRead /* = nullptr */)
+{
+  uint32 r = Read(pDestination, ByteCount);
+  if (pNumberOfBytesRead != nullptr)
+    *pNumberOfBytesRead = r;
+
+  return (r == ByteCount);
+}
+
+bool PrefetchingByteStream::WriteByte(byte SourceByte)
+{
+  return false;
+}
+
+uint32 PrefetchingByteStream::Write(const void* pSource, uint32 ByteCount)
+{
+  return 0;
+}
+
+bool PrefetchingByteStream::Write2(const void* pSource, uint32 ByteCount,
+                                   uint32* pNumberOfBytesWritten /* = nullptr */)
+{
+  return false;
+}
+
+bool PrefetchingByteStream::SeekAbsolute(uint64 Offset)
+{
+  MutexLock lock(m_lock);
+  if (Offset == m_position)
+    return true;
+
+  // skipping forward into data which has already been fetched just retires chunks
+  if (Offset > m_position && Offset <= m_fetchPosition)
+  {
+    uint64 skip = Offset - m_position;
+    while (skip > 0)
+    {
+      uint32 chunkRemaining = m_pChunkSizes[m_headChunk] - m_headChunkPosition;
+      if (skip < chunkRemaining)
+      {
+        m_headChunkPosition += (uint32)skip;
+        break;
+      }
+
+      skip -= chunkRemaining;
+      AdvanceChunkLocked();
+    }
+
+    m_position = Offset;
+    StartFillerLocked();
+    return true;
+  }
+
+  // anything else needs the worker out of the base stream first
+  StopFillerLocked();
+  if (!m_pBaseStream->SeekAbsolute(Offset))
+  {
+    // base stream didn't move (eg a backwards seek on a streamed zip entry), so the window is still valid
+    StartFillerLocked();
+    return false;
+  }
+
+  m_headChunk = 0;
+  m_filledChunks = 0;
+  m_headChunkPosition = 0;
+  m_position = m_fetchPosition = Offset;
+  m_endOfStream = false;
+  return true;
+}
+
+bool PrefetchingByteStream::SeekRelative(int64 Offset)
+{
+  uint64 position = GetPosition();
+  if (Offset < 0 && (uint64)-Offset > position)
+    return false;
+
+  return SeekAbsolute((uint64)((int64)position + Offset));
+}
+
+bool PrefetchingByteStream::SeekToEnd()
+{
+  return SeekAbsolute(m_size);
+}
+
+uint64 PrefetchingByteStream::GetSize() const
+{
+  return m_size;
+}
+
+uint64 PrefetchingByteStream::GetPosition() const
+{
+  return m_position;
+}
+
+bool PrefetchingByteStream::Flush()
+{
+  return false;
+}
+
+bool PrefetchingByteStream::Commit()
+{
+  return false;
+}
+
+bool PrefetchingByteStream::Discard()
+{
+  return false;
+}
+
+PrefetchingByteStream* ByteStream_CreatePrefetchingStream(ByteStream* pBaseStream,
+                                                          uint32 chunkSize /* = 64 * 1024 */,
+                                                          uint32 chunkCount /* = 4 */,
+                                                          ThreadPool* pThreadPool /* = nullptr */)
+{
+  return new PrefetchingByteStream(pBaseStream, chunkSize, chunkCount, pThreadPool);
+}
@@ -1,4 +1,5 @@
 #include "YBaseLib/Sockets/BufferedStreamSocket.h"
+#include "YBaseLib/ByteStream.h"
 #include "YBaseLib/Error.h"
 #include "YBaseLib/Log.h"
 #include "YBaseLib/Sockets/SocketMultiplexer.h"
@@ -12,14 +13,67 @@ Log_SetChannel(BufferedStreamSocket);
 #define closesocket close
 #define WSAEWOULDBLOCK EAGAIN
 #define WSAGetLastError() errno
-#define SIZE_CAST(x) x
+#endif
+
+// Scatter/gather buffers, as passed to the platform's vectored send and receive.
+#ifdef Y_PLATFORM_WINDOWS
+typedef WSABUF IOVector;
+
+static void SetIOVector(IOVector* pVector, const void* pBuffer, size_t length)
+{
+  pVector->buf = (CHAR*)pBuffer;
+  pVector->len = (ULONG)length;
+}
+
+static ssize_t SendVectors(SOCKET fileDescriptor, IOVector* pVectors, uint32 numVectors)
+{
+  DWORD bytesSent = 0;
+  if (WSASend(fileDescriptor, pVectors, (DWORD)numVectors, &bytesSent, 0, nullptr, nullptr) == SOCKET_ERROR)
+    return -1;
+
+  return (ssize_t)bytesSent;
+}
+
+static ssize_t ReceiveVectors(SOCKET fileDescriptor, IOVector* pVectors, uint32 numVectors)
+{
+  DWORD bytesReceived = 0;
+  DWORD flags = 0;
+  if (WSARecv(fileDescriptor, pVectors, (DWORD)numVectors, &bytesReceived, &flags, nullptr, nullptr) == SOCKET_ERROR)
+    return -1;
+
+  return (ssize_t)bytesReceived;
+}
 #else
-#define SIZE_CAST(x) static_cast<int>(x)
+typedef iovec IOVector;
+
+static void SetIOVector(IOVector* pVector, const void* pBuffer, size_t length)
+{
+  pVector->iov_base = const_cast<void*>(pBuffer);
+  pVector->iov_len = length;
+}
+
+static ssize_t SendVectors(SOCKET fileDescriptor, IOVector* pVectors, uint32 numVectors)
+{
+  return writev(fileDescriptor, pVectors, (int)numVectors);
+}
+
+static ssize_t ReceiveVectors(SOCKET fileDescriptor, IOVector* pVectors, uint32 numVectors)
+{
+  return readv(fileDescriptor, pVectors, (int)numVectors);
+}
 #endif
 
+// Most buffers passed to a single vectored send or receive. User buffers after this are queued, and buffered data is
+// sent or received with another call.
+static const uint32 MAX_IOVECS = 64;
+
 BufferedStreamSocket::BufferedStreamSocket(size_t receiveBufferSize /*= 16384*/, size_t sendBufferSize /*= 16384*/)
-  : m_receiveBuffer(receiveBufferSize), m_sendBuffer(sendBufferSize)
+  : m_receiveBuffer(receiveBufferSize), m_sendBuffer(sendBufferSize), m_receiveBufferFull(false), m_sendBatchDepth(0),
+    m_sendHighWatermark(sendBufferSize), m_sendLowWatermark(sendBufferSize / 2), m_sendBlocked(false),
+    m_peakQueuedSendBytes(0), m_totalQueuedSendBytes(0)
 {
+  // OnReadEvent/OnWriteEvent go until the socket would block, or the buffers are full/empty.
+  m_edgeTriggered = true;
 }
 
 BufferedStreamSocket::~BufferedStreamSocket() {}
@@ -29,60 +83,17 @@ size_t BufferedStreamSocket::Read(void* pBuffer, size_t bufferSize)
   m_lock.Lock();
 
   // Read from receive buffer.
-  size_t bytesToRead = Min(m_receiveBuffer.GetContiguousUsedBytes(), bufferSize);
-  if (bytesToRead > 0)
-  {
-    if (!m_receiveBuffer.Read(pBuffer, bytesToRead))
-      bytesToRead = 0;
-  }
+  size_t bytesRead = m_receiveBuffer.Read(pBuffer, bufferSize);
+  if (bytesRead > 0)
+    OnReceiveBufferConsumed();
 
   m_lock.Unlock();
-  return bytesToRead;
+  return bytesRead;
 }
 
 size_t BufferedStreamSocket::Write(const void* pBuffer, size_t bufferSize)
 {
-  m_lock.Lock();
-
-  // Write buffer currently being used?
-  // Don't send out-of-order, push to the write buffer.
-  size_t writtenBytes = 0;
-  if (m_sendBuffer.GetBufferUsed() == 0)
-  {
-    // Send as many bytes as possible immediately. If this fails, push to the write buffer.
-    ssize_t res = send(m_fileDescriptor, (const char*)pBuffer, SIZE_CAST(bufferSize), 0);
-    writtenBytes = (size_t)Max(res, (ssize_t)0);
-
-    // Socket error?
-    if (res < 0 && WSAGetLastError() != WSAEWOULDBLOCK)
-    {
-      CloseWithError();
-      m_lock.Unlock();
-      return 0;
-    }
-  }
-
-  // Any bytes left over?
-  if (writtenBytes < bufferSize)
-  {
-    // Copy remaining bytes into write buffer, and register for write notifications.
-    size_t bytesRemaining = bufferSize - writtenBytes;
-    size_t bufferSpace = m_sendBuffer.GetContiguousBufferSpace();
-    bool registerForWrites = (m_sendBuffer.GetBufferUsed() == 0);
-
-    // Write to buffer.
-    size_t bytesToWriteToBuffer = Min(bufferSpace, bytesRemaining);
-    if (m_sendBuffer.Write((const byte*)pBuffer + writtenBytes, bytesToWriteToBuffer))
-      writtenBytes += bytesToWriteToBuffer;
-
-    // Register for write notifications.
-    if (registerForWrites)
-      m_pMultiplexer->SetNotificationMask(this, m_fileDescriptor,
-                                          SocketMultiplexer::EventType_Read | SocketMultiplexer::EventType_Write);
-  }
-
-  m_lock.Unlock();
-  return writtenBytes;
+  return WriteVector(&pBuffer, &bufferSize, 1);
 }
 
 size_t BufferedStreamSocket::WriteVector(const void** ppBuffers, const size_t* pBufferLengths, size_t numBuffers)
@@ -96,20 +107,17 @@ size_t BufferedStreamSocket::WriteVector(const void** ppBuffers, const size_t* p
   }
 
   // Write buffer currently being used?
-  // Don't send out-of-order, push to the write buffer.
-  size_t writtenBytes = 0;
-  if (m_sendBuffer.GetBufferUsed() == 0)
+  // Don't send out-of-order, push to the write buffer. Otherwise send straight from the caller's buffers.
+  size_t bytesSent = 0;
+  if (m_sendBuffer.GetSize() == 0 && m_sendBatchDepth == 0)
   {
-#ifdef Y_PLATFORM_WINDOWS
-    WSABUF* bufs = (WSABUF*)alloca(sizeof(WSABUF) * numBuffers);
-    for (size_t i = 0; i < numBuffers; i++)
-    {
-      bufs[i].buf = (CHAR*)ppBuffers[i];
-      bufs[i].len = (ULONG)pBufferLengths[i];
-    }
+    IOVector vectors[MAX_IOVECS];
+    uint32 numVectors = (uint32)Min(numBuffers, (size_t)MAX_IOVECS);
+    for (uint32 i = 0; i < numVectors; i++)
+      SetIOVector(&vectors[i], ppBuffers[i], pBufferLengths[i]);
 
-    DWORD bytesSent = 0;
-    if (WSASend(m_fileDescriptor, bufs, (DWORD)numBuffers, &bytesSent, 0, nullptr, nullptr) == SOCKET_ERROR)
+    ssize_t res = SendVectors(m_fileDescriptor, vectors, numVectors);
+    if (res < 0)
     {
       if (WSAGetLastError() != WSAEWOULDBLOCK)
       {
@@ -118,76 +126,210 @@ size_t BufferedStreamSocket::WriteVector(const void** ppBuffers, const size_t* p
         m_lock.Unlock();
         return 0;
       }
+
+      res = 0;
     }
 
-    writtenBytes = (size_t)bytesSent;
+    bytesSent = (size_t)res;
+  }
 
-#else // Y_PLATFORM_WINDOWS
+  // Copy whatever wasn't sent into the write buffer, in order, until it's full.
+  bool registerForWrites = (m_sendBuffer.GetSize() == 0);
+  size_t writtenBytes = bytesSent;
+  size_t bufferStart = 0;
+  size_t totalLength = 0;
+  for (size_t i = 0; i < numBuffers; i++)
+    totalLength += pBufferLengths[i];
 
-    iovec* bufs = (iovec*)alloca(sizeof(iovec) * numBuffers);
-    for (size_t i = 0; i < numBuffers; i++)
+  for (size_t i = 0; i < numBuffers; i++)
+  {
+    size_t bufferEnd = bufferStart + pBufferLengths[i];
+    if (bufferEnd > bytesSent)
     {
-      bufs[i].iov_base = (void*)ppBuffers[i];
-      bufs[i].iov_len = pBufferLengths[i];
+      size_t bytesSentInBuffer = (bytesSent > bufferStart) ? (bytesSent - bufferStart) : 0;
+      size_t bytesRemainingInBuffer = pBufferLengths[i] - bytesSentInBuffer;
+      size_t bytesToWriteToBuffer = m_sendBuffer.Write((const byte*)ppBuffers[i] + bytesSentInBuffer,
+                                                       bytesRemainingInBuffer);
+      writtenBytes += bytesToWriteToBuffer;
+
+      // Out of space?
+      if (bytesToWriteToBuffer < bytesRemainingInBuffer)
+        break;
     }
 
-    ssize_t res = writev(m_fileDescriptor, bufs, numBuffers);
-    if (res < 0)
-    {
-      if (errno != EAGAIN)
-      {
-        // Socket error.
-        CloseWithError();
-        m_lock.Unlock();
-        return 0;
-      }
+    bufferStart = bufferEnd;
+  }
 
-      res = 0;
-    }
+  OnSendBufferWritten(writtenBytes - bytesSent, writtenBytes < totalLength);
 
-    writtenBytes = (size_t)res;
+  // Register for write notifications. A batch is sent when it ends.
+  if (registerForWrites && m_sendBuffer.GetSize() > 0 && m_sendBatchDepth == 0)
+    UpdateNotificationMask();
 
-#endif // Y_PLATFORM_WINDOWS
-  }
+  m_lock.Unlock();
+  return writtenBytes;
+}
+
+bool BufferedStreamSocket::TryWriteVector(const void** ppBuffers, const size_t* pBufferLengths, size_t numBuffers)
+{
+  m_lock.Lock();
 
-  // Find the buffer that we got up to
-  size_t currentOffset = 0;
-  bool registerForWrites = false;
+  // Whatever the socket doesn't take has to fit in the buffer.
+  size_t totalLength = 0;
   for (size_t i = 0; i < numBuffers; i++)
+    totalLength += pBufferLengths[i];
+
+  // Only wait for room if something queued will make some, anything larger than an empty buffer never fits.
+  bool result = (m_connected && totalLength <= m_sendBuffer.GetSpace());
+  if (result)
+    result = (WriteVector(ppBuffers, pBufferLengths, numBuffers) == totalLength);
+  else if (m_connected && m_sendBuffer.GetSize() > 0)
+    m_sendBlocked = true;
+
+  m_lock.Unlock();
+  return result;
+}
+
+size_t BufferedStreamSocket::WriteWithFileDescriptors(const void* pBuffer, size_t bufferSize,
+                                                      const int* pFileDescriptors, uint32 count)
+{
+  m_lock.Lock();
+
+  // Flush what's queued ahead, and make sure whatever the socket doesn't take of this fits behind it.
+  if (!m_connected || (m_sendBuffer.GetSize() > 0 && (!FlushSendBuffer() || m_sendBuffer.GetSize() > 0)) ||
+      bufferSize > m_sendBuffer.GetSpace())
   {
-    // Was this buffer only partially completed?
-    if ((currentOffset + pBufferLengths[i]) <= writtenBytes)
-    {
-      currentOffset += pBufferLengths[i];
-      continue;
-    }
+    if (m_connected && m_sendBuffer.GetSize() > 0)
+      m_sendBlocked = true;
 
-    // Copy remaining bytes into write buffer, and register for write notifications.
-    size_t bytesWrittenInBuffer = (writtenBytes - currentOffset);
-    size_t bytesRemainingInBuffer = pBufferLengths[i] - bytesWrittenInBuffer;
-    size_t bufferSpace = m_sendBuffer.GetContiguousBufferSpace();
-    if (m_sendBuffer.GetBufferUsed() == 0)
-      registerForWrites = true;
+    m_lock.Unlock();
+    return 0;
+  }
 
-    // Write to buffer.
-    size_t bytesToWriteToBuffer = Min(bytesRemainingInBuffer, bufferSpace);
-    if (m_sendBuffer.Write((const byte*)ppBuffers[i] + bytesWrittenInBuffer, bytesToWriteToBuffer))
-      writtenBytes += bytesToWriteToBuffer;
+  size_t bytesSent = StreamSocket::WriteWithFileDescriptors(pBuffer, bufferSize, pFileDescriptors, count);
+  if (bytesSent > 0 && bytesSent < bufferSize)
+  {
+    bytesSent += Write((const byte*)pBuffer + bytesSent, bufferSize - bytesSent);
+  }
+  else if (bytesSent == 0 && bufferSize > 0 && m_connected)
+  {
+    // The socket is full with nothing queued to drain, so watch for writes ourselves to tell the caller when to retry.
+    m_sendBlocked = true;
+    UpdateNotificationMask();
+  }
 
-    // Was this a complete write?
-    if (bytesToWriteToBuffer == bytesRemainingInBuffer)
-      currentOffset += pBufferLengths[i];
-    else
-      break;
+  m_lock.Unlock();
+  return bytesSent;
+}
+
+void BufferedStreamSocket::SetSendWatermarks(size_t highWatermark, size_t lowWatermark)
+{
+  DebugAssert(lowWatermark <= highWatermark);
+
+  m_lock.Lock();
+  m_sendHighWatermark = Min(highWatermark, m_sendBuffer.GetMaxSize());
+  m_sendLowWatermark = Min(lowWatermark, m_sendHighWatermark);
+  m_lock.Unlock();
+}
+
+void BufferedStreamSocket::BeginSendBatch()
+{
+  m_lock.Lock();
+  m_sendBatchDepth++;
+  m_lock.Unlock();
+}
+
+void BufferedStreamSocket::EndSendBatch()
+{
+  m_lock.Lock();
+
+  DebugAssert(m_sendBatchDepth > 0);
+  if (--m_sendBatchDepth == 0 && m_connected && m_sendBuffer.GetSize() > 0)
+  {
+    // Register for writes if the socket didn't take it all.
+    if (FlushSendBuffer() && m_sendBuffer.GetSize() > 0)
+      UpdateNotificationMask();
+  }
+  else if (m_sendBatchDepth == 0 && m_connected && m_sendBlocked)
+  {
+    // Write events are ignored during a batch, so re-arm in case the one a blocked socket waits for came and went.
+    UpdateNotificationMask();
+  }
+
+  m_lock.Unlock();
+}
+
+uint64 BufferedStreamSocket::SendFile(ByteStream* pStream, uint64 offset, uint64 length)
+{
+  m_lock.Lock();
+
+  if (!m_connected)
+  {
+    m_lock.Unlock();
+    return 0;
   }
 
-  // Register for write notifications.
+  // Nothing buffered, so the start can go straight out.
+  uint64 bytesSent = 0;
+  bool registerForWrites = (m_sendBuffer.GetSize() == 0);
   if (registerForWrites)
-    m_pMultiplexer->SetNotificationMask(this, m_fileDescriptor,
-                                        SocketMultiplexer::EventType_Read | SocketMultiplexer::EventType_Write);
+    bytesSent = StreamSocket::SendFile(pStream, offset, length);
+
+  // Read whatever the socket didn't take straight into the write buffer, rather than through a temporary.
+  uint64 streamSize = pStream->GetSize();
+  length = (offset < streamSize) ? Min(length, streamSize - offset) : 0;
+  if (m_connected && bytesSent < length && m_sendBuffer.GetSpace() > 0)
+  {
+    void* pRegions[MAX_IOVECS];
+    size_t writableSizes[MAX_IOVECS];
+    uint32 regionSizes[MAX_IOVECS];
+    size_t bytesWanted = (size_t)Min(length - bytesSent, (uint64)m_sendBuffer.GetSpace());
+    uint32 regionCount = m_sendBuffer.GetWriteRegions(pRegions, writableSizes, MAX_IOVECS, bytesWanted);
+    for (uint32 i = 0; i < regionCount; i++)
+      regionSizes[i] = (uint32)writableSizes[i];
+
+    uint64 oldPosition = pStream->GetPosition();
+    uint32 bytesRead = 0;
+    if (pStream->SeekAbsolute(offset + bytesSent))
+      bytesRead = pStream->ReadV(pRegions, regionSizes, regionCount);
+    pStream->SeekAbsolute(oldPosition);
+
+    m_sendBuffer.MoveWritePointer(bytesRead);
+    bytesSent += bytesRead;
+    OnSendBufferWritten(bytesRead, bytesSent < length);
+
+    // Register for write notifications.
+    if (registerForWrites && m_sendBuffer.GetSize() > 0)
+      UpdateNotificationMask();
+  }
+  else if (m_connected && bytesSent < length)
+  {
+    OnSendBufferWritten(0, true);
+  }
 
   m_lock.Unlock();
-  return writtenBytes;
+  return bytesSent;
+}
+
+size_t BufferedStreamSocket::WriteZeroCopy(const void* pBuffer, size_t bufferSize, bool* pCompletionPending,
+                                           uint32* pCompletionID)
+{
+  m_lock.Lock();
+
+  // Anything buffered has to go first, so this has to be copied in behind it.
+  size_t bytesWritten;
+  if (m_sendBuffer.GetSize() == 0)
+  {
+    bytesWritten = StreamSocket::WriteZeroCopy(pBuffer, bufferSize, pCompletionPending, pCompletionID);
+  }
+  else
+  {
+    *pCompletionPending = false;
+    bytesWritten = Write(pBuffer, bufferSize);
+  }
+
+  m_lock.Unlock();
+  return bytesWritten;
 }
 
 bool BufferedStreamSocket::AcquireReadBuffer(const void** ppBuffer, size_t* pBytesAvailable)
@@ -202,22 +344,42 @@ bool BufferedStreamSocket::AcquireReadBuffer(const void** ppBuffer, size_t* pByt
   return true;
 }
 
+uint32 BufferedStreamSocket::AcquireReadBuffers(const void** ppBuffers, size_t* pBufferSizes, uint32 maxBuffers)
+{
+  m_lock.Lock();
+  uint32 bufferCount = m_receiveBuffer.GetReadRegions(ppBuffers, pBufferSizes, maxBuffers);
+  if (bufferCount == 0)
+    m_lock.Unlock();
+
+  return bufferCount;
+}
+
 void BufferedStreamSocket::ReleaseReadBuffer(size_t bytesConsumed)
 {
-  DebugAssert(bytesConsumed <= m_receiveBuffer.GetContiguousBufferSpace());
-  if (bytesConsumed >= 0)
+  DebugAssert(bytesConsumed <= m_receiveBuffer.GetSize());
+  if (bytesConsumed > 0)
+  {
     m_receiveBuffer.MoveReadPointer(bytesConsumed);
+    OnReceiveBufferConsumed();
+  }
 
   m_lock.Unlock();
 }
 
 void BufferedStreamSocket::OnConnected()
 {
+  // Buffers are borrowed from the multiplexer's pool while there's data in them.
+  m_receiveBuffer.SetPool(m_pMultiplexer->GetBufferPool());
+  m_sendBuffer.SetPool(m_pMultiplexer->GetBufferPool());
+
   StreamSocket::OnConnected();
 }
 
 void BufferedStreamSocket::OnDisconnected(Error* pError)
 {
+  // Nowhere for unsent data to go now. Received data is kept until it's read, or the socket is destroyed.
+  m_sendBuffer.Clear();
+
   StreamSocket::OnDisconnected(pError);
 }
 
@@ -226,38 +388,58 @@ void BufferedStreamSocket::OnRead()
   StreamSocket::OnRead();
 }
 
+void BufferedStreamSocket::OnWritable() {}
+
+void BufferedStreamSocket::OnSendBufferDrained() {}
+
 void BufferedStreamSocket::OnReadEvent()
 {
   m_lock.Lock();
 
+  // Zero-copy completions raise read events too.
+  ProcessZeroCopyCompletions();
+
   if (m_connected)
   {
-    // Pull as many bytes as possible into the read buffer.
-    while (m_receiveBuffer.GetBufferSpace() > 0)
+    // Pull as many bytes as possible into the read buffer, borrowing chunks for as much as there's room for. Any
+    // which don't get filled go straight back to the pool.
+    void* pRegions[MAX_IOVECS];
+    size_t regionSizes[MAX_IOVECS];
+    uint32 regionCount;
+    while ((regionCount = m_receiveBuffer.GetWriteRegions(pRegions, regionSizes, MAX_IOVECS,
+                                                          m_receiveBuffer.GetSpace())) > 0)
     {
-      void* pBuffer;
-      size_t contiguousBytes = 1;
-      if (m_receiveBuffer.GetWritePointer(&pBuffer, &contiguousBytes))
+      IOVector vectors[MAX_IOVECS];
+      size_t requestedBytes = 0;
+      for (uint32 i = 0; i < regionCount; i++)
       {
-        ssize_t res = recv(m_fileDescriptor, (char*)pBuffer, SIZE_CAST(contiguousBytes), 0);
-        if (res <= 0 && WSAGetLastError() != WSAEWOULDBLOCK)
-        {
-          CloseWithError();
-          m_lock.Unlock();
-          return;
-        }
-
-        if (res > 0)
-        {
-          m_receiveBuffer.MoveWritePointer((size_t)res);
-          if ((size_t)res == contiguousBytes)
-            continue;
-        }
+        SetIOVector(&vectors[i], pRegions[i], regionSizes[i]);
+        requestedBytes += regionSizes[i];
+      }
 
-        break;
+#ifndef Y_PLATFORM_WINDOWS
+      ssize_t res = m_unixDomain ? ReceiveWithFileDescriptors(vectors, regionCount) :
+                                   ReceiveVectors(m_fileDescriptor, vectors, regionCount);
+#else
+      ssize_t res = ReceiveVectors(m_fileDescriptor, vectors, regionCount);
+#endif
+      m_receiveBuffer.MoveWritePointer((size_t)Max(res, (ssize_t)0));
+      if (res == 0 || (res < 0 && WSAGetLastError() != WSAEWOULDBLOCK))
+      {
+        CloseWithError();
+        m_lock.Unlock();
+        return;
       }
+
+      // Try again only if we filled everything we asked for. Unix domain reads also come back short at each
+      // segment that carried descriptors, with more behind it, so those go on until the socket would block.
+      if (res < 0 || (!m_unixDomain && (size_t)res < requestedBytes))
+        break;
     }
 
+    // If we stopped because there's no room, we won't be told about the rest until there is.
+    m_receiveBufferFull = (m_receiveBuffer.GetSpace() == 0);
+
     OnRead();
   }
 
@@ -268,41 +450,95 @@ void BufferedStreamSocket::OnWriteEvent()
 {
   m_lock.Lock();
 
-  // Try to send as many bytes as possible from the write buffer.
-  while (m_sendBuffer.GetBufferUsed() > 0)
+  // Closed since the event was collected? A batch in progress is sent when it ends.
+  if (!m_connected || m_sendBatchDepth > 0)
   {
-    size_t contiguousBytes;
-    const void* pBuffer;
-    if (m_sendBuffer.GetReadPointer(&pBuffer, &contiguousBytes))
-    {
-      ssize_t res = send(m_fileDescriptor, (const char*)pBuffer, SIZE_CAST(contiguousBytes), 0);
-      if (res < 0 && WSAGetLastError() != WSAEWOULDBLOCK)
-      {
-        CloseWithError();
-        m_lock.Unlock();
-        return;
-      }
+    m_lock.Unlock();
+    return;
+  }
 
-      // Any bytes written?
-      if (res > 0)
-      {
-        m_sendBuffer.MoveWritePointer((size_t)res);
+  // Do we still have bytes? If not, unregister for write notifications.
+  if (FlushSendBuffer() && m_sendBuffer.GetSize() == 0)
+    UpdateNotificationMask();
 
-        // Try again only if we did a whole write.
-        if ((size_t)res == contiguousBytes)
-          continue;
-      }
+  m_lock.Unlock();
+}
+
+bool BufferedStreamSocket::FlushSendBuffer()
+{
+  // Try to send as many bytes as possible from the write buffer, a run of chunks per call. If a call is short, the
+  // socket is full and we'll be told when there's room again.
+  bool hadQueuedBytes = (m_sendBuffer.GetSize() > 0);
+  const void* pRegions[MAX_IOVECS];
+  size_t regionSizes[MAX_IOVECS];
+  uint32 regionCount;
+  while ((regionCount = m_sendBuffer.GetReadRegions(pRegions, regionSizes, MAX_IOVECS)) > 0)
+  {
+    IOVector vectors[MAX_IOVECS];
+    size_t requestedBytes = 0;
+    for (uint32 i = 0; i < regionCount; i++)
+    {
+      SetIOVector(&vectors[i], pRegions[i], regionSizes[i]);
+      requestedBytes += regionSizes[i];
     }
 
-    // Don't try again.
-    break;
+    ssize_t res = SendVectors(m_fileDescriptor, vectors, regionCount);
+    if (res < 0 && WSAGetLastError() != WSAEWOULDBLOCK)
+    {
+      CloseWithError();
+      return false;
+    }
+
+    // Any bytes written?
+    if (res > 0)
+      m_sendBuffer.MoveReadPointer((size_t)res);
+
+    // Try again only if we did a whole write.
+    if (res < 0 || (size_t)res < requestedBytes)
+      break;
+  }
+
+  // Let producers held back by flow control go again, then report the queue empty if they didn't refill it. Either
+  // may close the socket.
+  if (m_sendBlocked && m_sendBuffer.GetSize() <= m_sendLowWatermark)
+  {
+    m_sendBlocked = false;
+    OnWritable();
   }
+  if (hadQueuedBytes && m_connected && m_sendBuffer.GetSize() == 0)
+    OnSendBufferDrained();
 
-  // Do we still have bytes? If not, unregister for read notifications.
-  if (m_sendBuffer.GetBufferUsed() == 0)
-    m_pMultiplexer->SetNotificationMask(this, m_fileDescriptor, SocketMultiplexer::EventType_Read);
+  return m_connected;
+}
 
-  m_lock.Unlock();
+void BufferedStreamSocket::OnSendBufferWritten(size_t bytesQueued, bool shortWrite)
+{
+  size_t queuedSize = m_sendBuffer.GetSize();
+  m_totalQueuedSendBytes += bytesQueued;
+  m_peakQueuedSendBytes = Max(m_peakQueuedSendBytes, queuedSize);
+  // Blocking is only undone by the queue draining, so there has to be something in it.
+  if (queuedSize > 0 && (shortWrite || queuedSize >= m_sendHighWatermark))
+    m_sendBlocked = true;
+}
+
+void BufferedStreamSocket::UpdateNotificationMask()
+{
+  // A blocked socket with an empty queue is waiting for room to write to the socket directly.
+  uint32 mask = SocketMultiplexer::EventType_Read | SocketMultiplexer::EventType_EdgeTriggered;
+  if (m_sendBuffer.GetSize() > 0 || m_sendBlocked)
+    mask |= SocketMultiplexer::EventType_Write;
+
+  m_pMultiplexer->SetNotificationMask(this, m_fileDescriptor, mask);
+}
+
+void BufferedStreamSocket::OnReceiveBufferConsumed()
+{
+  // Re-arm, so that data left in the socket when the buffer filled up raises another read event.
+  if (m_receiveBufferFull && m_connected)
+  {
+    m_receiveBufferFull = false;
+    UpdateNotificationMask();
+  }
 }
 
 #endif // #ifdef Y_SOCKET_IMPLEMENTATION_GENERIC
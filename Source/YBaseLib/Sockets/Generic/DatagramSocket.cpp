@@ -0,0 +1,475 @@
+#include "YBaseLib/Sockets/DatagramSocket.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/Memory.h"
+#include "YBaseLib/Sockets/SocketMultiplexer.h"
+Log_SetChannel(DatagramSocket);
+
+#ifdef Y_SOCKET_IMPLEMENTATION_GENERIC
+
+#ifdef Y_PLATFORM_LINUX
+#include <netinet/udp.h>
+#define HAVE_RECVMMSG 1
+#if defined(UDP_SEGMENT)
+#define HAVE_UDP_SEGMENT 1
+#endif
+#if defined(UDP_GRO)
+#define HAVE_UDP_GRO 1
+#endif
+#endif
+
+// Windows-isms
+#ifndef Y_PLATFORM_WINDOWS
+#define ioctlsocket ioctl
+#define closesocket close
+#define WSAEWOULDBLOCK EAGAIN
+#define WSAGetLastError() errno
+#endif
+
+// Batches read per read event. The registration is level-triggered, so anything left is picked up on the next poll,
+// after the other sockets on the loop have had a turn.
+static const uint32 MAX_RECEIVE_PASSES = 4;
+
+// With receive offload each slot has to hold a whole coalesced run, which can be up to the largest UDP datagram. Fewer
+// slots are needed as each can carry many packets.
+static const uint32 GRO_RECEIVE_SLOT_SIZE = 65536;
+static const uint32 GRO_RECEIVE_SLOT_COUNT = 16;
+
+// Largest buffer handed to the kernel in one segmented send, under the 65507 byte limit of a UDP payload over IPv4.
+static const uint32 MAX_SEGMENTED_SEND_SIZE = 65000;
+
+struct DatagramSocket::ReceiveRing
+{
+  uint32 SlotCount;
+  uint32 SlotSize;
+  byte* pBuffers;
+
+  sockaddr_storage SourceAddresses[MAX_BATCH_SIZE];
+  SocketAddress Addresses[MAX_BATCH_SIZE];
+
+#ifdef HAVE_RECVMMSG
+  mmsghdr Headers[MAX_BATCH_SIZE];
+  iovec Vectors[MAX_BATCH_SIZE];
+  // control messages are aligned as size_t
+  union
+  {
+    size_t Alignment;
+    byte Data[CMSG_SPACE(sizeof(int))];
+  } Control[MAX_BATCH_SIZE];
+#endif
+
+  // Packets handed to OnPackets. Coalesced receives are split into more than one, so this is flushed when full.
+  Packet Packets[MAX_BATCH_SIZE];
+};
+
+DatagramSocket::DatagramSocket(uint32 maxPacketSize /* = 2048 */, uint32 batchSize /* = MAX_BATCH_SIZE */)
+  : m_pMultiplexer(nullptr), m_fileDescriptor(INVALID_SOCKET), m_pReceiveRing(nullptr),
+    m_maxPacketSize(Max(maxPacketSize, (uint32)1)), m_batchSize(Min(Max(batchSize, (uint32)1), MAX_BATCH_SIZE)),
+    m_receiveOffload(false), m_sendOffloadUnsupported(false), m_packetsReceived(0), m_receiveCalls(0),
+    m_packetsSent(0), m_sendCalls(0)
+{
+  m_pReceiveRing = CreateReceiveRing(m_batchSize, m_maxPacketSize);
+}
+
+DatagramSocket::~DatagramSocket()
+{
+  DebugAssert(m_fileDescriptor == INVALID_SOCKET);
+  DestroyReceiveRing(m_pReceiveRing);
+}
+
+void DatagramSocket::Close()
+{
+  m_lock.Lock();
+
+  if (m_fileDescriptor == INVALID_SOCKET)
+  {
+    m_lock.Unlock();
+    return;
+  }
+
+  m_pMultiplexer->SetNotificationMask(this, m_fileDescriptor, 0);
+  closesocket(m_fileDescriptor);
+  m_fileDescriptor = INVALID_SOCKET;
+
+  m_lock.Unlock();
+
+  // Remove the open socket last. This is because it may be the last reference holder.
+  m_pMultiplexer->RemoveOpenSocket(this);
+}
+
+bool DatagramSocket::SendTo(const void* pData, size_t length, const SocketAddress* pAddress)
+{
+  Packet packet = {pData, length, pAddress};
+  return (SendMultiple(&packet, 1) == 1);
+}
+
+uint32 DatagramSocket::SendMultiple(const Packet* pPackets, uint32 count)
+{
+  m_lock.Lock();
+
+  uint32 packetsSent = 0;
+  while (packetsSent < count && m_fileDescriptor != INVALID_SOCKET)
+  {
+#ifdef HAVE_RECVMMSG
+    mmsghdr headers[MAX_BATCH_SIZE];
+    iovec vectors[MAX_BATCH_SIZE];
+    uint32 batchSize = Min(count - packetsSent, MAX_BATCH_SIZE);
+    Y_memzero(headers, sizeof(mmsghdr) * batchSize);
+    for (uint32 i = 0; i < batchSize; i++)
+    {
+      const Packet& packet = pPackets[packetsSent + i];
+      vectors[i].iov_base = const_cast<void*>(packet.pData);
+      vectors[i].iov_len = packet.Length;
+      headers[i].msg_hdr.msg_name = const_cast<void*>(packet.pAddress->GetData());
+      headers[i].msg_hdr.msg_namelen = packet.pAddress->GetLength();
+      headers[i].msg_hdr.msg_iov = &vectors[i];
+      headers[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // a full socket buffer or an error on the first packet fails the call, otherwise it stops short
+    int result = sendmmsg(m_fileDescriptor, headers, batchSize, 0);
+    if (result <= 0)
+      break;
+
+    m_sendCalls++;
+    m_packetsSent += (uint32)result;
+    packetsSent += (uint32)result;
+    if ((uint32)result < batchSize)
+      break;
+#else
+    const Packet& packet = pPackets[packetsSent];
+    if (sendto(m_fileDescriptor, (const char*)packet.pData, (int)packet.Length, 0,
+               (const sockaddr*)packet.pAddress->GetData(), packet.pAddress->GetLength()) < 0)
+    {
+      break;
+    }
+
+    m_sendCalls++;
+    m_packetsSent++;
+    packetsSent++;
+#endif
+  }
+
+  m_lock.Unlock();
+  return packetsSent;
+}
+
+uint32 DatagramSocket::SendSegmented(const void* pData, size_t length, uint32 segmentSize,
+                                     const SocketAddress* pAddress)
+{
+  if (segmentSize == 0)
+    return 0;
+  if (length <= segmentSize)
+    return SendTo(pData, length, pAddress) ? 1 : 0;
+
+  const byte* pBytes = reinterpret_cast<const byte*>(pData);
+  uint32 segmentCount = (uint32)((length + segmentSize - 1) / segmentSize);
+  uint32 segmentsSent = 0;
+
+  m_lock.Lock();
+
+#ifdef HAVE_UDP_SEGMENT
+  uint32 segmentsPerCall = Min(MAX_BATCH_SIZE, MAX_SEGMENTED_SEND_SIZE / segmentSize);
+  if (!m_sendOffloadUnsupported && segmentsPerCall > 1)
+  {
+    union
+    {
+      size_t alignment;
+      byte data[CMSG_SPACE(sizeof(uint16))];
+    } control;
+
+    while (segmentsSent < segmentCount && m_fileDescriptor != INVALID_SOCKET)
+    {
+      size_t offset = (size_t)segmentsSent * segmentSize;
+      size_t chunkLength = Min(length - offset, (size_t)segmentsPerCall * segmentSize);
+
+      iovec vector;
+      vector.iov_base = const_cast<byte*>(pBytes + offset);
+      vector.iov_len = chunkLength;
+
+      msghdr header;
+      Y_memzero(&header, sizeof(header));
+      header.msg_name = const_cast<void*>(pAddress->GetData());
+      header.msg_namelen = pAddress->GetLength();
+      header.msg_iov = &vector;
+      header.msg_iovlen = 1;
+      header.msg_control = control.data;
+      header.msg_controllen = sizeof(control.data);
+
+      cmsghdr* pControlHeader = CMSG_FIRSTHDR(&header);
+      pControlHeader->cmsg_level = IPPROTO_UDP;
+      pControlHeader->cmsg_type = UDP_SEGMENT;
+      pControlHeader->cmsg_len = CMSG_LEN(sizeof(uint16));
+      uint16 segmentSizeValue = (uint16)segmentSize;
+      std::memcpy(CMSG_DATA(pControlHeader), &segmentSizeValue, sizeof(segmentSizeValue));
+
+      if (sendmsg(m_fileDescriptor, &header, 0) < 0)
+      {
+        // the device or kernel can't segment this, so don't try again. the segment size being over the path MTU
+        // also gives EINVAL, in which case the fallback fails as well.
+        int errorCode = errno;
+        if (errorCode == EIO || errorCode == EINVAL || errorCode == ENOPROTOOPT || errorCode == EOPNOTSUPP)
+        {
+          Log_WarningPrintf("DatagramSocket::SendSegmented: Segmentation offload failed (%d), sending separately",
+                            errorCode);
+          m_sendOffloadUnsupported = true;
+          break;
+        }
+
+        m_lock.Unlock();
+        return segmentsSent;
+      }
+
+      uint32 chunkSegments = (uint32)((chunkLength + segmentSize - 1) / segmentSize);
+      m_sendCalls++;
+      m_packetsSent += chunkSegments;
+      segmentsSent += chunkSegments;
+    }
+  }
+#endif
+
+  // one datagram per segment, batched
+  while (segmentsSent < segmentCount)
+  {
+    Packet packets[MAX_BATCH_SIZE];
+    uint32 batchSize = Min(segmentCount - segmentsSent, MAX_BATCH_SIZE);
+    for (uint32 i = 0; i < batchSize; i++)
+    {
+      size_t offset = (size_t)(segmentsSent + i) * segmentSize;
+      packets[i].pData = pBytes + offset;
+      packets[i].Length = Min(length - offset, (size_t)segmentSize);
+      packets[i].pAddress = pAddress;
+    }
+
+    uint32 batchSent = SendMultiple(packets, batchSize);
+    segmentsSent += batchSent;
+    if (batchSent < batchSize)
+      break;
+  }
+
+  m_lock.Unlock();
+  return segmentsSent;
+}
+
+bool DatagramSocket::EnableReceiveOffload()
+{
+#ifdef HAVE_UDP_GRO
+  m_lock.Lock();
+
+  if (m_receiveOffload)
+  {
+    m_lock.Unlock();
+    return true;
+  }
+
+  int value = 1;
+  if (m_fileDescriptor == INVALID_SOCKET ||
+      setsockopt(m_fileDescriptor, IPPROTO_UDP, UDP_GRO, (const char*)&value, sizeof(value)) < 0)
+  {
+    m_lock.Unlock();
+    return false;
+  }
+
+  DestroyReceiveRing(m_pReceiveRing);
+  m_pReceiveRing = CreateReceiveRing(GRO_RECEIVE_SLOT_COUNT, GRO_RECEIVE_SLOT_SIZE);
+  m_receiveOffload = true;
+
+  m_lock.Unlock();
+  return true;
+#else
+  return false;
+#endif
+}
+
+void DatagramSocket::OnPackets(const Packet* pPackets, uint32 count)
+{
+  for (uint32 i = 0; i < count; i++)
+    OnPacket(pPackets[i].pData, pPackets[i].Length, pPackets[i].pAddress);
+}
+
+void DatagramSocket::OnPacket(const void* pData, size_t length, const SocketAddress* pAddress) {}
+
+void DatagramSocket::OnReadEvent()
+{
+  m_lock.Lock();
+
+  // a short batch means the queue is empty
+  for (uint32 pass = 0; pass < MAX_RECEIVE_PASSES && m_fileDescriptor != INVALID_SOCKET; pass++)
+  {
+    if (ReceiveBatch() < m_pReceiveRing->SlotCount)
+      break;
+  }
+
+  m_lock.Unlock();
+}
+
+void DatagramSocket::OnWriteEvent() {}
+
+uint32 DatagramSocket::ReceiveBatch()
+{
+  ReceiveRing* pRing = m_pReceiveRing;
+  uint32 receiveCount = 0;
+
+#ifdef HAVE_RECVMMSG
+  // the kernel writes back the lengths, so they're reset every time
+  for (uint32 i = 0; i < pRing->SlotCount; i++)
+  {
+    msghdr& header = pRing->Headers[i].msg_hdr;
+    header.msg_namelen = sizeof(sockaddr_storage);
+    header.msg_controllen = m_receiveOffload ? sizeof(pRing->Control[i].Data) : 0;
+    header.msg_flags = 0;
+  }
+
+  int result = recvmmsg(m_fileDescriptor, pRing->Headers, pRing->SlotCount, MSG_DONTWAIT, nullptr);
+  if (result <= 0)
+    return 0;
+
+  receiveCount = (uint32)result;
+#else
+  for (; receiveCount < pRing->SlotCount; receiveCount++)
+  {
+    socklen_t addressLength = sizeof(sockaddr_storage);
+    int result = recvfrom(m_fileDescriptor, (char*)(pRing->pBuffers + receiveCount * pRing->SlotSize),
+                          (int)pRing->SlotSize, 0, (sockaddr*)&pRing->SourceAddresses[receiveCount], &addressLength);
+    if (result < 0)
+      break;
+
+    pRing->Packets[receiveCount].Length = (size_t)result;
+    pRing->Addresses[receiveCount].SetFromSockaddr(&pRing->SourceAddresses[receiveCount], addressLength);
+  }
+
+  if (receiveCount == 0)
+    return 0;
+#endif
+
+  m_receiveCalls++;
+
+  uint32 packetCount = 0;
+  for (uint32 i = 0; i < receiveCount; i++)
+  {
+    const byte* pData = pRing->pBuffers + i * pRing->SlotSize;
+#ifdef HAVE_RECVMMSG
+    size_t length = pRing->Headers[i].msg_len;
+    SocketAddress* pAddress = &pRing->Addresses[i];
+    pAddress->SetFromSockaddr(&pRing->SourceAddresses[i], pRing->Headers[i].msg_hdr.msg_namelen);
+#else
+    size_t length = pRing->Packets[i].Length;
+    SocketAddress* pAddress = &pRing->Addresses[i];
+#endif
+
+    // a coalesced receive is a run of segments of the size given alongside, the last possibly shorter
+    size_t segmentSize = length;
+#ifdef HAVE_UDP_GRO
+    if (m_receiveOffload)
+    {
+      msghdr* pHeader = &pRing->Headers[i].msg_hdr;
+      for (cmsghdr* pControlHeader = CMSG_FIRSTHDR(pHeader); pControlHeader != nullptr;
+           pControlHeader = CMSG_NXTHDR(pHeader, pControlHeader))
+      {
+        if (pControlHeader->cmsg_level == IPPROTO_UDP && pControlHeader->cmsg_type == UDP_GRO)
+        {
+          int value;
+          std::memcpy(&value, CMSG_DATA(pControlHeader), sizeof(value));
+          if (value > 0)
+            segmentSize = (size_t)value;
+        }
+      }
+    }
+#endif
+
+    size_t offset = 0;
+    do
+    {
+      if (packetCount == MAX_BATCH_SIZE)
+      {
+        m_packetsReceived += packetCount;
+        OnPackets(pRing->Packets, packetCount);
+        packetCount = 0;
+      }
+
+      Packet& packet = pRing->Packets[packetCount++];
+      packet.pData = pData + offset;
+      packet.Length = Min(length - offset, segmentSize);
+      packet.pAddress = pAddress;
+      offset += segmentSize;
+    } while (offset < length);
+  }
+
+  if (packetCount > 0)
+  {
+    m_packetsReceived += packetCount;
+    OnPackets(pRing->Packets, packetCount);
+  }
+
+  return receiveCount;
+}
+
+bool DatagramSocket::InitializeSocket(SocketMultiplexer* pMultiplexer, SOCKET fileDescriptor, Error* pError)
+{
+  DebugAssert(m_pMultiplexer == nullptr);
+
+  // switch to nonblocking mode, sends report a full buffer rather than waiting
+  unsigned long value = 1;
+  if (ioctlsocket(fileDescriptor, FIONBIO, &value) < 0)
+  {
+    if (pError != nullptr)
+      pError->SetErrorSocket(WSAGetLastError());
+
+    closesocket(fileDescriptor);
+    return false;
+  }
+
+  m_pMultiplexer = pMultiplexer;
+  m_fileDescriptor = fileDescriptor;
+
+  // get local address, which has the port if it was bound to zero
+  sockaddr_storage sa;
+  socklen_t salen = sizeof(sa);
+  if (getsockname(m_fileDescriptor, (sockaddr*)&sa, &salen) == 0)
+    m_localAddress.SetFromSockaddr(&sa, salen);
+  else
+    m_localAddress.SetUnknown();
+
+  // register for reads, level-triggered so OnReadEvent can leave packets for the next poll
+  m_lock.Lock();
+  m_pMultiplexer->AddOpenSocket(this);
+  m_pMultiplexer->SetNotificationMask(this, m_fileDescriptor, SocketMultiplexer::EventType_Read);
+  m_lock.Unlock();
+  return true;
+}
+
+DatagramSocket::ReceiveRing* DatagramSocket::CreateReceiveRing(uint32 slotCount, uint32 slotSize)
+{
+  ReceiveRing* pRing = new ReceiveRing();
+  pRing->SlotCount = slotCount;
+  pRing->SlotSize = slotSize;
+  pRing->pBuffers = new byte[(size_t)slotCount * slotSize];
+
+#ifdef HAVE_RECVMMSG
+  // everything but the lengths stays put between reads
+  Y_memzero(pRing->Headers, sizeof(pRing->Headers));
+  for (uint32 i = 0; i < slotCount; i++)
+  {
+    pRing->Vectors[i].iov_base = pRing->pBuffers + i * slotSize;
+    pRing->Vectors[i].iov_len = slotSize;
+
+    msghdr& header = pRing->Headers[i].msg_hdr;
+    header.msg_name = &pRing->SourceAddresses[i];
+    header.msg_iov = &pRing->Vectors[i];
+    header.msg_iovlen = 1;
+    header.msg_control = pRing->Control[i].Data;
+  }
+#endif
+
+  return pRing;
+}
+
+void DatagramSocket::DestroyReceiveRing(ReceiveRing* pRing)
+{
+  if (pRing == nullptr)
+    return;
+
+  delete[] pRing->pBuffers;
+  delete pRing;
+}
+
+#endif // Y_SOCKET_IMPLEMENTATION_GENERIC
@@ -12,13 +12,18 @@ Log_SetChannel(StreamSocket);
 #define ioctlsocket ioctl
 #define closesocket close
 #define WSAEWOULDBLOCK EAGAIN
+#define WSAEINTR EINTR
+#define WSAECONNABORTED ECONNABORTED
 #define WSAGetLastError() errno
 #endif
 
+// how long to wait before accepting again when out of descriptors
+static const uint32 ACCEPT_RETRY_MILLISECONDS = 100;
+
 ListenSocket::ListenSocket(SocketMultiplexer* pMultiplexer,
                            SocketMultiplexer::CreateStreamSocketCallback acceptCallback, SOCKET fileDescriptor)
-  : m_pMultiplexer(pMultiplexer), m_acceptCallback(acceptCallback), m_numConnectionsAccepted(0),
-    m_fileDescriptor(fileDescriptor)
+  : m_acceptRetryTimer(this), m_pMultiplexer(pMultiplexer), m_acceptCallback(acceptCallback),
+    m_numConnectionsAccepted(0), m_fileDescriptor(fileDescriptor)
 {
   // add to list
   pMultiplexer->AddOpenSocket(this);
@@ -31,8 +36,9 @@ ListenSocket::ListenSocket(SocketMultiplexer* pMultiplexer,
   else
     m_localAddress.SetUnknown();
 
-  // register for reads
-  pMultiplexer->SetNotificationMask(this, fileDescriptor, SocketMultiplexer::EventType_Read);
+  // register for reads, OnReadEvent accepts until the queue is empty
+  pMultiplexer->SetNotificationMask(this, fileDescriptor,
+                                    SocketMultiplexer::EventType_Read | SocketMultiplexer::EventType_EdgeTriggered);
 }
 
 ListenSocket::~ListenSocket()
@@ -46,6 +52,7 @@ void ListenSocket::Close()
     return;
 
   m_pMultiplexer->SetNotificationMask(this, m_fileDescriptor, 0);
+  m_pMultiplexer->CancelTimer(&m_acceptRetryTimer);
   m_pMultiplexer->RemoveOpenSocket(this);
   closesocket(m_fileDescriptor);
   m_fileDescriptor = INVALID_SOCKET;
@@ -53,18 +60,49 @@ void ListenSocket::Close()
 
 void ListenSocket::OnReadEvent()
 {
-  // connection incoming
-  sockaddr_storage sa;
-  socklen_t salen = sizeof(sa);
-  SOCKET newFileDescriptor = accept(m_fileDescriptor, (sockaddr*)&sa, &salen);
-  if (newFileDescriptor < 0)
-    return;
+  // connections incoming, take all of them as we may not be told again until the queue has emptied
+  for (;;)
+  {
+    sockaddr_storage sa;
+    socklen_t salen = sizeof(sa);
+    SOCKET newFileDescriptor = accept(m_fileDescriptor, (sockaddr*)&sa, &salen);
+    if (newFileDescriptor == INVALID_SOCKET)
+    {
+      int error = WSAGetLastError();
+      if (error == WSAEWOULDBLOCK)
+        return;
+
+      // interrupted, or the connection was reset while queued, the rest of the queue is still there
+      if (error == WSAEINTR || error == WSAECONNABORTED)
+        continue;
+
+      // out of descriptors or memory: the queue isn't empty, so the edge won't come again, try later instead
+      if (m_fileDescriptor >= 0)
+      {
+        Log_WarningPrintf("ListenSocket::OnReadEvent: accept() failed: %d, retrying in %u ms", error,
+                          ACCEPT_RETRY_MILLISECONDS);
+        m_pMultiplexer->ScheduleTimer(&m_acceptRetryTimer, ACCEPT_RETRY_MILLISECONDS, this);
+      }
 
-  // create socket, we release our own reference.
-  StreamSocket* pStreamSocket = m_acceptCallback();
-  pStreamSocket->InitializeSocket(m_pMultiplexer, newFileDescriptor, nullptr);
-  pStreamSocket->Release();
-  m_numConnectionsAccepted++;
+      return;
+    }
+
+    // create socket, we release our own reference. it closes the descriptor if it can't be set up.
+    StreamSocket* pStreamSocket = m_acceptCallback();
+    if (pStreamSocket->InitializeSocket(m_pMultiplexer, newFileDescriptor, nullptr))
+      m_numConnectionsAccepted++;
+    else
+      Log_ErrorPrintf("ListenSocket::OnReadEvent: Failed to set up accepted socket");
+
+    pStreamSocket->Release();
+  }
+}
+
+void ListenSocket::AcceptRetryTimer::OnTimer()
+{
+  // runs on the listener's loop, so can't overlap a read event
+  if (m_pSocket->m_fileDescriptor >= 0)
+    m_pSocket->OnReadEvent();
 }
 
 void ListenSocket::OnWriteEvent() {}
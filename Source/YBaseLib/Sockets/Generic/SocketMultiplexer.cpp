@@ -1,15 +1,29 @@
 #include "YBaseLib/Sockets/SocketMultiplexer.h"
+#include "YBaseLib/Atomic.h"
+#include "YBaseLib/CPUID.h"
 #include "YBaseLib/Error.h"
 #include "YBaseLib/Log.h"
+#include "YBaseLib/Memory.h"
 #include "YBaseLib/NumericLimits.h"
 #include "YBaseLib/Platform.h"
+#include "YBaseLib/Sockets/DatagramSocket.h"
 #include "YBaseLib/Sockets/ListenSocket.h"
+#include "YBaseLib/Sockets/SocketBufferPool.h"
 #include "YBaseLib/Sockets/StreamSocket.h"
 #include "YBaseLib/Thread.h"
+#include "YBaseLib/Timer.h"
 Log_SetChannel(StreamSocket);
 
 #ifdef Y_SOCKET_IMPLEMENTATION_GENERIC
 
+#ifdef Y_PLATFORM_LINUX
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+// events collected per epoll_wait call
+static const uint32 EPOLL_BATCH_SIZE = 256;
+
 #ifndef Y_PLATFORM_WINDOWS
 #define ioctlsocket ioctl
 #define closesocket close
@@ -17,170 +31,321 @@ Log_SetChannel(StreamSocket);
 #define WSAGetLastError() errno
 #endif
 
-SocketMultiplexer::SocketMultiplexer() : m_pWorkerThread(nullptr) {}
+SocketMultiplexer::SocketMultiplexer(SOCKET_MULTIPLEXER_TYPE type)
+  : m_type(type), m_eventLoopCount(0), m_nextEventLoop(0), m_activeEventLoopCount(1),
+    m_pBufferPool(new SocketBufferPool())
+{
+  Y_memzero(m_eventLoops, sizeof(m_eventLoops));
+}
 
 SocketMultiplexer::~SocketMultiplexer()
 {
   StopWorkerThreads();
   CloseAll();
+
+  for (uint32 i = 0; i < m_eventLoopCount; i++)
+    DestroyEventLoop(m_eventLoops[i]);
+
+  // Sockets still referenced elsewhere keep the pool alive.
+  m_pBufferPool->Release();
 }
 
-SocketMultiplexer* SocketMultiplexer::Create(Error* pError)
+SOCKET_MULTIPLEXER_TYPE SocketMultiplexer::GetDefaultType()
 {
-  if (!Platform::InitializeSocketSupport(pError))
-    return nullptr;
-
-  return new SocketMultiplexer();
+#ifdef Y_PLATFORM_LINUX
+  return SOCKET_MULTIPLEXER_TYPE_EPOLL;
+#else
+  return SOCKET_MULTIPLEXER_TYPE_GENERIC;
+#endif
 }
 
-ListenSocket* SocketMultiplexer::InternalCreateListenSocket(const SocketAddress* pAddress,
-                                                            CreateStreamSocketCallback callback, Error* pError)
+SocketMultiplexer* SocketMultiplexer::Create(Error* pError, SOCKET_MULTIPLEXER_TYPE type /* = GetDefaultType() */)
 {
-  // create and bind socket
-  SOCKET fileDescriptor = INVALID_SOCKET;
-  switch (pAddress->GetType())
+  if (!Platform::InitializeSocketSupport(pError))
+    return nullptr;
+
+  switch (type)
   {
-    case SocketAddress::Type_IPv4:
+    case SOCKET_MULTIPLEXER_TYPE_GENERIC:
+#ifdef Y_PLATFORM_LINUX
+    case SOCKET_MULTIPLEXER_TYPE_EPOLL:
+#endif
+      break;
+
+    default:
     {
-      fileDescriptor = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-      if (fileDescriptor == INVALID_SOCKET)
-      {
-        if (pError != nullptr)
-          pError->SetErrorSocket(WSAGetLastError());
+      if (pError != nullptr)
+        pError->SetErrorUser((int32)0, "Multiplexer type is not supported on this platform.");
 
-        return nullptr;
-      }
+      return nullptr;
+    }
+  }
 
-      if (bind(fileDescriptor, (const sockaddr*)pAddress->GetData(), sizeof(sockaddr_in)) < 0)
-      {
-        if (pError != nullptr)
-          pError->SetErrorSocket(WSAGetLastError());
+  // there's always one event loop, which PollEvents() services when there are no worker threads
+  SocketMultiplexer* pMultiplexer = new SocketMultiplexer(type);
+  EventLoop* pEventLoop = pMultiplexer->CreateEventLoop(pError);
+  if (pEventLoop == nullptr)
+  {
+    delete pMultiplexer;
+    return nullptr;
+  }
 
-        closesocket(fileDescriptor);
-        return nullptr;
-      }
+  pMultiplexer->m_eventLoops[0] = pEventLoop;
+  pMultiplexer->m_eventLoopCount = 1;
+  return pMultiplexer;
+}
 
-      if (listen(fileDescriptor, 5) < 0)
-      {
-        if (pError != nullptr)
-          pError->SetErrorSocket(WSAGetLastError());
+SocketMultiplexer::EventLoop* SocketMultiplexer::CreateEventLoop(Error* pError)
+{
+  EventLoop* pEventLoop = new EventLoop();
+  pEventLoop->Index = m_eventLoopCount;
+  pEventLoop->EpollFileDescriptor = -1;
+  pEventLoop->WakeupFileDescriptor = -1;
+  pEventLoop->pWorkerThread = nullptr;
+  pEventLoop->TimerWheel.Reset(GetTimerTick());
+  pEventLoop->PollDeadline = Y_UINT64_MAX;
+
+#ifdef Y_PLATFORM_LINUX
+  // select waits on the wakeup eventfd too, so a poll can be cut short for a new timer
+  pEventLoop->WakeupFileDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (pEventLoop->WakeupFileDescriptor < 0)
+  {
+    if (pError != nullptr)
+      pError->SetErrorErrno(errno);
 
-        closesocket(fileDescriptor);
-        return nullptr;
-      }
+    DestroyEventLoop(pEventLoop);
+    return nullptr;
+  }
 
-      break;
+  if (m_type == SOCKET_MULTIPLEXER_TYPE_EPOLL)
+  {
+    pEventLoop->EpollFileDescriptor = epoll_create1(EPOLL_CLOEXEC);
+    if (pEventLoop->EpollFileDescriptor < 0)
+    {
+      if (pError != nullptr)
+        pError->SetErrorErrno(errno);
+
+      DestroyEventLoop(pEventLoop);
+      return nullptr;
     }
 
-    case SocketAddress::Type_IPv6:
+    // the wakeup eventfd stays registered, level-triggered, for the life of the loop
+    epoll_event ev;
+    Y_memzero(&ev, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = pEventLoop->WakeupFileDescriptor;
+    if (epoll_ctl(pEventLoop->EpollFileDescriptor, EPOLL_CTL_ADD, pEventLoop->WakeupFileDescriptor, &ev) < 0)
     {
-      fileDescriptor = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
-      if (fileDescriptor == INVALID_SOCKET)
-      {
-        if (pError != nullptr)
-          pError->SetErrorSocket(WSAGetLastError());
+      if (pError != nullptr)
+        pError->SetErrorErrno(errno);
 
-        return nullptr;
-      }
+      DestroyEventLoop(pEventLoop);
+      return nullptr;
+    }
+  }
+#endif
 
-      if (bind(fileDescriptor, (const sockaddr*)pAddress->GetData(), sizeof(sockaddr_in6)) < 0)
-      {
-        if (pError != nullptr)
-          pError->SetErrorSocket(WSAGetLastError());
+  return pEventLoop;
+}
 
-        closesocket(fileDescriptor);
-        return nullptr;
-      }
+void SocketMultiplexer::DestroyEventLoop(EventLoop* pEventLoop)
+{
+  DebugAssert(pEventLoop->pWorkerThread == nullptr);
 
-      if (listen(fileDescriptor, 5) < 0)
-      {
-        if (pError != nullptr)
-          pError->SetErrorSocket(WSAGetLastError());
+#ifdef Y_PLATFORM_LINUX
+  if (pEventLoop->WakeupFileDescriptor >= 0)
+    close(pEventLoop->WakeupFileDescriptor);
+  if (pEventLoop->EpollFileDescriptor >= 0)
+    close(pEventLoop->EpollFileDescriptor);
+#endif
+
+  delete pEventLoop;
+}
 
-        closesocket(fileDescriptor);
-        return nullptr;
-      }
 
+// Creates an unbound socket of the address's family, sequenced packet sockets only being available for unix domain.
+static SOCKET CreateSocketForAddress(const SocketAddress* pAddress, int type, int protocol, Error* pError)
+{
+  int family;
+  switch (pAddress->GetType())
+  {
+    case SocketAddress::Type_IPv4:
+      family = AF_INET;
       break;
-    }
+
+    case SocketAddress::Type_IPv6:
+      family = AF_INET6;
+      break;
+
+#ifndef Y_PLATFORM_WINDOWS
+    case SocketAddress::Type_Unix:
+      family = AF_UNIX;
+      protocol = 0;
+      break;
+#endif
 
     default:
     {
       if (pError != nullptr)
         pError->SetErrorUser((int32)0, "Unknown address type.");
 
-      return nullptr;
+      return INVALID_SOCKET;
     }
   }
 
+#ifndef Y_PLATFORM_WINDOWS
+  if (type == SOCK_SEQPACKET && family != AF_UNIX)
+  {
+    if (pError != nullptr)
+      pError->SetErrorUser((int32)0, "Sequenced packet sockets need a unix domain address.");
+
+    return INVALID_SOCKET;
+  }
+#endif
+
+  SOCKET fileDescriptor = socket(family, type, protocol);
+  if (fileDescriptor == INVALID_SOCKET && pError != nullptr)
+    pError->SetErrorSocket(WSAGetLastError());
+
+  return fileDescriptor;
+}
+
+static int GetSocketType(SOCKET_STREAM_TYPE streamType)
+{
+#ifndef Y_PLATFORM_WINDOWS
+  if (streamType == SOCKET_STREAM_TYPE_SEQPACKET)
+    return SOCK_SEQPACKET;
+#endif
+
+  return SOCK_STREAM;
+}
+
+ListenSocket* SocketMultiplexer::InternalCreateListenSocket(const SocketAddress* pAddress,
+                                                            CreateStreamSocketCallback callback,
+                                                            SOCKET_STREAM_TYPE streamType, Error* pError)
+{
+  // create and bind socket
+  SOCKET fileDescriptor = CreateSocketForAddress(pAddress, GetSocketType(streamType), IPPROTO_TCP, pError);
+  if (fileDescriptor == INVALID_SOCKET)
+    return nullptr;
+
+  if (bind(fileDescriptor, (const sockaddr*)pAddress->GetData(), pAddress->GetLength()) < 0 ||
+      listen(fileDescriptor, SOMAXCONN) < 0)
+  {
+    if (pError != nullptr)
+      pError->SetErrorSocket(WSAGetLastError());
+
+    closesocket(fileDescriptor);
+    return nullptr;
+  }
+
+  // switch to nonblocking mode, so the accept loop stops when the queue is empty
+  unsigned long value = 1;
+  if (ioctlsocket(fileDescriptor, FIONBIO, &value) < 0)
+  {
+    if (pError != nullptr)
+      pError->SetErrorSocket(WSAGetLastError());
+
+    closesocket(fileDescriptor);
+    return nullptr;
+  }
+
   // create listensocket
   return new ListenSocket(this, callback, fileDescriptor);
 }
 
 StreamSocket* SocketMultiplexer::InternalConnectStreamSocket(const SocketAddress* pAddress,
-                                                             CreateStreamSocketCallback callback, Error* pError)
+                                                             CreateStreamSocketCallback callback,
+                                                             SOCKET_STREAM_TYPE streamType, Error* pError)
 {
-  // create and bind socket
-  SOCKET fileDescriptor = INVALID_SOCKET;
-  switch (pAddress->GetType())
+  // create and connect socket
+  SOCKET fileDescriptor = CreateSocketForAddress(pAddress, GetSocketType(streamType), IPPROTO_TCP, pError);
+  if (fileDescriptor == INVALID_SOCKET)
+    return nullptr;
+
+  if (connect(fileDescriptor, (const sockaddr*)pAddress->GetData(), pAddress->GetLength()) < 0)
   {
-    case SocketAddress::Type_IPv4:
-    {
-      fileDescriptor = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-      if (fileDescriptor == INVALID_SOCKET)
-      {
-        if (pError != nullptr)
-          pError->SetErrorSocket(WSAGetLastError());
+    if (pError != nullptr)
+      pError->SetErrorSocket(WSAGetLastError());
 
-        return nullptr;
-      }
+    closesocket(fileDescriptor);
+    return nullptr;
+  }
 
-      if (connect(fileDescriptor, (const sockaddr*)pAddress->GetData(), sizeof(sockaddr_in)) < 0)
-      {
-        if (pError != nullptr)
-          pError->SetErrorSocket(WSAGetLastError());
+  // create stream socket
+  StreamSocket* pSocket = callback();
+  if (!pSocket->InitializeSocket(this, fileDescriptor, pError))
+  {
+    pSocket->Release();
+    return nullptr;
+  }
 
-        closesocket(fileDescriptor);
-        return nullptr;
-      }
+  return pSocket;
+}
 
-      break;
-    }
+bool SocketMultiplexer::InternalCreateStreamSocketPair(CreateStreamSocketCallback firstCallback,
+                                                       CreateStreamSocketCallback secondCallback,
+                                                       SOCKET_STREAM_TYPE streamType, StreamSocket** ppFirstSocket,
+                                                       StreamSocket** ppSecondSocket, Error* pError)
+{
+#ifndef Y_PLATFORM_WINDOWS
+  int fileDescriptors[2];
+  if (socketpair(AF_UNIX, GetSocketType(streamType), 0, fileDescriptors) < 0)
+  {
+    if (pError != nullptr)
+      pError->SetErrorSocket(WSAGetLastError());
 
-    case SocketAddress::Type_IPv6:
-    {
-      fileDescriptor = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
-      if (fileDescriptor == INVALID_SOCKET)
-      {
-        if (pError != nullptr)
-          pError->SetErrorSocket(WSAGetLastError());
+    return false;
+  }
 
-        return nullptr;
-      }
+  // the second end is closed along with the first if the first can't be set up
+  StreamSocket* pFirstSocket = firstCallback();
+  if (!pFirstSocket->InitializeSocket(this, fileDescriptors[0], pError))
+  {
+    pFirstSocket->Release();
+    closesocket(fileDescriptors[1]);
+    return false;
+  }
 
-      if (connect(fileDescriptor, (const sockaddr*)pAddress->GetData(), sizeof(sockaddr_in6)) < 0)
-      {
-        if (pError != nullptr)
-          pError->SetErrorSocket(WSAGetLastError());
+  StreamSocket* pSecondSocket = secondCallback();
+  if (!pSecondSocket->InitializeSocket(this, fileDescriptors[1], pError))
+  {
+    pSecondSocket->Release();
+    pFirstSocket->Close();
+    pFirstSocket->Release();
+    return false;
+  }
 
-        closesocket(fileDescriptor);
-        return nullptr;
-      }
+  *ppFirstSocket = pFirstSocket;
+  *ppSecondSocket = pSecondSocket;
+  return true;
+#else
+  if (pError != nullptr)
+    pError->SetErrorUser((int32)0, "Socket pairs are not supported on this platform.");
 
-      break;
-    }
+  return false;
+#endif
+}
 
-    default:
-    {
-      if (pError != nullptr)
-        pError->SetErrorUser((int32)0, "Unknown address type.");
+DatagramSocket* SocketMultiplexer::InternalCreateDatagramSocket(const SocketAddress* pBindAddress,
+                                                                CreateDatagramSocketCallback callback, Error* pError)
+{
+  // create and bind socket
+  SOCKET fileDescriptor = CreateSocketForAddress(pBindAddress, SOCK_DGRAM, IPPROTO_UDP, pError);
+  if (fileDescriptor == INVALID_SOCKET)
+    return nullptr;
 
-      return nullptr;
-    }
+  if (bind(fileDescriptor, (const sockaddr*)pBindAddress->GetData(), pBindAddress->GetLength()) < 0)
+  {
+    if (pError != nullptr)
+      pError->SetErrorSocket(WSAGetLastError());
+
+    closesocket(fileDescriptor);
+    return nullptr;
   }
 
-  // create stream socket
-  StreamSocket* pSocket = callback();
+  // create datagram socket
+  DatagramSocket* pSocket = callback();
   if (!pSocket->InitializeSocket(this, fileDescriptor, pError))
   {
     pSocket->Release();
@@ -192,6 +357,9 @@ StreamSocket* SocketMultiplexer::InternalConnectStreamSocket(const SocketAddress
 
 void SocketMultiplexer::AddOpenSocket(BaseSocket* pSocket)
 {
+  // hand sockets out to the loops in turn, they're fired from that loop's thread for the rest of their life
+  pSocket->m_eventLoopIndex = (Y_AtomicIncrement(m_nextEventLoop) - 1) % m_activeEventLoopCount;
+
   m_openSocketLock.Lock();
 
   DebugAssert(m_openSockets.IndexOf(pSocket) < 0);
@@ -207,10 +375,16 @@ void SocketMultiplexer::RemoveOpenSocket(BaseSocket* pSocket)
 
 #ifdef Y_BUILD_CONFIG_DEBUG
   // double-locking, living dangerously!
-  m_boundSocketLock.Lock();
-  for (BoundSocket& boundSocket : m_boundSockets)
-    DebugAssert(boundSocket.pSocket != pSocket);
-  m_boundSocketLock.Unlock();
+  for (uint32 i = 0; i < m_eventLoopCount; i++)
+  {
+    EventLoop* pEventLoop = m_eventLoops[i];
+    pEventLoop->BoundSocketLock.Lock();
+    for (BoundSocket& boundSocket : pEventLoop->BoundSockets)
+      DebugAssert(boundSocket.pSocket != pSocket);
+    for (BoundSocket& boundSocket : pEventLoop->SocketsByFileDescriptor)
+      DebugAssert(boundSocket.pSocket != pSocket);
+    pEventLoop->BoundSocketLock.Unlock();
+  }
 #endif
 
   DebugAssert(m_openSockets.IndexOf(pSocket) >= 0);
@@ -254,22 +428,43 @@ void SocketMultiplexer::CloseAll()
 
 void SocketMultiplexer::SetNotificationMask(BaseSocket* pSocket, SOCKET fileDescriptor, uint32 mask)
 {
-  m_boundSocketLock.Lock();
+  DebugAssert(pSocket->m_eventLoopIndex < m_eventLoopCount);
+  EventLoop* pEventLoop = m_eventLoops[pSocket->m_eventLoopIndex];
+  if (m_type == SOCKET_MULTIPLEXER_TYPE_EPOLL)
+    SetNotificationMaskEpoll(pEventLoop, pSocket, fileDescriptor, mask);
+  else
+    SetNotificationMaskSelect(pEventLoop, pSocket, fileDescriptor, mask);
+}
+
+void SocketMultiplexer::SetNotificationMaskSelect(EventLoop* pEventLoop, BaseSocket* pSocket, SOCKET fileDescriptor,
+                                                  uint32 mask)
+{
+  // select is level-triggered regardless
+  mask &= ~(uint32)EventType_EdgeTriggered;
 
-  for (uint32 i = 0; i < m_boundSockets.GetSize(); i++)
+  pEventLoop->BoundSocketLock.Lock();
+
+  for (uint32 i = 0; i < pEventLoop->BoundSockets.GetSize(); i++)
   {
-    BoundSocket& boundSocket = m_boundSockets[i];
+    BoundSocket& boundSocket = pEventLoop->BoundSockets[i];
     if (boundSocket.FileDescriptor == fileDescriptor)
     {
       DebugAssert(boundSocket.pSocket == pSocket);
 
       // unbinding?
+      uint32 addedEvents = mask & ~boundSocket.EventMask;
       if (mask != 0)
         boundSocket.EventMask = mask;
       else
-        m_boundSockets.FastRemove(i);
+        pEventLoop->BoundSockets.FastRemove(i);
+
+      pEventLoop->BoundSocketLock.Unlock();
+
+      // the select in progress was built from the old mask, so it wouldn't see the new events until it timed out.
+      // dropped events don't matter, a spurious one is ignored by the socket.
+      if (addedEvents != 0)
+        Wakeup(pEventLoop);
 
-      m_boundSocketLock.Unlock();
       return;
     }
   }
@@ -281,14 +476,98 @@ void SocketMultiplexer::SetNotificationMask(BaseSocket* pSocket, SOCKET fileDesc
     boundSocket.pSocket = pSocket;
     boundSocket.FileDescriptor = fileDescriptor;
     boundSocket.EventMask = mask;
-    m_boundSockets.Add(boundSocket);
+    pEventLoop->BoundSockets.Add(boundSocket);
   }
 
-  m_wakeupEvent.Signal();
-  m_boundSocketLock.Unlock();
+  pEventLoop->BoundSocketLock.Unlock();
+
+  if (mask != 0)
+    Wakeup(pEventLoop);
 }
 
 void SocketMultiplexer::PollEvents(uint32 milliseconds)
+{
+  PollEventLoop(m_eventLoops[0], milliseconds);
+}
+
+void SocketMultiplexer::PollEventLoop(EventLoop* pEventLoop, uint32 milliseconds)
+{
+  // don't sleep past the next timer
+  uint64 currentTick = GetTimerTick();
+  pEventLoop->TimerLock.Lock();
+  uint64 wakeupTick = pEventLoop->TimerWheel.GetNextWakeupTick();
+  if (wakeupTick != Y_UINT64_MAX)
+    milliseconds = (uint32)Min((uint64)milliseconds, (wakeupTick > currentTick) ? (wakeupTick - currentTick) : 0);
+  pEventLoop->PollDeadline = (milliseconds != Y_UINT32_MAX) ? (currentTick + milliseconds) : Y_UINT64_MAX;
+  pEventLoop->TimerLock.Unlock();
+
+  if (m_type == SOCKET_MULTIPLEXER_TYPE_EPOLL)
+    PollEventsEpoll(pEventLoop, milliseconds);
+  else
+    PollEventsSelect(pEventLoop, milliseconds);
+
+  FireTimers(pEventLoop);
+}
+
+void SocketMultiplexer::FireTimers(EventLoop* pEventLoop)
+{
+  // one at a time, without the lock, so OnTimer can schedule and cancel. the timer isn't touched after it fires.
+  uint64 currentTick = GetTimerTick();
+  for (;;)
+  {
+    pEventLoop->TimerLock.Lock();
+    SocketTimer* pTimer = pEventLoop->TimerWheel.PopExpiredTimer(currentTick);
+    pEventLoop->TimerLock.Unlock();
+    if (pTimer == nullptr)
+      break;
+
+    pTimer->OnTimer();
+  }
+}
+
+void SocketMultiplexer::ScheduleTimer(SocketTimer* pTimer, uint32 milliseconds, BaseSocket* pSocket /* = nullptr */)
+{
+  // it may be moving to another loop
+  CancelTimer(pTimer);
+
+  uint32 eventLoopIndex = (pSocket != nullptr) ? pSocket->m_eventLoopIndex : 0;
+  EventLoop* pEventLoop = m_eventLoops[eventLoopIndex];
+  uint64 deadline = GetTimerTick() + milliseconds;
+
+  pEventLoop->TimerLock.Lock();
+  pTimer->m_eventLoopIndex = eventLoopIndex;
+  pEventLoop->TimerWheel.Schedule(pTimer, deadline);
+  bool wakeup = (deadline < pEventLoop->PollDeadline);
+  pEventLoop->TimerLock.Unlock();
+
+  // the poll in progress would oversleep it
+  if (wakeup)
+    Wakeup(pEventLoop);
+}
+
+bool SocketMultiplexer::CancelTimer(SocketTimer* pTimer)
+{
+  if (!pTimer->m_scheduled)
+    return false;
+
+  EventLoop* pEventLoop = m_eventLoops[pTimer->m_eventLoopIndex];
+  pEventLoop->TimerLock.Lock();
+
+  // check again, it may have been popped to fire in the meantime
+  bool cancelled = pTimer->m_scheduled;
+  if (cancelled)
+    pEventLoop->TimerWheel.Cancel(pTimer);
+
+  pEventLoop->TimerLock.Unlock();
+  return cancelled;
+}
+
+uint64 SocketMultiplexer::GetTimerTick()
+{
+  return (uint64)Y_TimerConvertToMilliseconds(Y_TimerGetValue());
+}
+
+void SocketMultiplexer::PollEventsSelect(EventLoop* pEventLoop, uint32 milliseconds)
 {
   fd_set readFds;
   fd_set writeFds;
@@ -303,8 +582,8 @@ void SocketMultiplexer::PollEvents(uint32 milliseconds)
     FD_ZERO(&writeFds);
 
     // fill stuff
-    m_boundSocketLock.Lock();
-    for (BoundSocket& boundSocket : m_boundSockets)
+    pEventLoop->BoundSocketLock.Lock();
+    for (BoundSocket& boundSocket : pEventLoop->BoundSockets)
     {
       if (boundSocket.EventMask & EventType_Read)
         FD_SET(boundSocket.FileDescriptor, &readFds);
@@ -314,8 +593,8 @@ void SocketMultiplexer::PollEvents(uint32 milliseconds)
       maxFileDescriptor = Max(boundSocket.FileDescriptor, maxFileDescriptor);
       setCount++;
     }
-    m_boundSocketLock.Unlock();
-    if (setCount > 0)
+    pEventLoop->BoundSocketLock.Unlock();
+    if (setCount > 0 || pEventLoop->WakeupFileDescriptor >= 0)
       break;
 
     // win32 select doesn't seem to sleep as one would expect.
@@ -323,14 +602,22 @@ void SocketMultiplexer::PollEvents(uint32 milliseconds)
       return;
 
     // in case a socket is added/removed in the meantime.
-    if (!m_wakeupEvent.TryWait(milliseconds))
+    if (!pEventLoop->WakeupEvent.TryWait(milliseconds))
       return;
 
     // exit immediately after this next poll, don't wait.
-    m_wakeupEvent.Reset();
+    pEventLoop->WakeupEvent.Reset();
     milliseconds = 0;
   }
 
+#ifdef Y_PLATFORM_LINUX
+  if (pEventLoop->WakeupFileDescriptor >= 0)
+  {
+    FD_SET(pEventLoop->WakeupFileDescriptor, &readFds);
+    maxFileDescriptor = Max((SOCKET)pEventLoop->WakeupFileDescriptor, maxFileDescriptor);
+  }
+#endif
+
   // call select
   timeval tv;
   tv.tv_sec = milliseconds / 1000;
@@ -340,11 +627,20 @@ void SocketMultiplexer::PollEvents(uint32 milliseconds)
   if (result <= 0)
     return;
 
+#ifdef Y_PLATFORM_LINUX
+  if (pEventLoop->WakeupFileDescriptor >= 0 && FD_ISSET(pEventLoop->WakeupFileDescriptor, &readFds))
+  {
+    uint64 value;
+    while (read(pEventLoop->WakeupFileDescriptor, &value, sizeof(value)) > 0)
+      continue;
+  }
+#endif
+
   // find sockets that triggered, we use an array here so we can avoid holding the lock, and if a socket disconnects
   BoundSocket* pTriggeredSockets = (BoundSocket*)alloca(sizeof(BoundSocket) * setCount);
   uint32 nTriggeredSockets = 0;
-  m_boundSocketLock.Lock();
-  for (BoundSocket& boundSocket : m_boundSockets)
+  pEventLoop->BoundSocketLock.Lock();
+  for (BoundSocket& boundSocket : pEventLoop->BoundSockets)
   {
     uint32 eventMask = 0;
     if (FD_ISSET(boundSocket.FileDescriptor, &readFds))
@@ -352,22 +648,162 @@ void SocketMultiplexer::PollEvents(uint32 milliseconds)
     if (FD_ISSET(boundSocket.FileDescriptor, &writeFds))
       eventMask |= EventType_Write;
 
+    // we add a reference here in case the read kills it with a write pending, or something like that. taken while
+    // the lock is held, so a socket being closed on another thread can't be freed underneath us.
     if (eventMask != 0)
     {
       pTriggeredSockets[nTriggeredSockets].pSocket = boundSocket.pSocket;
       pTriggeredSockets[nTriggeredSockets].EventMask = eventMask;
+      pTriggeredSockets[nTriggeredSockets].pSocket->AddRef();
       nTriggeredSockets++;
     }
   }
-  m_boundSocketLock.Unlock();
+  pEventLoop->BoundSocketLock.Unlock();
+
+  FireEvents(pTriggeredSockets, nTriggeredSockets);
+}
+
+#ifdef Y_PLATFORM_LINUX
+
+void SocketMultiplexer::SetNotificationMaskEpoll(EventLoop* pEventLoop, BaseSocket* pSocket, SOCKET fileDescriptor,
+                                                 uint32 mask)
+{
+  MemArray<BoundSocket>& socketsByFileDescriptor = pEventLoop->SocketsByFileDescriptor;
+  pEventLoop->BoundSocketLock.Lock();
+
+  if ((uint32)fileDescriptor >= socketsByFileDescriptor.GetSize())
+  {
+    // nothing to unbind
+    if (mask == 0)
+    {
+      pEventLoop->BoundSocketLock.Unlock();
+      return;
+    }
+
+    socketsByFileDescriptor.Resize(Max((uint32)fileDescriptor + 1, socketsByFileDescriptor.GetSize() * 2));
+  }
+
+  BoundSocket& boundSocket = socketsByFileDescriptor[fileDescriptor];
+  int operation;
+  if (mask == 0)
+  {
+    if (boundSocket.pSocket == nullptr)
+    {
+      pEventLoop->BoundSocketLock.Unlock();
+      return;
+    }
+
+    DebugAssert(boundSocket.pSocket == pSocket);
+    boundSocket.pSocket = nullptr;
+    boundSocket.EventMask = 0;
+    operation = EPOLL_CTL_DEL;
+  }
+  else
+  {
+    // modifying an existing registration also re-arms edge-triggered events that are still pending, which is how
+    // sockets that stopped reading early (e.g. a full buffer) get told about data they left behind
+    DebugAssert(boundSocket.pSocket == nullptr || boundSocket.pSocket == pSocket);
+    operation = (boundSocket.pSocket != nullptr) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    boundSocket.pSocket = pSocket;
+    boundSocket.EventMask = mask;
+    boundSocket.FileDescriptor = fileDescriptor;
+  }
+
+  epoll_event ev;
+  Y_memzero(&ev, sizeof(ev));
+  ev.data.fd = fileDescriptor;
+  if (mask & EventType_Read)
+    ev.events |= EPOLLIN | EPOLLRDHUP;
+  if (mask & EventType_Write)
+    ev.events |= EPOLLOUT;
+  if (mask & EventType_EdgeTriggered)
+    ev.events |= EPOLLET;
+
+  if (epoll_ctl(pEventLoop->EpollFileDescriptor, operation, fileDescriptor, &ev) < 0)
+  {
+    Log_ErrorPrintf("SocketMultiplexer::SetNotificationMaskEpoll: epoll_ctl(%d, %d) failed: %d", operation,
+                    (int)fileDescriptor, errno);
+  }
+
+  pEventLoop->BoundSocketLock.Unlock();
+}
+
+void SocketMultiplexer::PollEventsEpoll(EventLoop* pEventLoop, uint32 milliseconds)
+{
+  const MemArray<BoundSocket>& socketsByFileDescriptor = pEventLoop->SocketsByFileDescriptor;
+  epoll_event events[EPOLL_BATCH_SIZE];
+  int timeout = (milliseconds != Y_UINT32_MAX) ? (int)Min(milliseconds, (uint32)Y_INT32_MAX) : -1;
+  int nEvents = epoll_wait(pEventLoop->EpollFileDescriptor, events, EPOLL_BATCH_SIZE, timeout);
+  if (nEvents <= 0)
+    return;
+
+  // look the sockets up under the lock, taking references, then fire without it
+  BoundSocket* pTriggeredSockets = (BoundSocket*)alloca(sizeof(BoundSocket) * nEvents);
+  uint32 nTriggeredSockets = 0;
+  pEventLoop->BoundSocketLock.Lock();
+  for (int i = 0; i < nEvents; i++)
+  {
+    int fileDescriptor = events[i].data.fd;
+    if (fileDescriptor == pEventLoop->WakeupFileDescriptor)
+    {
+      // drain it, the count doesn't matter
+      uint64 value;
+      while (read(pEventLoop->WakeupFileDescriptor, &value, sizeof(value)) > 0)
+        continue;
+
+      continue;
+    }
 
-  // fire events
+    // unregistered since the wait returned?
+    if ((uint32)fileDescriptor >= socketsByFileDescriptor.GetSize() ||
+        socketsByFileDescriptor[fileDescriptor].pSocket == nullptr)
+    {
+      continue;
+    }
+
+    // errors and hangups are passed on as whichever events the socket wants, the handler's read/write finds them
+    const BoundSocket& boundSocket = socketsByFileDescriptor[fileDescriptor];
+    uint32 eventMask = 0;
+    if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+      eventMask |= EventType_Read;
+    if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+      eventMask |= EventType_Write;
+
+    eventMask &= boundSocket.EventMask;
+    if (eventMask != 0)
+    {
+      pTriggeredSockets[nTriggeredSockets].pSocket = boundSocket.pSocket;
+      pTriggeredSockets[nTriggeredSockets].EventMask = eventMask;
+      pTriggeredSockets[nTriggeredSockets].pSocket->AddRef();
+      nTriggeredSockets++;
+    }
+  }
+  pEventLoop->BoundSocketLock.Unlock();
+
+  FireEvents(pTriggeredSockets, nTriggeredSockets);
+}
+
+#else // Y_PLATFORM_LINUX
+
+void SocketMultiplexer::SetNotificationMaskEpoll(EventLoop* pEventLoop, BaseSocket* pSocket, SOCKET fileDescriptor,
+                                                 uint32 mask)
+{
+  Panic("epoll multiplexer on unsupported platform");
+}
+
+void SocketMultiplexer::PollEventsEpoll(EventLoop* pEventLoop, uint32 milliseconds)
+{
+  Panic("epoll multiplexer on unsupported platform");
+}
+
+#endif // Y_PLATFORM_LINUX
+
+void SocketMultiplexer::FireEvents(const BoundSocket* pTriggeredSockets, uint32 nTriggeredSockets)
+{
   for (uint32 i = 0; i < nTriggeredSockets; i++)
   {
-    // we add a reference here in case the read kills it with a write pending, or something like that
     BaseSocket* pSocket = pTriggeredSockets[i].pSocket;
     uint32 eventMask = pTriggeredSockets[i].EventMask;
-    pSocket->AddRef();
 
     // fire events
     if (eventMask & EventType_Read)
@@ -380,44 +816,170 @@ void SocketMultiplexer::PollEvents(uint32 milliseconds)
   }
 }
 
-SocketMultiplexer::WorkerThread::WorkerThread(SocketMultiplexer* pThis) : m_pThis(pThis), m_stopFlag(false) {}
+void SocketMultiplexer::Wakeup(EventLoop* pEventLoop)
+{
+#ifdef Y_PLATFORM_LINUX
+  // the eventfd is always polled, so the event is never waited on here
+  if (pEventLoop->WakeupFileDescriptor >= 0)
+  {
+    uint64 value = 1;
+    if (write(pEventLoop->WakeupFileDescriptor, &value, sizeof(value)) < 0)
+      Log_ErrorPrintf("SocketMultiplexer::Wakeup: write to eventfd failed: %d", errno);
+
+    return;
+  }
+#endif
+
+  pEventLoop->WakeupEvent.Signal();
+}
+
+SocketMultiplexer::WorkerThread::WorkerThread(SocketMultiplexer* pThis, EventLoop* pEventLoop)
+  : m_pThis(pThis), m_pEventLoop(pEventLoop), m_stopFlag(false)
+{
+}
 
 int SocketMultiplexer::WorkerThread::ThreadEntryPoint()
 {
   while (!m_stopFlag)
-    m_pThis->PollEvents(1000);
+    m_pThis->PollEventLoop(m_pEventLoop, 1000);
 
   return 0;
 }
 
 uint32 SocketMultiplexer::CreateWorkerThreads(uint32 threadCount /*= 0*/)
 {
-  // Only a single worker thread permitted.
-  threadCount = 1;
+  // One loop per CPU thread by default.
+  if (threadCount == 0)
+  {
+    Y_CPUID_RESULT cpuid;
+    Y_ReadCPUID(&cpuid);
+    threadCount = Max(cpuid.ThreadCount, (uint32)1);
+  }
+  threadCount = Min(threadCount, MAX_EVENT_LOOPS);
+
+  m_eventLoopLock.Lock();
+
+  // Create any loops we don't have yet. The pointer has to be visible before the count is, as sockets being opened
+  // on other threads index the array without the lock.
+  while (m_eventLoopCount < threadCount)
+  {
+    Error error;
+    EventLoop* pEventLoop = CreateEventLoop(&error);
+    if (pEventLoop == nullptr)
+    {
+      Log_ErrorPrintf("SocketMultiplexer::CreateWorkerThreads: Failed to create event loop: %s",
+                      error.GetErrorCodeAndDescription().GetCharArray());
+      break;
+    }
+
+    m_eventLoops[m_eventLoopCount] = pEventLoop;
+    Y_AtomicIncrement(m_eventLoopCount);
+  }
 
-  // Create worker thread.
-  m_pWorkerThread = new WorkerThread(this);
-  if (!m_pWorkerThread->Start())
+  // Start a thread on each loop that doesn't have one.
+  uint32 runningCount = 0;
+  for (uint32 i = 0; i < m_eventLoopCount; i++)
   {
-    Log_ErrorPrint("Failed to start worker thread.");
-    delete m_pWorkerThread;
-    return 0;
+    EventLoop* pEventLoop = m_eventLoops[i];
+    if (pEventLoop->pWorkerThread == nullptr)
+    {
+      WorkerThread* pWorkerThread = new WorkerThread(this, pEventLoop);
+      if (!pWorkerThread->Start())
+      {
+        Log_ErrorPrint("Failed to start worker thread.");
+        delete pWorkerThread;
+        continue;
+      }
+
+      pEventLoop->pWorkerThread = pWorkerThread;
+    }
+
+    runningCount++;
   }
 
-  // Return created amount.
-  return threadCount;
+  m_activeEventLoopCount = m_eventLoopCount;
+  m_eventLoopLock.Unlock();
+
+  // Return running amount.
+  return runningCount;
 }
 
 void SocketMultiplexer::StopWorkerThreads()
 {
-  if (m_pWorkerThread != nullptr)
+  m_eventLoopLock.Lock();
+
+  for (uint32 i = 0; i < m_eventLoopCount; i++)
+  {
+    EventLoop* pEventLoop = m_eventLoops[i];
+    WorkerThread* pWorkerThread = pEventLoop->pWorkerThread;
+    if (pWorkerThread != nullptr)
+    {
+      pWorkerThread->m_stopFlag = true;
+      Wakeup(pEventLoop);
+      pWorkerThread->Join();
+      delete pWorkerThread;
+      pEventLoop->pWorkerThread = nullptr;
+    }
+  }
+
+  // Only the first loop is polled from here on, so everything has to live there.
+  m_activeEventLoopCount = 1;
+  for (uint32 i = 1; i < m_eventLoopCount; i++)
+    MoveEventLoopContents(m_eventLoops[i], m_eventLoops[0]);
+
+  m_openSocketLock.Lock();
+  for (BaseSocket* pSocket : m_openSockets)
+    pSocket->m_eventLoopIndex = 0;
+  m_openSocketLock.Unlock();
+
+  m_eventLoopLock.Unlock();
+}
+
+void SocketMultiplexer::MoveEventLoopContents(EventLoop* pFromEventLoop, EventLoop* pToEventLoop)
+{
+  MemArray<BoundSocket> movedSockets;
+  pFromEventLoop->BoundSocketLock.Lock();
+  if (m_type == SOCKET_MULTIPLEXER_TYPE_EPOLL)
+  {
+    for (const BoundSocket& boundSocket : pFromEventLoop->SocketsByFileDescriptor)
+    {
+      if (boundSocket.pSocket != nullptr)
+        movedSockets.Add(boundSocket);
+    }
+  }
+  else
+  {
+    movedSockets.AddRange(pFromEventLoop->BoundSockets.GetBasePointer(), pFromEventLoop->BoundSockets.GetSize());
+    pFromEventLoop->BoundSockets.Clear();
+  }
+  pFromEventLoop->BoundSocketLock.Unlock();
+
+  // Off the old loop before onto the new one, so a socket is never registered with both.
+  for (const BoundSocket& boundSocket : movedSockets)
+  {
+    boundSocket.pSocket->m_eventLoopIndex = pToEventLoop->Index;
+    if (m_type == SOCKET_MULTIPLEXER_TYPE_EPOLL)
+    {
+      SetNotificationMaskEpoll(pFromEventLoop, boundSocket.pSocket, boundSocket.FileDescriptor, 0);
+      SetNotificationMaskEpoll(pToEventLoop, boundSocket.pSocket, boundSocket.FileDescriptor, boundSocket.EventMask);
+    }
+    else
+    {
+      SetNotificationMaskSelect(pToEventLoop, boundSocket.pSocket, boundSocket.FileDescriptor, boundSocket.EventMask);
+    }
+  }
+
+  // Timers keep their deadlines.
+  pFromEventLoop->TimerLock.Lock();
+  pToEventLoop->TimerLock.Lock();
+  SocketTimer* pTimer;
+  while ((pTimer = pFromEventLoop->TimerWheel.PopAnyTimer()) != nullptr)
   {
-    m_pWorkerThread->m_stopFlag = true;
-    m_wakeupEvent.Signal();
-    m_pWorkerThread->Join();
-    delete m_pWorkerThread;
-    m_pWorkerThread = nullptr;
+    pTimer->m_eventLoopIndex = pToEventLoop->Index;
+    pToEventLoop->TimerWheel.Schedule(pTimer, pTimer->m_deadline);
   }
+  pToEventLoop->TimerLock.Unlock();
+  pFromEventLoop->TimerLock.Unlock();
 }
 
 #endif // Y_SOCKET_IMPLEMENTATION_GENERIC
@@ -1,11 +1,30 @@
 #include "YBaseLib/Sockets/StreamSocket.h"
+#include "YBaseLib/ByteStream.h"
 #include "YBaseLib/Error.h"
 #include "YBaseLib/Log.h"
+#include "YBaseLib/Memory.h"
 #include "YBaseLib/Sockets/SocketMultiplexer.h"
 Log_SetChannel(StreamSocket);
 
 #ifdef Y_SOCKET_IMPLEMENTATION_GENERIC
 
+#ifdef Y_PLATFORM_LINUX
+#include <linux/errqueue.h>
+#include <sys/sendfile.h>
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define HAVE_ZEROCOPY_SEND 1
+#endif
+#endif
+
+// Largest single sendfile call, so one large file doesn't hold the socket lock for too long.
+static const uint64 SENDFILE_CHUNK_SIZE = 16 * 1024 * 1024;
+
+// Streams which aren't backed by a file or memory are sent through a buffer this size.
+static const uint32 SENDFILE_BUFFER_SIZE = 65536;
+
+// Smaller sends are copied, the page pinning and completion notification cost more than the copy.
+static const size_t ZEROCOPY_MIN_SIZE = 16384;
+
 // Windows-isms
 #ifndef Y_PLATFORM_WINDOWS
 #define ioctlsocket ioctl
@@ -18,23 +37,45 @@ Log_SetChannel(StreamSocket);
 #endif
 
 StreamSocket::StreamSocket()
-  : BaseSocket(), m_pMultiplexer(nullptr), m_fileDescriptor(INVALID_SOCKET), m_connected(false)
+  : BaseSocket(), m_pMultiplexer(nullptr), m_fileDescriptor(INVALID_SOCKET), m_connected(false),
+    m_edgeTriggered(false), m_zeroCopyTried(false), m_zeroCopyEnabled(false), m_nextZeroCopyID(0),
+    m_zeroCopyOutstanding(0), m_unixDomain(false)
 {
 }
 
 StreamSocket::~StreamSocket()
 {
   DebugAssert(m_fileDescriptor < 0);
+
+#ifndef Y_PLATFORM_WINDOWS
+  for (int fileDescriptor : m_receivedFileDescriptors)
+    close(fileDescriptor);
+#endif
 }
 
 size_t StreamSocket::Read(void* pBuffer, size_t bufferSize)
 {
   m_lock.Lock();
   if (!m_connected)
+  {
+    m_lock.Unlock();
     return 0;
+  }
 
   // try a read
-  ssize_t len = recv(m_fileDescriptor, (char*)pBuffer, SIZE_CAST(bufferSize), 0);
+  ssize_t len;
+#ifndef Y_PLATFORM_WINDOWS
+  if (m_unixDomain)
+  {
+    iovec vector = {pBuffer, bufferSize};
+    len = ReceiveWithFileDescriptors(&vector, 1);
+  }
+  else
+#endif
+  {
+    len = recv(m_fileDescriptor, (char*)pBuffer, SIZE_CAST(bufferSize), 0);
+  }
+
   if (len <= 0)
   {
     // Check for EAGAIN
@@ -55,6 +96,84 @@ size_t StreamSocket::Read(void* pBuffer, size_t bufferSize)
   return len;
 }
 
+size_t StreamSocket::ReadVector(void** ppBuffers, const size_t* pBufferLengths, size_t numBuffers)
+{
+  m_lock.Lock();
+
+  if (!m_connected || numBuffers == 0)
+  {
+    m_lock.Unlock();
+    return 0;
+  }
+
+#ifdef Y_PLATFORM_WINDOWS
+
+  WSABUF* bufs = (WSABUF*)alloca(sizeof(WSABUF) * numBuffers);
+  for (size_t i = 0; i < numBuffers; i++)
+  {
+    bufs[i].buf = (CHAR*)ppBuffers[i];
+    bufs[i].len = (ULONG)pBufferLengths[i];
+  }
+
+  DWORD bytesReceived = 0;
+  DWORD flags = 0;
+  if (WSARecv(m_fileDescriptor, bufs, (DWORD)numBuffers, &bytesReceived, &flags, nullptr, nullptr) == SOCKET_ERROR)
+  {
+    if (WSAGetLastError() == WSAEWOULDBLOCK)
+    {
+      // Not an error. Just means no data is available.
+      m_lock.Unlock();
+      return 0;
+    }
+
+    // Socket error.
+    CloseWithError();
+    m_lock.Unlock();
+    return 0;
+  }
+  else if (bytesReceived == 0)
+  {
+    // Connection closed by peer.
+    CloseWithError();
+    m_lock.Unlock();
+    return 0;
+  }
+
+  m_lock.Unlock();
+  return (size_t)bytesReceived;
+
+#else // Y_PLATFORM_WINDOWS
+
+  iovec* bufs = (iovec*)alloca(sizeof(iovec) * numBuffers);
+  for (size_t i = 0; i < numBuffers; i++)
+  {
+    bufs[i].iov_base = ppBuffers[i];
+    bufs[i].iov_len = pBufferLengths[i];
+  }
+
+  ssize_t res = m_unixDomain ? ReceiveWithFileDescriptors(bufs, (uint32)numBuffers) :
+                               readv(m_fileDescriptor, bufs, numBuffers);
+  if (res <= 0)
+  {
+    if (res < 0 && errno == EAGAIN)
+    {
+      // Not an error. Just means no data is available.
+      m_lock.Unlock();
+      return 0;
+    }
+
+    // Socket error, or the peer closed the connection.
+    CloseWithError();
+    m_lock.Unlock();
+    return 0;
+  }
+
+  m_lock.Unlock();
+  return (size_t)res;
+
+#endif // Y_PLATFORM_WINDOWS
+}
+
 size_t StreamSocket::Write(const void* pBuffer, size_t bufferLength)
 {
   m_lock.Lock();
@@ -150,6 +269,193 @@ size_t StreamSocket::WriteVector(const void** ppBuffers, const size_t* pBufferLe
 #endif // Y_PLATFORM_WINDOWS
 }
 
+uint64 StreamSocket::SendFile(ByteStream* pStream, uint64 offset, uint64 length)
+{
+  m_lock.Lock();
+
+  if (!m_connected)
+  {
+    m_lock.Unlock();
+    return 0;
+  }
+
+  // Don't send past the end.
+  uint64 streamSize = pStream->GetSize();
+  length = (offset < streamSize) ? Min(length, streamSize - offset) : 0;
+  uint64 bytesSent = 0;
+
+#ifdef Y_PLATFORM_LINUX
+  // File-backed: the kernel sends from the page cache. This uses its own offset, so the stream isn't seeked.
+  int fileDescriptor = pStream->GetFileDescriptor();
+  if (fileDescriptor >= 0)
+  {
+    off_t fileOffset = (off_t)offset;
+    while (bytesSent < length)
+    {
+      size_t chunkSize = (size_t)Min(length - bytesSent, SENDFILE_CHUNK_SIZE);
+      ssize_t res = sendfile(m_fileDescriptor, fileDescriptor, &fileOffset, chunkSize);
+      if (res < 0)
+      {
+        if (errno == EAGAIN)
+          break;
+
+        // Not supported for this file? Fall back to reading it.
+        if ((errno == EINVAL || errno == ENOSYS) && bytesSent == 0)
+        {
+          fileDescriptor = -1;
+          break;
+        }
+
+        // Socket error.
+        CloseWithError();
+        m_lock.Unlock();
+        return bytesSent;
+      }
+
+      // Truncated underneath us?
+      if (res == 0)
+        break;
+
+      bytesSent += (uint64)res;
+    }
+
+    if (fileDescriptor >= 0)
+    {
+      m_lock.Unlock();
+      return bytesSent;
+    }
+  }
+#endif
+
+  // Memory-backed: send in place.
+  const byte* pMemory = pStream->GetMemoryBasePointer();
+  if (pMemory != nullptr)
+  {
+    while (bytesSent < length && m_connected)
+    {
+      size_t chunkSize = (size_t)Min(length - bytesSent, (uint64)0x40000000);
+      size_t bytesWritten = Write(pMemory + offset + bytesSent, chunkSize);
+      bytesSent += bytesWritten;
+      if (bytesWritten < chunkSize)
+        break;
+    }
+
+    m_lock.Unlock();
+    return bytesSent;
+  }
+
+  // Anything else is read through a buffer, putting the position back afterwards.
+  uint64 oldPosition = pStream->GetPosition();
+  if (length > 0 && pStream->SeekAbsolute(offset))
+  {
+    byte* pBuffer = new byte[SENDFILE_BUFFER_SIZE];
+    while (bytesSent < length && m_connected)
+    {
+      uint32 bytesRead = pStream->Read(pBuffer, (uint32)Min(length - bytesSent, (uint64)SENDFILE_BUFFER_SIZE));
+      if (bytesRead == 0)
+        break;
+
+      size_t bytesWritten = Write(pBuffer, bytesRead);
+      bytesSent += bytesWritten;
+      if (bytesWritten < bytesRead)
+        break;
+    }
+    delete[] pBuffer;
+  }
+  pStream->SeekAbsolute(oldPosition);
+
+  m_lock.Unlock();
+  return bytesSent;
+}
+
+size_t StreamSocket::WriteZeroCopy(const void* pBuffer, size_t bufferSize, bool* pCompletionPending,
+                                   uint32* pCompletionID)
+{
+  *pCompletionPending = false;
+
+  m_lock.Lock();
+
+  if (!m_connected)
+  {
+    m_lock.Unlock();
+    return 0;
+  }
+
+#ifdef HAVE_ZEROCOPY_SEND
+  // Enable on first use. Older kernels don't support it, in which case we always copy.
+  if (!m_zeroCopyTried && bufferSize >= ZEROCOPY_MIN_SIZE)
+  {
+    int value = 1;
+    m_zeroCopyTried = true;
+    m_zeroCopyEnabled = (setsockopt(m_fileDescriptor, SOL_SOCKET, SO_ZEROCOPY, &value, sizeof(value)) == 0);
+  }
+
+  if (m_zeroCopyEnabled && bufferSize >= ZEROCOPY_MIN_SIZE)
+  {
+    ssize_t res = send(m_fileDescriptor, (const char*)pBuffer, bufferSize, MSG_ZEROCOPY);
+    if (res < 0)
+    {
+      // ENOBUFS is the pinned page limit, the same as a full socket buffer as far as the caller is concerned.
+      if (errno != EAGAIN && errno != ENOBUFS)
+        CloseWithError();
+
+      m_lock.Unlock();
+      return 0;
+    }
+
+    // The kernel gives every successful send the next ID, even short ones.
+    *pCompletionPending = true;
+    *pCompletionID = m_nextZeroCopyID++;
+    m_zeroCopyOutstanding++;
+    m_lock.Unlock();
+    return (size_t)res;
+  }
+#endif
+
+  size_t bytesWritten = Write(pBuffer, bufferSize);
+  m_lock.Unlock();
+  return bytesWritten;
+}
+
+void StreamSocket::ProcessZeroCopyCompletions()
+{
+#ifdef HAVE_ZEROCOPY_SEND
+  while (m_zeroCopyOutstanding > 0 && m_connected)
+  {
+    // Aligned for cmsghdr.
+    uint64 control[16];
+    msghdr msg;
+    Y_memzero(&msg, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(m_fileDescriptor, &msg, MSG_ERRQUEUE) < 0)
+      break;
+
+    for (cmsghdr* pHeader = CMSG_FIRSTHDR(&msg); pHeader != nullptr; pHeader = CMSG_NXTHDR(&msg, pHeader))
+    {
+      if (!(pHeader->cmsg_level == SOL_IP && pHeader->cmsg_type == IP_RECVERR) &&
+          !(pHeader->cmsg_level == SOL_IPV6 && pHeader->cmsg_type == IPV6_RECVERR))
+      {
+        continue;
+      }
+
+      const sock_extended_err* pError = (const sock_extended_err*)CMSG_DATA(pHeader);
+      if (pError->ee_errno != 0 || pError->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+
+      // If the kernel had to copy anyway (e.g. loopback, or a device without scatter-gather), stop asking.
+      if (pError->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        m_zeroCopyEnabled = false;
+
+      uint32 firstCompletionID = pError->ee_info;
+      uint32 lastCompletionID = pError->ee_data;
+      m_zeroCopyOutstanding -= Min(lastCompletionID - firstCompletionID + 1, m_zeroCopyOutstanding);
+      OnZeroCopyCompleted(firstCompletionID, lastCompletionID);
+    }
+  }
+#endif
+}
+
 void StreamSocket::Close()
 {
   m_lock.Lock();
@@ -172,6 +478,127 @@ void StreamSocket::Close()
   m_lock.Unlock();
 }
 
+size_t StreamSocket::WriteWithFileDescriptors(const void* pBuffer, size_t bufferSize, const int* pFileDescriptors,
+                                              uint32 count)
+{
+  if (count == 0)
+    return Write(pBuffer, bufferSize);
+
+#ifndef Y_PLATFORM_WINDOWS
+  if (!m_unixDomain || bufferSize == 0 || count > MAX_PASSED_FILE_DESCRIPTORS)
+  {
+    Log_ErrorPrintf("StreamSocket::WriteWithFileDescriptors: Can't pass %u descriptors with %u bytes on this socket",
+                    count, (uint32)bufferSize);
+    return 0;
+  }
+
+  m_lock.Lock();
+
+  if (!m_connected)
+  {
+    m_lock.Unlock();
+    return 0;
+  }
+
+  union
+  {
+    size_t alignment;
+    byte data[CMSG_SPACE(sizeof(int) * MAX_PASSED_FILE_DESCRIPTORS)];
+  } control;
+
+  iovec vector = {const_cast<void*>(pBuffer), bufferSize};
+  msghdr msg;
+  Y_memzero(&msg, sizeof(msg));
+  msg.msg_iov = &vector;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+  cmsghdr* pControlHeader = CMSG_FIRSTHDR(&msg);
+  pControlHeader->cmsg_level = SOL_SOCKET;
+  pControlHeader->cmsg_type = SCM_RIGHTS;
+  pControlHeader->cmsg_len = CMSG_LEN(sizeof(int) * count);
+  std::memcpy(CMSG_DATA(pControlHeader), pFileDescriptors, sizeof(int) * count);
+
+  ssize_t len = sendmsg(m_fileDescriptor, &msg, 0);
+  if (len <= 0)
+  {
+    // a full socket isn't an error, the descriptors weren't sent either
+    if (len < 0 && errno != EAGAIN)
+      CloseWithError();
+
+    m_lock.Unlock();
+    return 0;
+  }
+
+  m_lock.Unlock();
+  return (size_t)len;
+#else
+  Log_ErrorPrintf("StreamSocket::WriteWithFileDescriptors: Not supported on this platform");
+  return 0;
+#endif
+}
+
+int StreamSocket::TakeReceivedFileDescriptor()
+{
+  m_lock.Lock();
+  int fileDescriptor = m_receivedFileDescriptors.IsEmpty() ? -1 : m_receivedFileDescriptors.PopFront();
+  m_lock.Unlock();
+  return fileDescriptor;
+}
+
+#ifndef Y_PLATFORM_WINDOWS
+ssize_t StreamSocket::ReceiveWithFileDescriptors(iovec* pVectors, uint32 numVectors)
+{
+  union
+  {
+    size_t alignment;
+    byte data[CMSG_SPACE(sizeof(int) * MAX_PASSED_FILE_DESCRIPTORS)];
+  } control;
+
+  msghdr msg;
+  Y_memzero(&msg, sizeof(msg));
+  msg.msg_iov = pVectors;
+  msg.msg_iovlen = numVectors;
+  msg.msg_control = control.data;
+  msg.msg_controllen = sizeof(control.data);
+
+  // received descriptors shouldn't leak into processes we start
+  int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+  flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+  ssize_t res = recvmsg(m_fileDescriptor, &msg, flags);
+  if (res <= 0)
+    return res;
+
+  for (cmsghdr* pControlHeader = CMSG_FIRSTHDR(&msg); pControlHeader != nullptr;
+       pControlHeader = CMSG_NXTHDR(&msg, pControlHeader))
+  {
+    if (pControlHeader->cmsg_level != SOL_SOCKET || pControlHeader->cmsg_type != SCM_RIGHTS)
+      continue;
+
+    uint32 count = (uint32)((pControlHeader->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+    for (uint32 i = 0; i < count; i++)
+    {
+      int fileDescriptor;
+      std::memcpy(&fileDescriptor, CMSG_DATA(pControlHeader) + i * sizeof(int), sizeof(int));
+      m_receivedFileDescriptors.Add(fileDescriptor);
+    }
+  }
+
+  // the kernel closes whatever didn't fit
+  if (msg.msg_flags & MSG_CTRUNC)
+  {
+    Log_WarningPrintf("StreamSocket::ReceiveWithFileDescriptors: More than %u descriptors passed at once, some dropped",
+                      MAX_PASSED_FILE_DESCRIPTORS);
+  }
+
+  return res;
+}
+#endif
+
 void StreamSocket::CloseWithError()
 {
   m_lock.Lock();
@@ -210,11 +637,14 @@ void StreamSocket::OnDisconnected(Error* pError)
 
 void StreamSocket::OnRead() {}
 
+void StreamSocket::OnZeroCopyCompleted(uint32 firstCompletionID, uint32 lastCompletionID) {}
+
 void StreamSocket::OnReadEvent()
 {
-  // forward through
+  // forward through, zero-copy completions raise read events too
   m_lock.Lock();
 
+  ProcessZeroCopyCompletions();
   if (m_connected)
     OnRead();
 
@@ -229,6 +659,18 @@ void StreamSocket::OnWriteEvent()
 bool StreamSocket::InitializeSocket(SocketMultiplexer* pMultiplexer, SOCKET fileDescriptor, Error* pError)
 {
   DebugAssert(m_pMultiplexer == nullptr);
+
+  // switch to nonblocking mode, before the socket takes the descriptor so a failure leaves nothing to tear down
+  unsigned long value = 1;
+  if (ioctlsocket(fileDescriptor, FIONBIO, &value) < 0)
+  {
+    if (pError != nullptr)
+      pError->SetErrorSocket(WSAGetLastError());
+
+    closesocket(fileDescriptor);
+    return false;
+  }
+
   m_pMultiplexer = pMultiplexer;
   m_fileDescriptor = fileDescriptor;
   m_connected = true;
@@ -248,22 +690,16 @@ bool StreamSocket::InitializeSocket(SocketMultiplexer* pMultiplexer, SOCKET file
   else
     m_remoteAddress.SetUnknown();
 
-  // switch to nonblocking mode
-  unsigned long value = 1;
-  if (ioctlsocket(m_fileDescriptor, FIONBIO, &value) < 0)
-  {
-    if (pError != nullptr)
-      pError->SetErrorSocket(WSAGetLastError());
-
-    return false;
-  }
+  m_unixDomain = (m_localAddress.GetType() == SocketAddress::Type_Unix);
 
-  // register for notifications
+  // register for notifications, holding the lock so that no events are handled before the connected notification
+  m_lock.Lock();
   m_pMultiplexer->AddOpenSocket(this);
-  m_pMultiplexer->SetNotificationMask(this, m_fileDescriptor, SocketMultiplexer::EventType_Read);
+  m_pMultiplexer->SetNotificationMask(this, m_fileDescriptor,
+                                      SocketMultiplexer::EventType_Read |
+                                        (m_edgeTriggered ? SocketMultiplexer::EventType_EdgeTriggered : 0));
 
   // trigger connected notitifcation
-  m_lock.Lock();
   OnConnected();
   m_lock.Unlock();
   return true;
@@ -0,0 +1,381 @@
+#include "YBaseLib/Sockets/MessageStreamSocket.h"
+#include "YBaseLib/Assert.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/NumericLimits.h"
+#include "YBaseLib/Sockets/SocketBufferPool.h"
+#include "YBaseLib/Sockets/SocketMultiplexer.h"
+#include <cstring>
+Log_SetChannel(MessageStreamSocket);
+
+// Most receive buffer chunks looked at by one OnRead, which also limits the message size.
+static const uint32 MAX_READ_BUFFERS = 256;
+
+// Messages per SendMessages batch, two buffers each.
+static const uint32 SEND_BATCH_SIZE = 32;
+
+// The received data, as runs acquired from the receive buffer, addressed by offset from the start. Lookups mostly move
+// forwards, so the run holding the last offset looked up is remembered.
+struct MessageStreamSocket::ReceivedData
+{
+  const void* pBuffers[MAX_READ_BUFFERS];
+  size_t BufferSizes[MAX_READ_BUFFERS];
+  uint32 BufferCount;
+  size_t TotalSize;
+
+  uint32 CurrentBuffer;
+  size_t CurrentBufferStart;
+
+  void Seek(size_t offset)
+  {
+    if (offset < CurrentBufferStart)
+    {
+      CurrentBuffer = 0;
+      CurrentBufferStart = 0;
+    }
+
+    while (CurrentBuffer < (BufferCount - 1) && offset >= (CurrentBufferStart + BufferSizes[CurrentBuffer]))
+    {
+      CurrentBufferStart += BufferSizes[CurrentBuffer];
+      CurrentBuffer++;
+    }
+  }
+
+  // The range in place, or nullptr if it spans runs.
+  const byte* GetContiguous(size_t offset, size_t length)
+  {
+    Seek(offset);
+    if ((offset + length) > (CurrentBufferStart + BufferSizes[CurrentBuffer]))
+      return nullptr;
+
+    return reinterpret_cast<const byte*>(pBuffers[CurrentBuffer]) + (offset - CurrentBufferStart);
+  }
+
+  void Copy(size_t offset, void* pDestination, size_t length)
+  {
+    byte* pDestinationPtr = reinterpret_cast<byte*>(pDestination);
+    Seek(offset);
+    for (uint32 i = CurrentBuffer; i < BufferCount && length > 0; i++)
+    {
+      size_t bufferOffset = (i == CurrentBuffer) ? (offset - CurrentBufferStart) : 0;
+      size_t copyLength = Min(length, BufferSizes[i] - bufferOffset);
+      std::memcpy(pDestinationPtr, reinterpret_cast<const byte*>(pBuffers[i]) + bufferOffset, copyLength);
+      pDestinationPtr += copyLength;
+      length -= copyLength;
+    }
+  }
+
+  // Position of the first occurrence of the pattern at or after offset. If there isn't one, returns false and sets
+  // *pPosition to the first offset which could still start one.
+  bool Find(size_t offset, const byte* pPattern, uint32 patternLength, size_t* pPosition)
+  {
+    size_t position = offset;
+    while (position < TotalSize)
+    {
+      // scan for the first byte within a run, then check the rest wherever it is
+      Seek(position);
+      const byte* pBuffer = reinterpret_cast<const byte*>(pBuffers[CurrentBuffer]);
+      size_t bufferOffset = position - CurrentBufferStart;
+      const byte* pFound = reinterpret_cast<const byte*>(
+        std::memchr(pBuffer + bufferOffset, pPattern[0], BufferSizes[CurrentBuffer] - bufferOffset));
+      if (pFound == nullptr)
+      {
+        position = CurrentBufferStart + BufferSizes[CurrentBuffer];
+        continue;
+      }
+
+      position = CurrentBufferStart + (size_t)(pFound - pBuffer);
+      if ((position + patternLength) > TotalSize)
+        break;
+
+      byte candidate[MAX_DELIMITER_LENGTH];
+      Copy(position, candidate, patternLength);
+      if (std::memcmp(candidate, pPattern, patternLength) == 0)
+      {
+        *pPosition = position;
+        return true;
+      }
+
+      position++;
+    }
+
+    *pPosition = Min(position, TotalSize);
+    return false;
+  }
+};
+
+MessageStreamSocket::MessageStreamSocket(size_t receiveBufferSize /* = 65536 */, size_t sendBufferSize /* = 65536 */)
+  : BufferedStreamSocket(receiveBufferSize, sendBufferSize), m_framingMode(FramingMode_LengthPrefix), m_prefixLength(4),
+    m_prefixBigEndian(true), m_delimiterLength(0), m_maxMessageSize(Y_UINT32_MAX), m_delimiterSearchOffset(0)
+{
+}
+
+MessageStreamSocket::~MessageStreamSocket() {}
+
+void MessageStreamSocket::SetLengthPrefixFraming(uint32 prefixLength, bool bigEndian /* = true */)
+{
+  DebugAssert(prefixLength == 1 || prefixLength == 2 || prefixLength == 4);
+  m_framingMode = FramingMode_LengthPrefix;
+  m_prefixLength = prefixLength;
+  m_prefixBigEndian = bigEndian;
+}
+
+void MessageStreamSocket::SetDelimiterFraming(const void* pDelimiter, uint32 delimiterLength)
+{
+  DebugAssert(delimiterLength > 0 && delimiterLength <= MAX_DELIMITER_LENGTH);
+  m_framingMode = FramingMode_Delimiter;
+  std::memcpy(m_delimiter, pDelimiter, delimiterLength);
+  m_delimiterLength = delimiterLength;
+  m_delimiterSearchOffset = 0;
+}
+
+uint32 MessageStreamSocket::GetMaxMessageSize() const
+{
+  // a whole frame has to fit in the receive buffer, and in the chunks one parsing pass looks at
+  size_t bufferLimit = GetReceiveBufferSize();
+  SocketMultiplexer* pMultiplexer = GetMultiplexer();
+  if (pMultiplexer != nullptr)
+    bufferLimit = Min(bufferLimit, (size_t)(MAX_READ_BUFFERS - 1) * pMultiplexer->GetBufferPool()->GetChunkSize());
+
+  size_t framingLength;
+  size_t prefixLimit;
+  if (m_framingMode == FramingMode_LengthPrefix)
+  {
+    framingLength = m_prefixLength;
+    prefixLimit = (m_prefixLength == 4) ? Y_UINT32_MAX : ((1u << (m_prefixLength * 8)) - 1);
+  }
+  else
+  {
+    framingLength = m_delimiterLength;
+    prefixLimit = Y_UINT32_MAX;
+  }
+
+  size_t limit = (bufferLimit > framingLength) ? (bufferLimit - framingLength) : 0;
+  return (uint32)Min((size_t)m_maxMessageSize, Min(limit, prefixLimit));
+}
+
+bool MessageStreamSocket::SendMessage(const void* pMessage, size_t length)
+{
+  const void* pBuffers[2];
+  size_t bufferLengths[2];
+  byte prefix[4];
+  if (m_framingMode == FramingMode_LengthPrefix)
+  {
+    uint32 prefixLength = EncodeLengthPrefix(length, prefix);
+    if (prefixLength == 0)
+      return false;
+
+    pBuffers[0] = prefix;
+    bufferLengths[0] = prefixLength;
+    pBuffers[1] = pMessage;
+    bufferLengths[1] = length;
+  }
+  else
+  {
+    pBuffers[0] = pMessage;
+    bufferLengths[0] = length;
+    pBuffers[1] = m_delimiter;
+    bufferLengths[1] = m_delimiterLength;
+  }
+
+  return TryWriteVector(pBuffers, bufferLengths, 2);
+}
+
+uint32 MessageStreamSocket::SendMessages(const void** ppMessages, const size_t* pLengths, uint32 count)
+{
+  // Small messages are copied into the send buffer and go out together when the batch ends. A batch of messages is
+  // written with one call, so only has one pass through the lock and the buffer.
+  BeginSendBatch();
+
+  uint32 sentCount = 0;
+  while (sentCount < count)
+  {
+    const void* pBuffers[SEND_BATCH_SIZE * 2];
+    size_t bufferLengths[SEND_BATCH_SIZE * 2];
+    byte prefixes[SEND_BATCH_SIZE][4];
+    uint32 batchCount = Min(count - sentCount, SEND_BATCH_SIZE);
+    for (uint32 i = 0; i < batchCount; i++)
+    {
+      const void* pMessage = ppMessages[sentCount + i];
+      size_t length = pLengths[sentCount + i];
+      if (m_framingMode == FramingMode_LengthPrefix)
+      {
+        uint32 prefixLength = EncodeLengthPrefix(length, prefixes[i]);
+        if (prefixLength == 0)
+        {
+          batchCount = i;
+          break;
+        }
+
+        pBuffers[i * 2] = prefixes[i];
+        bufferLengths[i * 2] = prefixLength;
+        pBuffers[i * 2 + 1] = pMessage;
+        bufferLengths[i * 2 + 1] = length;
+      }
+      else
+      {
+        pBuffers[i * 2] = pMessage;
+        bufferLengths[i * 2] = length;
+        pBuffers[i * 2 + 1] = m_delimiter;
+        bufferLengths[i * 2 + 1] = m_delimiterLength;
+      }
+    }
+
+    // if the whole batch doesn't fit, fall back to one at a time to send as many as will
+    if (batchCount > 0 && TryWriteVector(pBuffers, bufferLengths, batchCount * 2))
+    {
+      sentCount += batchCount;
+      if (batchCount == SEND_BATCH_SIZE)
+        continue;
+    }
+    else
+    {
+      for (uint32 i = 0; i < batchCount && TryWriteVector(&pBuffers[i * 2], &bufferLengths[i * 2], 2); i++)
+        sentCount++;
+    }
+
+    // short batch, so something didn't fit or this was the end
+    break;
+  }
+
+  EndSendBatch();
+  return sentCount;
+}
+
+uint32 MessageStreamSocket::EncodeLengthPrefix(size_t length, byte* pPrefix) const
+{
+  if (m_prefixLength < 4 && length >= ((size_t)1 << (m_prefixLength * 8)))
+    return 0;
+  if ((uint64)length > Y_UINT32_MAX)
+    return 0;
+
+  for (uint32 i = 0; i < m_prefixLength; i++)
+  {
+    uint32 shift = (m_prefixBigEndian ? (m_prefixLength - 1 - i) : i) * 8;
+    pPrefix[i] = (byte)(length >> shift);
+  }
+
+  return m_prefixLength;
+}
+
+bool MessageStreamSocket::ParseFrame(ReceivedData* pData, size_t offset, size_t searchOffset, size_t* pPayloadOffset,
+                                     size_t* pPayloadLength, size_t* pFrameEnd, bool* pInvalid) const
+{
+  size_t available = pData->TotalSize - offset;
+  uint32 maxMessageSize = GetMaxMessageSize();
+  if (m_framingMode == FramingMode_LengthPrefix)
+  {
+    *pFrameEnd = offset;
+    if (available < m_prefixLength)
+      return false;
+
+    byte prefix[4];
+    pData->Copy(offset, prefix, m_prefixLength);
+    uint32 length = 0;
+    for (uint32 i = 0; i < m_prefixLength; i++)
+    {
+      uint32 shift = (m_prefixBigEndian ? (m_prefixLength - 1 - i) : i) * 8;
+      length |= (uint32)prefix[i] << shift;
+    }
+
+    if (length > maxMessageSize)
+    {
+      *pInvalid = true;
+      return false;
+    }
+
+    if ((available - m_prefixLength) < length)
+      return false;
+
+    *pPayloadOffset = offset + m_prefixLength;
+    *pPayloadLength = length;
+    *pFrameEnd = *pPayloadOffset + length;
+    return true;
+  }
+  else
+  {
+    size_t position;
+    if (!pData->Find(offset + searchOffset, m_delimiter, m_delimiterLength, &position))
+    {
+      // no delimiter within the longest message means there won't be one
+      *pInvalid = ((position - offset) > maxMessageSize);
+      *pFrameEnd = position;
+      return false;
+    }
+
+    if ((position - offset) > maxMessageSize)
+    {
+      *pInvalid = true;
+      return false;
+    }
+
+    *pPayloadOffset = offset;
+    *pPayloadLength = position - offset;
+    *pFrameEnd = position + m_delimiterLength;
+    return true;
+  }
+}
+
+void MessageStreamSocket::OnRead()
+{
+  // replies to everything received go out together
+  BeginSendBatch();
+
+  // one pass only sees so many chunks, and the socket is edge-triggered, so go on while passes fill up and parse
+  // something, otherwise the frames in the chunks beyond wait for the peer to send more
+  bool invalid = false;
+  ReceivedData data;
+  do
+  {
+    data.BufferCount = AcquireReadBuffers(data.pBuffers, data.BufferSizes, MAX_READ_BUFFERS);
+    if (data.BufferCount == 0)
+      break;
+
+    data.TotalSize = 0;
+    for (uint32 i = 0; i < data.BufferCount; i++)
+      data.TotalSize += data.BufferSizes[i];
+    data.CurrentBuffer = 0;
+    data.CurrentBufferStart = 0;
+
+    size_t offset = 0;
+    size_t searchOffset = m_delimiterSearchOffset;
+    while (IsConnected())
+    {
+      size_t payloadOffset, payloadLength, frameEnd;
+      if (!ParseFrame(&data, offset, searchOffset, &payloadOffset, &payloadLength, &frameEnd, &invalid))
+      {
+        // don't search the start of the incomplete frame again next time
+        m_delimiterSearchOffset = invalid ? 0 : (frameEnd - offset);
+        break;
+      }
+
+      // in place if it's within a chunk, otherwise put together
+      const byte* pMessage = data.GetContiguous(payloadOffset, payloadLength);
+      if (pMessage == nullptr)
+      {
+        if (m_assemblyBuffer.GetSize() < payloadLength)
+          m_assemblyBuffer.Resize((uint32)payloadLength);
+
+        data.Copy(payloadOffset, m_assemblyBuffer.GetBasePointer(), payloadLength);
+        pMessage = m_assemblyBuffer.GetBasePointer();
+      }
+
+      OnMessage(pMessage, payloadLength);
+      offset = frameEnd;
+      searchOffset = 0;
+      m_delimiterSearchOffset = 0;
+    }
+
+    ReleaseReadBuffer(offset);
+    if (offset == 0)
+      break;
+  } while (data.BufferCount == MAX_READ_BUFFERS && !invalid && IsConnected());
+
+  EndSendBatch();
+
+  if (invalid)
+  {
+    Log_WarningPrintf("MessageStreamSocket::OnRead: Message over %u bytes received, closing connection",
+                      GetMaxMessageSize());
+    Close();
+  }
+}
@@ -1,15 +1,18 @@
 #include "YBaseLib/Sockets/SocketAddress.h"
 #include "YBaseLib/Sockets/SystemHeaders.h"
+#include <cstddef>
 
 SocketAddress::SocketAddress(const SocketAddress& copy)
 {
   m_type = copy.m_type;
+  m_length = copy.m_length;
   std::memcpy(m_data, copy.m_data, sizeof(m_data));
 }
 
 SocketAddress& SocketAddress::operator=(const SocketAddress& copy)
 {
   m_type = copy.m_type;
+  m_length = copy.m_length;
   std::memcpy(m_data, copy.m_data, sizeof(m_data));
   return *this;
 }
@@ -17,13 +20,36 @@ SocketAddress& SocketAddress::operator=(const SocketAddress& copy)
 void SocketAddress::SetUnknown()
 {
   m_type = Type_Unknown;
+  m_length = 0;
   Y_memzero(m_data, sizeof(m_data));
 }
 
 void SocketAddress::SetFromSockaddr(const void* pSockaddr, size_t sockaddrLength)
 {
   Y_memzero(m_data, sizeof(m_data));
-  std::memcpy(m_data, pSockaddr, Min(sockaddrLength, sizeof(m_data)));
+  m_length = (uint32)Min(sockaddrLength, sizeof(m_data));
+  std::memcpy(m_data, pSockaddr, m_length);
+
+  switch (reinterpret_cast<const sockaddr*>(m_data)->sa_family)
+  {
+    case AF_INET:
+      m_type = Type_IPv4;
+      break;
+
+    case AF_INET6:
+      m_type = Type_IPv6;
+      break;
+
+#ifndef Y_PLATFORM_WINDOWS
+    case AF_UNIX:
+      m_type = Type_Unix;
+      break;
+#endif
+
+    default:
+      m_type = Type_Unknown;
+      break;
+  }
 }
 
 bool SocketAddress::Parse(Type type, const char* address, uint32 port, SocketAddress* pOutAddress)
@@ -33,6 +59,7 @@ bool SocketAddress::Parse(Type type, const char* address, uint32 port, SocketAdd
     case Type_IPv4:
     {
       pOutAddress->m_type = Type_IPv4;
+      pOutAddress->m_length = sizeof(sockaddr_in);
       sockaddr_in* pSockaddrIn = reinterpret_cast<sockaddr_in*>(pOutAddress->m_data);
       Y_memzero(pSockaddrIn, sizeof(sockaddr_in));
       pSockaddrIn->sin_family = AF_INET;
@@ -47,6 +74,7 @@ bool SocketAddress::Parse(Type type, const char* address, uint32 port, SocketAdd
     case Type_IPv6:
     {
       pOutAddress->m_type = Type_IPv6;
+      pOutAddress->m_length = sizeof(sockaddr_in6);
       sockaddr_in6* pSockaddrIn = reinterpret_cast<sockaddr_in6*>(pOutAddress->m_data);
       Y_memzero(pSockaddrIn, sizeof(sockaddr_in6));
       pSockaddrIn->sin6_family = AF_INET;
@@ -57,6 +85,36 @@ bool SocketAddress::Parse(Type type, const char* address, uint32 port, SocketAdd
       else
         return true;
     }
+
+#ifndef Y_PLATFORM_WINDOWS
+    case Type_Unix:
+    {
+      // abstract names aren't null-terminated, so the length covers exactly the name
+      size_t pathLength = std::strlen(address);
+      sockaddr_un* pSockaddrUn = reinterpret_cast<sockaddr_un*>(pOutAddress->m_data);
+      if (pathLength == 0 || pathLength >= sizeof(pSockaddrUn->sun_path))
+        return false;
+
+      pOutAddress->m_type = Type_Unix;
+      Y_memzero(pSockaddrUn, sizeof(sockaddr_un));
+      pSockaddrUn->sun_family = AF_UNIX;
+      std::memcpy(pSockaddrUn->sun_path, address, pathLength);
+#ifdef Y_PLATFORM_LINUX
+      if (address[0] == '@')
+      {
+        pSockaddrUn->sun_path[0] = '\0';
+        pOutAddress->m_length = (uint32)(offsetof(sockaddr_un, sun_path) + pathLength);
+        return true;
+      }
+#endif
+
+      pOutAddress->m_length = (uint32)(offsetof(sockaddr_un, sun_path) + pathLength + 1);
+      return true;
+    }
+#endif
+
+    default:
+      break;
   }
 
   return false;
@@ -107,6 +165,23 @@ void SocketAddress::ToString(String& destination) const
       break;
     }
 
+#ifndef Y_PLATFORM_WINDOWS
+    case Type_Unix:
+    {
+      // socketpair and unbound sockets have no path, abstract names are shown with a leading '@'
+      const sockaddr_un* pSockaddrUn = reinterpret_cast<const sockaddr_un*>(m_data);
+      size_t pathOffset = offsetof(sockaddr_un, sun_path);
+      destination.Clear();
+      if (m_length <= pathOffset)
+        destination.AppendString("<unnamed>");
+      else if (pSockaddrUn->sun_path[0] == '\0')
+        destination.AppendFormattedString("@%.*s", (int)(m_length - pathOffset - 1), pSockaddrUn->sun_path + 1);
+      else
+        destination.AppendFormattedString("%.*s", (int)(m_length - pathOffset), pSockaddrUn->sun_path);
+      break;
+    }
+#endif
+
     default:
     {
       destination.Clear();
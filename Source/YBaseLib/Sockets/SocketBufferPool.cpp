@@ -0,0 +1,319 @@
+#include "YBaseLib/Sockets/SocketBufferPool.h"
+#include "YBaseLib/Assert.h"
+#include "YBaseLib/Memory.h"
+
+SocketBufferPool::SocketBufferPool(uint32 chunkSize /* = DEFAULT_CHUNK_SIZE */,
+                                   uint32 maxFreeChunks /* = DEFAULT_MAX_FREE_CHUNKS */)
+  : m_chunkSize(chunkSize), m_maxFreeChunks(maxFreeChunks), m_pFreeChunks(nullptr), m_freeChunkCount(0),
+    m_chunksInUse(0), m_peakChunksInUse(0), m_borrowCount(0)
+{
+  DebugAssert(chunkSize > 0);
+}
+
+SocketBufferPool::~SocketBufferPool()
+{
+  // queues hold a reference, so nothing can still be borrowed
+  DebugAssert(m_chunksInUse == 0);
+  Trim();
+}
+
+SocketBufferPool::Chunk* SocketBufferPool::BorrowChunk()
+{
+  m_lock.Lock();
+
+  Chunk* pChunk = m_pFreeChunks;
+  if (pChunk != nullptr)
+  {
+    m_pFreeChunks = pChunk->pNext;
+    m_freeChunkCount--;
+  }
+
+  m_chunksInUse++;
+  m_peakChunksInUse = Max(m_peakChunksInUse, m_chunksInUse);
+  m_borrowCount++;
+
+  m_lock.Unlock();
+
+  // allocate outside the lock
+  if (pChunk == nullptr)
+    pChunk = (Chunk*)std::malloc(sizeof(Chunk) + m_chunkSize);
+
+  pChunk->pNext = nullptr;
+  pChunk->Start = 0;
+  pChunk->End = 0;
+  return pChunk;
+}
+
+void SocketBufferPool::ReturnChunk(Chunk* pChunk)
+{
+  m_lock.Lock();
+
+  DebugAssert(m_chunksInUse > 0);
+  m_chunksInUse--;
+
+  if (m_freeChunkCount < m_maxFreeChunks)
+  {
+    pChunk->pNext = m_pFreeChunks;
+    m_pFreeChunks = pChunk;
+    m_freeChunkCount++;
+    pChunk = nullptr;
+  }
+
+  m_lock.Unlock();
+
+  // over the limit, free outside the lock
+  if (pChunk != nullptr)
+    std::free(pChunk);
+}
+
+void SocketBufferPool::Trim()
+{
+  m_lock.Lock();
+  Chunk* pChunk = m_pFreeChunks;
+  m_pFreeChunks = nullptr;
+  m_freeChunkCount = 0;
+  m_lock.Unlock();
+
+  while (pChunk != nullptr)
+  {
+    Chunk* pNext = pChunk->pNext;
+    std::free(pChunk);
+    pChunk = pNext;
+  }
+}
+
+void SocketBufferPool::GetStatistics(Statistics* pStatistics) const
+{
+  m_lock.Lock();
+  pStatistics->ChunkSize = m_chunkSize;
+  pStatistics->ChunksInUse = m_chunksInUse;
+  pStatistics->PeakChunksInUse = m_peakChunksInUse;
+  pStatistics->ChunksFree = m_freeChunkCount;
+  pStatistics->BorrowCount = m_borrowCount;
+  m_lock.Unlock();
+}
+
+SocketBufferQueue::SocketBufferQueue(size_t maxSize)
+  : m_pPool(nullptr), m_pHead(nullptr), m_pTail(nullptr), m_maxSize(maxSize), m_size(0)
+{
+}
+
+SocketBufferQueue::~SocketBufferQueue()
+{
+  Clear();
+  if (m_pPool != nullptr)
+    m_pPool->Release();
+}
+
+void SocketBufferQueue::SetPool(SocketBufferPool* pPool)
+{
+  DebugAssert(m_pHead == nullptr);
+  pPool->AddRef();
+  if (m_pPool != nullptr)
+    m_pPool->Release();
+
+  m_pPool = pPool;
+}
+
+size_t SocketBufferQueue::Write(const void* pSource, size_t byteCount)
+{
+  const byte* pSourcePtr = reinterpret_cast<const byte*>(pSource);
+  size_t bytesRemaining = Min(byteCount, GetSpace());
+  size_t bytesWritten = bytesRemaining;
+  if (bytesRemaining == 0)
+    return 0;
+
+  DebugAssert(m_pPool != nullptr);
+  uint32 chunkSize = m_pPool->GetChunkSize();
+  while (bytesRemaining > 0)
+  {
+    // start a new chunk when the last one is full
+    if (m_pTail == nullptr || m_pTail->End == chunkSize)
+    {
+      SocketBufferPool::Chunk* pChunk = m_pPool->BorrowChunk();
+      if (m_pTail != nullptr)
+        m_pTail->pNext = pChunk;
+      else
+        m_pHead = pChunk;
+
+      m_pTail = pChunk;
+    }
+
+    // copy data
+    size_t copyCount = Min(bytesRemaining, (size_t)(chunkSize - m_pTail->End));
+    std::memcpy(m_pTail->GetData() + m_pTail->End, pSourcePtr, copyCount);
+    m_pTail->End += (uint32)copyCount;
+    pSourcePtr += copyCount;
+    bytesRemaining -= copyCount;
+  }
+
+  m_size += bytesWritten;
+  return bytesWritten;
+}
+
+size_t SocketBufferQueue::Read(void* pDestination, size_t byteCount)
+{
+  byte* pDestinationPtr = reinterpret_cast<byte*>(pDestination);
+  size_t bytesRead = Min(byteCount, m_size);
+  size_t bytesRemaining = bytesRead;
+  while (bytesRemaining > 0)
+  {
+    // copy data
+    size_t copyCount = Min(bytesRemaining, (size_t)(m_pHead->End - m_pHead->Start));
+    std::memcpy(pDestinationPtr, m_pHead->GetData() + m_pHead->Start, copyCount);
+    MoveReadPointer(copyCount);
+    pDestinationPtr += copyCount;
+    bytesRemaining -= copyCount;
+  }
+
+  return bytesRead;
+}
+
+bool SocketBufferQueue::GetReadPointer(const void** ppReadPointer, size_t* pByteCount) const
+{
+  if (m_size == 0)
+    return false;
+
+  *ppReadPointer = m_pHead->GetData() + m_pHead->Start;
+  *pByteCount = m_pHead->End - m_pHead->Start;
+  return true;
+}
+
+uint32 SocketBufferQueue::GetReadRegions(const void** ppRegions, size_t* pRegionSizes, uint32 maxRegions) const
+{
+  uint32 regionCount = 0;
+  for (const SocketBufferPool::Chunk* pChunk = m_pHead; pChunk != nullptr && regionCount < maxRegions;
+       pChunk = pChunk->pNext)
+  {
+    // the rest are empty
+    if (pChunk->End == pChunk->Start)
+      break;
+
+    ppRegions[regionCount] = pChunk->GetData() + pChunk->Start;
+    pRegionSizes[regionCount] = pChunk->End - pChunk->Start;
+    regionCount++;
+  }
+
+  return regionCount;
+}
+
+void SocketBufferQueue::MoveReadPointer(size_t byteCount)
+{
+  DebugAssert(byteCount <= m_size);
+  m_size -= byteCount;
+
+  while (byteCount > 0)
+  {
+    size_t bytesInChunk = m_pHead->End - m_pHead->Start;
+    size_t consumeCount = Min(byteCount, bytesInChunk);
+    m_pHead->Start += (uint32)consumeCount;
+    byteCount -= consumeCount;
+
+    // drained? hand it straight back, so idle sockets hold nothing
+    if (m_pHead->Start == m_pHead->End)
+    {
+      SocketBufferPool::Chunk* pChunk = m_pHead;
+      m_pHead = pChunk->pNext;
+      if (m_pHead == nullptr)
+        m_pTail = nullptr;
+
+      m_pPool->ReturnChunk(pChunk);
+    }
+  }
+}
+
+uint32 SocketBufferQueue::GetWriteRegions(void** ppRegions, size_t* pRegionSizes, uint32 maxRegions, size_t maxBytes)
+{
+  maxBytes = Min(maxBytes, GetSpace());
+  if (maxBytes == 0 || maxRegions == 0)
+    return 0;
+
+  DebugAssert(m_pPool != nullptr);
+  uint32 chunkSize = m_pPool->GetChunkSize();
+  uint32 regionCount = 0;
+
+  // the space left in the last chunk
+  if (m_pTail != nullptr && m_pTail->End < chunkSize)
+  {
+    ppRegions[regionCount] = m_pTail->GetData() + m_pTail->End;
+    pRegionSizes[regionCount] = Min((size_t)(chunkSize - m_pTail->End), maxBytes);
+    maxBytes -= pRegionSizes[regionCount];
+    regionCount++;
+  }
+
+  // then fresh chunks, which MoveWritePointer returns if they aren't used
+  while (maxBytes > 0 && regionCount < maxRegions)
+  {
+    SocketBufferPool::Chunk* pChunk = m_pPool->BorrowChunk();
+    if (m_pTail != nullptr)
+      m_pTail->pNext = pChunk;
+    else
+      m_pHead = pChunk;
+
+    m_pTail = pChunk;
+
+    ppRegions[regionCount] = pChunk->GetData();
+    pRegionSizes[regionCount] = Min((size_t)chunkSize, maxBytes);
+    maxBytes -= pRegionSizes[regionCount];
+    regionCount++;
+  }
+
+  return regionCount;
+}
+
+void SocketBufferQueue::MoveWritePointer(size_t byteCount)
+{
+  DebugAssert(byteCount <= GetSpace());
+  m_size += byteCount;
+
+  // skip the full chunks, then fill from the first with space
+  uint32 chunkSize = (m_pPool != nullptr) ? m_pPool->GetChunkSize() : 0;
+  for (SocketBufferPool::Chunk* pChunk = m_pHead; pChunk != nullptr && byteCount > 0; pChunk = pChunk->pNext)
+  {
+    size_t fillCount = Min(byteCount, (size_t)(chunkSize - pChunk->End));
+    pChunk->End += (uint32)fillCount;
+    byteCount -= fillCount;
+  }
+  DebugAssert(byteCount == 0);
+
+  ReturnUnusedChunks();
+}
+
+void SocketBufferQueue::Clear()
+{
+  while (m_pHead != nullptr)
+  {
+    SocketBufferPool::Chunk* pChunk = m_pHead;
+    m_pHead = pChunk->pNext;
+    m_pPool->ReturnChunk(pChunk);
+  }
+
+  m_pTail = nullptr;
+  m_size = 0;
+}
+
+void SocketBufferQueue::ReturnUnusedChunks()
+{
+  // find the last chunk holding data
+  SocketBufferPool::Chunk* pLastUsed = nullptr;
+  for (SocketBufferPool::Chunk* pChunk = m_pHead; pChunk != nullptr && pChunk->End != pChunk->Start;
+       pChunk = pChunk->pNext)
+  {
+    pLastUsed = pChunk;
+  }
+
+  SocketBufferPool::Chunk* pChunk = (pLastUsed != nullptr) ? pLastUsed->pNext : m_pHead;
+  while (pChunk != nullptr)
+  {
+    SocketBufferPool::Chunk* pNext = pChunk->pNext;
+    m_pPool->ReturnChunk(pChunk);
+    pChunk = pNext;
+  }
+
+  if (pLastUsed != nullptr)
+    pLastUsed->pNext = nullptr;
+  else
+    m_pHead = nullptr;
+
+  m_pTail = pLastUsed;
+}
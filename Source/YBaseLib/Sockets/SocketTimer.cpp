@@ -0,0 +1,232 @@
+#include "YBaseLib/Sockets/SocketTimer.h"
+#include "YBaseLib/Assert.h"
+#include "YBaseLib/Memory.h"
+#include "YBaseLib/NumericLimits.h"
+
+SocketTimer::SocketTimer()
+  : m_pNext(nullptr), m_pPrev(nullptr), m_deadline(0), m_eventLoopIndex(0), m_wheelLevel(0), m_wheelSlot(0),
+    m_scheduled(false)
+{
+}
+
+SocketTimer::~SocketTimer()
+{
+  DebugAssert(!m_scheduled);
+}
+
+SocketTimerWheel::SocketTimerWheel(uint64 currentTick /* = 0 */) : m_currentTick(currentTick), m_timerCount(0)
+{
+  Y_memzero(m_pSlots, sizeof(m_pSlots));
+  Y_memzero(m_occupiedSlots, sizeof(m_occupiedSlots));
+  m_pOverflowTimers = nullptr;
+}
+
+SocketTimerWheel::~SocketTimerWheel()
+{
+  Reset(m_currentTick);
+}
+
+void SocketTimerWheel::Reset(uint64 currentTick)
+{
+  for (uint32 level = 0; level <= OVERFLOW_LEVEL; level++)
+  {
+    uint32 slotCount = (level == OVERFLOW_LEVEL) ? 1 : SLOT_COUNT;
+    for (uint32 slot = 0; slot < slotCount; slot++)
+    {
+      SocketTimer** ppHead = GetListHead(level, slot);
+      for (SocketTimer* pTimer = *ppHead; pTimer != nullptr; pTimer = pTimer->m_pNext)
+        pTimer->m_scheduled = false;
+
+      *ppHead = nullptr;
+    }
+  }
+
+  Y_memzero(m_occupiedSlots, sizeof(m_occupiedSlots));
+  m_currentTick = currentTick;
+  m_timerCount = 0;
+}
+
+void SocketTimerWheel::Schedule(SocketTimer* pTimer, uint64 deadline)
+{
+  DebugAssert(!pTimer->m_scheduled);
+  pTimer->m_deadline = deadline;
+  pTimer->m_scheduled = true;
+  Place(pTimer);
+  m_timerCount++;
+}
+
+void SocketTimerWheel::Cancel(SocketTimer* pTimer)
+{
+  DebugAssert(pTimer->m_scheduled && m_timerCount > 0);
+  Unlink(pTimer);
+  pTimer->m_scheduled = false;
+  m_timerCount--;
+}
+
+SocketTimer* SocketTimerWheel::PopExpiredTimer(uint64 currentTick)
+{
+  for (;;)
+  {
+    // everything in the current level 0 slot is due
+    SocketTimer* pTimer = m_pSlots[0][m_currentTick & SLOT_MASK];
+    if (pTimer != nullptr)
+    {
+      Cancel(pTimer);
+      return pTimer;
+    }
+
+    if (m_currentTick >= currentTick)
+      return nullptr;
+
+    // every slot before the next wakeup is empty, so skip straight there, cascading if it's the start of a turn
+    uint64 wakeupTick = GetNextWakeupTick();
+    if (wakeupTick > currentTick)
+    {
+      m_currentTick = currentTick;
+      return nullptr;
+    }
+
+    m_currentTick = wakeupTick;
+    if ((m_currentTick & SLOT_MASK) == 0)
+      Cascade();
+  }
+}
+
+SocketTimer* SocketTimerWheel::PopAnyTimer()
+{
+  for (uint32 level = 0; level <= OVERFLOW_LEVEL && m_timerCount > 0; level++)
+  {
+    uint32 slotCount = (level == OVERFLOW_LEVEL) ? 1 : SLOT_COUNT;
+    for (uint32 slot = 0; slot < slotCount; slot++)
+    {
+      SocketTimer* pTimer = *GetListHead(level, slot);
+      if (pTimer != nullptr)
+      {
+        Cancel(pTimer);
+        return pTimer;
+      }
+    }
+  }
+
+  return nullptr;
+}
+
+uint64 SocketTimerWheel::GetNextWakeupTick() const
+{
+  if (m_timerCount == 0)
+    return Y_UINT64_MAX;
+
+  // the first occupied slot from the lowest level up. level 0 slots are exact, higher ones are when they cascade.
+  // the current slot of a higher level is always empty, it was cascaded when the tick reached it.
+  for (uint32 level = 0; level < LEVEL_COUNT; level++)
+  {
+    uint32 shift = level * SLOT_BITS;
+    uint32 currentSlot = (uint32)(m_currentTick >> shift) & SLOT_MASK;
+    uint32 slot;
+    if (FindOccupiedSlot(level, (level == 0) ? currentSlot : (currentSlot + 1), &slot))
+    {
+      uint64 turnStart = (m_currentTick >> (shift + SLOT_BITS)) << (shift + SLOT_BITS);
+      return turnStart + ((uint64)slot << shift);
+    }
+  }
+
+  // only overflow timers, which are looked at once the top level wraps
+  uint32 topShift = LEVEL_COUNT * SLOT_BITS;
+  return ((m_currentTick >> topShift) + 1) << topShift;
+}
+
+SocketTimer** SocketTimerWheel::GetListHead(uint32 level, uint32 slot)
+{
+  return (level == OVERFLOW_LEVEL) ? &m_pOverflowTimers : &m_pSlots[level][slot];
+}
+
+void SocketTimerWheel::Place(SocketTimer* pTimer)
+{
+  // the lowest level where the deadline is in the same turn as the current tick
+  uint64 deadline = Max(pTimer->m_deadline, m_currentTick);
+  uint32 level = 0;
+  while (level < LEVEL_COUNT &&
+         (deadline >> ((level + 1) * SLOT_BITS)) != (m_currentTick >> ((level + 1) * SLOT_BITS)))
+  {
+    level++;
+  }
+
+  uint32 slot = 0;
+  if (level < LEVEL_COUNT)
+  {
+    slot = (uint32)(deadline >> (level * SLOT_BITS)) & SLOT_MASK;
+    m_occupiedSlots[level][slot / 64] |= (uint64)1 << (slot % 64);
+  }
+
+  SocketTimer** ppHead = GetListHead(level, slot);
+  pTimer->m_wheelLevel = level;
+  pTimer->m_wheelSlot = slot;
+  pTimer->m_pPrev = nullptr;
+  pTimer->m_pNext = *ppHead;
+  if (*ppHead != nullptr)
+    (*ppHead)->m_pPrev = pTimer;
+
+  *ppHead = pTimer;
+}
+
+void SocketTimerWheel::Unlink(SocketTimer* pTimer)
+{
+  SocketTimer** ppHead = GetListHead(pTimer->m_wheelLevel, pTimer->m_wheelSlot);
+  if (pTimer->m_pPrev != nullptr)
+    pTimer->m_pPrev->m_pNext = pTimer->m_pNext;
+  else
+    *ppHead = pTimer->m_pNext;
+
+  if (pTimer->m_pNext != nullptr)
+    pTimer->m_pNext->m_pPrev = pTimer->m_pPrev;
+
+  if (*ppHead == nullptr && pTimer->m_wheelLevel < LEVEL_COUNT)
+    m_occupiedSlots[pTimer->m_wheelLevel][pTimer->m_wheelSlot / 64] &= ~((uint64)1 << (pTimer->m_wheelSlot % 64));
+
+  pTimer->m_pNext = nullptr;
+  pTimer->m_pPrev = nullptr;
+}
+
+void SocketTimerWheel::Cascade()
+{
+  // from the top down, so timers can drop more than one level
+  for (uint32 level = OVERFLOW_LEVEL; level > 0; level--)
+  {
+    uint32 shift = level * SLOT_BITS;
+    if ((m_currentTick & (((uint64)1 << shift) - 1)) != 0)
+      continue;
+
+    uint32 slot = (level == OVERFLOW_LEVEL) ? 0 : ((uint32)(m_currentTick >> shift) & SLOT_MASK);
+    SocketTimer** ppHead = GetListHead(level, slot);
+    SocketTimer* pTimer = *ppHead;
+    *ppHead = nullptr;
+    if (level < LEVEL_COUNT)
+      m_occupiedSlots[level][slot / 64] &= ~((uint64)1 << (slot % 64));
+
+    while (pTimer != nullptr)
+    {
+      SocketTimer* pNext = pTimer->m_pNext;
+      Place(pTimer);
+      pTimer = pNext;
+    }
+  }
+}
+
+bool SocketTimerWheel::FindOccupiedSlot(uint32 level, uint32 startSlot, uint32* pSlot) const
+{
+  for (uint32 word = startSlot / 64; word < SLOT_COUNT / 64; word++)
+  {
+    uint64 mask = m_occupiedSlots[level][word];
+    if (word == startSlot / 64)
+      mask &= ~(uint64)0 << (startSlot % 64);
+
+    uint64 bit;
+    if (mask != 0 && Y_bitscanforward(mask, &bit))
+    {
+      *pSlot = word * 64 + (uint32)bit;
+      return true;
+    }
+  }
+
+  return false;
+}
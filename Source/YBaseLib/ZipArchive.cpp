@@ -3,7 +3,12 @@
 #ifdef HAVE_ZLIB
 #include "YBaseLib/BinaryReader.h"
 #include "YBaseLib/BinaryWriter.h"
+#include "YBaseLib/CRC32.h"
+#include "YBaseLib/CompressionCodec.h"
 #include "YBaseLib/Log.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/MutexLock.h"
+#include "YBaseLib/ThreadPool.h"
 #include "YBaseLib/Timestamp.h"
 Log_SetChannel(ZipArchive);
 
@@ -17,14 +22,121 @@ Log_SetChannel(ZipArchive);
 // zip file constants
 static const uint32 ZIP_ARCHIVE_VERSION_MADE_BY = 0;
 static const uint32 ZIP_ARCHIVE_VERSION_TO_EXTRACT = 20;
+static const uint32 ZIP_ARCHIVE_VERSION_TO_EXTRACT_ZIP64 = 45;
 static const uint32 ZIP_ARCHIVE_LOCAL_FILE_HEADER_SIGNTURE = 0x04034b50;
 static const uint32 ZIP_ARCHIVE_DATA_DESCRIPTOR_SIGNATURE = 0x08074b50;
 static const uint32 ZIP_ARCHIVE_CENTRAL_DIRECTORY_FILE_HEADER_SIGNATURE = 0x02014b50;
 static const uint32 ZIP_ARCHIVE_END_OF_CENTRAL_DIRECTORY_SIGNATURE = 0x06054b50;
+static const uint32 ZIP_ARCHIVE_ZIP64_END_OF_CENTRAL_DIRECTORY_SIGNATURE = 0x06064b50;
+static const uint32 ZIP_ARCHIVE_ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIGNATURE = 0x07064b50;
+
+// zip64: 32-bit fields which overflow are set to 0xFFFFFFFF (16-bit counts to 0xFFFF) and the real values are stored
+// in a zip64 extra field, or for the end record, in a zip64 end record found through a locator in front of it.
+// streamed entries reserve space for the extra field in their local header, as their size isn't known up front. if
+// it turns out not to be needed, it is left as an extra field with an unassigned id, which readers skip.
+static const uint16 ZIP_EXTRA_FIELD_ZIP64_ID = 0x0001;
+static const uint16 ZIP_EXTRA_FIELD_RESERVED_ID = 0x5953;
+static const uint32 ZIP_LOCAL_ZIP64_EXTRA_FIELD_SIZE = 4 + 8 + 8;
+static const uint32 ZIP_ZIP64_END_OF_CENTRAL_DIRECTORY_SIZE = 56;
+static const uint32 ZIP_ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIZE = 20;
+
+// compression methods besides stored (0) and deflate (Z_DEFLATED). zstd's id is from the zip specification, which
+// requires version 6.3 to extract it. lz4 has no assigned id, so the one used here is only understood by this library.
+static const uint32 ZIP_COMPRESSION_METHOD_ZSTD = 93;
+static const uint32 ZIP_COMPRESSION_METHOD_LZ4 = 0x4C34;
+static const uint32 ZIP_ARCHIVE_VERSION_TO_EXTRACT_ZSTD = 63;
 
 static const uint32 ZIP_STREAM_BUFFER_SIZE = 16384;
 static const uint32 ZIP_BUFFERED_IO_CHUNK_SIZE = 4096;
 
+// parallel compression: deflate window carried between blocks, and how much closed-but-unwritten entry data may be
+// held in memory before closing another entry waits for the oldest one to be written
+static const uint32 ZIP_DEFLATE_DICTIONARY_SIZE = 32768;
+static const uint64 ZIP_MAX_PENDING_WRITE_BYTES = 64 * 1024 * 1024;
+
+// decompressed bytes between the inflate checkpoints streamed readers seek through
+static const uint32 ZIP_DEFAULT_SEEK_CHECKPOINT_INTERVAL = 1024 * 1024;
+
+// bulk extraction: neighbouring entries are fetched in a single read of up to ZIP_EXTRACT_READ_SIZE, as long as the
+// dead space between them is under ZIP_EXTRACT_MAX_READ_GAP. at most ZIP_EXTRACT_MAX_IN_FLIGHT_BYTES of compressed
+// data is held waiting for workers.
+static const uint32 ZIP_LOCAL_FILE_HEADER_SIZE = 30;
+static const uint32 ZIP_EXTRACT_READ_SIZE = 4 * 1024 * 1024;
+static const uint32 ZIP_EXTRACT_MAX_READ_GAP = 64 * 1024;
+static const uint64 ZIP_EXTRACT_MAX_IN_FLIGHT_BYTES = 64 * 1024 * 1024;
+static const uint32 ZIP_EXTRACT_OUTPUT_CHUNK_SIZE = 256 * 1024;
+
+// fixed-size parts of the records which are decoded in place
+static const uint32 ZIP_CENTRAL_DIRECTORY_FILE_HEADER_SIZE = 46;
+static const uint32 ZIP_END_OF_CENTRAL_DIRECTORY_SIZE = 22;
+
+static bool GetCompressionMethodCodec(uint32 compressionMethod, COMPRESSION_CODEC* pCodec)
+{
+  switch (compressionMethod)
+  {
+    case Z_DEFLATED:
+      *pCodec = COMPRESSION_CODEC_DEFLATE;
+      return true;
+
+    case ZIP_COMPRESSION_METHOD_ZSTD:
+      *pCodec = COMPRESSION_CODEC_ZSTD;
+      return true;
+
+    case ZIP_COMPRESSION_METHOD_LZ4:
+      *pCodec = COMPRESSION_CODEC_LZ4;
+      return true;
+  }
+
+  return false;
+}
+
+static uint32 GetCodecCompressionMethod(COMPRESSION_CODEC codec)
+{
+  switch (codec)
+  {
+    case COMPRESSION_CODEC_ZSTD:
+      return ZIP_COMPRESSION_METHOD_ZSTD;
+
+    case COMPRESSION_CODEC_LZ4:
+      return ZIP_COMPRESSION_METHOD_LZ4;
+
+    default:
+      return Z_DEFLATED;
+  }
+}
+
+static uint32 GetVersionRequiredToExtract(uint32 compressionMethod)
+{
+  return (compressionMethod == 0 || compressionMethod == Z_DEFLATED) ? ZIP_ARCHIVE_VERSION_TO_EXTRACT :
+                                                                       ZIP_ARCHIVE_VERSION_TO_EXTRACT_ZSTD;
+}
+
+// returns null, with an error logged, if the method isn't known or its codec isn't built in
+static CompressionCodecStream* CreateDecompressorForMethod(uint32 compressionMethod)
+{
+  COMPRESSION_CODEC codec;
+  CompressionCodecStream* pDecompressor = NULL;
+  if (!GetCompressionMethodCodec(compressionMethod, &codec) ||
+      (pDecompressor = CompressionCodec::CreateDecompressor(codec)) == NULL)
+  {
+    Log_ErrorPrintf("ZipArchive: Compression method %u is not supported", compressionMethod);
+  }
+
+  return pDecompressor;
+}
+
+// fields are widened to hold zip64 values
+struct ZIP_ARCHIVE_END_OF_CENTRAL_DIRECTORY
+{
+  uint32 DiskNumber;
+  uint32 CentralDirectoryDisk;
+  uint64 CentralDirectoryRecordsOnThisDisk;
+  uint64 CentralDirectoryTotalRecords;
+  uint64 CentralDirectorySize;
+  uint64 CentralDirectoryOffset;
+  uint16 CommentLength;
+};
+
 struct ZIP_ARCHIVE_LOCAL_FILE_HEADER
 {
   uint32 Signature;
@@ -70,272 +182,1145 @@ static uint32 TimestampToZipTime(const Timestamp& ts)
          ((expandedTime.Second / 2) + (32 * expandedTime.Minute) + (2048 * expandedTime.Hour));
 }
 
-class ZipArchiveStreamedReadByteStream : public ByteStream
+static inline uint16 ReadZipUInt16(const byte* pData)
 {
-public:
-  ZipArchiveStreamedReadByteStream(ZipArchive* pZipArchive, ByteStream* pArchiveStream, uint64 baseOffset,
-                                   ZIP_ARCHIVE_LOCAL_FILE_HEADER* pLocalFileHeader)
-    : m_pZipArchive(pZipArchive), m_pArchiveStream(pArchiveStream), m_baseOffset(baseOffset),
-      m_currentFileOffset(baseOffset), m_inBufferBytes(0), m_inBufferPosition(0), m_currentDecompressedOffset(0),
-      m_currentCRC32(0)
-  {
-    std::memcpy(&m_localFileHeader, pLocalFileHeader, sizeof(m_localFileHeader));
+  return (uint16)((uint16)pData[0] | ((uint16)pData[1] << 8));
+}
 
-    switch (m_localFileHeader.CompressionMethod)
-    {
-      case Z_DEFLATED:
-      {
-        Y_memzero(&m_zStream, sizeof(m_zStream));
-        if (inflateInit2(&m_zStream, -MAX_WBITS) != Z_OK)
-          Panic("inflateInit2 failed");
-      }
-      break;
-    }
+static inline uint32 ReadZipUInt32(const byte* pData)
+{
+  return (uint32)pData[0] | ((uint32)pData[1] << 8) | ((uint32)pData[2] << 16) | ((uint32)pData[3] << 24);
+}
 
-    m_pZipArchive->m_nOpenStreamedReads++;
-  }
+static inline uint64 ReadZipUInt64(const byte* pData)
+{
+  return (uint64)ReadZipUInt32(pData) | ((uint64)ReadZipUInt32(pData + 4) << 32);
+}
 
-  ~ZipArchiveStreamedReadByteStream()
+// replaces the values which are saturated with those from the zip64 extra field, if there is one. the extra field
+// only holds the values which overflowed, in this order. pOffsetToFileHeader is null for local headers.
+static bool ApplyZip64ExtraField(const byte* pExtraField, uint32 extraFieldLength, uint64* pDecompressedSize,
+                                 uint64* pCompressedSize, uint64* pOffsetToFileHeader)
+{
+  uint32 position = 0;
+  while ((position + 4) <= extraFieldLength)
   {
-    m_pZipArchive->m_nOpenStreamedReads--;
+    uint32 fieldId = ReadZipUInt16(pExtraField + position);
+    uint32 fieldSize = ReadZipUInt16(pExtraField + position + 2);
+    position += 4;
+    if (fieldSize > (extraFieldLength - position))
+      return false;
 
-    switch (m_localFileHeader.CompressionMethod)
+    if (fieldId == ZIP_EXTRA_FIELD_ZIP64_ID)
     {
-      case Z_DEFLATED:
+      const byte* pField = pExtraField + position;
+      const byte* pFieldEnd = pField + fieldSize;
+      uint64* ppValues[3] = {pDecompressedSize, pCompressedSize, pOffsetToFileHeader};
+      for (uint32 i = 0; i < countof(ppValues); i++)
       {
-        inflateEnd(&m_zStream);
+        if (ppValues[i] == NULL || *ppValues[i] != 0xFFFFFFFFULL)
+          continue;
+        if ((pField + 8) > pFieldEnd)
+          return false;
+
+        *ppValues[i] = ReadZipUInt64(pField);
+        pField += 8;
       }
-      break;
+
+      return true;
     }
+
+    position += fieldSize;
   }
 
-  bool FillInputBuffer()
-  {
-    if (m_errorState)
-      return false;
+  return true;
+}
 
-    if (m_currentFileOffset == (m_baseOffset + m_localFileHeader.CompressedSize))
-      return false;
+// reads size bytes at offset, in place if the stream is memory-backed, otherwise into pBuffer
+static const byte* ReadZipRecord(ByteStream* pStream, uint64 offset, uint32 size, byte* pBuffer)
+{
+  if (offset > pStream->GetSize() || size > (pStream->GetSize() - offset))
+    return NULL;
 
-    if (!m_pArchiveStream->SeekAbsolute(m_currentFileOffset))
-    {
-      m_errorState = true;
-      return false;
-    }
+  const byte* pStreamMemory = pStream->GetMemoryBasePointer();
+  if (pStreamMemory != NULL)
+    return pStreamMemory + offset;
 
-    // needs more input buffer FIXME
-    uint32 readSize =
-      (uint32)Min(m_localFileHeader.CompressedSize - (m_currentFileOffset - m_baseOffset), (uint64)sizeof(m_pInBuffer));
-    uint32 nInputBytes = m_pArchiveStream->Read(m_pInBuffer, readSize);
-    if (nInputBytes == 0 || m_pArchiveStream->InErrorState())
+  if (!pStream->SeekAbsolute(offset) || pStream->Read(pBuffer, size) != size)
+    return NULL;
+
+  return pBuffer;
+}
+
+// the end record is followed by a comment of up to 64KiB, so the last 64KiB + 22 bytes are fetched in one read (or
+// used in place for memory-backed streams) and scanned backwards
+static bool ReadEndOfCentralDirectory(ByteStream* pStream, ZIP_ARCHIVE_END_OF_CENTRAL_DIRECTORY* pEndOfCentralDirectory)
+{
+  uint64 streamSize = pStream->GetSize();
+  if (streamSize < ZIP_END_OF_CENTRAL_DIRECTORY_SIZE)
+    return false;
+
+  uint32 tailSize = (uint32)Min(streamSize, (uint64)(ZIP_END_OF_CENTRAL_DIRECTORY_SIZE + 0xFFFF));
+  uint64 tailOffset = streamSize - tailSize;
+  const byte* pTail = pStream->GetMemoryBasePointer();
+  byte* pTailBuffer = NULL;
+  if (pTail != NULL)
+  {
+    pTail += tailOffset;
+  }
+  else
+  {
+    pTailBuffer = (byte*)std::malloc(tailSize);
+    if (!pStream->SeekAbsolute(tailOffset) || pStream->Read(pTailBuffer, tailSize) != tailSize)
     {
-      m_errorState = true;
+      std::free(pTailBuffer);
       return false;
     }
 
-    m_currentFileOffset += (uint64)nInputBytes;
-    m_inBufferBytes = nInputBytes;
-    return true;
+    pTail = pTailBuffer;
   }
 
-  virtual uint32 Read(void* pDestination, uint32 ByteCount)
+  bool result = false;
+  uint64 recordOffset = 0;
+  for (uint32 i = tailSize - ZIP_END_OF_CENTRAL_DIRECTORY_SIZE + 1; i-- > 0;)
   {
-    if (m_errorState)
-      return 0;
-
-    switch (m_localFileHeader.CompressionMethod)
+    const byte* pRecord = pTail + i;
+    if (ReadZipUInt32(pRecord) == ZIP_ARCHIVE_END_OF_CENTRAL_DIRECTORY_SIGNATURE)
     {
-        // uncompressed
-      case 0:
-      {
-        byte* pCurrentPtr = reinterpret_cast<byte*>(pDestination);
-        uint32 remaining = ByteCount;
-
-        while (remaining > 0)
-        {
-          if (m_inBufferPosition == m_inBufferBytes)
-          {
-            if (!FillInputBuffer())
-              break;
-
-            m_inBufferPosition = 0;
-          }
-
-          uint32 copyLength = Min(remaining, m_inBufferBytes - m_inBufferPosition);
-          std::memcpy(pCurrentPtr, m_pInBuffer + m_inBufferPosition, copyLength);
-          m_currentCRC32 = crc32(m_currentCRC32, pCurrentPtr, copyLength);
-          m_currentDecompressedOffset += (uint64)copyLength;
-          m_inBufferPosition += copyLength;
-          pCurrentPtr += copyLength;
-          remaining -= copyLength;
-        }
-
-        if (m_currentDecompressedOffset == m_localFileHeader.DecompressedSize &&
-            m_currentCRC32 != m_localFileHeader.CRC32)
-        {
-          Log_ErrorPrintf("ZipArchiveStreamedReadByteStream::Read: CRC mismatch: %u / %u", m_currentCRC32,
-                          m_localFileHeader.CRC32);
-          m_errorState = true;
-          return 0;
-        }
-
-        return (ByteCount - remaining);
-      }
+      pEndOfCentralDirectory->DiskNumber = ReadZipUInt16(pRecord + 4);
+      pEndOfCentralDirectory->CentralDirectoryDisk = ReadZipUInt16(pRecord + 6);
+      pEndOfCentralDirectory->CentralDirectoryRecordsOnThisDisk = ReadZipUInt16(pRecord + 8);
+      pEndOfCentralDirectory->CentralDirectoryTotalRecords = ReadZipUInt16(pRecord + 10);
+      pEndOfCentralDirectory->CentralDirectorySize = ReadZipUInt32(pRecord + 12);
+      pEndOfCentralDirectory->CentralDirectoryOffset = ReadZipUInt32(pRecord + 16);
+      pEndOfCentralDirectory->CommentLength = ReadZipUInt16(pRecord + 20);
+      recordOffset = tailOffset + i;
+      result = true;
       break;
+    }
+  }
 
-        // deflate
-      case Z_DEFLATED:
-      {
-        m_zStream.avail_out = ByteCount;
-        m_zStream.next_out = (Bytef*)pDestination;
-
-        while (m_zStream.avail_out > 0)
-        {
-          if (m_zStream.avail_in == 0)
-          {
-            // if there is no input bytes, there can still be output bytes if they're repeating
-            // this logic could probably be written a bit better though (maybe Z_BUF_ERROR)
-            if (FillInputBuffer())
-            {
-              m_zStream.avail_in = m_inBufferBytes;
-              m_zStream.next_in = (Bytef*)m_pInBuffer;
-            }
-          }
+  std::free(pTailBuffer);
+  if (!result || recordOffset < ZIP_ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIZE)
+    return result;
 
-          // save the buffer pointer
-          Bytef* pOldPointer = m_zStream.next_out;
+  // a zip64 locator directly in front of the end record points at the zip64 end record, which has the full values
+  byte locatorBuffer[ZIP_ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIZE];
+  const byte* pLocator = ReadZipRecord(pStream, recordOffset - ZIP_ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIZE,
+                                       ZIP_ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIZE, locatorBuffer);
+  if (pLocator == NULL || ReadZipUInt32(pLocator) != ZIP_ARCHIVE_ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIGNATURE)
+    return true;
 
-          // inflate it
-          int err = inflate(&m_zStream, Z_SYNC_FLUSH);
-          if (err != Z_OK && err != Z_STREAM_END)
-          {
-            // some other error
-            Log_ErrorPrintf("ZipArchiveStreamedReadByteStream::Read: zlib returned error: %d", err);
-            m_errorState = true;
-            break;
-          }
+  byte recordBuffer[ZIP_ZIP64_END_OF_CENTRAL_DIRECTORY_SIZE];
+  const byte* pRecord =
+    ReadZipRecord(pStream, ReadZipUInt64(pLocator + 8), ZIP_ZIP64_END_OF_CENTRAL_DIRECTORY_SIZE, recordBuffer);
+  if (pRecord == NULL || ReadZipUInt32(pRecord) != ZIP_ARCHIVE_ZIP64_END_OF_CENTRAL_DIRECTORY_SIGNATURE)
+  {
+    Log_ErrorPrintf("ReadEndOfCentralDirectory: Zip64 end of central directory record is missing or corrupted");
+    return false;
+  }
 
-          // update crc32
-          if (m_zStream.next_out != pOldPointer)
-            m_currentCRC32 = crc32(m_currentCRC32, pOldPointer, static_cast<uInt>(m_zStream.next_out - pOldPointer));
+  pEndOfCentralDirectory->DiskNumber = ReadZipUInt32(pRecord + 16);
+  pEndOfCentralDirectory->CentralDirectoryDisk = ReadZipUInt32(pRecord + 20);
+  pEndOfCentralDirectory->CentralDirectoryRecordsOnThisDisk = ReadZipUInt64(pRecord + 24);
+  pEndOfCentralDirectory->CentralDirectoryTotalRecords = ReadZipUInt64(pRecord + 32);
+  pEndOfCentralDirectory->CentralDirectorySize = ReadZipUInt64(pRecord + 40);
+  pEndOfCentralDirectory->CentralDirectoryOffset = ReadZipUInt64(pRecord + 48);
+  return true;
+}
 
-          // handle return
-          if (err == Z_OK)
-          {
-            // done this block, so continue with the next one if required
-            continue;
-          }
-          else if (err == Z_STREAM_END)
-          {
-            // check crc32
-            if (m_currentCRC32 != m_localFileHeader.CRC32)
-            {
-              // error
-              Log_ErrorPrintf("ZipArchiveStreamedReadByteStream::Read: CRC mismatch: %u / %u", m_currentCRC32,
-                              m_localFileHeader.CRC32);
-              m_errorState = true;
-              return 0;
-            }
+// writes a local header followed by the name. sizes which don't fit in 32 bits go in a zip64 extra field. with
+// reserveZip64, an extra field of the same size is written either way, so the header can be rewritten in place once
+// the sizes are known.
+static bool WriteLocalFileHeader(ByteStream* pStream, const ZIP_ARCHIVE_LOCAL_FILE_HEADER* pLocalFileHeader,
+                                 const String& fileName, bool reserveZip64)
+{
+  bool zip64 =
+    (pLocalFileHeader->CompressedSize >= 0xFFFFFFFFULL || pLocalFileHeader->DecompressedSize >= 0xFFFFFFFFULL);
+  uint32 versionRequiredToExtract = Max((uint32)pLocalFileHeader->VersionRequiredToExtract,
+                                        GetVersionRequiredToExtract(pLocalFileHeader->CompressionMethod));
+  uint32 compressedSize32 = (uint32)pLocalFileHeader->CompressedSize;
+  uint32 decompressedSize32 = (uint32)pLocalFileHeader->DecompressedSize;
+  if (zip64)
+  {
+    versionRequiredToExtract = Max(versionRequiredToExtract, ZIP_ARCHIVE_VERSION_TO_EXTRACT_ZIP64);
+    compressedSize32 = 0xFFFFFFFF;
+    decompressedSize32 = 0xFFFFFFFF;
+  }
 
-            // end of stream, so exit the loop
-            break;
-          }
-        }
+  BinaryWriter binaryWriter(pStream, ENDIAN_TYPE_LITTLE);
+  uint32 filenameLength = Min(fileName.GetLength(), (uint32)0xFFFF);
+  uint32 extraFieldLength = (zip64 || reserveZip64) ? ZIP_LOCAL_ZIP64_EXTRA_FIELD_SIZE : 0;
+  if (!binaryWriter.SafeWriteUInt32(pLocalFileHeader->Signature) ||             // Signature
+      !binaryWriter.SafeWriteUInt16((uint16)versionRequiredToExtract) ||        // VersionRequiredToExtract
+      !binaryWriter.SafeWriteUInt16(pLocalFileHeader->Flags) ||                 // Flags
+      !binaryWriter.SafeWriteUInt16(pLocalFileHeader->CompressionMethod) ||     // CompressionMethod
+      !binaryWriter.SafeWriteUInt32(pLocalFileHeader->ModificationTimestamp) || // ModificationTimestamp
+      !binaryWriter.SafeWriteUInt32(pLocalFileHeader->CRC32) ||                 // CRC32
+      !binaryWriter.SafeWriteUInt32(compressedSize32) ||                        // CompressedSize
+      !binaryWriter.SafeWriteUInt32(decompressedSize32) ||                      // DecompressedSize
+      !binaryWriter.SafeWriteUInt16((uint16)filenameLength) ||                  // FilenameLength
+      !binaryWriter.SafeWriteUInt16((uint16)extraFieldLength) ||                // ExtraFieldLength
+      !binaryWriter.SafeWriteFixedString(fileName, filenameLength))             // Filename
+  {
+    return false;
+  }
 
-        uint32 bytesRead = (ByteCount - (uint32)m_zStream.avail_out);
-        m_currentDecompressedOffset += (uint64)bytesRead;
-        m_zStream.avail_out = 0;
-        m_zStream.next_out = NULL;
-        return bytesRead;
-      }
-      break;
+  if (extraFieldLength == 0)
+    return true;
 
-        // unknown method
-      default:
-      {
-        Log_ErrorPrintf("ZipArchiveStreamedReadByteStream::Read: Unknown compression method: %u",
-                        (uint32)m_localFileHeader.CompressionMethod);
-        m_errorState = true;
-        return 0;
-      }
-      break;
-    }
-  }
+  // the local zip64 field always has both sizes
+  return (binaryWriter.SafeWriteUInt16((zip64) ? ZIP_EXTRA_FIELD_ZIP64_ID : ZIP_EXTRA_FIELD_RESERVED_ID) &&
+          binaryWriter.SafeWriteUInt16((uint16)(ZIP_LOCAL_ZIP64_EXTRA_FIELD_SIZE - 4)) &&
+          binaryWriter.SafeWriteUInt64(pLocalFileHeader->DecompressedSize) &&
+          binaryWriter.SafeWriteUInt64(pLocalFileHeader->CompressedSize));
+}
 
-  virtual bool ReadByte(byte* pDestByte)
+// One piece of an entry compressed on the archive's thread pool. Blocks after the first are primed with the input which
+// precedes them, and every block but the last ends on a sync flush, so the outputs concatenate into a single deflate
+// stream (the same approach pigz uses). Stored blocks only have their CRC calculated. Other codecs can't be joined up
+// like this, so their entries are compressed as a single block.
+class ZipArchiveCompressionBlock : public ThreadPoolWorkItem
+{
+public:
+  ZipArchiveCompressionBlock(ZipArchive* pArchive, uint32 compressionMethod, uint32 compressionLevel,
+                             const byte* pInput, uint32 inputSize, const byte* pDictionary, uint32 dictionarySize,
+                             bool lastBlock, byte* pOwnedMemory)
+    : m_pArchive(pArchive), m_compressionMethod(compressionMethod), m_compressionLevel(compressionLevel),
+      m_pInput(pInput), m_inputSize(inputSize), m_pDictionary(pDictionary), m_dictionarySize(dictionarySize),
+      m_lastBlock(lastBlock), m_pOwnedMemory(pOwnedMemory), m_pOutput(NULL), m_outputSize(0), m_crc32(0),
+      m_successful(false), m_completed(false)
   {
-    return (Read(reinterpret_cast<void*>(pDestByte), sizeof(byte)) == sizeof(byte));
   }
 
-  virtual bool Read2(void* pDestination, uint32 ByteCount, uint32* pNumberOfBytesRead = nullptr)
+  ~ZipArchiveCompressionBlock()
   {
-    uint32 nBytes = Read(pDestination, ByteCount);
-    if (pNumberOfBytesRead != nullptr)
-      *pNumberOfBytesRead = nBytes;
+    if (m_pOutput != m_pInput)
+      std::free(m_pOutput);
 
-    return (nBytes == ByteCount);
+    std::free(m_pOwnedMemory);
   }
 
-  virtual bool WriteByte(byte SourceByte) { return false; }
-
-  virtual uint32 Write(const void* pSource, uint32 ByteCount) { return false; }
+  const byte* GetOutput() const { return m_pOutput; }
+  uint32 GetOutputSize() const { return m_outputSize; }
+  uint32 GetInputSize() const { return m_inputSize; }
+  uint32 GetCRC32() const { return m_crc32; }
+  bool IsSuccessful() const { return m_successful; }
 
-  virtual bool Write2(const void* pSource, uint32 ByteCount, uint32* pNumberOfBytesWritten = nullptr) { return false; }
+  // m_compressionLock must be held
+  bool IsCompletedLocked() const { return m_completed; }
 
-  virtual bool SeekAbsolute(uint64 Offset)
+protected:
+  virtual int32 ProcessWork() override
   {
-    // any change?
-    if (Offset == m_currentDecompressedOffset)
-      return true;
+    m_crc32 = CRC32::ComputeBuffer(0, m_pInput, m_inputSize);
 
-    // allow forward seeks
-    if (Offset > m_currentDecompressedOffset)
-      return SeekRelative(int64(Offset - m_currentDecompressedOffset));
-
-    m_errorState = true;
-    return false;
-  }
+    if (m_compressionMethod == 0)
+    {
+      m_pOutput = const_cast<byte*>(m_pInput);
+      m_outputSize = m_inputSize;
+      m_successful = true;
+      return 0;
+    }
 
-  virtual bool SeekRelative(int64 Offset)
-  {
-    if (Offset >= 0)
+    COMPRESSION_CODEC codec;
+    if (m_compressionMethod != Z_DEFLATED && GetCompressionMethodCodec(m_compressionMethod, &codec))
     {
-      // read in data until the position is correct
-      uint64 remaining = (uint64)Offset;
-      byte data[ZIP_STREAM_BUFFER_SIZE];
-      while (remaining > 0)
+      DebugAssert(m_lastBlock && m_dictionarySize == 0);
+      uint32 outputBufferSize =
+        CompressionCodec::GetCompressedBufferUpperBounds(codec, m_inputSize, m_compressionLevel);
+      m_pOutput = (byte*)std::malloc(outputBufferSize);
+      m_successful = CompressionCodec::WriteCompressedDataToBuffer(codec, m_pOutput, outputBufferSize, &m_outputSize,
+                                                                   m_pInput, m_inputSize, m_compressionLevel);
+      if (!m_successful)
       {
-        uint32 readSize = (uint32)Min(remaining, (uint64)ZIP_STREAM_BUFFER_SIZE);
-        if (Read(data, readSize) != readSize)
-          return false;
-
-        remaining -= (uint64)readSize;
+        Log_ErrorPrintf("ZipArchiveCompressionBlock::ProcessWork: %s compression failed",
+                        CompressionCodec::GetName(codec));
       }
 
-      return true;
+      return 0;
     }
 
-    m_errorState = true;
-    return false;
-  }
+    z_stream zStream;
+    Y_memzero(&zStream, sizeof(zStream));
+    if (deflateInit2(&zStream, m_compressionLevel, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      return 0;
 
-  virtual bool SeekToEnd()
-  {
-    m_errorState = true;
-    return false;
-  }
+    if (m_dictionarySize > 0 && deflateSetDictionary(&zStream, (const Bytef*)m_pDictionary, m_dictionarySize) != Z_OK)
+    {
+      deflateEnd(&zStream);
+      return 0;
+    }
 
-  virtual uint64 GetPosition() const { return m_currentDecompressedOffset; }
+    // deflateBound only covers Z_FINISH, a sync flush adds an empty stored block
+    uint32 outputBufferSize = (uint32)deflateBound(&zStream, m_inputSize) + 16;
+    m_pOutput = (byte*)std::malloc(outputBufferSize);
 
-  virtual uint64 GetSize() const { return m_localFileHeader.DecompressedSize; }
+    zStream.next_in = (Bytef*)m_pInput;
+    zStream.avail_in = m_inputSize;
+    zStream.next_out = (Bytef*)m_pOutput;
+    zStream.avail_out = outputBufferSize;
 
-  virtual bool Flush() { return false; }
+    int err = deflate(&zStream, (m_lastBlock) ? Z_FINISH : Z_SYNC_FLUSH);
+    if ((m_lastBlock && err == Z_STREAM_END) || (!m_lastBlock && err == Z_OK && zStream.avail_out > 0))
+    {
+      m_outputSize = outputBufferSize - zStream.avail_out;
+      m_successful = true;
+    }
+    else
+    {
+      Log_ErrorPrintf("ZipArchiveCompressionBlock::ProcessWork: zlib returned error %d", err);
+    }
 
-  virtual bool Discard() { return false; }
+    deflateEnd(&zStream);
+    return 0;
+  }
 
-  virtual bool Commit() { return false; }
+  virtual void OnCompleted() override
+  {
+    ThreadPoolWorkItem::OnCompleted();
 
-private:
+    MutexLock lock(m_pArchive->m_compressionLock);
+    m_completed = true;
+    m_pArchive->m_compressionCondition.WakeAll();
+  }
+
+private:
+  ZipArchive* m_pArchive;
+  uint32 m_compressionMethod;
+  uint32 m_compressionLevel;
+  const byte* m_pInput;
+  uint32 m_inputSize;
+  const byte* m_pDictionary;
+  uint32 m_dictionarySize;
+  bool m_lastBlock;
+  byte* m_pOwnedMemory;
+
+  byte* m_pOutput;
+  uint32 m_outputSize;
+  uint32 m_crc32;
+  bool m_successful;
+  bool m_completed;
+};
+
+// a closed buffered write whose blocks are being compressed, waiting for its turn to be written to the archive
+struct ZipArchivePendingWrite
+{
+  ZipArchive::FileEntry* pFileEntry;
+  uint32 CompressionMethod;
+  uint32 CompressionLevel;
+  Timestamp ModifiedTime;
+  byte* pData;
+  uint32 DataSize;
+  PODArray<ZipArchiveCompressionBlock*> Blocks;
+};
+
+// an entry selected for bulk extraction, along with the end of the archive range which can contain it.
+// entries of index-only archives have no FileEntry, and are decoded from IndexRecordOffset when they're reached.
+struct ZipArchiveExtractEntry
+{
+  const ZipArchive::FileEntry* pFileEntry;
+  uint32 IndexRecordOffset;
+  ByteStream* pArchiveStream;
+  uint32 StreamIndex;
+  uint64 Offset;
+  uint64 CompressedSize;
+  uint64 SpanEnd;
+};
+
+static int CompareExtractEntries(const ZipArchiveExtractEntry* pLeft, const ZipArchiveExtractEntry* pRight)
+{
+  if (pLeft->StreamIndex != pRight->StreamIndex)
+    return (pLeft->StreamIndex < pRight->StreamIndex) ? -1 : 1;
+  if (pLeft->Offset != pRight->Offset)
+    return (pLeft->Offset < pRight->Offset) ? -1 : 1;
+
+  return 0;
+}
+
+// a range of the archive fetched with a single read, shared by the items for the entries inside it
+class ZipArchiveExtractBuffer : public ReferenceCounted
+{
+public:
+  ZipArchiveExtractBuffer(uint32 size) : m_pData((byte*)std::malloc(size)), m_size(size) {}
+  ~ZipArchiveExtractBuffer() { std::free(m_pData); }
+
+  byte* GetData() const { return m_pData; }
+  uint32 GetSize() const { return m_size; }
+
+private:
+  byte* m_pData;
+  uint32 m_size;
+};
+
+class ZipArchiveExtractQueue;
+
+// decompresses one entry out of an extract buffer into the sink's stream
+class ZipArchiveExtractItem : public ThreadPoolWorkItem
+{
+public:
+  ZipArchiveExtractItem(ZipArchiveExtractQueue* pQueue, const char* fileName, ByteStream* pOutputStream,
+                        const ZIP_ARCHIVE_LOCAL_FILE_HEADER* pLocalFileHeader, ZipArchiveExtractBuffer* pBuffer,
+                        uint32 dataOffset)
+    : m_pQueue(pQueue), m_fileName(fileName), m_pOutputStream(pOutputStream), m_localFileHeader(*pLocalFileHeader),
+      m_pBuffer(pBuffer), m_dataOffset(dataOffset), m_successful(false)
+  {
+    m_pBuffer->AddRef();
+  }
+
+  ~ZipArchiveExtractItem() { m_pBuffer->Release(); }
+
+  const String& GetFileName() const { return m_fileName; }
+  ByteStream* GetOutputStream() const { return m_pOutputStream; }
+  uint64 GetInputSize() const { return m_localFileHeader.CompressedSize; }
+  bool IsSuccessful() const { return m_successful; }
+
+  void Extract()
+  {
+    const byte* pInput = m_pBuffer->GetData() + m_dataOffset;
+    uint32 inputSize = (uint32)m_localFileHeader.CompressedSize;
+    uint32 currentCRC32 = 0;
+    uint64 outputSize = 0;
+    bool result = true;
+
+    if (m_localFileHeader.CompressionMethod == 0)
+    {
+      currentCRC32 = CRC32::ComputeBuffer(0, pInput, inputSize);
+      outputSize = inputSize;
+      result = (inputSize == 0 || m_pOutputStream->Write2(pInput, inputSize));
+    }
+    else
+    {
+      CompressionCodecStream* pDecompressor = CreateDecompressorForMethod(m_localFileHeader.CompressionMethod);
+      result = (pDecompressor != NULL);
+
+      // the whole input is already in memory, so only the output needs chunking. like the buffered reader, this
+      // stops once the expected amount is out rather than requiring an end of stream marker.
+      byte* pOutputChunk = (byte*)std::malloc(ZIP_EXTRACT_OUTPUT_CHUNK_SIZE);
+      while (result && outputSize < m_localFileHeader.DecompressedSize)
+      {
+        byte* pOutput = pOutputChunk;
+        uint32 outputRemaining = ZIP_EXTRACT_OUTPUT_CHUNK_SIZE;
+        COMPRESSION_CODEC_RESULT err = pDecompressor->Process(&pInput, &inputSize, &pOutput, &outputRemaining, false);
+        if (err == COMPRESSION_CODEC_RESULT_ERROR)
+        {
+          result = false;
+          break;
+        }
+
+        uint32 chunkSize = ZIP_EXTRACT_OUTPUT_CHUNK_SIZE - outputRemaining;
+        currentCRC32 = CRC32::ComputeBuffer(currentCRC32, pOutputChunk, chunkSize);
+        outputSize += chunkSize;
+        if (chunkSize > 0 && !m_pOutputStream->Write2(pOutputChunk, chunkSize))
+        {
+          result = false;
+          break;
+        }
+
+        if (err == COMPRESSION_CODEC_RESULT_STREAM_END)
+          break;
+      }
+
+      std::free(pOutputChunk);
+      delete pDecompressor;
+    }
+
+    m_successful = (result && outputSize == m_localFileHeader.DecompressedSize &&
+                    currentCRC32 == m_localFileHeader.CRC32);
+  }
+
+protected:
+  virtual int32 ProcessWork() override
+  {
+    Extract();
+    return 0;
+  }
+
+  virtual void OnCompleted() override;
+
+private:
+  ZipArchiveExtractQueue* m_pQueue;
+  String m_fileName;
+  ByteStream* m_pOutputStream;
+  ZIP_ARCHIVE_LOCAL_FILE_HEADER m_localFileHeader;
+  ZipArchiveExtractBuffer* m_pBuffer;
+  uint32 m_dataOffset;
+  bool m_successful;
+};
+
+// runs extract items on the pool, and hands them back to the sink on the extracting thread as they finish
+class ZipArchiveExtractQueue
+{
+public:
+  ZipArchiveExtractQueue(ZipArchiveExtractSink* pSink, ThreadPool* pThreadPool, ProgressCallbacks* pProgressCallbacks)
+    : m_pSink(pSink), m_pThreadPool(pThreadPool), m_pProgressCallbacks(pProgressCallbacks),
+      m_maxItemsInFlight((pThreadPool != NULL) ? Max(pThreadPool->GetWorkerThreadCount() * 2, (uint32)1) : 1),
+      m_itemsInFlight(0), m_bytesInFlight(0)
+  {
+  }
+
+  ~ZipArchiveExtractQueue() { DebugAssert(m_itemsInFlight == 0); }
+
+  // takes ownership of the caller's reference to the item
+  bool Submit(ZipArchiveExtractItem* pItem)
+  {
+    m_itemsInFlight++;
+    m_bytesInFlight += pItem->GetInputSize();
+
+    bool result = true;
+    if (m_pThreadPool != NULL)
+    {
+      m_pThreadPool->EnqueueWorkItem(pItem);
+    }
+    else
+    {
+      pItem->Extract();
+      m_completedItems.Add(pItem);
+    }
+
+    // each item holds a sink stream open, so don't let too many build up
+    while (m_itemsInFlight >= m_maxItemsInFlight)
+      result &= CompleteItems(true);
+
+    result &= CompleteItems(false);
+    return result;
+  }
+
+  // waits until a read of readSize bytes will fit within the in-flight budget
+  bool ReserveBytes(uint64 readSize)
+  {
+    bool result = true;
+    while (m_itemsInFlight > 0 && (m_bytesInFlight + readSize) > ZIP_EXTRACT_MAX_IN_FLIGHT_BYTES)
+      result &= CompleteItems(true);
+
+    return result;
+  }
+
+  bool WaitForAll()
+  {
+    bool result = true;
+    while (m_itemsInFlight > 0)
+      result &= CompleteItems(true);
+
+    return result;
+  }
+
+  // called on the worker
+  void OnItemCompleted(ZipArchiveExtractItem* pItem)
+  {
+    MutexLock lock(m_lock);
+    m_completedItems.Add(pItem);
+    m_condition.WakeAll();
+  }
+
+private:
+  bool CompleteItems(bool waitForItem)
+  {
+    bool result = true;
+    for (;;)
+    {
+      m_lock.Lock();
+      while (waitForItem && m_completedItems.GetSize() == 0)
+        m_condition.SleepAndRelease(&m_lock);
+      if (m_completedItems.GetSize() == 0)
+      {
+        m_lock.Unlock();
+        break;
+      }
+
+      ZipArchiveExtractItem* pItem = m_completedItems.PopFront();
+      m_lock.Unlock();
+      waitForItem = false;
+
+      if (!pItem->IsSuccessful())
+        Log_ErrorPrintf("ZipArchive::ExtractFiles: Failed to extract '%s'", pItem->GetFileName().GetCharArray());
+
+      result &= pItem->IsSuccessful();
+      result &= m_pSink->CloseEntry(pItem->GetFileName(), pItem->GetOutputStream(), pItem->IsSuccessful());
+      pItem->GetOutputStream()->Release();
+
+      m_itemsInFlight--;
+      m_bytesInFlight -= pItem->GetInputSize();
+      m_pProgressCallbacks->IncrementProgressValue();
+      pItem->Release();
+    }
+
+    return result;
+  }
+
+  ZipArchiveExtractSink* m_pSink;
+  ThreadPool* m_pThreadPool;
+  ProgressCallbacks* m_pProgressCallbacks;
+  uint32 m_maxItemsInFlight;
+  uint32 m_itemsInFlight;
+  uint64 m_bytesInFlight;
+
+  Mutex m_lock;
+  ConditionVariable m_condition;
+  PODArray<ZipArchiveExtractItem*> m_completedItems;
+};
+
+void ZipArchiveExtractItem::OnCompleted()
+{
+  ThreadPoolWorkItem::OnCompleted();
+  m_pQueue->OnItemCompleted(this);
+}
+
+// zran-style random access into a deflate entry. inflating can only be picked up part way through a stream at a block
+// boundary, given the bits of the boundary byte which belong to the next block, and the last 32KB of output to
+// resolve back-references with. the index records these every interval bytes of output, and is only extended as far
+// as seeks have needed, carrying on from its last checkpoint.
+class ZipArchiveInflateIndex
+{
+public:
+  struct Checkpoint
+  {
+    uint64 CompressedOffset; // first whole byte of the next block, relative to the entry's data
+    uint64 DecompressedOffset;
+    byte* pWindow;
+    uint32 WindowSize;
+    uint32 Bits; // bits at the top of the previous byte which belong to the next block
+    byte PreviousByte;
+  };
+
+  ZipArchiveInflateIndex(ByteStream* pArchiveStream, uint64 dataOffset, uint64 compressedSize, uint32 crc32,
+                         uint32 interval)
+    : m_pArchiveStream(pArchiveStream), m_dataOffset(dataOffset), m_compressedSize(compressedSize), m_crc32(crc32),
+      m_interval(interval), m_coveredOffset(0), m_complete(false), m_failed(false)
+  {
+  }
+
+  ~ZipArchiveInflateIndex()
+  {
+    for (uint32 i = 0; i < m_checkpoints.GetSize(); i++)
+      std::free(m_checkpoints[i].pWindow);
+  }
+
+  bool Matches(ByteStream* pArchiveStream, uint64 dataOffset, uint64 compressedSize, uint32 crc32) const
+  {
+    return (m_pArchiveStream == pArchiveStream && m_dataOffset == dataOffset && m_compressedSize == compressedSize &&
+            m_crc32 == crc32);
+  }
+
+  // sets up a raw inflate stream to continue from a checkpoint
+  static bool RestoreCheckpoint(z_stream* pZStream, const Checkpoint* pCheckpoint)
+  {
+    if (inflateReset(pZStream) != Z_OK)
+      return false;
+
+    if (pCheckpoint->Bits > 0 &&
+        inflatePrime(pZStream, (int)pCheckpoint->Bits, pCheckpoint->PreviousByte >> (8 - pCheckpoint->Bits)) != Z_OK)
+    {
+      return false;
+    }
+
+    return (pCheckpoint->WindowSize == 0 ||
+            inflateSetDictionary(pZStream, pCheckpoint->pWindow, pCheckpoint->WindowSize) == Z_OK);
+  }
+
+  // the last checkpoint at or before decompressedOffset, or null if there isn't one
+  const Checkpoint* FindCheckpoint(uint64 decompressedOffset) const
+  {
+    const Checkpoint* pCheckpoint = NULL;
+    uint32 first = 0;
+    uint32 count = m_checkpoints.GetSize();
+    while (count > 0)
+    {
+      uint32 half = count / 2;
+      if (m_checkpoints[first + half].DecompressedOffset <= decompressedOffset)
+      {
+        pCheckpoint = &m_checkpoints[first + half];
+        first += half + 1;
+        count -= half + 1;
+      }
+      else
+      {
+        count = half;
+      }
+    }
+
+    return pCheckpoint;
+  }
+
+  // inflates on from the last checkpoint until there is one past decompressedOffset, or the end of the entry
+  bool Extend(uint64 decompressedOffset)
+  {
+    if (m_complete || decompressedOffset < m_coveredOffset)
+      return true;
+    if (m_failed)
+      return false;
+
+    z_stream zStream;
+    Y_memzero(&zStream, sizeof(zStream));
+    if (inflateInit2(&zStream, -MAX_WBITS) != Z_OK)
+      return false;
+
+    // output goes round a window-sized buffer, which starts with the last checkpoint's window at its end
+    byte* pWindow = (byte*)std::malloc(ZIP_DEFLATE_DICTIONARY_SIZE);
+    uint64 compressedOffset = 0;
+    uint64 currentDecompressedOffset = 0;
+    uint32 windowBytes = 0;
+    bool result = true;
+    if (m_checkpoints.GetSize() > 0)
+    {
+      const Checkpoint& lastCheckpoint = m_checkpoints.LastElement();
+      result = RestoreCheckpoint(&zStream, &lastCheckpoint);
+      std::memcpy(pWindow + ZIP_DEFLATE_DICTIONARY_SIZE - lastCheckpoint.WindowSize, lastCheckpoint.pWindow,
+                  lastCheckpoint.WindowSize);
+      compressedOffset = lastCheckpoint.CompressedOffset;
+      currentDecompressedOffset = lastCheckpoint.DecompressedOffset;
+      windowBytes = lastCheckpoint.WindowSize;
+    }
+
+    uint64 lastCheckpointOffset = currentDecompressedOffset;
+    byte inputBuffer[ZIP_STREAM_BUFFER_SIZE];
+    uint32 inputSize = 0;
+    byte previousByte = 0;
+    while (result)
+    {
+      if (zStream.avail_in == 0)
+      {
+        // the last byte of the old buffer may be shared with the next block
+        if (inputSize > 0)
+          previousByte = inputBuffer[inputSize - 1];
+
+        inputSize = (uint32)Min(m_compressedSize - compressedOffset, (uint64)sizeof(inputBuffer));
+        if (inputSize == 0 || !m_pArchiveStream->SeekAbsolute(m_dataOffset + compressedOffset) ||
+            m_pArchiveStream->Read(inputBuffer, inputSize) != inputSize)
+        {
+          result = false;
+          break;
+        }
+
+        zStream.next_in = inputBuffer;
+        zStream.avail_in = inputSize;
+      }
+
+      if (zStream.avail_out == 0)
+      {
+        zStream.next_out = pWindow;
+        zStream.avail_out = ZIP_DEFLATE_DICTIONARY_SIZE;
+      }
+
+      uint32 inputBefore = zStream.avail_in;
+      uint32 outputBefore = zStream.avail_out;
+      int err = inflate(&zStream, Z_BLOCK);
+      uint32 outputBytes = outputBefore - zStream.avail_out;
+      compressedOffset += (uint64)(inputBefore - zStream.avail_in);
+      currentDecompressedOffset += (uint64)outputBytes;
+      windowBytes = Min(windowBytes + outputBytes, ZIP_DEFLATE_DICTIONARY_SIZE);
+      if (err == Z_STREAM_END)
+      {
+        m_complete = true;
+        break;
+      }
+      else if (err != Z_OK)
+      {
+        result = false;
+        break;
+      }
+
+      // at the end of a block, which isn't the last one
+      if ((zStream.data_type & 128) != 0 && (zStream.data_type & 64) == 0 &&
+          currentDecompressedOffset - lastCheckpointOffset >= m_interval)
+      {
+        Checkpoint checkpoint;
+        checkpoint.CompressedOffset = compressedOffset;
+        checkpoint.DecompressedOffset = currentDecompressedOffset;
+        checkpoint.Bits = (uint32)(zStream.data_type & 7);
+        checkpoint.PreviousByte = (zStream.next_in > inputBuffer) ? zStream.next_in[-1] : previousByte;
+        checkpoint.WindowSize = windowBytes;
+        checkpoint.pWindow = (byte*)std::malloc(windowBytes);
+
+        // unwrap the last windowBytes of output, which end where the next output goes
+        uint32 windowEnd = ZIP_DEFLATE_DICTIONARY_SIZE - zStream.avail_out;
+        if (windowBytes <= windowEnd)
+        {
+          std::memcpy(checkpoint.pWindow, pWindow + windowEnd - windowBytes, windowBytes);
+        }
+        else
+        {
+          uint32 wrappedBytes = windowBytes - windowEnd;
+          std::memcpy(checkpoint.pWindow, pWindow + ZIP_DEFLATE_DICTIONARY_SIZE - wrappedBytes, wrappedBytes);
+          std::memcpy(checkpoint.pWindow + wrappedBytes, pWindow, windowEnd);
+        }
+
+        m_checkpoints.Add(checkpoint);
+        lastCheckpointOffset = currentDecompressedOffset;
+        if (currentDecompressedOffset > decompressedOffset)
+          break;
+      }
+    }
+
+    m_coveredOffset = currentDecompressedOffset;
+    m_failed = !result;
+    inflateEnd(&zStream);
+    std::free(pWindow);
+    return result;
+  }
+
+private:
+  ByteStream* m_pArchiveStream;
+  uint64 m_dataOffset;
+  uint64 m_compressedSize;
+  uint32 m_crc32;
+  uint32 m_interval;
+
+  PODArray<Checkpoint> m_checkpoints;
+  uint64 m_coveredOffset;
+  bool m_complete;
+  bool m_failed;
+};
+
+// raw inflater which starts from a checkpoint instead of the beginning of the stream. Reset goes back to the beginning.
+class ZipArchiveCheckpointInflater : public CompressionCodecStream
+{
+public:
+  ZipArchiveCheckpointInflater() : m_initialized(false) { Y_memzero(&m_zStream, sizeof(m_zStream)); }
+
+  ~ZipArchiveCheckpointInflater()
+  {
+    if (m_initialized)
+      inflateEnd(&m_zStream);
+  }
+
+  bool Initialize(const ZipArchiveInflateIndex::Checkpoint* pCheckpoint)
+  {
+    m_initialized = (inflateInit2(&m_zStream, -MAX_WBITS) == Z_OK);
+    return (m_initialized && ZipArchiveInflateIndex::RestoreCheckpoint(&m_zStream, pCheckpoint));
+  }
+
+  virtual COMPRESSION_CODEC_RESULT Process(const byte** ppInput, uint32* pInputSize, byte** ppOutput,
+                                           uint32* pOutputSize, bool finish) override
+  {
+    m_zStream.next_in = (Bytef*)*ppInput;
+    m_zStream.avail_in = *pInputSize;
+    m_zStream.next_out = (Bytef*)*ppOutput;
+    m_zStream.avail_out = *pOutputSize;
+
+    int err = inflate(&m_zStream, Z_NO_FLUSH);
+
+    *ppInput = (const byte*)m_zStream.next_in;
+    *pInputSize = m_zStream.avail_in;
+    *ppOutput = (byte*)m_zStream.next_out;
+    *pOutputSize = m_zStream.avail_out;
+
+    if (err == Z_STREAM_END)
+      return COMPRESSION_CODEC_RESULT_STREAM_END;
+    else if (err == Z_OK)
+      return COMPRESSION_CODEC_RESULT_OK;
+    else
+      return COMPRESSION_CODEC_RESULT_ERROR;
+  }
+
+  virtual bool Reset() override { return (inflateReset(&m_zStream) == Z_OK); }
+
+private:
+  z_stream m_zStream;
+  bool m_initialized;
+};
+
+class ZipArchiveStreamedReadByteStream : public ByteStream
+{
+public:
+  ZipArchiveStreamedReadByteStream(ZipArchive* pZipArchive, ByteStream* pArchiveStream, uint64 baseOffset,
+                                   ZIP_ARCHIVE_LOCAL_FILE_HEADER* pLocalFileHeader)
+    : m_pZipArchive(pZipArchive), m_pArchiveStream(pArchiveStream), m_baseOffset(baseOffset),
+      m_currentFileOffset(baseOffset), m_inBufferBytes(0), m_inBufferPosition(0), m_currentDecompressedOffset(0),
+      m_currentCRC32(0), m_verifyCRC(true), m_pDecompressor(NULL), m_endOfStream(false)
+  {
+    std::memcpy(&m_localFileHeader, pLocalFileHeader, sizeof(m_localFileHeader));
+
+    if (m_localFileHeader.CompressionMethod != 0 &&
+        (m_pDecompressor = CreateDecompressorForMethod(m_localFileHeader.CompressionMethod)) == NULL)
+    {
+      m_errorState = true;
+    }
+
+    m_pZipArchive->m_nOpenStreamedReads++;
+  }
+
+  ~ZipArchiveStreamedReadByteStream()
+  {
+    m_pZipArchive->m_nOpenStreamedReads--;
+    delete m_pDecompressor;
+  }
+
+  bool FillInputBuffer()
+  {
+    if (m_errorState)
+      return false;
+
+    if (m_currentFileOffset == (m_baseOffset + m_localFileHeader.CompressedSize))
+      return false;
+
+    if (!m_pArchiveStream->SeekAbsolute(m_currentFileOffset))
+    {
+      m_errorState = true;
+      return false;
+    }
+
+    // needs more input buffer FIXME
+    uint32 readSize =
+      (uint32)Min(m_localFileHeader.CompressedSize - (m_currentFileOffset - m_baseOffset), (uint64)sizeof(m_pInBuffer));
+    uint32 nInputBytes = m_pArchiveStream->Read(m_pInBuffer, readSize);
+    if (nInputBytes == 0 || m_pArchiveStream->InErrorState())
+    {
+      m_errorState = true;
+      return false;
+    }
+
+    m_currentFileOffset += (uint64)nInputBytes;
+    m_inBufferBytes = nInputBytes;
+    return true;
+  }
+
+  virtual uint32 Read(void* pDestination, uint32 ByteCount)
+  {
+    if (m_errorState)
+      return 0;
+
+    switch (m_localFileHeader.CompressionMethod)
+    {
+        // uncompressed
+      case 0:
+      {
+        byte* pCurrentPtr = reinterpret_cast<byte*>(pDestination);
+        uint32 remaining = ByteCount;
+
+        while (remaining > 0)
+        {
+          if (m_inBufferPosition == m_inBufferBytes)
+          {
+            if (!FillInputBuffer())
+              break;
+
+            m_inBufferPosition = 0;
+          }
+
+          uint32 copyLength = Min(remaining, m_inBufferBytes - m_inBufferPosition);
+          std::memcpy(pCurrentPtr, m_pInBuffer + m_inBufferPosition, copyLength);
+          if (m_verifyCRC)
+            m_currentCRC32 = CRC32::ComputeBuffer(m_currentCRC32, pCurrentPtr, copyLength);
+          m_currentDecompressedOffset += (uint64)copyLength;
+          m_inBufferPosition += copyLength;
+          pCurrentPtr += copyLength;
+          remaining -= copyLength;
+        }
+
+        if (m_verifyCRC && m_currentDecompressedOffset == m_localFileHeader.DecompressedSize &&
+            m_currentCRC32 != m_localFileHeader.CRC32)
+        {
+          Log_ErrorPrintf("ZipArchiveStreamedReadByteStream::Read: CRC mismatch: %u / %u", m_currentCRC32,
+                          m_localFileHeader.CRC32);
+          m_errorState = true;
+          return 0;
+        }
+
+        return (ByteCount - remaining);
+      }
+      break;
+
+        // compressed
+      default:
+      {
+        byte* pOutput = reinterpret_cast<byte*>(pDestination);
+        uint32 outputRemaining = ByteCount;
+
+        while (outputRemaining > 0 && !m_endOfStream)
+        {
+          // if there are no input bytes left, there can still be output bytes buffered in the decompressor
+          if (m_inBufferPosition == m_inBufferBytes && FillInputBuffer())
+            m_inBufferPosition = 0;
+
+          const byte* pInput = m_pInBuffer + m_inBufferPosition;
+          uint32 inputRemaining = m_inBufferBytes - m_inBufferPosition;
+          byte* pOldPointer = pOutput;
+          COMPRESSION_CODEC_RESULT result =
+            m_pDecompressor->Process(&pInput, &inputRemaining, &pOutput, &outputRemaining, false);
+          m_inBufferPosition = m_inBufferBytes - inputRemaining;
+          if (result == COMPRESSION_CODEC_RESULT_ERROR)
+          {
+            Log_ErrorPrintf("ZipArchiveStreamedReadByteStream::Read: Failed to decompress data");
+            m_errorState = true;
+            break;
+          }
+
+          // update crc32
+          if (m_verifyCRC && pOutput != pOldPointer)
+            m_currentCRC32 = CRC32::ComputeBuffer(m_currentCRC32, pOldPointer, pOutput - pOldPointer);
+
+          if (result == COMPRESSION_CODEC_RESULT_STREAM_END)
+          {
+            // check crc32
+            if (m_verifyCRC && m_currentCRC32 != m_localFileHeader.CRC32)
+            {
+              Log_ErrorPrintf("ZipArchiveStreamedReadByteStream::Read: CRC mismatch: %u / %u", m_currentCRC32,
+                              m_localFileHeader.CRC32);
+              m_errorState = true;
+              return 0;
+            }
+
+            // end of stream, so exit the loop
+            m_endOfStream = true;
+            break;
+          }
+        }
+
+        uint32 bytesRead = (ByteCount - outputRemaining);
+        m_currentDecompressedOffset += (uint64)bytesRead;
+        return bytesRead;
+      }
+      break;
+    }
+  }
+
+  virtual bool ReadByte(byte* pDestByte)
+  {
+    return (Read(reinterpret_cast<void*>(pDestByte), sizeof(byte)) == sizeof(byte));
+  }
+
+  virtual bool Read2(void* pDestination, uint32 ByteCount, uint32* pNumberOfBytesRead = nullptr)
+  {
+    uint32 nBytes = Read(pDestination, ByteCount);
+    if (pNumberOfBytesRead != nullptr)
+      *pNumberOfBytesRead = nBytes;
+
+    return (nBytes == ByteCount);
+  }
+
+  virtual bool WriteByte(byte SourceByte) { return false; }
+
+  virtual uint32 Write(const void* pSource, uint32 ByteCount) { return false; }
+
+  virtual bool Write2(const void* pSource, uint32 ByteCount, uint32* pNumberOfBytesWritten = nullptr) { return false; }
+
+  // goes back to the start of the entry, checking the CRC again from there
+  bool Rewind()
+  {
+    if (m_pDecompressor != NULL && !m_pDecompressor->Reset())
+      return false;
+
+    m_currentFileOffset = m_baseOffset;
+    m_inBufferBytes = 0;
+    m_inBufferPosition = 0;
+    m_currentDecompressedOffset = 0;
+    m_currentCRC32 = 0;
+    m_verifyCRC = true;
+    m_endOfStream = false;
+    return true;
+  }
+
+  // carries on inflating from a checkpoint. the CRC can't be checked once data has been skipped.
+  bool RestartAtCheckpoint(const ZipArchiveInflateIndex::Checkpoint* pCheckpoint)
+  {
+    ZipArchiveCheckpointInflater* pInflater = new ZipArchiveCheckpointInflater();
+    if (!pInflater->Initialize(pCheckpoint))
+    {
+      delete pInflater;
+      return false;
+    }
+
+    delete m_pDecompressor;
+    m_pDecompressor = pInflater;
+    m_currentFileOffset = m_baseOffset + pCheckpoint->CompressedOffset;
+    m_inBufferBytes = 0;
+    m_inBufferPosition = 0;
+    m_currentDecompressedOffset = pCheckpoint->DecompressedOffset;
+    m_verifyCRC = false;
+    m_endOfStream = false;
+    return true;
+  }
+
+  bool SkipForward(uint64 byteCount)
+  {
+    // read in data until the position is correct
+    uint64 remaining = byteCount;
+    byte data[ZIP_STREAM_BUFFER_SIZE];
+    while (remaining > 0)
+    {
+      uint32 readSize = (uint32)Min(remaining, (uint64)ZIP_STREAM_BUFFER_SIZE);
+      if (Read(data, readSize) != readSize)
+        return false;
+
+      remaining -= (uint64)readSize;
+    }
+
+    return true;
+  }
+
+  virtual bool SeekAbsolute(uint64 Offset)
+  {
+    // any change?
+    if (Offset == m_currentDecompressedOffset)
+      return true;
+    if (m_errorState || Offset > m_localFileHeader.DecompressedSize)
+      return false;
+
+    // stored data can be seeked to directly
+    if (m_localFileHeader.CompressionMethod == 0)
+    {
+      m_currentFileOffset = m_baseOffset + Offset;
+      m_inBufferBytes = 0;
+      m_inBufferPosition = 0;
+      m_currentDecompressedOffset = Offset;
+      m_currentCRC32 = 0;
+      m_verifyCRC = (Offset == 0);
+      return true;
+    }
+
+    // deflate entries can go to the nearest checkpoint, when it's behind us or more than an interval ahead
+    uint32 checkpointInterval = m_pZipArchive->m_seekCheckpointInterval;
+    if (m_localFileHeader.CompressionMethod == Z_DEFLATED && checkpointInterval > 0 &&
+        (Offset < m_currentDecompressedOffset || Offset - m_currentDecompressedOffset > checkpointInterval))
+    {
+      // if the index can't be extended, the data is corrupt, which skipping forward will find as well. the index is
+      // looked up each time rather than kept, as the archive drops them when its streams change.
+      ZipArchiveInflateIndex* pIndex =
+        m_pZipArchive->GetInflateIndex(m_pArchiveStream, m_baseOffset, &m_localFileHeader);
+      pIndex->Extend(Offset);
+
+      const ZipArchiveInflateIndex::Checkpoint* pCheckpoint = pIndex->FindCheckpoint(Offset);
+      if (pCheckpoint != NULL &&
+          (Offset < m_currentDecompressedOffset || pCheckpoint->DecompressedOffset > m_currentDecompressedOffset) &&
+          !RestartAtCheckpoint(pCheckpoint))
+      {
+        m_errorState = true;
+        return false;
+      }
+    }
+
+    // otherwise going backwards starts again from the beginning
+    if (Offset < m_currentDecompressedOffset && !Rewind())
+    {
+      m_errorState = true;
+      return false;
+    }
+
+    return SkipForward(Offset - m_currentDecompressedOffset);
+  }
+
+  virtual bool SeekRelative(int64 Offset)
+  {
+    if (Offset < 0 && (uint64)-Offset > m_currentDecompressedOffset)
+      return false;
+
+    return SeekAbsolute((uint64)((int64)m_currentDecompressedOffset + Offset));
+  }
+
+  virtual bool SeekToEnd() { return SeekAbsolute(m_localFileHeader.DecompressedSize); }
+
+  virtual uint64 GetPosition() const { return m_currentDecompressedOffset; }
+
+  virtual uint64 GetSize() const { return m_localFileHeader.DecompressedSize; }
+
+  virtual bool Flush() { return false; }
+
+  virtual bool Discard() { return false; }
+
+  virtual bool Commit() { return false; }
+
+private:
   ZipArchive* m_pZipArchive;
   ByteStream* m_pArchiveStream;
   uint64 m_baseOffset;
@@ -347,8 +1332,10 @@ private:
   uint32 m_inBufferPosition;
   uint64 m_currentDecompressedOffset;
   uint32 m_currentCRC32;
+  bool m_verifyCRC;
 
-  z_stream m_zStream;
+  CompressionCodecStream* m_pDecompressor;
+  bool m_endOfStream;
 };
 
 class ZipArchiveBufferedReadByteStream : public ByteStream
@@ -384,27 +1371,30 @@ public:
           m_errorState = true;
         }
 
-        currentCRC32 = crc32(0, (const Bytef*)m_pData, m_size);
+        currentCRC32 = CRC32::ComputeBuffer(0, m_pData, m_size);
       }
       break;
 
-      case Z_DEFLATED:
+      default:
       {
-        z_stream zStream;
-        Y_memzero(&zStream, sizeof(zStream));
-        if (inflateInit2(&zStream, -MAX_WBITS) != Z_OK)
-          Panic("inflateInit2 failed");
+        CompressionCodecStream* pDecompressor = CreateDecompressorForMethod(pLocalFileHeader->CompressionMethod);
+        if (pDecompressor == NULL)
+        {
+          decompressError = true;
+          m_errorState = true;
+          break;
+        }
 
-        zStream.next_in = NULL;
-        zStream.avail_in = 0;
-        zStream.next_out = (Bytef*)m_pData;
-        zStream.avail_out = m_size;
+        const byte* pInput = NULL;
+        uint32 inputRemaining = 0;
+        byte* pOutput = m_pData;
+        uint32 outputRemaining = m_size;
 
         uint32 remainingInputBytes = (uint32)pLocalFileHeader->CompressedSize;
-        while (zStream.avail_out > 0)
+        while (outputRemaining > 0)
         {
           // in buffer exhausted?
-          if (zStream.avail_in == 0)
+          if (inputRemaining == 0 && remainingInputBytes > 0)
           {
             // fill it
             uint32 readSize = Min(ZIP_BUFFERED_IO_CHUNK_SIZE, remainingInputBytes);
@@ -417,16 +1407,17 @@ public:
 
             // update pointers
             remainingInputBytes -= readSize;
-            zStream.next_in = (Bytef*)ioBuffer;
-            zStream.avail_in = readSize;
+            pInput = ioBuffer;
+            inputRemaining = readSize;
           }
 
           // save the buffer pointer
-          Bytef* pOldPointer = zStream.next_out;
+          byte* pOldPointer = pOutput;
 
           // decompress the next block
-          int err = inflate(&zStream, Z_SYNC_FLUSH);
-          if (err != Z_OK && err != Z_STREAM_END)
+          COMPRESSION_CODEC_RESULT err =
+            pDecompressor->Process(&pInput, &inputRemaining, &pOutput, &outputRemaining, false);
+          if (err == COMPRESSION_CODEC_RESULT_ERROR)
           {
             // some other error
             decompressError = true;
@@ -434,30 +1425,17 @@ public:
           }
 
           // update crc32
-          if (zStream.next_out != pOldPointer)
-            currentCRC32 = crc32(currentCRC32, pOldPointer, static_cast<uInt>(zStream.next_out - pOldPointer));
+          if (pOutput != pOldPointer)
+            currentCRC32 = CRC32::ComputeBuffer(currentCRC32, pOldPointer, pOutput - pOldPointer);
 
-          // handle return
-          if (err == Z_OK)
-          {
-            // done this block, so continue with the next one if required
-            continue;
-          }
-          else if (err == Z_STREAM_END)
-          {
-            // end of stream, so exit the loop
+          // end of stream, so exit the loop
+          if (err == COMPRESSION_CODEC_RESULT_STREAM_END)
             break;
-          }
         }
-
-        inflateEnd(&zStream);
-      }
-      break;
-
-      default:
-        decompressError = true;
-        m_errorState = true;
-        break;
+
+        delete pDecompressor;
+      }
+      break;
     }
 
     // check crc32
@@ -569,6 +1547,140 @@ private:
   uint32 m_size;
 };
 
+// read-only view over a stored entry in a memory-backed archive stream. holds a reference to the archive stream so
+// the memory stays valid for the view's lifetime. the CRC is computed as the data is read rather than up front, so a
+// mapping is only faulted in as far as the furthest read; it runs sequentially, so a read after a forward seek also
+// hashes the range skipped over. a mismatch fails the read which reaches the end of the entry.
+class ZipArchiveStoredViewByteStream : public ByteStream
+{
+public:
+  ZipArchiveStoredViewByteStream(ByteStream* pArchiveStream, const byte* pData, uint64 size, uint32 expectedCRC32,
+                                 bool verifyCRC)
+    : m_pArchiveStream(pArchiveStream), m_pData(pData), m_position(0), m_size(size), m_expectedCRC32(expectedCRC32),
+      m_verifiedSize(verifyCRC ? 0 : size), m_currentCRC32(0)
+  {
+    m_pArchiveStream->AddRef();
+  }
+
+  ~ZipArchiveStoredViewByteStream() { m_pArchiveStream->Release(); }
+
+  // extends the running CRC up to endOffset, returns false once the whole entry has been hashed and doesn't match
+  bool VerifyTo(uint64 endOffset)
+  {
+    if (endOffset <= m_verifiedSize)
+      return true;
+
+    // the entry is mapped, so its size always fits in a size_t
+    m_currentCRC32 =
+      CRC32::ComputeBuffer(m_currentCRC32, m_pData + m_verifiedSize, (size_t)(endOffset - m_verifiedSize));
+    m_verifiedSize = endOffset;
+
+    if (m_verifiedSize == m_size && m_currentCRC32 != m_expectedCRC32)
+    {
+      Log_ErrorPrintf("ZipArchiveStoredViewByteStream::VerifyTo: CRC mismatch: %u / %u", m_currentCRC32,
+                      m_expectedCRC32);
+      m_errorState = true;
+      return false;
+    }
+
+    return true;
+  }
+
+  virtual uint32 Read(void* pDestination, uint32 ByteCount)
+  {
+    if (m_errorState)
+      return 0;
+
+    uint32 sz = (uint32)Min((uint64)ByteCount, m_size - m_position);
+    if (sz > 0)
+    {
+      if (!VerifyTo(m_position + sz))
+        return 0;
+
+      std::memcpy(pDestination, m_pData + m_position, sz);
+      m_position += sz;
+    }
+
+    return sz;
+  }
+
+  virtual bool ReadByte(byte* pDestByte) { return (Read(pDestByte, sizeof(byte)) == sizeof(byte)); }
+
+  virtual bool Read2(void* pDestination, uint32 ByteCount, uint32* pNumberOfBytesRead = nullptr)
+  {
+    uint32 nBytes = Read(pDestination, ByteCount);
+    if (pNumberOfBytesRead != nullptr)
+      *pNumberOfBytesRead = nBytes;
+
+    if (nBytes != ByteCount)
+    {
+      m_errorState = true;
+      return false;
+    }
+
+    return true;
+  }
+
+  virtual bool WriteByte(byte SourceByte) { return false; }
+
+  virtual uint32 Write(const void* pSource, uint32 ByteCount) { return 0; }
+
+  virtual bool Write2(const void* pSource, uint32 ByteCount, uint32* pNumberOfBytesWritten = NULL) { return false; }
+
+  virtual bool SeekAbsolute(uint64 Offset)
+  {
+    if (Offset > m_size)
+    {
+      m_errorState = true;
+      return false;
+    }
+
+    m_position = Offset;
+    return true;
+  }
+
+  virtual bool SeekRelative(int64 Offset)
+  {
+    int64 newPosition = (int64)m_position + Offset;
+    if (newPosition < 0 || (uint64)newPosition > m_size)
+    {
+      m_errorState = true;
+      return false;
+    }
+
+    m_position = (uint64)newPosition;
+    return true;
+  }
+
+  virtual bool SeekToEnd()
+  {
+    m_position = m_size;
+    return true;
+  }
+
+  virtual uint64 GetPosition() const { return m_position; }
+
+  virtual uint64 GetSize() const { return m_size; }
+
+  virtual bool Flush() { return false; }
+
+  virtual bool Discard() { return false; }
+
+  virtual bool Commit() { return false; }
+
+  // only exposed once nothing is left to verify, otherwise in-place copies would bypass the CRC check
+  virtual const byte* GetMemoryBasePointer() const { return (m_verifiedSize == m_size) ? m_pData : NULL; }
+
+private:
+  ByteStream* m_pArchiveStream;
+  const byte* m_pData;
+  uint64 m_position;
+  uint64 m_size;
+  uint32 m_expectedCRC32;
+  uint64 m_verifiedSize;
+  uint32 m_currentCRC32;
+};
+
 class ZipArchiveStreamedWriteByteStream : public ByteStream
 {
 public:
@@ -577,23 +1689,17 @@ public:
                                     uint32 compressionLevel)
     : m_pZipArchive(pZipArchive), m_pArchiveStream(pArchiveStream), m_pFileEntry(pFileEntry), m_baseOffset(baseOffset),
       m_currentFileOffset(baseOffset), m_currentCompressedSize(0), m_currentDecompressedSize(0), m_outBufferBytes(0),
-      m_currentCRC32(0), m_compressionMethod(compressionMethod)
+      m_currentCRC32(0), m_compressionMethod(compressionMethod), m_compressionLevel(compressionLevel),
+      m_pCompressor(NULL), m_parallel(compressionMethod == Z_DEFLATED && pZipArchive->m_pCompressionThreadPool != NULL),
+      m_pBlockBuffer(NULL), m_blockDictionarySize(0), m_blockInputSize(0)
   {
-    Y_memzero(&m_zStream, sizeof(m_zStream));
-
-    switch (compressionMethod)
-    {
-      case Z_DEFLATED:
-      {
-        int err = deflateInit2(&m_zStream, compressionLevel, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
-        if (err != Z_OK)
-          Panic("deflateInit2 failed");
-
-        m_zStream.avail_out = sizeof(m_pOutBuffer);
-        m_zStream.next_out = (Bytef*)m_pOutBuffer;
-      }
-      break;
-    }
+    // in parallel mode, input is gathered into blocks which are deflated on the archive's thread pool instead. other
+    // codecs can't be split into blocks, so they're always compressed here.
+    COMPRESSION_CODEC codec;
+    if (m_parallel)
+      m_pBlockBuffer = (byte*)std::malloc(ZIP_DEFLATE_DICTIONARY_SIZE + m_pZipArchive->m_compressionBlockSize);
+    else if (GetCompressionMethodCodec(compressionMethod, &codec))
+      m_pCompressor = CompressionCodec::CreateCompressor(codec, compressionLevel);
 
     m_pZipArchive->m_nOpenStreamedWrites++;
     m_pFileEntry->WriteOpenCount++;
@@ -606,14 +1712,15 @@ public:
     if (!m_errorState)
       Finalize();
 
-    switch (m_compressionMethod)
+    delete m_pCompressor;
+
+    // blocks are only left behind on error
+    for (uint32 i = 0; i < m_compressionBlocks.GetSize(); i++)
     {
-      case Z_DEFLATED:
-      {
-        deflateEnd(&m_zStream);
-      }
-      break;
+      m_pZipArchive->WaitForCompressionBlock(m_compressionBlocks[i]);
+      m_compressionBlocks[i]->Release();
     }
+    std::free(m_pBlockBuffer);
 
     if (m_errorState)
       m_pFileEntry->IsDeleted = true;
@@ -630,22 +1737,15 @@ public:
       return false;
     }
 
-    BinaryWriter binaryWriter(m_pArchiveStream, ENDIAN_TYPE_LITTLE);
-    uint32 filenameLength = Min(m_pFileEntry->FileName.GetLength(), (uint32)0xFFFF);
-
-    if (!binaryWriter.SafeWriteUInt32(~ZIP_ARCHIVE_LOCAL_FILE_HEADER_SIGNTURE) ||   // Signature
-        !binaryWriter.SafeWriteUInt16(ZIP_ARCHIVE_VERSION_TO_EXTRACT) ||            // VersionRequiredToExtract
-        !binaryWriter.SafeWriteUInt16(0) ||                                         // Flags
-        !binaryWriter.SafeWriteUInt16((uint16)m_compressionMethod) ||               // CompressionMethod
-        !binaryWriter.SafeWriteUInt32(0) ||                                         // ModificationTimestamp
-        !binaryWriter.SafeWriteUInt32(m_currentCRC32) ||                            // CRC32
-        !binaryWriter.SafeWriteUInt32(0) ||                                         // CompressedSize
-        !binaryWriter.SafeWriteUInt32(0) ||                                         // DecompressedSize
-        !binaryWriter.SafeWriteUInt16((uint16)filenameLength) ||                    // FilenameLength
-        !binaryWriter.SafeWriteUInt16(0) ||                                         // ExtraFieldLength
-        !binaryWriter.SafeWriteFixedString(m_pFileEntry->FileName, filenameLength)) // Filename
+    // the size isn't known yet, so leave room for zip64 sizes
+    ZIP_ARCHIVE_LOCAL_FILE_HEADER localFileHeader;
+    Y_memzero(&localFileHeader, sizeof(localFileHeader));
+    localFileHeader.Signature = ~ZIP_ARCHIVE_LOCAL_FILE_HEADER_SIGNTURE;
+    localFileHeader.VersionRequiredToExtract = ZIP_ARCHIVE_VERSION_TO_EXTRACT;
+    localFileHeader.CompressionMethod = (uint16)m_compressionMethod;
+    localFileHeader.CRC32 = m_currentCRC32;
+    if (!WriteLocalFileHeader(m_pArchiveStream, &localFileHeader, m_pFileEntry->FileName, true))
     {
-
       SetErrorState();
       return false;
     }
@@ -671,50 +1771,99 @@ public:
       m_currentCompressedSize += (uint64)m_outBufferBytes;
       m_currentFileOffset += (uint64)m_outBufferBytes;
       m_outBufferBytes = 0;
-
-      m_zStream.avail_out = sizeof(m_pOutBuffer);
-      m_zStream.next_out = (Bytef*)m_pOutBuffer;
     }
 
     return true;
   }
 
-  bool Finalize()
+  bool SubmitCompressionBlock(bool lastBlock)
   {
-    switch (m_compressionMethod)
+    // the next block is primed with the tail of this one, which has to be copied as this buffer goes with the block
+    byte* pNextBlockBuffer = NULL;
+    uint32 nextDictionarySize = 0;
+    if (!lastBlock)
+    {
+      pNextBlockBuffer = (byte*)std::malloc(ZIP_DEFLATE_DICTIONARY_SIZE + m_pZipArchive->m_compressionBlockSize);
+      nextDictionarySize = Min(m_blockDictionarySize + m_blockInputSize, ZIP_DEFLATE_DICTIONARY_SIZE);
+      std::memcpy(pNextBlockBuffer,
+                  m_pBlockBuffer + m_blockDictionarySize + m_blockInputSize - nextDictionarySize, nextDictionarySize);
+    }
+
+    m_compressionBlocks.Add(m_pZipArchive->SubmitCompressionBlock(
+      Z_DEFLATED, m_compressionLevel, m_pBlockBuffer + m_blockDictionarySize, m_blockInputSize, m_pBlockBuffer,
+      m_blockDictionarySize, lastBlock, m_pBlockBuffer));
+
+    m_pBlockBuffer = pNextBlockBuffer;
+    m_blockDictionarySize = nextDictionarySize;
+    m_blockInputSize = 0;
+
+    // keep a couple of blocks per worker in flight, and write out whatever has finished in the meantime
+    uint32 maxBlocksInFlight = m_pZipArchive->m_pCompressionThreadPool->GetWorkerThreadCount() * 2;
+    while (m_compressionBlocks.GetSize() > 0)
     {
-      case Z_DEFLATED:
+      ZipArchiveCompressionBlock* pBlock = m_compressionBlocks[0];
+      if (!lastBlock && m_compressionBlocks.GetSize() <= maxBlocksInFlight &&
+          !m_pZipArchive->IsCompressionBlockCompleted(pBlock))
       {
-        DebugAssert(m_zStream.avail_in == 0);
+        break;
+      }
 
-        for (;;)
-        {
-          int err = deflate(&m_zStream, Z_FINISH);
-          m_outBufferBytes = sizeof(m_pOutBuffer) - m_zStream.avail_out;
+      m_pZipArchive->WaitForCompressionBlock(pBlock);
+      if (!pBlock->IsSuccessful() || !m_pArchiveStream->SeekAbsolute(m_currentFileOffset) ||
+          m_pArchiveStream->Write(pBlock->GetOutput(), pBlock->GetOutputSize()) != pBlock->GetOutputSize())
+      {
+        SetErrorState();
+        return false;
+      }
 
-          if (err == Z_OK)
-          {
-            // possibly the output buffer is full
-            if (!FlushOutputBuffer())
-              return false;
+      m_currentCRC32 = CRC32::CombineCRC(m_currentCRC32, pBlock->GetCRC32(), pBlock->GetInputSize());
+      m_currentCompressedSize += (uint64)pBlock->GetOutputSize();
+      m_currentFileOffset += (uint64)pBlock->GetOutputSize();
+      m_compressionBlocks.PopFront();
+      pBlock->Release();
+    }
 
-            // retry
-            continue;
-          }
-          else if (err == Z_STREAM_END)
-          {
-            // completed
-            break;
-          }
-          else
-          {
-            // some other error
-            SetErrorState();
+    return true;
+  }
+
+  bool Finalize()
+  {
+    if (m_parallel && !SubmitCompressionBlock(true))
+      return false;
+
+    if (m_pCompressor != NULL)
+    {
+      for (;;)
+      {
+        const byte* pInput = NULL;
+        uint32 inputRemaining = 0;
+        byte* pOutput = m_pOutBuffer + m_outBufferBytes;
+        uint32 outputRemaining = sizeof(m_pOutBuffer) - m_outBufferBytes;
+        COMPRESSION_CODEC_RESULT err =
+          m_pCompressor->Process(&pInput, &inputRemaining, &pOutput, &outputRemaining, true);
+        m_outBufferBytes = sizeof(m_pOutBuffer) - outputRemaining;
+
+        if (err == COMPRESSION_CODEC_RESULT_OK)
+        {
+          // possibly the output buffer is full
+          if (!FlushOutputBuffer())
             return false;
-          }
+
+          // retry
+          continue;
+        }
+        else if (err == COMPRESSION_CODEC_RESULT_STREAM_END)
+        {
+          // completed
+          break;
+        }
+        else
+        {
+          // some other error
+          SetErrorState();
+          return false;
         }
       }
-      break;
     }
 
     // flush all buffers
@@ -731,16 +1880,17 @@ public:
     // get the timestamp
     Timestamp modifiedTimestamp(Timestamp::Now());
 
-    // rewrite the local header
-    BinaryWriter binaryWriter(m_pArchiveStream, ENDIAN_TYPE_LITTLE);
-    if (!binaryWriter.SafeWriteUInt32(ZIP_ARCHIVE_LOCAL_FILE_HEADER_SIGNTURE) || // Signature
-        !binaryWriter.SafeWriteUInt16(ZIP_ARCHIVE_VERSION_TO_EXTRACT) ||         // VersionRequiredToExtract
-        !binaryWriter.SafeWriteUInt16(0) ||                                      // Flags
-        !binaryWriter.SafeWriteUInt16((uint16)m_compressionMethod) ||            // CompressionMethod
-        !binaryWriter.SafeWriteUInt32(TimestampToZipTime(Timestamp::Now())) ||   // ModificationTimestamp
-        !binaryWriter.SafeWriteUInt32(m_currentCRC32) ||                         // CRC32
-        !binaryWriter.SafeWriteUInt32((uint32)m_currentCompressedSize) ||        // CompressedSize
-        !binaryWriter.SafeWriteUInt32((uint32)m_currentDecompressedSize))        // DecompressedSize
+    // rewrite the local header, into the same space as the sizes are fixed-length
+    ZIP_ARCHIVE_LOCAL_FILE_HEADER localFileHeader;
+    localFileHeader.Signature = ZIP_ARCHIVE_LOCAL_FILE_HEADER_SIGNTURE;
+    localFileHeader.VersionRequiredToExtract = ZIP_ARCHIVE_VERSION_TO_EXTRACT;
+    localFileHeader.Flags = 0;
+    localFileHeader.CompressionMethod = (uint16)m_compressionMethod;
+    localFileHeader.ModificationTimestamp = TimestampToZipTime(modifiedTimestamp);
+    localFileHeader.CRC32 = m_currentCRC32;
+    localFileHeader.CompressedSize = m_currentCompressedSize;
+    localFileHeader.DecompressedSize = m_currentDecompressedSize;
+    if (!WriteLocalFileHeader(m_pArchiveStream, &localFileHeader, m_pFileEntry->FileName, true))
     {
       SetErrorState();
       return false;
@@ -765,12 +1915,33 @@ public:
 
   virtual uint32 Write(const void* pSource, uint32 ByteCount)
   {
+    if (m_parallel)
+    {
+      const byte* pCurrentPtr = reinterpret_cast<const byte*>(pSource);
+      uint32 remaining = ByteCount;
+      while (remaining > 0 && !m_errorState)
+      {
+        uint32 copyLength = Min(remaining, m_pZipArchive->m_compressionBlockSize - m_blockInputSize);
+        std::memcpy(m_pBlockBuffer + m_blockDictionarySize + m_blockInputSize, pCurrentPtr, copyLength);
+        m_blockInputSize += copyLength;
+        pCurrentPtr += copyLength;
+        remaining -= copyLength;
+
+        if (m_blockInputSize == m_pZipArchive->m_compressionBlockSize && !SubmitCompressionBlock(false))
+          break;
+      }
+
+      uint32 bytesWritten = ByteCount - remaining;
+      m_currentDecompressedSize += (uint64)bytesWritten;
+      return bytesWritten;
+    }
+
     switch (m_compressionMethod)
     {
       case 0:
       {
         const byte* pCurrentPtr = reinterpret_cast<const byte*>(pSource);
-        uint32 remaining = 0;
+        uint32 remaining = ByteCount;
 
         while (remaining > 0)
         {
@@ -779,7 +1950,8 @@ public:
 
           uint32 copyLength = Min(remaining, uint32(sizeof(m_pOutBuffer) - m_outBufferBytes));
           std::memcpy(m_pOutBuffer + m_outBufferBytes, pCurrentPtr, copyLength);
-          m_currentCRC32 = crc32(m_currentCRC32, pCurrentPtr, copyLength);
+          m_currentCRC32 = CRC32::ComputeBuffer(m_currentCRC32, pCurrentPtr, copyLength);
+          m_outBufferBytes += copyLength;
           pCurrentPtr += copyLength;
           remaining -= copyLength;
         }
@@ -790,44 +1962,39 @@ public:
       }
       break;
 
-      case Z_DEFLATED:
+      default:
       {
+        if (m_pCompressor == NULL)
+        {
+          SetErrorState();
+          return 0;
+        }
+
         // set up pointers
-        m_zStream.avail_in = ByteCount;
-        m_zStream.next_in = (Bytef*)pSource;
+        const byte* pInput = reinterpret_cast<const byte*>(pSource);
+        uint32 inputRemaining = ByteCount;
 
         // loop
-        while (m_zStream.avail_in > 0)
+        while (inputRemaining > 0)
         {
-          if (m_zStream.avail_out == 0)
-          {
-            if (!FlushOutputBuffer())
-            {
-              m_errorState = true;
-              break;
-            }
-
-            m_zStream.avail_out = sizeof(m_pOutBuffer);
-            m_zStream.next_out = (Bytef*)m_pOutBuffer;
-          }
+          if (m_outBufferBytes == sizeof(m_pOutBuffer) && !FlushOutputBuffer())
+            break;
 
-          const Bytef* pOldPointer = m_zStream.next_in;
-          int err = deflate(&m_zStream, Z_NO_FLUSH);
-          m_outBufferBytes = sizeof(m_pOutBuffer) - m_zStream.avail_out;
+          const byte* pOldPointer = pInput;
+          byte* pOutput = m_pOutBuffer + m_outBufferBytes;
+          uint32 outputRemaining = sizeof(m_pOutBuffer) - m_outBufferBytes;
+          COMPRESSION_CODEC_RESULT err =
+            m_pCompressor->Process(&pInput, &inputRemaining, &pOutput, &outputRemaining, false);
+          m_outBufferBytes = sizeof(m_pOutBuffer) - outputRemaining;
 
           // update crc
-          if (m_zStream.next_in != pOldPointer)
-            m_currentCRC32 = crc32(m_currentCRC32, pOldPointer, static_cast<uInt>(m_zStream.next_in - pOldPointer));
+          if (pInput != pOldPointer)
+            m_currentCRC32 = CRC32::ComputeBuffer(m_currentCRC32, pOldPointer, pInput - pOldPointer);
 
           // test return
-          if (err == Z_OK)
-          {
-            // more data to be processed
-            continue;
-          }
-          else
+          if (err != COMPRESSION_CODEC_RESULT_OK)
           {
-            Log_ErrorPrintf("ZipArchiveStreamedWriteByteStream::Write: zlib returned error %d", err);
+            Log_ErrorPrintf("ZipArchiveStreamedWriteByteStream::Write: Compression failed");
 
             // some error occured
             SetErrorState();
@@ -835,16 +2002,12 @@ public:
           }
         }
 
-        uint32 bytesWritten = ByteCount - (m_zStream.avail_in);
-        m_zStream.avail_in = 0;
-        m_zStream.next_in = NULL;
+        uint32 bytesWritten = ByteCount - inputRemaining;
         m_currentDecompressedSize += (uint64)bytesWritten;
         return bytesWritten;
       }
       break;
     }
-
-    return 0;
   }
 
   virtual bool WriteByte(byte SourceByte) { return (Write(&SourceByte, sizeof(byte)) == sizeof(byte)); }
@@ -902,8 +2065,15 @@ private:
   uint32 m_outBufferBytes;
   uint32 m_currentCRC32;
   uint32 m_compressionMethod;
+  uint32 m_compressionLevel;
 
-  z_stream m_zStream;
+  CompressionCodecStream* m_pCompressor;
+
+  bool m_parallel;
+  byte* m_pBlockBuffer;
+  uint32 m_blockDictionarySize;
+  uint32 m_blockInputSize;
+  PODArray<ZipArchiveCompressionBlock*> m_compressionBlocks;
 };
 
 class ZipArchiveBufferedWriteByteStream : public ByteStream
@@ -949,14 +2119,24 @@ public:
   {
     Assert(m_pArchive->m_nOpenStreamedWrites == 0);
 
-    // setup zlib
-    z_stream zStream;
-    if (m_compressionMethod == Z_DEFLATED)
+    // hand the data over to the compression threads, the archive writes it out when its turn comes
+    if (m_pArchive->m_pCompressionThreadPool != NULL)
     {
-      Y_memzero(&zStream, sizeof(zStream));
-      int err = deflateInit2(&zStream, m_compressionLevel, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
-      if (err != Z_OK)
-        return false;
+      ZipArchivePendingWrite* pPendingWrite = new ZipArchivePendingWrite;
+      pPendingWrite->pFileEntry = m_pFileEntry;
+      pPendingWrite->CompressionMethod = m_compressionMethod;
+      pPendingWrite->CompressionLevel = m_compressionLevel;
+      pPendingWrite->ModifiedTime = Timestamp::Now();
+      pPendingWrite->pData = m_pMemory;
+      pPendingWrite->DataSize = m_size;
+      m_pMemory = NULL;
+
+      m_pFileEntry->CompressionMethod = m_compressionMethod;
+      m_pFileEntry->ModifiedTime = pPendingWrite->ModifiedTime;
+      m_pFileEntry->DecompressedFileSize = m_size;
+      m_pFileEntry->IsDeleted = false;
+      m_pArchive->QueuePendingWrite(pPendingWrite);
+      return true;
     }
 
     // seek to the header
@@ -993,76 +2173,51 @@ public:
     if (m_size > 0)
     {
       // calculate crc32
-      crc = crc32(0, (const Bytef*)m_pMemory, m_size);
+      crc = CRC32::ComputeBuffer(0, m_pMemory, m_size);
 
       // compress?
-      if (m_compressionMethod == Z_DEFLATED)
+      if (m_compressionMethod != 0)
       {
-        byte compressionBuffer[ZIP_BUFFERED_IO_CHUNK_SIZE];
-        zStream.avail_in = m_size;
-        zStream.next_in = (Bytef*)m_pMemory;
-        zStream.avail_out = sizeof(compressionBuffer);
-        zStream.next_out = (Bytef*)compressionBuffer;
-
-        while (zStream.avail_in > 0)
+        COMPRESSION_CODEC codec;
+        CompressionCodecStream* pCompressor = NULL;
+        if (!GetCompressionMethodCodec(m_compressionMethod, &codec) ||
+            (pCompressor = CompressionCodec::CreateCompressor(codec, m_compressionLevel)) == NULL)
         {
-          if (zStream.avail_out == 0)
-          {
-            binaryWriter.WriteBytes(compressionBuffer, sizeof(compressionBuffer));
-            zStream.avail_out = sizeof(compressionBuffer);
-            zStream.next_out = (Bytef*)compressionBuffer;
-          }
-
-          int err = deflate(&zStream, Z_NO_FLUSH);
-          if (err == Z_OK)
-          {
-            // ok, more data to go
-            continue;
-          }
-          else
-          {
-            // error of some sort
-            deflateEnd(&zStream);
-            return false;
-          }
+          return false;
         }
 
-        // complete compression
+        byte compressionBuffer[ZIP_BUFFERED_IO_CHUNK_SIZE];
+        const byte* pInput = m_pMemory;
+        uint32 inputRemaining = m_size;
         for (;;)
         {
-          if (zStream.avail_out == 0)
+          byte* pOutput = compressionBuffer;
+          uint32 outputRemaining = sizeof(compressionBuffer);
+          COMPRESSION_CODEC_RESULT err =
+            pCompressor->Process(&pInput, &inputRemaining, &pOutput, &outputRemaining, true);
+          if (err == COMPRESSION_CODEC_RESULT_ERROR)
           {
-            binaryWriter.WriteBytes(compressionBuffer, sizeof(compressionBuffer));
-            zStream.avail_out = sizeof(compressionBuffer);
-            zStream.next_out = (Bytef*)compressionBuffer;
+            // error of some sort
+            delete pCompressor;
+            return false;
           }
 
-          int err = deflate(&zStream, Z_FINISH);
-          if (err == Z_STREAM_END)
-          {
-            // complete
-            break;
-          }
-          else if (err == Z_OK)
-          {
-            // more data to go
-            continue;
-          }
-          else
+          uint32 outputSize = sizeof(compressionBuffer) - outputRemaining;
+          if (!binaryWriter.SafeWriteBytes(compressionBuffer, outputSize))
           {
-            // error of some sort
-            deflateEnd(&zStream);
+            delete pCompressor;
+            SetErrorState();
             return false;
           }
-        }
 
-        // write any remaining bytes
-        if (zStream.avail_out != sizeof(compressionBuffer))
-          binaryWriter.WriteBytes(compressionBuffer, sizeof(compressionBuffer) - zStream.avail_out);
+          compressedFileSize += outputSize;
+          if (err == COMPRESSION_CODEC_RESULT_STREAM_END)
+            break;
+        }
 
         // fill fields
-        compressedFileSize = zStream.total_out;
-        decompressedFileSize = zStream.total_in;
+        decompressedFileSize = m_size;
+        delete pCompressor;
       }
       else
       {
@@ -1083,8 +2238,9 @@ public:
     }
 
     // write the local header
+    uint32 versionRequiredToExtract = GetVersionRequiredToExtract(m_compressionMethod);
     if (!binaryWriter.SafeWriteUInt32(ZIP_ARCHIVE_LOCAL_FILE_HEADER_SIGNTURE) || // Signature
-        !binaryWriter.SafeWriteUInt16(ZIP_ARCHIVE_VERSION_TO_EXTRACT) ||         // VersionRequiredToExtract
+        !binaryWriter.SafeWriteUInt16((uint16)versionRequiredToExtract) ||       // VersionRequiredToExtract
         !binaryWriter.SafeWriteUInt16(0) ||                                      // Flags
         !binaryWriter.SafeWriteUInt16((uint16)m_compressionMethod) ||            // CompressionMethod
         !binaryWriter.SafeWriteUInt32(TimestampToZipTime(Timestamp::Now())) ||   // ModificationTimestamp
@@ -1238,7 +2394,10 @@ private:
 
 ZipArchive::ZipArchive(ByteStream* pReadStream, ByteStream* pWriteStream)
   : m_pReadStream(pReadStream), m_pWriteStream(pWriteStream), m_nOpenStreamedReads(0), m_nOpenStreamedWrites(0),
-    m_nOpenBufferedReads(0), m_nOpenBufferedWrites(0)
+    m_nOpenBufferedReads(0), m_nOpenBufferedWrites(0), m_pCompressionThreadPool(NULL),
+    m_compressionBlockSize(128 * 1024), m_pendingWriteBytes(0), m_pCentralDirectory(NULL),
+    m_pOwnedCentralDirectory(NULL), m_centralDirectorySize(0), m_verifyStoredEntryCRC(true),
+    m_seekCheckpointInterval(ZIP_DEFAULT_SEEK_CHECKPOINT_INTERVAL), m_appendMode(false), m_appendCommittedSize(0)
 {
   if (pReadStream != NULL)
     pReadStream->AddRef();
@@ -1248,6 +2407,11 @@ ZipArchive::ZipArchive(ByteStream* pReadStream, ByteStream* pWriteStream)
 
 ZipArchive::~ZipArchive()
 {
+  DiscardPendingWrites();
+  ClearInflateIndexes();
+
+  std::free(m_pOwnedCentralDirectory);
+
   if (m_pReadStream != NULL)
     m_pReadStream->Release();
   if (m_pWriteStream != NULL)
@@ -1257,11 +2421,15 @@ ZipArchive::~ZipArchive()
 bool ZipArchive::StatFile(const char* filename, FILESYSTEM_STAT_DATA* pStatData) const
 {
   const FileHashTable::Member* pMember;
-  if (((pMember = m_writeFileHashTable.Find(filename)) != NULL && !pMember->Value->IsDeleted) ||
-      ((pMember = m_readFileHashTable.Find(filename)) != NULL && !pMember->Value->IsDeleted))
-  {
-    const FileEntry* pFileEntry = pMember->Value;
+  const FileEntry* pFileEntry;
+  FileEntry indexedEntry;
+  if ((pMember = m_writeFileHashTable.Find(filename)) != NULL && !pMember->Value->IsDeleted)
+    pFileEntry = pMember->Value;
+  else
+    pFileEntry = FindCommittedFileEntry(filename, &indexedEntry);
 
+  if (pFileEntry != NULL)
+  {
     // attributes
     pStatData->Attributes = 0;
     {
@@ -1273,17 +2441,80 @@ bool ZipArchive::StatFile(const char* filename, FILESYSTEM_STAT_DATA* pStatData)
     // modification time
     pStatData->ModificationTime = pFileEntry->ModifiedTime;
 
-    // size (uncompressed)
-    pStatData->Size = pFileEntry->DecompressedFileSize;
+    // size (uncompressed)
+    pStatData->Size = pFileEntry->DecompressedFileSize;
+
+    // ok
+    return true;
+  }
+
+  return false;
+}
+
+bool ZipArchive::ReadLocalFileHeader(ByteStream* pStream, const FileEntry* pFileEntry,
+                                     ZIP_ARCHIVE_LOCAL_FILE_HEADER* pLocalFileHeader)
+{
+  BinaryReader binaryReader(pStream, ENDIAN_TYPE_LITTLE);
+  uint32 compressedSize32;
+  uint32 decompressedSize32;
+  if (!binaryReader.SafeReadUInt32(&pLocalFileHeader->Signature) ||
+      !binaryReader.SafeReadUInt16(&pLocalFileHeader->VersionRequiredToExtract) ||
+      !binaryReader.SafeReadUInt16(&pLocalFileHeader->Flags) ||
+      !binaryReader.SafeReadUInt16(&pLocalFileHeader->CompressionMethod) ||
+      !binaryReader.SafeReadUInt32(&pLocalFileHeader->ModificationTimestamp) ||
+      !binaryReader.SafeReadUInt32(&pLocalFileHeader->CRC32) || !binaryReader.SafeReadUInt32(&compressedSize32) ||
+      !binaryReader.SafeReadUInt32(&decompressedSize32) ||
+      !binaryReader.SafeReadUInt16(&pLocalFileHeader->FilenameLength) ||
+      !binaryReader.SafeReadUInt16(&pLocalFileHeader->ExtraFieldLength))
+  {
+    return false;
+  }
+
+  pLocalFileHeader->CompressedSize = (uint64)compressedSize32;
+  pLocalFileHeader->DecompressedSize = (uint64)decompressedSize32;
+
+  if (pLocalFileHeader->Signature != ZIP_ARCHIVE_LOCAL_FILE_HEADER_SIGNTURE)
+    return false;
+
+  // stored, or one of the codecs. whether the codec is built in is checked when the data is decompressed, so entries
+  // can still be copied without it.
+  COMPRESSION_CODEC codec;
+  if (pLocalFileHeader->CompressionMethod != 0 &&
+      !GetCompressionMethodCodec(pLocalFileHeader->CompressionMethod, &codec))
+  {
+    return false;
+  }
 
-    // ok
-    return true;
+  // ugh, streamed files. have to handle these carefully
+  // otherwise, should be accurate
+  if (pLocalFileHeader->Flags & 8)
+  {
+    if (pFileEntry->CRC32 == 0)
+      return false;
+
+    // pull from central directory
+    pLocalFileHeader->CRC32 = pFileEntry->CRC32;
+    pLocalFileHeader->CompressedSize = pFileEntry->CompressedFileSize;
+    pLocalFileHeader->DecompressedSize = pFileEntry->DecompressedFileSize;
+  }
+  else if (pLocalFileHeader->CompressedSize == 0xFFFFFFFF || pLocalFileHeader->DecompressedSize == 0xFFFFFFFF)
+  {
+    // zip64, the central directory has the same values as the local extra field
+    pLocalFileHeader->CompressedSize = pFileEntry->CompressedFileSize;
+    pLocalFileHeader->DecompressedSize = pFileEntry->DecompressedFileSize;
+  }
+  else if (pLocalFileHeader->CompressedSize != pFileEntry->CompressedFileSize ||
+           pLocalFileHeader->DecompressedSize != pFileEntry->DecompressedFileSize)
+  {
+    return false;
   }
 
-  return false;
+  uint32 seekDistance = (uint32)pLocalFileHeader->FilenameLength + (uint32)pLocalFileHeader->ExtraFieldLength;
+  return pStream->SeekRelative(seekDistance);
 }
 
-ByteStream* ZipArchive::OpenFile(const char* filename, uint32 openMode, uint32 compressionLevel /* = 6 */)
+ByteStream* ZipArchive::OpenFile(const char* filename, uint32 openMode, uint32 compressionLevel /* = 6 */,
+                                 COMPRESSION_CODEC codec /* = COMPRESSION_CODEC_DEFLATE */)
 {
   // zip archives do not support reading and writing at the same time
   if ((openMode & (BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_WRITE)) == (BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_WRITE))
@@ -1293,6 +2524,8 @@ ByteStream* ZipArchive::OpenFile(const char* filename, uint32 openMode, uint32 c
   if (openMode & BYTESTREAM_OPEN_READ)
   {
     const FileHashTable::Member* pMember;
+    const FileEntry* pFileEntry;
+    FileEntry indexedEntry;
     ByteStream* pStreamToReadFrom = NULL;
     if ((pMember = m_writeFileHashTable.Find(filename)) != NULL && !pMember->Value->IsDeleted)
     {
@@ -1300,9 +2533,12 @@ ByteStream* ZipArchive::OpenFile(const char* filename, uint32 openMode, uint32 c
       if (pMember->Value->WriteOpenCount > 0)
         return NULL;
 
+      // the entry may not have been written out yet
+      WritePendingWrites(true);
+      pFileEntry = pMember->Value;
       pStreamToReadFrom = m_pWriteStream;
     }
-    else if ((pMember = m_readFileHashTable.Find(filename)) != NULL && !pMember->Value->IsDeleted)
+    else if ((pFileEntry = FindCommittedFileEntry(filename, &indexedEntry)) != NULL)
     {
       pStreamToReadFrom = m_pReadStream;
     }
@@ -1310,60 +2546,29 @@ ByteStream* ZipArchive::OpenFile(const char* filename, uint32 openMode, uint32 c
       return NULL;
 
     // read the local file header
-    const FileEntry* pFileEntry = pMember->Value;
-    BinaryReader binaryReader(pStreamToReadFrom, ENDIAN_TYPE_LITTLE);
-    if (!pStreamToReadFrom->SeekAbsolute(pFileEntry->OffsetToFileHeader))
-      return NULL;
-
     ZIP_ARCHIVE_LOCAL_FILE_HEADER localFileHeader;
-    uint32 compressedSize32;
-    uint32 decompressedSize32;
-    if (!binaryReader.SafeReadUInt32(&localFileHeader.Signature) ||
-        !binaryReader.SafeReadUInt16(&localFileHeader.VersionRequiredToExtract) ||
-        !binaryReader.SafeReadUInt16(&localFileHeader.Flags) ||
-        !binaryReader.SafeReadUInt16(&localFileHeader.CompressionMethod) ||
-        !binaryReader.SafeReadUInt32(&localFileHeader.ModificationTimestamp) ||
-        !binaryReader.SafeReadUInt32(&localFileHeader.CRC32) || !binaryReader.SafeReadUInt32(&compressedSize32) ||
-        !binaryReader.SafeReadUInt32(&decompressedSize32) ||
-        !binaryReader.SafeReadUInt16(&localFileHeader.FilenameLength) ||
-        !binaryReader.SafeReadUInt16(&localFileHeader.ExtraFieldLength))
+    if (!pStreamToReadFrom->SeekAbsolute(pFileEntry->OffsetToFileHeader) ||
+        !ReadLocalFileHeader(pStreamToReadFrom, pFileEntry, &localFileHeader))
     {
       return NULL;
     }
 
-    localFileHeader.CompressedSize = (uint64)compressedSize32;
-    localFileHeader.DecompressedSize = (uint64)decompressedSize32;
-
-    if (localFileHeader.Signature != ZIP_ARCHIVE_LOCAL_FILE_HEADER_SIGNTURE)
-      return NULL;
-
-    // only handling deflate at the moment
-    if (localFileHeader.CompressionMethod != 0 && localFileHeader.CompressionMethod != Z_DEFLATED)
-      return NULL;
-
-    // ugh, streamed files. have to handle these carefully
-    // otherwise, should be accurate
-    if (localFileHeader.Flags & 8)
-    {
-      if (pFileEntry->CRC32 == 0)
-        return NULL;
-
-      // pull from central directory
-      localFileHeader.CRC32 = pFileEntry->CRC32;
-      localFileHeader.CompressedSize = pFileEntry->CompressedFileSize;
-      localFileHeader.DecompressedSize = pFileEntry->DecompressedFileSize;
-    }
-    else if (localFileHeader.CompressedSize != pFileEntry->CompressedFileSize ||
-             localFileHeader.DecompressedSize != pFileEntry->DecompressedFileSize)
+    // stored entries in a memory-backed archive can be read in place, whichever mode was asked for
+    const byte* pStreamMemory = pStreamToReadFrom->GetMemoryBasePointer();
+    uint64 dataOffset = pStreamToReadFrom->GetPosition();
+    // (not when appending, as the memory can move when the same stream is written to)
+    if (pStreamMemory != NULL && pStreamToReadFrom == m_pReadStream && m_pReadStream != m_pWriteStream &&
+        localFileHeader.CompressionMethod == 0 &&
+        dataOffset + localFileHeader.DecompressedSize <= pStreamToReadFrom->GetSize())
     {
-      return NULL;
+      return new ZipArchiveStoredViewByteStream(pStreamToReadFrom, pStreamMemory + dataOffset,
+                                                localFileHeader.DecompressedSize, localFileHeader.CRC32,
+                                                m_verifyStoredEntryCRC);
     }
 
-    uint32 seekDistance = (uint32)localFileHeader.FilenameLength + (uint32)localFileHeader.ExtraFieldLength;
-    if (!pStreamToReadFrom->SeekRelative(seekDistance))
-      return NULL;
-
-    if (openMode & BYTESTREAM_OPEN_STREAMED || (openMode & BYTESTREAM_OPEN_SEEKABLE) == 0)
+    // entries too large to buffer are streamed, which still allows forward seeks
+    if (openMode & BYTESTREAM_OPEN_STREAMED || (openMode & BYTESTREAM_OPEN_SEEKABLE) == 0 ||
+        localFileHeader.DecompressedSize > 0xFFFFFFFFULL)
     {
       // create stream
       ZipArchiveStreamedReadByteStream* pReaderStream = new ZipArchiveStreamedReadByteStream(
@@ -1394,6 +2599,9 @@ ByteStream* ZipArchive::OpenFile(const char* filename, uint32 openMode, uint32 c
       if (m_nOpenBufferedWrites > 0 || m_nOpenStreamedWrites > 0)
         return NULL;
 
+      // the streamed entry has to come after anything closed before it
+      WritePendingWrites(true);
+
       // seek to the end of the write stream
       if (!m_pWriteStream->SeekToEnd())
         return NULL;
@@ -1406,7 +2614,12 @@ ByteStream* ZipArchive::OpenFile(const char* filename, uint32 openMode, uint32 c
     }
 
     // determine compression method
-    uint32 compressionMethod = (compressionLevel == 0) ? 0 : Z_DEFLATED;
+    uint32 compressionMethod = (compressionLevel == 0) ? 0 : GetCodecCompressionMethod(codec);
+    if (compressionMethod != 0 && !CompressionCodec::IsAvailable(codec))
+    {
+      Log_ErrorPrintf("ZipArchive::OpenFile: Codec '%s' is not available", CompressionCodec::GetName(codec));
+      return NULL;
+    }
 
     // see if the file is already present
     FileHashTable::Member* pMember = m_writeFileHashTable.Find(filename);
@@ -1426,294 +2639,696 @@ ByteStream* ZipArchive::OpenFile(const char* filename, uint32 openMode, uint32 c
       pMember = m_writeFileHashTable.Insert(pFileEntry->FileName, pFileEntry);
     }
 
-    // create the stream object
-    if (streamed)
-    {
-      ZipArchiveStreamedWriteByteStream* pWriterStream = new ZipArchiveStreamedWriteByteStream(
-        this, m_pWriteStream, pMember->Value, m_pWriteStream->GetPosition(), compressionMethod, compressionLevel);
-      if (!pWriterStream->WriteHeader())
+    // create the stream object
+    if (streamed)
+    {
+      ZipArchiveStreamedWriteByteStream* pWriterStream = new ZipArchiveStreamedWriteByteStream(
+        this, m_pWriteStream, pMember->Value, m_pWriteStream->GetPosition(), compressionMethod, compressionLevel);
+      if (!pWriterStream->WriteHeader())
+      {
+        pWriterStream->Release();
+        pMember->Value->IsDeleted = true;
+        return NULL;
+      }
+
+      return pWriterStream;
+    }
+    else
+    {
+      ZipArchiveBufferedWriteByteStream* pWriterStream = new ZipArchiveBufferedWriteByteStream(
+        this, m_pWriteStream, pMember->Value, compressionMethod, compressionLevel);
+      return pWriterStream;
+    }
+  }
+
+  return NULL;
+}
+
+bool ZipArchive::DeleteFile(const char* filename)
+{
+  FileHashTable::Member* pMember;
+  bool result = false;
+
+  // remove from both read and write streams
+  pMember = m_readFileHashTable.Find(filename);
+  if (pMember != NULL)
+  {
+    pMember->Value->IsDeleted = true;
+    result = true;
+  }
+
+  pMember = m_writeFileHashTable.Find(filename);
+  if (pMember != NULL)
+  {
+    pMember->Value->IsDeleted = true;
+    result = true;
+  }
+
+  return result;
+}
+
+bool ZipArchive::CopyFile(ZipArchive* pOtherArchive, const char* filename)
+{
+  if (m_pWriteStream == NULL)
+    return false;
+
+  WritePendingWrites(true);
+  pOtherArchive->WritePendingWrites(true);
+
+  const FileHashTable::Member* pSourceMember;
+  const FileEntry* pSourceEntry;
+  FileEntry indexedEntry;
+  ByteStream* pSourceStream;
+
+  pSourceMember = pOtherArchive->m_writeFileHashTable.Find(filename);
+  if (pSourceMember == NULL)
+  {
+    if ((pSourceEntry = pOtherArchive->FindCommittedFileEntry(filename, &indexedEntry)) != NULL)
+    {
+      pSourceStream = pOtherArchive->m_pReadStream;
+    }
+    else
+    {
+      return false;
+    }
+  }
+  else
+  {
+    pSourceEntry = pSourceMember->Value;
+    pSourceStream = pOtherArchive->m_pWriteStream;
+  }
+
+  // seek read stream to the file header offset
+  if (!pSourceStream->SeekAbsolute(pSourceEntry->OffsetToFileHeader))
+    return false;
+
+  // find offset that we are writing to
+  if (!m_pWriteStream->SeekToEnd())
+    return false;
+
+  // create in file table
+  FileHashTable::Member* pDestinationMember = m_writeFileHashTable.Find(pSourceEntry->FileName);
+  if (pDestinationMember != NULL)
+  {
+    if (pDestinationMember->Value->WriteOpenCount > 0)
+      return false;
+  }
+  else
+  {
+    FileEntry* pFileEntry = new FileEntry;
+    pDestinationMember = m_writeFileHashTable.Insert(pSourceEntry->FileName, pFileEntry);
+  }
+
+  // fill file entry
+  FileEntry* pDestinationEntry = pDestinationMember->Value;
+  pDestinationEntry->FileName = pSourceEntry->FileName;
+  pDestinationEntry->CompressionMethod = pSourceEntry->CompressionMethod;
+  pDestinationEntry->ModifiedTime = pSourceEntry->ModifiedTime;
+  pDestinationEntry->CRC32 = pSourceEntry->CRC32;
+  pDestinationEntry->OffsetToFileHeader = m_pWriteStream->GetPosition();
+  pDestinationEntry->CompressedFileSize = pSourceEntry->CompressedFileSize;
+  pDestinationEntry->DecompressedFileSize = pSourceEntry->DecompressedFileSize;
+  pDestinationEntry->IsDeleted = false;
+  pDestinationEntry->WriteOpenCount = 0;
+
+  // copy the local header, with sizes from the central directory if the entry was streamed as the data descriptor
+  // isn't copied
+  ZIP_ARCHIVE_LOCAL_FILE_HEADER localFileHeader;
+  if (!ReadLocalFileHeader(pSourceStream, pSourceEntry, &localFileHeader))
+  {
+    pDestinationEntry->IsDeleted = true;
+    return false;
+  }
+
+  localFileHeader.Flags &= ~(uint16)8;
+  if (!WriteLocalFileHeader(m_pWriteStream, &localFileHeader, pSourceEntry->FileName, false))
+  {
+    pDestinationEntry->IsDeleted = true;
+    return false;
+  }
+
+  // read+write chunks
+  static const uint32 CHUNKSIZE = 4096;
+  byte chunkBuffer[CHUNKSIZE];
+  uint64 remaining = pSourceEntry->CompressedFileSize;
+  while (remaining > 0)
+  {
+    uint32 copySize = (uint32)Min(remaining, (uint64)CHUNKSIZE);
+
+    // read it
+    uint32 bytesRead = pSourceStream->Read(chunkBuffer, copySize);
+    if (bytesRead != copySize)
+    {
+      // io error
+      return false;
+    }
+
+    // write it
+    uint32 bytesWritten = m_pWriteStream->Write(chunkBuffer, copySize);
+    if (bytesWritten != copySize)
+    {
+      // io error
+      return false;
+    }
+
+    remaining -= (uint64)copySize;
+  }
+
+  // all good
+  return true;
+}
+
+bool ZipArchive::ExtractAll(ZipArchiveExtractSink* pSink, ThreadPool* pThreadPool /* = NULL */,
+                            ProgressCallbacks* pProgressCallbacks /* = ProgressCallbacks::NullProgressCallback */)
+{
+  return ExtractFiles(NULL, pSink, pThreadPool, pProgressCallbacks);
+}
+
+bool ZipArchive::ExtractMatching(const char* pattern, ZipArchiveExtractSink* pSink,
+                                 ThreadPool* pThreadPool /* = NULL */,
+                                 ProgressCallbacks* pProgressCallbacks /* = ProgressCallbacks::NullProgressCallback */)
+{
+  return ExtractFiles(pattern, pSink, pThreadPool, pProgressCallbacks);
+}
+
+bool ZipArchive::ExtractFiles(const char* pattern, ZipArchiveExtractSink* pSink, ThreadPool* pThreadPool,
+                              ProgressCallbacks* pProgressCallbacks)
+{
+  // the archive streams get moved around, which would corrupt an open streamed write
+  if (m_nOpenStreamedWrites > 0)
+  {
+    Log_ErrorPrintf("ZipArchive::ExtractFiles: Cannot extract while a streamed write is open");
+    return false;
+  }
+
+  // entries still being compressed have to be in the archive before they can be read back
+  WritePendingWrites(true);
+
+  // gather entries, anything in the write table shadows the read table
+  PODArray<ZipArchiveExtractEntry> entries;
+  for (FileHashTable::ConstIterator itr = m_writeFileHashTable.Begin(); !itr.AtEnd(); itr.Forward())
+  {
+    const FileEntry* pFileEntry = itr->Value;
+    if (pFileEntry->IsDeleted || pFileEntry->WriteOpenCount > 0 ||
+        (pattern != NULL && !Y_striwildcmp(pFileEntry->FileName, pattern)))
+    {
+      continue;
+    }
+
+    ZipArchiveExtractEntry entry = {pFileEntry, 0, m_pWriteStream, 1, pFileEntry->OffsetToFileHeader,
+                                    pFileEntry->CompressedFileSize, 0};
+    entries.Add(entry);
+  }
+  if (IsIndexed())
+  {
+    // only the name and location are needed up front, the rest is decoded as entries are reached
+    String filename;
+    for (uint32 i = 0; i < m_index.GetSize(); i++)
+    {
+      const byte* pRecord = m_pCentralDirectory + m_index[i].RecordOffset;
+      filename.Clear();
+      filename.AppendString((const char*)pRecord + ZIP_CENTRAL_DIRECTORY_FILE_HEADER_SIZE, ReadZipUInt16(pRecord + 28));
+      if (pattern != NULL && !Y_striwildcmp(filename, pattern))
+        continue;
+
+      uint64 offsetToFileHeader, compressedSize, decompressedSize;
+      ReadIndexedEntryLocation(pRecord, &offsetToFileHeader, &compressedSize, &decompressedSize);
+
+      // skip duplicates, the first one in the directory sorts first
+      if (i > 0 && m_index[i - 1].NameHash == m_index[i].NameHash)
+      {
+        FileEntry indexedEntry;
+        if (FindCommittedFileEntry(filename, &indexedEntry) != NULL &&
+            offsetToFileHeader != indexedEntry.OffsetToFileHeader)
+        {
+          continue;
+        }
+      }
+
+      ZipArchiveExtractEntry entry = {NULL, m_index[i].RecordOffset, m_pReadStream, 0, offsetToFileHeader,
+                                      compressedSize, 0};
+      entries.Add(entry);
+    }
+  }
+  else
+  {
+    for (FileHashTable::ConstIterator itr = m_readFileHashTable.Begin(); !itr.AtEnd(); itr.Forward())
+    {
+      const FileEntry* pFileEntry = itr->Value;
+      if (pFileEntry->IsDeleted || m_writeFileHashTable.Find(pFileEntry->FileName) != NULL ||
+          (pattern != NULL && !Y_striwildcmp(pFileEntry->FileName, pattern)))
+      {
+        continue;
+      }
+
+      ZipArchiveExtractEntry entry = {pFileEntry, 0, m_pReadStream, 0, pFileEntry->OffsetToFileHeader,
+                                      pFileEntry->CompressedFileSize, 0};
+      entries.Add(entry);
+    }
+  }
+
+  // read in archive order, and work out how far each entry can extend: the local header can't be larger than the
+  // fixed part plus maximal name and extra fields, and entries don't overlap
+  entries.Sort(CompareExtractEntries);
+  for (uint32 i = 0; i < entries.GetSize(); i++)
+  {
+    ZipArchiveExtractEntry& entry = entries[i];
+    entry.SpanEnd = entry.Offset + ZIP_LOCAL_FILE_HEADER_SIZE + 0xFFFF + 0xFFFF + entry.CompressedSize;
+    if ((i + 1) < entries.GetSize() && entries[i + 1].StreamIndex == entry.StreamIndex)
+      entry.SpanEnd = Min(entry.SpanEnd, entries[i + 1].Offset);
+    else
+      entry.SpanEnd = Min(entry.SpanEnd, entry.pArchiveStream->GetSize());
+  }
+
+  pProgressCallbacks->PushState();
+  pProgressCallbacks->SetStatusText("Extracting files...");
+  pProgressCallbacks->SetProgressRange(entries.GetSize());
+  pProgressCallbacks->SetProgressValue(0);
+
+  ZipArchiveExtractQueue queue(pSink, pThreadPool, pProgressCallbacks);
+  bool result = true;
+  uint32 entryIndex = 0;
+  while (entryIndex < entries.GetSize() && !pProgressCallbacks->IsCancelled())
+  {
+    // entries too large to hold in memory are streamed through on this thread instead
+    const ZipArchiveExtractEntry& firstEntry = entries[entryIndex];
+    if ((firstEntry.SpanEnd - firstEntry.Offset) > ZIP_EXTRACT_MAX_IN_FLIGHT_BYTES)
+    {
+      result &= ExtractEntryStreamed(&firstEntry, pSink);
+      pProgressCallbacks->IncrementProgressValue();
+      entryIndex++;
+      continue;
+    }
+
+    // pull in neighbouring entries with the same read
+    uint64 readStart = firstEntry.Offset;
+    uint64 readEnd = firstEntry.SpanEnd;
+    uint32 readEntryCount = 1;
+    for (; (entryIndex + readEntryCount) < entries.GetSize(); readEntryCount++)
+    {
+      const ZipArchiveExtractEntry& nextEntry = entries[entryIndex + readEntryCount];
+      if (nextEntry.StreamIndex != firstEntry.StreamIndex || nextEntry.Offset > (readEnd + ZIP_EXTRACT_MAX_READ_GAP) ||
+          (nextEntry.SpanEnd - readStart) > ZIP_EXTRACT_READ_SIZE)
+      {
+        break;
+      }
+
+      readEnd = nextEntry.SpanEnd;
+    }
+
+    // fetch it once there's room
+    uint64 readSize = readEnd - readStart;
+    result &= queue.ReserveBytes(readSize);
+
+    ZipArchiveExtractBuffer* pBuffer = NULL;
+    if (readEnd > readStart && readSize <= 0xFFFFFFFFULL)
+    {
+      pBuffer = new ZipArchiveExtractBuffer((uint32)readSize);
+      if (pBuffer->GetData() == NULL || !firstEntry.pArchiveStream->SeekAbsolute(readStart) ||
+          firstEntry.pArchiveStream->Read(pBuffer->GetData(), (uint32)readSize) != (uint32)readSize)
+      {
+        pBuffer->Release();
+        pBuffer = NULL;
+      }
+    }
+    if (pBuffer == NULL)
+    {
+      Log_ErrorPrintf("ZipArchive::ExtractFiles: Failed to read %u entries (%llu bytes) at offset %llu",
+                      readEntryCount, (unsigned long long)readSize, (unsigned long long)readStart);
+
+      for (uint32 i = 0; i < readEntryCount; i++)
+        pProgressCallbacks->IncrementProgressValue();
+
+      entryIndex += readEntryCount;
+      result = false;
+      continue;
+    }
+
+    ReadOnlyMemoryByteStream* pBufferStream = ByteStream_CreateReadOnlyMemoryStream(pBuffer->GetData(),
+                                                                                    pBuffer->GetSize());
+    for (uint32 i = 0; i < readEntryCount && !pProgressCallbacks->IsCancelled(); i++)
+    {
+      const ZipArchiveExtractEntry& entry = entries[entryIndex + i];
+      const FileEntry* pFileEntry = entry.pFileEntry;
+      FileEntry indexedEntry;
+      if (pFileEntry == NULL)
+      {
+        DecodeIndexedEntry(entry.IndexRecordOffset, &indexedEntry);
+        pFileEntry = &indexedEntry;
+      }
+
+      ZIP_ARCHIVE_LOCAL_FILE_HEADER localFileHeader;
+      if (!pBufferStream->SeekAbsolute(entry.Offset - readStart) ||
+          !ReadLocalFileHeader(pBufferStream, pFileEntry, &localFileHeader) ||
+          (pBufferStream->GetPosition() + localFileHeader.CompressedSize) > (uint64)pBuffer->GetSize())
+      {
+        Log_ErrorPrintf("ZipArchive::ExtractFiles: Corrupted local file header for '%s'",
+                        pFileEntry->FileName.GetCharArray());
+        pProgressCallbacks->IncrementProgressValue();
+        result = false;
+        continue;
+      }
+
+      FILESYSTEM_STAT_DATA statData;
+      statData.Attributes = (pFileEntry->CompressionMethod != 0) ? FILESYSTEM_FILE_ATTRIBUTE_COMPRESSED : 0;
+      statData.ModificationTime = pFileEntry->ModifiedTime;
+      statData.Size = pFileEntry->DecompressedFileSize;
+
+      // a null stream means the sink isn't interested in this entry
+      ByteStream* pOutputStream = NULL;
+      if (!pSink->OpenEntry(pFileEntry->FileName, &statData, &pOutputStream))
       {
-        pWriterStream->Release();
-        pMember->Value->IsDeleted = true;
-        return NULL;
+        Log_ErrorPrintf("ZipArchive::ExtractFiles: Sink failed to open '%s'", pFileEntry->FileName.GetCharArray());
+        pProgressCallbacks->IncrementProgressValue();
+        result = false;
+        continue;
+      }
+      if (pOutputStream == NULL)
+      {
+        pProgressCallbacks->IncrementProgressValue();
+        continue;
       }
 
-      return pWriterStream;
-    }
-    else
-    {
-      ZipArchiveBufferedWriteByteStream* pWriterStream = new ZipArchiveBufferedWriteByteStream(
-        this, m_pWriteStream, pMember->Value, compressionMethod, compressionLevel);
-      return pWriterStream;
+      uint32 dataOffset = (uint32)pBufferStream->GetPosition();
+      result &= queue.Submit(new ZipArchiveExtractItem(&queue, pFileEntry->FileName.GetCharArray(), pOutputStream,
+                                                       &localFileHeader, pBuffer, dataOffset));
     }
+
+    pBufferStream->Release();
+    pBuffer->Release();
+    entryIndex += readEntryCount;
   }
 
-  return NULL;
+  result &= queue.WaitForAll();
+  if (pProgressCallbacks->IsCancelled())
+    result = false;
+
+  pProgressCallbacks->PopState();
+  return result;
 }
 
-bool ZipArchive::DeleteFile(const char* filename)
+bool ZipArchive::ExtractEntryStreamed(const ZipArchiveExtractEntry* pEntry, ZipArchiveExtractSink* pSink)
 {
-  FileHashTable::Member* pMember;
-  bool result = false;
-
-  // remove from both read and write streams
-  pMember = m_readFileHashTable.Find(filename);
-  if (pMember != NULL)
+  const FileEntry* pFileEntry = pEntry->pFileEntry;
+  FileEntry indexedEntry;
+  if (pFileEntry == NULL)
   {
-    pMember->Value->IsDeleted = true;
-    result = true;
+    DecodeIndexedEntry(pEntry->IndexRecordOffset, &indexedEntry);
+    pFileEntry = &indexedEntry;
   }
 
-  pMember = m_writeFileHashTable.Find(filename);
-  if (pMember != NULL)
+  ZIP_ARCHIVE_LOCAL_FILE_HEADER localFileHeader;
+  if (!pEntry->pArchiveStream->SeekAbsolute(pEntry->Offset) ||
+      !ReadLocalFileHeader(pEntry->pArchiveStream, pFileEntry, &localFileHeader))
   {
-    pMember->Value->IsDeleted = true;
-    result = true;
+    Log_ErrorPrintf("ZipArchive::ExtractEntryStreamed: Corrupted local file header for '%s'",
+                    pFileEntry->FileName.GetCharArray());
+    return false;
   }
 
-  return result;
-}
+  FILESYSTEM_STAT_DATA statData;
+  statData.Attributes = (pFileEntry->CompressionMethod != 0) ? FILESYSTEM_FILE_ATTRIBUTE_COMPRESSED : 0;
+  statData.ModificationTime = pFileEntry->ModifiedTime;
+  statData.Size = pFileEntry->DecompressedFileSize;
 
-bool ZipArchive::CopyFile(ZipArchive* pOtherArchive, const char* filename)
-{
-  if (m_pWriteStream == NULL)
+  ByteStream* pOutputStream = NULL;
+  if (!pSink->OpenEntry(pFileEntry->FileName, &statData, &pOutputStream))
+  {
+    Log_ErrorPrintf("ZipArchive::ExtractEntryStreamed: Sink failed to open '%s'", pFileEntry->FileName.GetCharArray());
     return false;
+  }
+  if (pOutputStream == NULL)
+    return true;
 
-  const FileHashTable::Member* pSourceMember;
-  ByteStream* pSourceStream;
+  ZipArchiveStreamedReadByteStream* pReadStream = new ZipArchiveStreamedReadByteStream(
+    this, pEntry->pArchiveStream, pEntry->pArchiveStream->GetPosition(), &localFileHeader);
 
-  pSourceMember = pOtherArchive->m_writeFileHashTable.Find(filename);
-  if (pSourceMember == NULL)
-  {
-    if ((pSourceMember = pOtherArchive->m_readFileHashTable.Find(filename)) != NULL)
-    {
-      pSourceStream = pOtherArchive->m_pReadStream;
-    }
-    else
-    {
-      return false;
-    }
-  }
-  else
+  byte* pChunk = (byte*)std::malloc(ZIP_EXTRACT_OUTPUT_CHUNK_SIZE);
+  uint64 remaining = localFileHeader.DecompressedSize;
+  bool successful = true;
+  while (remaining > 0 && successful)
   {
-    pSourceStream = pOtherArchive->m_pWriteStream;
+    uint32 chunkSize = (uint32)Min(remaining, (uint64)ZIP_EXTRACT_OUTPUT_CHUNK_SIZE);
+    successful = (pReadStream->Read(pChunk, chunkSize) == chunkSize && pOutputStream->Write2(pChunk, chunkSize));
+    remaining -= chunkSize;
   }
 
-  const FileEntry* pSourceEntry = pSourceMember->Value;
+  // reading past the end makes sure the end of the deflate stream, and so the CRC check, has been reached
+  successful = (successful && pReadStream->Read(pChunk, 1) == 0 && !pReadStream->InErrorState());
+  std::free(pChunk);
+  pReadStream->Release();
 
-  // seek read stream to the file header offset
-  if (!pSourceStream->SeekAbsolute(pSourceEntry->OffsetToFileHeader))
-    return false;
+  if (!successful)
+    Log_ErrorPrintf("ZipArchive::ExtractEntryStreamed: Failed to extract '%s'", pFileEntry->FileName.GetCharArray());
 
-  // find offset that we are writing to
-  if (!m_pWriteStream->SeekToEnd())
+  bool result = pSink->CloseEntry(pFileEntry->FileName, pOutputStream, successful);
+  pOutputStream->Release();
+  return (result && successful);
+}
+
+bool ZipArchive::UpgradeToWritableArchive(ByteStream* pWriteStream)
+{
+  if (m_pWriteStream != NULL)
     return false;
 
-  // create in file table
-  FileHashTable::Member* pDestinationMember = m_writeFileHashTable.Find(pSourceEntry->FileName);
-  if (pDestinationMember != NULL)
-  {
-    if (pDestinationMember->Value->WriteOpenCount > 0)
-      return false;
-  }
-  else
+  // committing needs a full file table
+  if (IsIndexed())
   {
-    FileEntry* pFileEntry = new FileEntry;
-    pDestinationMember = m_writeFileHashTable.Insert(pSourceEntry->FileName, pFileEntry);
+    Log_ErrorPrintf("ZipArchive::UpgradeToWritableArchive: Index-only archives cannot be written");
+    return false;
   }
 
-  // fill file entry
-  FileEntry* pDestinationEntry = pDestinationMember->Value;
-  pDestinationEntry->FileName = pSourceEntry->FileName;
-  pDestinationEntry->CompressionMethod = pSourceEntry->CompressionMethod;
-  pDestinationEntry->ModifiedTime = pSourceEntry->ModifiedTime;
-  pDestinationEntry->CRC32 = pSourceEntry->CRC32;
-  pDestinationEntry->OffsetToFileHeader = m_pWriteStream->GetPosition();
-  pDestinationEntry->CompressedFileSize = pSourceEntry->CompressedFileSize;
-  pDestinationEntry->DecompressedFileSize = pSourceEntry->DecompressedFileSize;
-  pDestinationEntry->IsDeleted = false;
-  pDestinationEntry->WriteOpenCount = 0;
+  m_pWriteStream = pWriteStream;
+  m_pWriteStream->AddRef();
+  return true;
+}
 
-  // write local header
-  {
-    BinaryReader binaryReader(pSourceStream);
+void ZipArchive::SetCompressionThreadPool(ThreadPool* pThreadPool, uint32 blockSize /* = 128 * 1024 */)
+{
+  WritePendingWrites(true);
 
-    ZIP_ARCHIVE_LOCAL_FILE_HEADER localFileHeader;
-    uint32 compressedSize32;
-    uint32 decompressedSize32;
-    if (!binaryReader.SafeReadUInt32(&localFileHeader.Signature) ||
-        !binaryReader.SafeReadUInt16(&localFileHeader.VersionRequiredToExtract) ||
-        !binaryReader.SafeReadUInt16(&localFileHeader.Flags) ||
-        !binaryReader.SafeReadUInt16(&localFileHeader.CompressionMethod) ||
-        !binaryReader.SafeReadUInt32(&localFileHeader.ModificationTimestamp) ||
-        !binaryReader.SafeReadUInt32(&localFileHeader.CRC32) || !binaryReader.SafeReadUInt32(&compressedSize32) ||
-        !binaryReader.SafeReadUInt32(&decompressedSize32) ||
-        !binaryReader.SafeReadUInt16(&localFileHeader.FilenameLength) ||
-        !binaryReader.SafeReadUInt16(&localFileHeader.ExtraFieldLength))
-    {
-      pDestinationEntry->IsDeleted = true;
-      return false;
-    }
+  m_pCompressionThreadPool = pThreadPool;
+  m_compressionBlockSize = Max(blockSize, ZIP_DEFLATE_DICTIONARY_SIZE);
+}
 
-    localFileHeader.CompressedSize = (uint64)compressedSize32;
-    localFileHeader.DecompressedSize = (uint64)decompressedSize32;
+ZipArchiveCompressionBlock* ZipArchive::SubmitCompressionBlock(uint32 compressionMethod, uint32 compressionLevel,
+                                                               const byte* pInput, uint32 inputSize,
+                                                               const byte* pDictionary, uint32 dictionarySize,
+                                                               bool lastBlock, byte* pOwnedMemory)
+{
+  // the caller keeps the initial reference
+  ZipArchiveCompressionBlock* pBlock = new ZipArchiveCompressionBlock(
+    this, compressionMethod, compressionLevel, pInput, inputSize, pDictionary, dictionarySize, lastBlock, pOwnedMemory);
+  m_pCompressionThreadPool->EnqueueWorkItem(pBlock);
+  return pBlock;
+}
 
-    if (localFileHeader.Signature != ZIP_ARCHIVE_LOCAL_FILE_HEADER_SIGNTURE)
-    {
-      pDestinationEntry->IsDeleted = true;
-      return false;
-    }
+bool ZipArchive::IsCompressionBlockCompleted(ZipArchiveCompressionBlock* pBlock)
+{
+  MutexLock lock(m_compressionLock);
+  return pBlock->IsCompletedLocked();
+}
 
-    // only handling deflate at the moment
-    if (localFileHeader.CompressionMethod != 0 && localFileHeader.CompressionMethod != Z_DEFLATED)
-    {
-      pDestinationEntry->IsDeleted = true;
-      return false;
-    }
+void ZipArchive::WaitForCompressionBlock(ZipArchiveCompressionBlock* pBlock)
+{
+  m_compressionLock.Lock();
+  while (!pBlock->IsCompletedLocked())
+    m_compressionCondition.SleepAndRelease(&m_compressionLock);
+  m_compressionLock.Unlock();
+}
+
+void ZipArchive::QueuePendingWrite(ZipArchivePendingWrite* pPendingWrite)
+{
+  // split into blocks, each one primed with the data before it. only deflate and stored data can be joined back up.
+  bool splittable = (pPendingWrite->CompressionMethod == 0 || pPendingWrite->CompressionMethod == Z_DEFLATED);
+  uint32 offset = 0;
+  do
+  {
+    uint32 blockSize = (splittable) ? Min(m_compressionBlockSize, pPendingWrite->DataSize - offset) :
+                                      pPendingWrite->DataSize;
+    uint32 dictionarySize = Min(offset, ZIP_DEFLATE_DICTIONARY_SIZE);
+    bool lastBlock = (offset + blockSize) == pPendingWrite->DataSize;
+    pPendingWrite->Blocks.Add(SubmitCompressionBlock(
+      pPendingWrite->CompressionMethod, pPendingWrite->CompressionLevel, pPendingWrite->pData + offset,
+      blockSize, pPendingWrite->pData + offset - dictionarySize, dictionarySize, lastBlock, NULL));
+    offset += blockSize;
+  } while (offset < pPendingWrite->DataSize);
+
+  m_pendingWrites.Add(pPendingWrite);
+  m_pendingWriteBytes += pPendingWrite->DataSize;
+
+  // write out anything which has finished, and bound the amount held in memory
+  WritePendingWrites(false);
+  while (m_pendingWriteBytes > ZIP_MAX_PENDING_WRITE_BYTES && m_pendingWrites.GetSize() > 1)
+    WritePendingWrite(m_pendingWrites.PopFront());
+}
 
-    // ugh, streamed files. have to handle these carefully
-    // otherwise, should be accurate
-    if (localFileHeader.Flags & 8)
+void ZipArchive::WritePendingWrites(bool waitForCompletion)
+{
+  while (m_pendingWrites.GetSize() > 0)
+  {
+    ZipArchivePendingWrite* pPendingWrite = m_pendingWrites[0];
+    if (!waitForCompletion)
     {
-      if (pSourceEntry->CRC32 == 0)
+      // entries are written strictly in order, so stop at the first one that isn't ready
+      uint32 i;
+      for (i = 0; i < pPendingWrite->Blocks.GetSize(); i++)
       {
-        pDestinationEntry->IsDeleted = true;
-        return false;
+        if (!IsCompressionBlockCompleted(pPendingWrite->Blocks[i]))
+          break;
       }
-
-      // pull from central directory, and strip the streamed flag from it, since we're not going to append the
-      // post-header
-      localFileHeader.CRC32 = pSourceEntry->CRC32;
-      localFileHeader.CompressedSize = pSourceEntry->CompressedFileSize;
-      localFileHeader.DecompressedSize = pSourceEntry->DecompressedFileSize;
-      localFileHeader.Flags &= ~(uint16)8;
-    }
-    else if (localFileHeader.CompressedSize != pSourceEntry->CompressedFileSize ||
-             localFileHeader.DecompressedSize != pSourceEntry->DecompressedFileSize)
-    {
-      pDestinationEntry->IsDeleted = true;
-      return false;
-    }
-
-    uint32 seekDistance = (uint32)localFileHeader.FilenameLength + (uint32)localFileHeader.ExtraFieldLength;
-    if (!pSourceStream->SeekRelative(seekDistance))
-    {
-      pDestinationEntry->IsDeleted = true;
-      return false;
+      if (i != pPendingWrite->Blocks.GetSize())
+        break;
     }
 
-    // write the local file header to the write stream
-    BinaryWriter binaryWriter(m_pWriteStream, ENDIAN_TYPE_LITTLE);
-    uint32 filenameLength = Min(pSourceEntry->FileName.GetLength(), (uint32)0xFFFF);
-    if (!binaryWriter.SafeWriteUInt32(localFileHeader.Signature) ||                 // Signature
-        !binaryWriter.SafeWriteUInt16(localFileHeader.VersionRequiredToExtract) ||  // VersionRequiredToExtract
-        !binaryWriter.SafeWriteUInt16(localFileHeader.Flags) ||                     // Flags
-        !binaryWriter.SafeWriteUInt16(localFileHeader.CompressionMethod) ||         // CompressionMethod
-        !binaryWriter.SafeWriteUInt32(localFileHeader.ModificationTimestamp) ||     // ModificationTimestamp
-        !binaryWriter.SafeWriteUInt32(localFileHeader.CRC32) ||                     // CRC32
-        !binaryWriter.SafeWriteUInt32((uint32)localFileHeader.CompressedSize) ||    // CompressedSize
-        !binaryWriter.SafeWriteUInt32((uint32)localFileHeader.DecompressedSize) ||  // DecompressedSize
-        !binaryWriter.SafeWriteUInt16((uint16)filenameLength) ||                    // FilenameLength
-        !binaryWriter.SafeWriteUInt16(0) ||                                         // ExtraFieldLength
-        !binaryWriter.SafeWriteFixedString(pSourceEntry->FileName, filenameLength)) // Filename
-    {
-      pDestinationEntry->IsDeleted = true;
-      return false;
-    }
+    m_pendingWrites.PopFront();
+    WritePendingWrite(pPendingWrite);
   }
+}
 
-  // read+write chunks
-  static const uint32 CHUNKSIZE = 4096;
-  byte chunkBuffer[CHUNKSIZE];
-  uint64 remaining = pSourceEntry->CompressedFileSize;
-  while (remaining > 0)
+bool ZipArchive::WritePendingWrite(ZipArchivePendingWrite* pPendingWrite)
+{
+  FileEntry* pFileEntry = pPendingWrite->pFileEntry;
+  uint32 blockCount = pPendingWrite->Blocks.GetSize();
+  // one slot per block, which scales with the entry size, so these are too big for the stack
+  PODArray<const void*> blockOutputs;
+  PODArray<uint32> blockOutputSizes;
+  blockOutputs.Resize(blockCount);
+  blockOutputSizes.Resize(blockCount);
+  const void** ppBlockOutputs = blockOutputs.GetBasePointer();
+  uint32* pBlockOutputSizes = blockOutputSizes.GetBasePointer();
+  uint32 crc = 0;
+  uint64 compressedSize = 0;
+  bool result = true;
+
+  for (uint32 i = 0; i < blockCount; i++)
   {
-    uint32 copySize = (uint32)Min(remaining, (uint64)CHUNKSIZE);
+    ZipArchiveCompressionBlock* pBlock = pPendingWrite->Blocks[i];
+    WaitForCompressionBlock(pBlock);
+
+    result &= pBlock->IsSuccessful();
+    crc = (i == 0) ? pBlock->GetCRC32() : CRC32::CombineCRC(crc, pBlock->GetCRC32(), pBlock->GetInputSize());
+    ppBlockOutputs[i] = pBlock->GetOutput();
+    pBlockOutputSizes[i] = pBlock->GetOutputSize();
+    compressedSize += pBlock->GetOutputSize();
+  }
 
-    // read it
-    uint32 bytesRead = pSourceStream->Read(chunkBuffer, copySize);
-    if (bytesRead != copySize)
-    {
-      // io error
-      return false;
-    }
+  // sizes are known now, so the header can be written in one pass
+  uint64 offsetToLocalFileHeader = 0;
+  if (result && compressedSize <= 0xFFFFFFFFULL && m_pWriteStream->SeekToEnd())
+  {
+    offsetToLocalFileHeader = m_pWriteStream->GetPosition();
 
-    // write it
-    uint32 bytesWritten = m_pWriteStream->Write(chunkBuffer, copySize);
-    if (bytesWritten != copySize)
+    BinaryWriter binaryWriter(m_pWriteStream, ENDIAN_TYPE_LITTLE);
+    uint32 versionRequiredToExtract = GetVersionRequiredToExtract(pPendingWrite->CompressionMethod);
+    uint32 filenameLength = Min(pFileEntry->FileName.GetLength(), (uint32)0xFFFF);
+    if (!binaryWriter.SafeWriteUInt32(ZIP_ARCHIVE_LOCAL_FILE_HEADER_SIGNTURE) ||          // Signature
+        !binaryWriter.SafeWriteUInt16((uint16)versionRequiredToExtract) ||                // VersionRequiredToExtract
+        !binaryWriter.SafeWriteUInt16(0) ||                                               // Flags
+        !binaryWriter.SafeWriteUInt16((uint16)pPendingWrite->CompressionMethod) ||        // CompressionMethod
+        !binaryWriter.SafeWriteUInt32(TimestampToZipTime(pPendingWrite->ModifiedTime)) || // ModificationTimestamp
+        !binaryWriter.SafeWriteUInt32(crc) ||                                             // CRC32
+        !binaryWriter.SafeWriteUInt32((uint32)compressedSize) ||                          // CompressedSize
+        !binaryWriter.SafeWriteUInt32(pPendingWrite->DataSize) ||                         // DecompressedSize
+        !binaryWriter.SafeWriteUInt16((uint16)filenameLength) ||                          // FilenameLength
+        !binaryWriter.SafeWriteUInt16(0) ||                                               // ExtraFieldLength
+        !binaryWriter.SafeWriteFixedString(pFileEntry->FileName, filenameLength) ||       // Filename
+        !binaryWriter.SafeWriteVector(ppBlockOutputs, pBlockOutputSizes, blockCount))     // Data
     {
-      // io error
-      return false;
+      result = false;
     }
+  }
+  else
+  {
+    result = false;
+  }
 
-    remaining -= (uint64)copySize;
+  if (result)
+  {
+    pFileEntry->CompressionMethod = pPendingWrite->CompressionMethod;
+    pFileEntry->ModifiedTime = pPendingWrite->ModifiedTime;
+    pFileEntry->CRC32 = crc;
+    pFileEntry->OffsetToFileHeader = offsetToLocalFileHeader;
+    pFileEntry->CompressedFileSize = compressedSize;
+    pFileEntry->DecompressedFileSize = pPendingWrite->DataSize;
+  }
+  else
+  {
+    Log_ErrorPrintf("ZipArchive::WritePendingWrite: Failed to write '%s'", pFileEntry->FileName.GetCharArray());
+    pFileEntry->IsDeleted = true;
   }
 
-  // all good
-  return true;
+  m_pendingWriteBytes -= pPendingWrite->DataSize;
+  for (uint32 i = 0; i < blockCount; i++)
+    pPendingWrite->Blocks[i]->Release();
+  std::free(pPendingWrite->pData);
+  delete pPendingWrite;
+  return result;
 }
 
-bool ZipArchive::UpgradeToWritableArchive(ByteStream* pWriteStream)
+void ZipArchive::DiscardPendingWrites()
 {
-  if (m_pWriteStream != NULL)
-    return false;
+  while (m_pendingWrites.GetSize() > 0)
+  {
+    ZipArchivePendingWrite* pPendingWrite = m_pendingWrites.PopFront();
+    for (uint32 i = 0; i < pPendingWrite->Blocks.GetSize(); i++)
+    {
+      WaitForCompressionBlock(pPendingWrite->Blocks[i]);
+      pPendingWrite->Blocks[i]->Release();
+    }
 
-  m_pWriteStream = pWriteStream;
-  m_pWriteStream->AddRef();
-  return true;
+    pPendingWrite->pFileEntry->IsDeleted = true;
+    m_pendingWriteBytes -= pPendingWrite->DataSize;
+    std::free(pPendingWrite->pData);
+    delete pPendingWrite;
+  }
 }
 
-bool ZipArchive::ParseZip()
+ZipArchiveInflateIndex* ZipArchive::GetInflateIndex(ByteStream* pStream, uint64 dataOffset,
+                                                    const ZIP_ARCHIVE_LOCAL_FILE_HEADER* pLocalFileHeader)
 {
-  BinaryReader binaryReader(m_pReadStream, ENDIAN_TYPE_LITTLE);
-
-  // start at the end of the file - 4
-  if (!m_pReadStream->SeekToEnd() || !m_pReadStream->SeekRelative(-4))
-    return false;
-
-  // find the end of central directory record
-  uint32 signature;
-  for (;;)
+  // only entries which have been seeked around in have an index, so there aren't many to look through
+  for (uint32 i = 0; i < m_inflateIndexes.GetSize(); i++)
   {
-    signature = binaryReader.ReadUInt32();
-    if (signature == ZIP_ARCHIVE_END_OF_CENTRAL_DIRECTORY_SIGNATURE)
-      break;
-
-    if (!m_pReadStream->SeekRelative(-5))
-      return false;
+    if (m_inflateIndexes[i]->Matches(pStream, dataOffset, pLocalFileHeader->CompressedSize, pLocalFileHeader->CRC32))
+      return m_inflateIndexes[i];
   }
 
-  // got it, so pull out the fields
-  uint16 diskNumber;
-  uint16 centralDirectoryDisk;
-  uint16 centralDirectoryRecordsOnThisDisk;
-  uint16 centralDirectoryTotalRecords;
-  uint32 centralDirectorySize;
-  uint32 centralDirectoryOffset;
-  uint16 commentLength;
+  ZipArchiveInflateIndex* pIndex = new ZipArchiveInflateIndex(
+    pStream, dataOffset, pLocalFileHeader->CompressedSize, pLocalFileHeader->CRC32, m_seekCheckpointInterval);
+  m_inflateIndexes.Add(pIndex);
+  return pIndex;
+}
 
-  if (!binaryReader.SafeReadUInt16(&diskNumber) || !binaryReader.SafeReadUInt16(&centralDirectoryDisk) ||
-      !binaryReader.SafeReadUInt16(&centralDirectoryRecordsOnThisDisk) ||
-      !binaryReader.SafeReadUInt16(&centralDirectoryTotalRecords) ||
-      !binaryReader.SafeReadUInt32(&centralDirectorySize) || !binaryReader.SafeReadUInt32(&centralDirectoryOffset) ||
-      !binaryReader.SafeReadUInt16(&commentLength))
-  {
+void ZipArchive::ClearInflateIndexes()
+{
+  for (uint32 i = 0; i < m_inflateIndexes.GetSize(); i++)
+    delete m_inflateIndexes[i];
+  m_inflateIndexes.Clear();
+}
+
+bool ZipArchive::ParseZip()
+{
+  ZIP_ARCHIVE_END_OF_CENTRAL_DIRECTORY endOfCentralDirectory;
+  if (!ReadEndOfCentralDirectory(m_pReadStream, &endOfCentralDirectory))
     return false;
-  }
 
   // multi-disk archives are not supported
-  if (centralDirectoryDisk != 0 || centralDirectoryRecordsOnThisDisk != centralDirectoryTotalRecords)
+  if (endOfCentralDirectory.CentralDirectoryDisk != 0 ||
+      endOfCentralDirectory.CentralDirectoryRecordsOnThisDisk != endOfCentralDirectory.CentralDirectoryTotalRecords)
   {
     Log_ErrorPrintf("ZipArchive::ParseZip: Multi-disk archives are unsupported.");
     return false;
   }
 
   // go to the central directory
-  if (!m_pReadStream->SeekAbsolute(centralDirectoryOffset))
+  BinaryReader binaryReader(m_pReadStream, ENDIAN_TYPE_LITTLE);
+  if (!m_pReadStream->SeekAbsolute(endOfCentralDirectory.CentralDirectoryOffset))
     return false;
 
   // parse the central directory
-  for (uint16 i = 0; i < centralDirectoryTotalRecords; i++)
+  PODArray<byte> extraField;
+  for (uint64 i = 0; i < endOfCentralDirectory.CentralDirectoryTotalRecords; i++)
   {
     uint32 fileSignature;
     uint16 versionMadeBy;
@@ -1746,35 +3361,212 @@ bool ZipArchive::ParseZip()
       return false;
     }
 
-    if (fileSignature != ZIP_ARCHIVE_CENTRAL_DIRECTORY_FILE_HEADER_SIGNATURE)
-      return false;
+    if (fileSignature != ZIP_ARCHIVE_CENTRAL_DIRECTORY_FILE_HEADER_SIGNATURE)
+      return false;
+
+    // the extra field is only of interest if it has zip64 values
+    uint64 compressedSize64 = compressedSize;
+    uint64 uncompressedSize64 = uncompressedSize;
+    uint64 fileHeaderOffset64 = fileHeaderOffset;
+    uint32 skipLength = (uint32)extraFieldLength + (uint32)fileCommentLength;
+    if (extraFieldLength > 0 &&
+        (compressedSize == 0xFFFFFFFF || uncompressedSize == 0xFFFFFFFF || fileHeaderOffset == 0xFFFFFFFF))
+    {
+      extraField.Resize(extraFieldLength);
+      if (!binaryReader.SafeReadBytes(extraField.GetBasePointer(), extraFieldLength) ||
+          !ApplyZip64ExtraField(extraField.GetBasePointer(), extraFieldLength, &uncompressedSize64, &compressedSize64,
+                                &fileHeaderOffset64))
+      {
+        return false;
+      }
+
+      skipLength = fileCommentLength;
+    }
+
+    if (skipLength > 0 && !m_pReadStream->SeekRelative(skipLength))
+      return false;
+
+    if (m_readFileHashTable.Find(fileName) != NULL)
+    {
+      Log_WarningPrintf("ZipArchive::ParseZip: Duplicate file name in zip: '%s'.", fileName.GetCharArray());
+      continue;
+    }
+
+    FileEntry* pFileEntry = new FileEntry;
+    pFileEntry->FileName = fileName;
+    pFileEntry->CompressionMethod = compressionMethod;
+    pFileEntry->ModifiedTime = ZipTimeToTimestamp(modificationTimestamp);
+    pFileEntry->CRC32 = crc;
+    pFileEntry->OffsetToFileHeader = fileHeaderOffset64;
+    pFileEntry->CompressedFileSize = compressedSize64;
+    pFileEntry->DecompressedFileSize = uncompressedSize64;
+    pFileEntry->IsDeleted = false;
+    pFileEntry->WriteOpenCount = 0;
+    m_readFileHashTable.Insert(pFileEntry->FileName, pFileEntry);
+  }
+
+  return true;
+}
+
+bool ZipArchive::ParseIndex()
+{
+  ZIP_ARCHIVE_END_OF_CENTRAL_DIRECTORY endOfCentralDirectory;
+  if (!ReadEndOfCentralDirectory(m_pReadStream, &endOfCentralDirectory))
+    return false;
+
+  if (endOfCentralDirectory.CentralDirectoryDisk != 0 ||
+      endOfCentralDirectory.CentralDirectoryRecordsOnThisDisk != endOfCentralDirectory.CentralDirectoryTotalRecords)
+  {
+    Log_ErrorPrintf("ZipArchive::ParseIndex: Multi-disk archives are unsupported.");
+    return false;
+  }
+
+  // records are addressed with 32-bit offsets
+  uint64 centralDirectoryOffset = endOfCentralDirectory.CentralDirectoryOffset;
+  if (endOfCentralDirectory.CentralDirectorySize > 0xFFFFFFFFULL)
+  {
+    Log_ErrorPrintf("ZipArchive::ParseIndex: Central directory is too large to index.");
+    return false;
+  }
+
+  uint32 centralDirectorySize = (uint32)endOfCentralDirectory.CentralDirectorySize;
+  if (centralDirectoryOffset > m_pReadStream->GetSize() ||
+      centralDirectorySize > (m_pReadStream->GetSize() - centralDirectoryOffset))
+  {
+    return false;
+  }
+
+  // use the directory in place if possible
+  const byte* pStreamMemory = m_pReadStream->GetMemoryBasePointer();
+  if (pStreamMemory != NULL)
+  {
+    m_pCentralDirectory = pStreamMemory + centralDirectoryOffset;
+  }
+  else
+  {
+    m_pOwnedCentralDirectory = (byte*)std::malloc(Max(centralDirectorySize, (uint32)1));
+    if (!m_pReadStream->SeekAbsolute(centralDirectoryOffset) ||
+        m_pReadStream->Read(m_pOwnedCentralDirectory, centralDirectorySize) != centralDirectorySize)
+    {
+      return false;
+    }
+
+    m_pCentralDirectory = m_pOwnedCentralDirectory;
+  }
+  m_centralDirectorySize = centralDirectorySize;
 
-    if (((uint32)extraFieldLength + (uint32)fileCommentLength) > 0 &&
-        !m_pReadStream->SeekRelative((uint32)extraFieldLength + (uint32)fileCommentLength))
+  // the record count in the end record is only 16 bits without zip64, so walk the directory by size instead
+  uint64 maxRecordCount = centralDirectorySize / ZIP_CENTRAL_DIRECTORY_FILE_HEADER_SIZE;
+  m_index.Reserve((uint32)Min(endOfCentralDirectory.CentralDirectoryTotalRecords, maxRecordCount));
+  uint32 recordOffset = 0;
+  while (recordOffset < centralDirectorySize)
+  {
+    const byte* pRecord = m_pCentralDirectory + recordOffset;
+    if ((centralDirectorySize - recordOffset) < ZIP_CENTRAL_DIRECTORY_FILE_HEADER_SIZE ||
+        ReadZipUInt32(pRecord) != ZIP_ARCHIVE_CENTRAL_DIRECTORY_FILE_HEADER_SIGNATURE)
+    {
+      Log_ErrorPrintf("ZipArchive::ParseIndex: Corrupted central directory at offset %u", recordOffset);
       return false;
+    }
 
-    if (m_readFileHashTable.Find(fileName) != NULL)
+    uint32 filenameLength = ReadZipUInt16(pRecord + 28);
+    uint32 recordSize = ZIP_CENTRAL_DIRECTORY_FILE_HEADER_SIZE + filenameLength + ReadZipUInt16(pRecord + 30) +
+                        ReadZipUInt16(pRecord + 32);
+    if (recordSize > (centralDirectorySize - recordOffset))
     {
-      Log_WarningPrintf("ZipArchive::ParseZip: Duplicate file name in zip: '%s'.", fileName.GetCharArray());
-      continue;
+      Log_ErrorPrintf("ZipArchive::ParseIndex: Corrupted central directory at offset %u", recordOffset);
+      return false;
     }
 
-    FileEntry* pFileEntry = new FileEntry;
-    pFileEntry->FileName = fileName;
-    pFileEntry->CompressionMethod = compressionMethod;
-    pFileEntry->ModifiedTime = ZipTimeToTimestamp(modificationTimestamp);
-    pFileEntry->CRC32 = crc;
-    pFileEntry->OffsetToFileHeader = (uint64)fileHeaderOffset;
-    pFileEntry->CompressedFileSize = (uint64)compressedSize;
-    pFileEntry->DecompressedFileSize = (uint64)uncompressedSize;
-    pFileEntry->IsDeleted = false;
-    pFileEntry->WriteOpenCount = 0;
-    m_readFileHashTable.Insert(pFileEntry->FileName, pFileEntry);
+    IndexEntry indexEntry;
+    indexEntry.NameHash =
+      FileHashTable::GetStringHash((const char*)pRecord + ZIP_CENTRAL_DIRECTORY_FILE_HEADER_SIZE, filenameLength);
+    indexEntry.RecordOffset = recordOffset;
+    m_index.Add(indexEntry);
+    recordOffset += recordSize;
   }
 
+  // ties are broken by directory order, so the first of any duplicate names wins as with ParseZip
+  m_index.Sort(CompareIndexEntries);
   return true;
 }
 
+int ZipArchive::CompareIndexEntries(const IndexEntry* pLeft, const IndexEntry* pRight)
+{
+  if (pLeft->NameHash != pRight->NameHash)
+    return (pLeft->NameHash < pRight->NameHash) ? -1 : 1;
+  if (pLeft->RecordOffset != pRight->RecordOffset)
+    return (pLeft->RecordOffset < pRight->RecordOffset) ? -1 : 1;
+
+  return 0;
+}
+
+void ZipArchive::DecodeIndexedEntry(uint32 recordOffset, FileEntry* pFileEntry) const
+{
+  const byte* pRecord = m_pCentralDirectory + recordOffset;
+  pFileEntry->FileName.Clear();
+  pFileEntry->FileName.AppendString((const char*)pRecord + ZIP_CENTRAL_DIRECTORY_FILE_HEADER_SIZE,
+                                    ReadZipUInt16(pRecord + 28));
+  pFileEntry->CompressionMethod = ReadZipUInt16(pRecord + 10);
+  pFileEntry->ModifiedTime = ZipTimeToTimestamp(ReadZipUInt32(pRecord + 12));
+  pFileEntry->CRC32 = ReadZipUInt32(pRecord + 16);
+  ReadIndexedEntryLocation(pRecord, &pFileEntry->OffsetToFileHeader, &pFileEntry->CompressedFileSize,
+                           &pFileEntry->DecompressedFileSize);
+  pFileEntry->IsDeleted = false;
+  pFileEntry->WriteOpenCount = 0;
+}
+
+void ZipArchive::ReadIndexedEntryLocation(const byte* pRecord, uint64* pOffsetToFileHeader, uint64* pCompressedSize,
+                                          uint64* pDecompressedSize)
+{
+  *pCompressedSize = ReadZipUInt32(pRecord + 20);
+  *pDecompressedSize = ReadZipUInt32(pRecord + 24);
+  *pOffsetToFileHeader = ReadZipUInt32(pRecord + 42);
+
+  // records were bounds-checked when the index was built. a broken zip64 field leaves the values saturated, which
+  // then fail the local header checks.
+  uint32 filenameLength = ReadZipUInt16(pRecord + 28);
+  ApplyZip64ExtraField(pRecord + ZIP_CENTRAL_DIRECTORY_FILE_HEADER_SIZE + filenameLength, ReadZipUInt16(pRecord + 30),
+                       pDecompressedSize, pCompressedSize, pOffsetToFileHeader);
+}
+
+const ZipArchive::FileEntry* ZipArchive::FindCommittedFileEntry(const char* filename, FileEntry* pIndexedEntry) const
+{
+  if (!IsIndexed())
+  {
+    const FileHashTable::Member* pMember = m_readFileHashTable.Find(filename);
+    return (pMember != NULL && !pMember->Value->IsDeleted) ? pMember->Value : NULL;
+  }
+
+  uint32 filenameLength = Y_strlen(filename);
+  HashType hash = FileHashTable::GetStringHash(filename, filenameLength);
+
+  // first entry with this hash
+  uint32 low = 0;
+  uint32 high = m_index.GetSize();
+  while (low < high)
+  {
+    uint32 middle = low + (high - low) / 2;
+    if (m_index[middle].NameHash < hash)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  for (; low < m_index.GetSize() && m_index[low].NameHash == hash; low++)
+  {
+    const byte* pRecord = m_pCentralDirectory + m_index[low].RecordOffset;
+    if (ReadZipUInt16(pRecord + 28) == filenameLength &&
+        Y_strnicmp((const char*)pRecord + ZIP_CENTRAL_DIRECTORY_FILE_HEADER_SIZE, filename, filenameLength) == 0)
+    {
+      DecodeIndexedEntry(m_index[low].RecordOffset, pIndexedEntry);
+      return pIndexedEntry;
+    }
+  }
+
+  return NULL;
+}
+
 bool ZipArchive::CommitChanges()
 {
   DebugAssert(m_pWriteStream != NULL);
@@ -1783,6 +3575,9 @@ bool ZipArchive::CommitChanges()
   if ((m_nOpenStreamedReads + m_nOpenStreamedWrites + m_nOpenBufferedWrites) > 0)
     return false;
 
+  // entries still being compressed go first, in the order they were closed
+  WritePendingWrites(true);
+
   // start writing at the end
   if (!m_pWriteStream->SeekToEnd())
     return false;
@@ -1795,82 +3590,28 @@ bool ZipArchive::CommitChanges()
     if (pFileEntry->IsDeleted || m_writeFileHashTable.Find(itr->Key) != NULL)
       continue;
 
+    // when appending, the entry is already in the write stream, so only the central directory needs to know about it
+    if (m_appendMode)
+    {
+      FileEntry* pNewFileEntry = new FileEntry(*pFileEntry);
+      m_writeFileHashTable.Insert(pNewFileEntry->FileName, pNewFileEntry);
+      continue;
+    }
+
     if (!m_pReadStream->SeekAbsolute(pFileEntry->OffsetToFileHeader))
       return false;
 
     // store the starting offset
     uint64 newStartingOffset = m_pWriteStream->GetPosition();
-    {
-      BinaryReader binaryReader(m_pReadStream);
-
-      ZIP_ARCHIVE_LOCAL_FILE_HEADER localFileHeader;
-      uint32 compressedSize32;
-      uint32 decompressedSize32;
-      if (!binaryReader.SafeReadUInt32(&localFileHeader.Signature) ||
-          !binaryReader.SafeReadUInt16(&localFileHeader.VersionRequiredToExtract) ||
-          !binaryReader.SafeReadUInt16(&localFileHeader.Flags) ||
-          !binaryReader.SafeReadUInt16(&localFileHeader.CompressionMethod) ||
-          !binaryReader.SafeReadUInt32(&localFileHeader.ModificationTimestamp) ||
-          !binaryReader.SafeReadUInt32(&localFileHeader.CRC32) || !binaryReader.SafeReadUInt32(&compressedSize32) ||
-          !binaryReader.SafeReadUInt32(&decompressedSize32) ||
-          !binaryReader.SafeReadUInt16(&localFileHeader.FilenameLength) ||
-          !binaryReader.SafeReadUInt16(&localFileHeader.ExtraFieldLength))
-      {
-        return false;
-      }
-
-      localFileHeader.CompressedSize = (uint64)compressedSize32;
-      localFileHeader.DecompressedSize = (uint64)decompressedSize32;
-
-      if (localFileHeader.Signature != ZIP_ARCHIVE_LOCAL_FILE_HEADER_SIGNTURE)
-        return false;
-
-      // only handling deflate at the moment
-      if (localFileHeader.CompressionMethod != 0 && localFileHeader.CompressionMethod != Z_DEFLATED)
-        return false;
-
-      // ugh, streamed files. have to handle these carefully
-      // otherwise, should be accurate
-      if (localFileHeader.Flags & 8)
-      {
-        if (pFileEntry->CRC32 == 0)
-          return false;
-
-        // pull from central directory, and strip the streamed flag from it, since we're not going to append the
-        // post-header
-        localFileHeader.CRC32 = pFileEntry->CRC32;
-        localFileHeader.CompressedSize = pFileEntry->CompressedFileSize;
-        localFileHeader.DecompressedSize = pFileEntry->DecompressedFileSize;
-        localFileHeader.Flags &= ~(uint16)8;
-      }
-      else if (localFileHeader.CompressedSize != pFileEntry->CompressedFileSize ||
-               localFileHeader.DecompressedSize != pFileEntry->DecompressedFileSize)
-      {
-        return false;
-      }
 
-      uint32 seekDistance = (uint32)localFileHeader.FilenameLength + (uint32)localFileHeader.ExtraFieldLength;
-      if (!m_pReadStream->SeekRelative(seekDistance))
-        return false;
+    // copy the local header, without the streamed flag as the data descriptor isn't copied
+    ZIP_ARCHIVE_LOCAL_FILE_HEADER localFileHeader;
+    if (!ReadLocalFileHeader(m_pReadStream, pFileEntry, &localFileHeader))
+      return false;
 
-      // write the local file header to the write stream
-      BinaryWriter binaryWriter(m_pWriteStream, ENDIAN_TYPE_LITTLE);
-      uint32 filenameLength = Min(pFileEntry->FileName.GetLength(), (uint32)0xFFFF);
-      if (!binaryWriter.SafeWriteUInt32(localFileHeader.Signature) ||                // Signature
-          !binaryWriter.SafeWriteUInt16(localFileHeader.VersionRequiredToExtract) || // VersionRequiredToExtract
-          !binaryWriter.SafeWriteUInt16(localFileHeader.Flags) ||                    // Flags
-          !binaryWriter.SafeWriteUInt16(localFileHeader.CompressionMethod) ||        // CompressionMethod
-          !binaryWriter.SafeWriteUInt32(localFileHeader.ModificationTimestamp) ||    // ModificationTimestamp
-          !binaryWriter.SafeWriteUInt32(localFileHeader.CRC32) ||                    // CRC32
-          !binaryWriter.SafeWriteUInt32((uint32)localFileHeader.CompressedSize) ||   // CompressedSize
-          !binaryWriter.SafeWriteUInt32((uint32)localFileHeader.DecompressedSize) || // DecompressedSize
-          !binaryWriter.SafeWriteUInt16((uint16)filenameLength) ||                   // FilenameLength
-          !binaryWriter.SafeWriteUInt16(0) ||                                        // ExtraFieldLength
-          !binaryWriter.SafeWriteFixedString(pFileEntry->FileName, filenameLength))  // Filename
-      {
-        return false;
-      }
-    }
+    localFileHeader.Flags &= ~(uint16)8;
+    if (!WriteLocalFileHeader(m_pWriteStream, &localFileHeader, pFileEntry->FileName, false))
+      return false;
 
     // read+write chunks
     static const uint32 CHUNKSIZE = 4096;
@@ -1931,34 +3672,101 @@ bool ZipArchive::CommitChanges()
       // filenames are limited to 65535 characters
       uint32 filenameLength = Min(pFileEntry->FileName.GetLength(), (uint32)0xFFFF);
 
+      // values which don't fit go in a zip64 extra field, in this order
+      uint64 zip64Values[3];
+      uint32 zip64ValueCount = 0;
+      uint32 decompressedSize32 = (uint32)pFileEntry->DecompressedFileSize;
+      uint32 compressedSize32 = (uint32)pFileEntry->CompressedFileSize;
+      uint32 offsetToFileHeader32 = (uint32)pFileEntry->OffsetToFileHeader;
+      if (pFileEntry->DecompressedFileSize >= 0xFFFFFFFFULL)
+      {
+        zip64Values[zip64ValueCount++] = pFileEntry->DecompressedFileSize;
+        decompressedSize32 = 0xFFFFFFFF;
+      }
+      if (pFileEntry->CompressedFileSize >= 0xFFFFFFFFULL)
+      {
+        zip64Values[zip64ValueCount++] = pFileEntry->CompressedFileSize;
+        compressedSize32 = 0xFFFFFFFF;
+      }
+      if (pFileEntry->OffsetToFileHeader >= 0xFFFFFFFFULL)
+      {
+        zip64Values[zip64ValueCount++] = pFileEntry->OffsetToFileHeader;
+        offsetToFileHeader32 = 0xFFFFFFFF;
+      }
+
+      uint32 versionToExtract = GetVersionRequiredToExtract(pFileEntry->CompressionMethod);
+      if (zip64ValueCount > 0)
+        versionToExtract = Max(versionToExtract, ZIP_ARCHIVE_VERSION_TO_EXTRACT_ZIP64);
+      uint32 extraFieldLength = (zip64ValueCount > 0) ? (4 + zip64ValueCount * 8) : 0;
+
       // write header
       if (!binaryWriter.SafeWriteUInt32(ZIP_ARCHIVE_CENTRAL_DIRECTORY_FILE_HEADER_SIGNATURE) || // Signature
           !binaryWriter.SafeWriteUInt16(ZIP_ARCHIVE_VERSION_MADE_BY) ||                         // Version Made By
-          !binaryWriter.SafeWriteUInt16(ZIP_ARCHIVE_VERSION_TO_EXTRACT) ||                      // Version To Extract
+          !binaryWriter.SafeWriteUInt16((uint16)versionToExtract) ||                            // Version To Extract
           !binaryWriter.SafeWriteUInt16(0) ||                                                   // Flags
           !binaryWriter.SafeWriteUInt16((uint16)pFileEntry->CompressionMethod) ||               // Compression Method
           !binaryWriter.SafeWriteUInt32(TimestampToZipTime(pFileEntry->ModifiedTime)) ||        // Modified Timestamp
           !binaryWriter.SafeWriteUInt32(pFileEntry->CRC32) ||                                   // CRC32
-          !binaryWriter.SafeWriteUInt32((uint32)pFileEntry->CompressedFileSize) ||              // Compressed Size
-          !binaryWriter.SafeWriteUInt32((uint32)pFileEntry->DecompressedFileSize) ||            // Decompressed Size
+          !binaryWriter.SafeWriteUInt32(compressedSize32) ||                                    // Compressed Size
+          !binaryWriter.SafeWriteUInt32(decompressedSize32) ||                                  // Decompressed Size
           !binaryWriter.SafeWriteUInt16((uint16)filenameLength) ||                              // Filename Length
-          !binaryWriter.SafeWriteUInt16(0) ||                                                   // Extra Field Length
+          !binaryWriter.SafeWriteUInt16((uint16)extraFieldLength) ||                            // Extra Field Length
           !binaryWriter.SafeWriteUInt16(0) ||                                                   // File Comment Length
           !binaryWriter.SafeWriteUInt16(0) ||                                       // Disk number where file starts
           !binaryWriter.SafeWriteUInt16(0) ||                                       // Internal File Attributes
           !binaryWriter.SafeWriteUInt32(0) ||                                       // External File Attributes
-          !binaryWriter.SafeWriteUInt32((uint32)pFileEntry->OffsetToFileHeader) ||  // Offset to file header
+          !binaryWriter.SafeWriteUInt32(offsetToFileHeader32) ||                    // Offset to file header
           !binaryWriter.SafeWriteFixedString(pFileEntry->FileName, filenameLength)) // Filename
       {
         return false;
       }
 
+      if (zip64ValueCount > 0)
+      {
+        if (!binaryWriter.SafeWriteUInt16(ZIP_EXTRA_FIELD_ZIP64_ID) ||
+            !binaryWriter.SafeWriteUInt16((uint16)(zip64ValueCount * 8)))
+        {
+          return false;
+        }
+
+        for (uint32 i = 0; i < zip64ValueCount; i++)
+        {
+          if (!binaryWriter.SafeWriteUInt64(zip64Values[i]))
+            return false;
+        }
+      }
+
       nCentralDirectoryEntries++;
     }
 
-    // can only write 65536 files to a zip archive
+    // past 65535 entries or 4GiB, the end record's values are saturated and a zip64 end record has the real ones
     uint64 centralDirectorySize = (uint64)(m_pWriteStream->GetPosition() - centralDirectoryOffset);
-    nCentralDirectoryEntries = Min(nCentralDirectoryEntries, (uint32)0xFFFF);
+    if (nCentralDirectoryEntries >= 0xFFFF || centralDirectorySize >= 0xFFFFFFFFULL ||
+        centralDirectoryOffset >= 0xFFFFFFFFULL)
+    {
+      uint64 zip64EndOfCentralDirectoryOffset = m_pWriteStream->GetPosition();
+      if (!binaryWriter.SafeWriteUInt32(ZIP_ARCHIVE_ZIP64_END_OF_CENTRAL_DIRECTORY_SIGNATURE) || // Signature
+          !binaryWriter.SafeWriteUInt64(ZIP_ZIP64_END_OF_CENTRAL_DIRECTORY_SIZE - 12) ||         // Size of the rest
+          !binaryWriter.SafeWriteUInt16(ZIP_ARCHIVE_VERSION_MADE_BY) ||                          // Version Made By
+          !binaryWriter.SafeWriteUInt16(ZIP_ARCHIVE_VERSION_TO_EXTRACT_ZIP64) ||                 // Version To Extract
+          !binaryWriter.SafeWriteUInt32(0) ||                                                    // Disk Number
+          !binaryWriter.SafeWriteUInt32(0) ||                 // Disk where central directory starts
+          !binaryWriter.SafeWriteUInt64(nCentralDirectoryEntries) || // Central directory record count on this disk
+          !binaryWriter.SafeWriteUInt64(nCentralDirectoryEntries) || // Central directory record count
+          !binaryWriter.SafeWriteUInt64(centralDirectorySize) ||     // Central directory size
+          !binaryWriter.SafeWriteUInt64(centralDirectoryOffset) ||   // Central directory offset
+          !binaryWriter.SafeWriteUInt32(ZIP_ARCHIVE_ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIGNATURE) || // Signature
+          !binaryWriter.SafeWriteUInt32(0) ||                                // Disk with the zip64 end record
+          !binaryWriter.SafeWriteUInt64(zip64EndOfCentralDirectoryOffset) || // Offset of the zip64 end record
+          !binaryWriter.SafeWriteUInt32(1))                                  // Total number of disks
+      {
+        return false;
+      }
+
+      nCentralDirectoryEntries = Min(nCentralDirectoryEntries, (uint32)0xFFFF);
+      centralDirectorySize = Min(centralDirectorySize, (uint64)0xFFFFFFFF);
+      centralDirectoryOffset = Min(centralDirectoryOffset, (uint64)0xFFFFFFFF);
+    }
 
     // write the end of central directory marker
     if (!binaryWriter.SafeWriteUInt32(ZIP_ARCHIVE_END_OF_CENTRAL_DIRECTORY_SIGNATURE) || // Signature
@@ -1975,7 +3783,8 @@ bool ZipArchive::CommitChanges()
     }
   }
 
-  // close the read stream
+  // close the read stream, entries are at new offsets from here on
+  ClearInflateIndexes();
   if (m_pReadStream != NULL)
   {
     m_pReadStream->Release();
@@ -2002,20 +3811,114 @@ bool ZipArchive::CommitChanges()
   // replace stream pointers
   m_pReadStream = m_pWriteStream;
   m_pWriteStream = NULL;
+
+  // appending carries on into the same stream
+  if (m_appendMode)
+  {
+    m_pWriteStream = m_pReadStream;
+    m_pWriteStream->AddRef();
+    m_appendCommittedSize = m_pReadStream->GetSize();
+  }
+
   return true;
 }
 
 bool ZipArchive::DiscardChanges()
 {
+  DiscardPendingWrites();
+  ClearInflateIndexes();
+
   // empty the write files table
   m_writeFileHashTable.Clear();
 
+  if (m_appendMode)
+  {
+    // deletes only ever touched the in-memory tables
+    for (FileHashTable::Iterator itr = m_readFileHashTable.Begin(); !itr.AtEnd(); itr.Forward())
+      itr->Value->IsDeleted = false;
+
+    // anything appended since the last commit sits after the end record, where readers scanning back from the end of
+    // the stream may not find it. committing the unchanged table writes a fresh copy of the directory after it.
+    if (m_pWriteStream->GetSize() == m_appendCommittedSize)
+      return true;
+
+    return CommitChanges();
+  }
+
   // close it
   m_pWriteStream->Release();
   m_pWriteStream = NULL;
   return true;
 }
 
+uint64 ZipArchive::GetReclaimableBytes() const
+{
+  if (m_pReadStream == NULL || IsIndexed())
+    return 0;
+
+  // each live entry costs its local header, data and central directory record, names are stored in both headers
+  uint64 usedBytes = ZIP_END_OF_CENTRAL_DIRECTORY_SIZE;
+  for (FileHashTable::ConstIterator itr = m_readFileHashTable.Begin(); !itr.AtEnd(); itr.Forward())
+  {
+    const FileEntry* pFileEntry = itr->Value;
+    uint32 filenameLength = Min(pFileEntry->FileName.GetLength(), (uint32)0xFFFF);
+    usedBytes += (uint64)(ZIP_LOCAL_FILE_HEADER_SIZE + ZIP_CENTRAL_DIRECTORY_FILE_HEADER_SIZE + filenameLength * 2);
+    usedBytes += pFileEntry->CompressedFileSize;
+  }
+
+  uint64 streamSize = (m_appendMode) ? m_appendCommittedSize : m_pReadStream->GetSize();
+  return (streamSize > usedBytes) ? (streamSize - usedBytes) : 0;
+}
+
+bool ZipArchive::Compact(ByteStream* pNewStream)
+{
+  if (m_pReadStream == NULL || IsIndexed())
+    return false;
+
+  bool hasChanges = (m_writeFileHashTable.GetMemberCount() > 0 ||
+                     (m_nOpenStreamedReads + m_nOpenStreamedWrites + m_nOpenBufferedWrites) > 0);
+  for (FileHashTable::ConstIterator itr = m_readFileHashTable.Begin(); !itr.AtEnd() && !hasChanges; itr.Forward())
+    hasChanges = itr->Value->IsDeleted;
+  if (hasChanges)
+  {
+    Log_ErrorPrintf("ZipArchive::Compact: Archive has uncommitted changes or open streams");
+    return false;
+  }
+
+  // a regular commit into an empty stream copies every live entry and nothing else
+  bool appendMode = m_appendMode;
+  ByteStream* pOldWriteStream = m_pWriteStream;
+  m_pWriteStream = pNewStream;
+  m_pWriteStream->AddRef();
+  m_appendMode = false;
+  if (!CommitChanges())
+  {
+    // the read side is only replaced once the commit succeeds, so carry on with it
+    for (FileHashTable::Iterator itr = m_writeFileHashTable.Begin(); !itr.AtEnd(); itr.Forward())
+      delete itr->Value;
+    m_writeFileHashTable.Clear();
+    m_pWriteStream->Release();
+    m_pWriteStream = pOldWriteStream;
+    m_appendMode = appendMode;
+    return false;
+  }
+
+  if (appendMode)
+  {
+    pOldWriteStream->Release();
+    m_pWriteStream = m_pReadStream;
+    m_pWriteStream->AddRef();
+    m_appendMode = true;
+    m_appendCommittedSize = m_pReadStream->GetSize();
+  }
+  else
+  {
+    m_pWriteStream = pOldWriteStream;
+  }
+
+  return true;
+}
+
 ZipArchive* ZipArchive::CreateArchive(ByteStream* pWriteStream)
 {
   ZipArchive* pZipArchive = new ZipArchive(NULL, pWriteStream);
@@ -2034,6 +3937,34 @@ ZipArchive* ZipArchive::OpenArchiveReadOnly(ByteStream* pReadStream)
   return pZipArchive;
 }
 
+ZipArchive* ZipArchive::OpenArchiveIndexed(ByteStream* pReadStream)
+{
+  ZipArchive* pZipArchive = new ZipArchive(pReadStream, NULL);
+  if (!pZipArchive->ParseIndex())
+  {
+    delete pZipArchive;
+    return NULL;
+  }
+
+  return pZipArchive;
+}
+
+ZipArchive* ZipArchive::OpenArchiveForAppend(ByteStream* pStream)
+{
+  ZipArchive* pZipArchive = new ZipArchive(pStream, NULL);
+  if (pStream->GetSize() > 0 && !pZipArchive->ParseZip())
+  {
+    delete pZipArchive;
+    return NULL;
+  }
+
+  pZipArchive->m_pWriteStream = pStream;
+  pZipArchive->m_pWriteStream->AddRef();
+  pZipArchive->m_appendMode = true;
+  pZipArchive->m_appendCommittedSize = pStream->GetSize();
+  return pZipArchive;
+}
+
 ZipArchive* ZipArchive::OpenArchiveReadWrite(ByteStream* pReadStream, ByteStream* pWriteStream)
 {
   DebugAssert(pReadStream != pWriteStream);
@@ -2066,7 +3997,10 @@ bool ZipArchive::FindFiles(const char* path, const char* pattern, uint32 flags,
     pResults->Clear();
 
   uint32 count = FindFilesInTable(m_writeFileHashTable, path, pattern, flags, pResults);
-  count += FindFilesInTable(m_readFileHashTable, path, pattern, flags, pResults);
+  if (IsIndexed())
+    count += FindFilesInIndex(path, pattern, flags, pResults);
+  else
+    count += FindFilesInTable(m_readFileHashTable, path, pattern, flags, pResults);
 
   return (count > 0);
 }
@@ -2074,15 +4008,6 @@ bool ZipArchive::FindFiles(const char* path, const char* pattern, uint32 flags,
 uint32 ZipArchive::FindFilesInTable(const FileHashTable& fileTable, const char* path, const char* pattern, uint32 flags,
                                     FileSystem::FindResultsArray* pResults) const
 {
-  // small speed optimization for '*' case
-  bool hasWildCards = false;
-  bool wildCardMatchAll = false;
-  if (Y_strpbrk(pattern, "*?") != NULL)
-  {
-    hasWildCards = true;
-    wildCardMatchAll = !(Y_strcmp(pattern, "*"));
-  }
-
   // ignore leading /
   if (path[0] == '/')
     path++;
@@ -2095,64 +4020,153 @@ uint32 ZipArchive::FindFilesInTable(const FileHashTable& fileTable, const char*
   for (FileHashTable::ConstIterator itr = fileTable.Begin(); !itr.AtEnd(); itr.Forward())
   {
     const FileEntry* pFileEntry = itr->Value;
-    if (pFileEntry->IsDeleted)
+    if (!pFileEntry->IsDeleted && AddFindResult(pFileEntry, path, pathLength, pattern, flags, pResults))
+      count++;
+  }
+
+  return count;
+}
+
+uint32 ZipArchive::FindFilesInIndex(const char* path, const char* pattern, uint32 flags,
+                                    FileSystem::FindResultsArray* pResults) const
+{
+  if (path[0] == '/')
+    path++;
+
+  uint32 pathLength = Y_strlen(path);
+  uint32 count = 0;
+
+  FileEntry indexedEntry;
+  for (uint32 i = 0; i < m_index.GetSize(); i++)
+  {
+    // only decode entries under the path
+    const byte* pRecord = m_pCentralDirectory + m_index[i].RecordOffset;
+    const char* filename = (const char*)pRecord + ZIP_CENTRAL_DIRECTORY_FILE_HEADER_SIZE;
+    uint32 filenameLength = ReadZipUInt16(pRecord + 28);
+    if (filenameLength <= pathLength || filename[pathLength] != '/' || Y_strnicmp(filename, path, pathLength) != 0)
       continue;
 
-    if (Y_strnicmp(pFileEntry->FileName, path, pathLength) == 0 && pFileEntry->FileName[pathLength] == '/')
-    {
-      // path matches
-      const char* afterPathPart = pFileEntry->FileName.GetCharArray() + pathLength + 1;
+    DecodeIndexedEntry(m_index[i].RecordOffset, &indexedEntry);
+    if (AddFindResult(&indexedEntry, path, pathLength, pattern, flags, pResults))
+      count++;
+  }
 
-      // check if it contains another directory
-      if (!(flags & FILESYSTEM_FIND_RECURSIVE) && Y_strchr(afterPathPart, '/') != NULL)
-        continue;
+  return count;
+}
 
-      // match the filename part
-      const char* fileNamePart = Y_strrchr(afterPathPart, '/');
-      if (fileNamePart == NULL)
-        fileNamePart = afterPathPart;
-      else
-        fileNamePart++;
+bool ZipArchive::AddFindResult(const FileEntry* pFileEntry, const char* path, uint32 pathLength, const char* pattern,
+                               uint32 flags, FileSystem::FindResultsArray* pResults) const
+{
+  if (Y_strnicmp(pFileEntry->FileName, path, pathLength) != 0 || pFileEntry->FileName[pathLength] != '/')
+    return false;
 
-      if (hasWildCards)
-      {
-        if (!wildCardMatchAll && !Y_strwildcmp(fileNamePart, pattern))
-          continue;
-      }
-      else
-      {
-        if (Y_stricmp(fileNamePart, pattern) != 0)
-          continue;
-      }
+  // path matches
+  const char* afterPathPart = pFileEntry->FileName.GetCharArray() + pathLength + 1;
 
-      // create data
-      FILESYSTEM_FIND_DATA outData;
-      if (flags & FILESYSTEM_FIND_RELATIVE_PATHS)
-        Y_strncpy(outData.FileName, countof(outData.FileName), afterPathPart);
-      else
-        Y_strncpy(outData.FileName, countof(outData.FileName), pFileEntry->FileName);
+  // check if it contains another directory
+  if (!(flags & FILESYSTEM_FIND_RECURSIVE) && Y_strchr(afterPathPart, '/') != NULL)
+    return false;
 
-      // remaining fields
-      outData.ModificationTime = pFileEntry->ModifiedTime;
-      outData.Attributes = 0;
-      outData.Size = pFileEntry->DecompressedFileSize;
+  // match the filename part
+  const char* fileNamePart = Y_strrchr(afterPathPart, '/');
+  if (fileNamePart == NULL)
+    fileNamePart = afterPathPart;
+  else
+    fileNamePart++;
 
-      // check it does not exist
-      uint32 i;
-      for (i = 0; i < pResults->GetSize(); i++)
-      {
-        if (Y_stricmp(outData.FileName, pResults->GetElement(i).FileName) == 0)
-          break;
-      }
-      if (i == pResults->GetSize())
-      {
-        pResults->Add(outData);
-        count++;
-      }
+  if (Y_strpbrk(pattern, "*?") != NULL)
+  {
+    // small speed optimization for '*' case
+    if (Y_strcmp(pattern, "*") != 0 && !Y_strwildcmp(fileNamePart, pattern))
+      return false;
+  }
+  else
+  {
+    if (Y_stricmp(fileNamePart, pattern) != 0)
+      return false;
+  }
+
+  // create data
+  FILESYSTEM_FIND_DATA outData;
+  if (flags & FILESYSTEM_FIND_RELATIVE_PATHS)
+    Y_strncpy(outData.FileName, countof(outData.FileName), afterPathPart);
+  else
+    Y_strncpy(outData.FileName, countof(outData.FileName), pFileEntry->FileName);
+
+  // remaining fields
+  outData.ModificationTime = pFileEntry->ModifiedTime;
+  outData.Attributes = 0;
+  outData.Size = pFileEntry->DecompressedFileSize;
+
+  // check it does not exist
+  for (uint32 i = 0; i < pResults->GetSize(); i++)
+  {
+    if (Y_stricmp(outData.FileName, pResults->GetElement(i).FileName) == 0)
+      return false;
+  }
+
+  pResults->Add(outData);
+  return true;
+}
+
+bool ZipArchiveDirectoryExtractSink::OpenEntry(const char* filename, const FILESYSTEM_STAT_DATA* pStatData,
+                                               ByteStream** ppStream)
+{
+  // keep everything inside the base path
+  if (filename[0] == '/' || filename[0] == '\\' || Y_strchr(filename, ':') != NULL)
+  {
+    Log_WarningPrintf("ZipArchiveDirectoryExtractSink::OpenEntry: Skipping '%s', absolute path", filename);
+    *ppStream = NULL;
+    return true;
+  }
+  for (const char* pComponent = filename; *pComponent != '\0';)
+  {
+    const char* pComponentEnd = Y_strpbrk(pComponent, "/\\");
+    uint32 componentLength = (pComponentEnd != NULL) ? (uint32)(pComponentEnd - pComponent) : Y_strlen(pComponent);
+    if (componentLength == 2 && pComponent[0] == '.' && pComponent[1] == '.')
+    {
+      Log_WarningPrintf("ZipArchiveDirectoryExtractSink::OpenEntry: Skipping '%s', parent directory reference",
+                        filename);
+      *ppStream = NULL;
+      return true;
     }
+
+    pComponent += componentLength;
+    if (*pComponent != '\0')
+      pComponent++;
   }
 
-  return count;
+  String path;
+  path.Format("%s/%s", m_basePath.GetCharArray(), filename);
+
+  // directory entries
+  if (path[path.GetLength() - 1] == '/')
+  {
+    *ppStream = NULL;
+    return FileSystem::CreateDirectory(path, true);
+  }
+
+  *ppStream = FileSystem::OpenFile(path, BYTESTREAM_OPEN_CREATE | BYTESTREAM_OPEN_CREATE_PATH | BYTESTREAM_OPEN_WRITE |
+                                           BYTESTREAM_OPEN_TRUNCATE | BYTESTREAM_OPEN_ATOMIC_UPDATE |
+                                           BYTESTREAM_OPEN_STREAMED);
+  if (*ppStream == NULL)
+  {
+    Log_ErrorPrintf("ZipArchiveDirectoryExtractSink::OpenEntry: Failed to open '%s'", path.GetCharArray());
+    return false;
+  }
+
+  return true;
+}
+
+bool ZipArchiveDirectoryExtractSink::CloseEntry(const char* filename, ByteStream* pStream, bool success)
+{
+  if (!success)
+  {
+    pStream->Discard();
+    return false;
+  }
+
+  return pStream->Commit();
 }
 
 #endif // HAVE_ZLIB
@@ -3,9 +3,18 @@
 #include "YBaseLib/Log.h"
 Log_SetChannel(Main);
 
+DECLARE_TEST_SUITE(AsyncFile);
 DECLARE_TEST_SUITE(Base64);
 DECLARE_TEST_SUITE(BitSet);
+DECLARE_TEST_SUITE(ByteStream);
+DECLARE_TEST_SUITE(CircularBuffer);
+DECLARE_TEST_SUITE(CompressionCodec);
 DECLARE_TEST_SUITE(CPUID);
+DECLARE_TEST_SUITE(CRC32);
+DECLARE_TEST_SUITE(Sockets);
+#ifdef HAVE_ZLIB
+DECLARE_TEST_SUITE(ZipArchive);
+#endif
 
 struct TestSuiteEntry
 {
@@ -14,9 +23,18 @@ struct TestSuiteEntry
 };
 
 static const TestSuiteEntry s_testSuites[] = {
+  {"AsyncFile", INVOKE_TEST_SUITE(AsyncFile)},
   {"Base64", INVOKE_TEST_SUITE(Base64)},
   {"BitSet", INVOKE_TEST_SUITE(BitSet)},
+  {"ByteStream", INVOKE_TEST_SUITE(ByteStream)},
+  {"CircularBuffer", INVOKE_TEST_SUITE(CircularBuffer)},
+  {"CompressionCodec", INVOKE_TEST_SUITE(CompressionCodec)},
   {"CPUID", INVOKE_TEST_SUITE(CPUID)},
+  {"CRC32", INVOKE_TEST_SUITE(CRC32)},
+  {"Sockets", INVOKE_TEST_SUITE(Sockets)},
+#ifdef HAVE_ZLIB
+  {"ZipArchive", INVOKE_TEST_SUITE(ZipArchive)},
+#endif
 };
 
 int main(int argc, char* argv[])
@@ -0,0 +1,133 @@
+#include "TestSuite.h"
+#include "YBaseLib/AsyncFile.h"
+#include "YBaseLib/FileSystem.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/Memory.h"
+#include "YBaseLib/PODArray.h"
+#include <cstring>
+Log_SetChannel(TestAsyncFile);
+
+static const char* TEST_FILE_NAME = "TestAsyncFile.bin";
+static const uint32 TEST_FILE_SIZE = 1024 * 1024 + 1234;
+static const uint32 TEST_BLOCK_SIZE = 64 * 1024;
+
+static byte TestPatternByte(uint64 offset)
+{
+  return (byte)((offset * 2654435761u) >> 13);
+}
+
+static bool TestAsyncFileBackend(ASYNC_FILE_BACKEND backend)
+{
+  AsyncFile* pFile = AsyncFile::Open(TEST_FILE_NAME,
+                                     BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_WRITE | BYTESTREAM_OPEN_CREATE |
+                                       BYTESTREAM_OPEN_TRUNCATE,
+                                     4, backend);
+  if (pFile == nullptr)
+  {
+    // io_uring may be blocked by seccomp or an old kernel, that's not a failure
+    Log_WarningPrintf("SKIP: backend %u unavailable", (uint32)backend);
+    return (backend == ASYNC_FILE_BACKEND_IO_URING);
+  }
+
+  Log_InfoPrintf("Testing backend %u", (uint32)pFile->GetBackend());
+
+  byte* pData = new byte[TEST_FILE_SIZE];
+  for (uint32 i = 0; i < TEST_FILE_SIZE; i++)
+    pData[i] = TestPatternByte(i);
+
+  // write with more requests than the queue depth, so submission has to wait for slots
+  bool result = true;
+  PODArray<AsyncFileRequest*> requests;
+  for (uint32 offset = 0; offset < TEST_FILE_SIZE; offset += TEST_BLOCK_SIZE)
+  {
+    uint32 length = Min(TEST_BLOCK_SIZE, TEST_FILE_SIZE - offset);
+    AsyncFileRequest* pRequest = pFile->WriteAsync(pData + offset, length, offset);
+    if (pRequest == nullptr)
+    {
+      // the requests already queued still point into pData, so fall through and wait for them
+      Log_ErrorPrintf("FAIL: WriteAsync at %u", offset);
+      result = false;
+      break;
+    }
+    requests.Add(pRequest);
+  }
+
+  for (uint32 i = 0; i < requests.GetSize(); i++)
+  {
+    if (!requests[i]->WaitForCompletion() || requests[i]->GetResult() != (int32)requests[i]->GetLength())
+    {
+      Log_ErrorPrintf("FAIL: write %u returned %d", i, requests[i]->GetResult());
+      result = false;
+    }
+    requests[i]->Release();
+  }
+  requests.Clear();
+
+  if (pFile->GetSize() != TEST_FILE_SIZE)
+  {
+    Log_ErrorPrintf("FAIL: file size %u after writes", (uint32)pFile->GetSize());
+    result = false;
+  }
+
+  // short read at end of file
+  byte tail[100];
+  if (pFile->Read(tail, sizeof(tail), TEST_FILE_SIZE - 10) != 10 || tail[9] != pData[TEST_FILE_SIZE - 1])
+  {
+    Log_ErrorPrintf("FAIL: short read at end of file");
+    result = false;
+  }
+
+  // sequential stream with a window smaller than the file, crossing chunk boundaries with odd-sized reads
+  ByteStream* pStream = AsyncFile_CreateSequentialReadStream(pFile, 16384, 4);
+  byte* pReadBack = new byte[TEST_FILE_SIZE];
+  uint32 position = 0;
+  while (position < TEST_FILE_SIZE)
+  {
+    uint32 readSize = pStream->Read(pReadBack + position, Min((uint32)7919, TEST_FILE_SIZE - position));
+    if (readSize == 0)
+      break;
+    position += readSize;
+  }
+  if (position != TEST_FILE_SIZE || std::memcmp(pReadBack, pData, TEST_FILE_SIZE) != 0)
+  {
+    Log_ErrorPrintf("FAIL: sequential stream read back %u bytes", position);
+    result = false;
+  }
+
+  // forward seek inside the window, backwards seek outside it
+  byte value;
+  const uint64 seekOffsets[] = {100, 5000, 40000, 3, TEST_FILE_SIZE - 1};
+  for (uint32 i = 0; i < countof(seekOffsets); i++)
+  {
+    if (!pStream->SeekAbsolute(seekOffsets[i]) || !pStream->ReadByte(&value) ||
+        value != TestPatternByte(seekOffsets[i]))
+    {
+      Log_ErrorPrintf("FAIL: seek to %u", (uint32)seekOffsets[i]);
+      result = false;
+    }
+  }
+  if (pStream->ReadByte(&value))
+  {
+    Log_ErrorPrintf("FAIL: read past end of stream");
+    result = false;
+  }
+
+  pStream->Release();
+  pFile->Release();
+  delete[] pReadBack;
+  delete[] pData;
+
+  if (result)
+    Log_InfoPrintf("PASS: backend %u", (uint32)backend);
+
+  return result;
+}
+
+DEFINE_TEST_SUITE(AsyncFile)
+{
+  bool result = true;
+  result &= TestAsyncFileBackend(ASYNC_FILE_BACKEND_THREAD_POOL);
+  result &= TestAsyncFileBackend(ASYNC_FILE_BACKEND_IO_URING);
+  FileSystem::DeleteFile(TEST_FILE_NAME);
+  return result;
+}
@@ -0,0 +1,451 @@
+#include "TestSuite.h"
+#include "YBaseLib/BinaryReader.h"
+#include "YBaseLib/BinaryWriter.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/FileSystem.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/PrefetchingByteStream.h"
+#include "YBaseLib/ThreadPool.h"
+#include "YBaseLib/Timer.h"
+#include <cstring>
+Log_SetChannel(TestByteStream);
+
+static const uint32 TEST_DATA_SIZE = 300000;
+static const uint32 COPY_TEST_DATA_SIZE = 64 * 1024 * 1024;
+static const char* COPY_TEST_SOURCE_FILE_NAME = "TestByteStreamCopySource.bin";
+static const char* COPY_TEST_DESTINATION_FILE_NAME = "TestByteStreamCopyDestination.bin";
+static const char* VECTORED_TEST_FILE_NAME = "TestByteStreamVectored.bin";
+static const char* COMMIT_TEST_FILE_NAME_PREFIX = "TestByteStreamCommit";
+static const uint32 COMMIT_TEST_THREAD_COUNT = 4;
+static const uint32 COMMIT_TEST_FILES_PER_THREAD = 32;
+
+static byte TestPatternByte(uint64 offset)
+{
+  return (byte)((offset * 2654435761u) >> 11);
+}
+
+static byte* CreateTestData(uint32 size)
+{
+  byte* pData = new byte[size];
+  for (uint32 i = 0; i < size; i++)
+    pData[i] = TestPatternByte(i);
+  return pData;
+}
+
+static bool TestPrefetchingStream()
+{
+  byte* pData = CreateTestData(TEST_DATA_SIZE);
+  ByteStream* pBaseStream = ByteStream_CreateReadOnlyMemoryStream(pData, TEST_DATA_SIZE);
+  PrefetchingByteStream* pStream = ByteStream_CreatePrefetchingStream(pBaseStream, 4096, 3);
+  pBaseStream->Release();
+
+  bool result = true;
+
+  // odd-sized reads straddling chunk boundaries
+  byte* pReadBack = new byte[TEST_DATA_SIZE];
+  uint32 position = 0;
+  for (;;)
+  {
+    uint32 readSize = pStream->Read(pReadBack + position, Min((uint32)1531, TEST_DATA_SIZE - position));
+    if (readSize == 0)
+      break;
+    position += readSize;
+  }
+  if (position != TEST_DATA_SIZE || std::memcmp(pReadBack, pData, TEST_DATA_SIZE) != 0)
+  {
+    Log_ErrorPrintf("FAIL: prefetching stream read back %u bytes", position);
+    result = false;
+  }
+
+  // short forward skips stay in the window, the rest restart it
+  byte value;
+  const uint64 seekOffsets[] = {0, 10, 5000, 5001, 12000, 100, TEST_DATA_SIZE - 1, 200000};
+  for (uint32 i = 0; i < countof(seekOffsets); i++)
+  {
+    if (!pStream->SeekAbsolute(seekOffsets[i]) || !pStream->ReadByte(&value) ||
+        value != TestPatternByte(seekOffsets[i]) || pStream->GetPosition() != seekOffsets[i] + 1)
+    {
+      Log_ErrorPrintf("FAIL: prefetching stream seek to %u", (uint32)seekOffsets[i]);
+      result = false;
+    }
+  }
+
+  if (!pStream->SeekToEnd() || pStream->ReadByte(&value) || pStream->GetSize() != TEST_DATA_SIZE)
+  {
+    Log_ErrorPrintf("FAIL: prefetching stream end of stream");
+    result = false;
+  }
+
+  pStream->Release();
+  delete[] pReadBack;
+  delete[] pData;
+
+  if (result)
+    Log_InfoPrintf("PASS: prefetching stream");
+
+  return result;
+}
+
+static bool VerifyCopiedStream(const char* name, ByteStream* pStream, const byte* pExpectedData, uint32 expectedSize,
+                               double elapsedMilliseconds)
+{
+  bool result = (pStream->GetSize() == expectedSize);
+  if (result)
+  {
+    const byte* pMemory = pStream->GetMemoryBasePointer();
+    if (pMemory != nullptr)
+    {
+      result = (std::memcmp(pMemory, pExpectedData, expectedSize) == 0);
+    }
+    else
+    {
+      byte* pReadBack = new byte[expectedSize];
+      result = (pStream->SeekAbsolute(0) && pStream->Read(pReadBack, expectedSize) == expectedSize &&
+                std::memcmp(pReadBack, pExpectedData, expectedSize) == 0);
+      delete[] pReadBack;
+    }
+  }
+
+  if (result)
+  {
+    Log_InfoPrintf("PASS: copy %s, %.1f MB/s", name,
+                   ((double)expectedSize / 1048576.0) / (Max(elapsedMilliseconds, 0.001) / 1000.0));
+  }
+  else
+  {
+    Log_ErrorPrintf("FAIL: copy %s", name);
+  }
+
+  return result;
+}
+
+static bool TestCopyStream()
+{
+  byte* pData = CreateTestData(COPY_TEST_DATA_SIZE);
+  bool result = true;
+  Timer timer;
+
+  // memory -> memory
+  {
+    ByteStream* pSource = ByteStream_CreateReadOnlyMemoryStream(pData, COPY_TEST_DATA_SIZE);
+    ByteStream* pDestination = ByteStream_CreateGrowableMemoryStream();
+    timer.Reset();
+    result &= ByteStream_CopyStream(pDestination, pSource);
+    result &= VerifyCopiedStream("memory -> memory", pDestination, pData, COPY_TEST_DATA_SIZE,
+                                 timer.GetTimeMilliseconds());
+    pDestination->Release();
+    pSource->Release();
+  }
+
+  // memory -> file
+  ByteStream* pSourceFile;
+  {
+    ByteStream* pSource = ByteStream_CreateReadOnlyMemoryStream(pData, COPY_TEST_DATA_SIZE);
+    result &= ByteStream_OpenFileStream(COPY_TEST_SOURCE_FILE_NAME,
+                                        BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_WRITE | BYTESTREAM_OPEN_CREATE |
+                                          BYTESTREAM_OPEN_TRUNCATE,
+                                        &pSourceFile);
+    if (!result)
+    {
+      Log_ErrorPrintf("FAIL: could not create %s", COPY_TEST_SOURCE_FILE_NAME);
+      pSource->Release();
+      delete[] pData;
+      return false;
+    }
+
+    timer.Reset();
+    result &= ByteStream_CopyStream(pSourceFile, pSource);
+    pSourceFile->Flush();
+    result &= VerifyCopiedStream("memory -> file", pSourceFile, pData, COPY_TEST_DATA_SIZE,
+                                 timer.GetTimeMilliseconds());
+    pSource->Release();
+  }
+
+  // file -> file
+  {
+    ByteStream* pDestination;
+    if (ByteStream_OpenFileStream(COPY_TEST_DESTINATION_FILE_NAME,
+                                  BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_WRITE | BYTESTREAM_OPEN_CREATE |
+                                    BYTESTREAM_OPEN_TRUNCATE,
+                                  &pDestination))
+    {
+      timer.Reset();
+      result &= ByteStream_CopyStream(pDestination, pSourceFile);
+      result &= VerifyCopiedStream("file -> file", pDestination, pData, COPY_TEST_DATA_SIZE,
+                                   timer.GetTimeMilliseconds());
+      pDestination->Release();
+    }
+    else
+    {
+      Log_ErrorPrintf("FAIL: could not create %s", COPY_TEST_DESTINATION_FILE_NAME);
+      result = false;
+    }
+  }
+
+  // file -> memory
+  {
+    ByteStream* pDestination = ByteStream_CreateGrowableMemoryStream();
+    timer.Reset();
+    result &= ByteStream_CopyStream(pDestination, pSourceFile);
+    result &= VerifyCopiedStream("file -> memory", pDestination, pData, COPY_TEST_DATA_SIZE,
+                                 timer.GetTimeMilliseconds());
+    pDestination->Release();
+  }
+
+  // partial copy from the middle of a stream
+  {
+    ByteStream* pDestination = ByteStream_CreateGrowableMemoryStream();
+    pSourceFile->SeekAbsolute(1000);
+    if (ByteStream_CopyBytes(pSourceFile, 5000, pDestination) != 5000 || pSourceFile->GetPosition() != 6000 ||
+        std::memcmp(pDestination->GetMemoryBasePointer(), pData + 1000, 5000) != 0)
+    {
+      Log_ErrorPrintf("FAIL: CopyBytes from offset");
+      result = false;
+    }
+    pDestination->Release();
+  }
+
+  pSourceFile->Release();
+  FileSystem::DeleteFile(COPY_TEST_SOURCE_FILE_NAME);
+  FileSystem::DeleteFile(COPY_TEST_DESTINATION_FILE_NAME);
+  delete[] pData;
+  return result;
+}
+
+static bool TestVectoredStream(const char* name, ByteStream* pStream, const byte* pData, uint32 bufferSize)
+{
+  // three uneven buffers, written and read back in one call each
+  const uint32 bufferLengths[3] = {bufferSize, 1, bufferSize * 2 + 7};
+  const uint32 totalLength = bufferLengths[0] + bufferLengths[1] + bufferLengths[2];
+  const void* writeBuffers[3] = {pData, pData + bufferLengths[0], pData + bufferLengths[0] + bufferLengths[1]};
+
+  byte* pReadBack = new byte[totalLength];
+  void* readBuffers[3] = {pReadBack, pReadBack + bufferLengths[0], pReadBack + bufferLengths[0] + bufferLengths[1]};
+
+  bool result = (pStream->SeekAbsolute(0) && pStream->WriteV(writeBuffers, bufferLengths, 3) == totalLength &&
+                 pStream->GetPosition() == totalLength && pStream->WriteByte(0x5A) && pStream->SeekAbsolute(0) &&
+                 pStream->ReadV(readBuffers, bufferLengths, 3) == totalLength &&
+                 std::memcmp(pReadBack, pData, totalLength) == 0 && pStream->GetPosition() == totalLength);
+
+  byte value;
+  result &= (pStream->ReadByte(&value) && value == 0x5A);
+
+  // short read at end of stream
+  result &= (pStream->SeekAbsolute(totalLength - 10) && pStream->ReadV(readBuffers, bufferLengths, 3) == 11);
+
+  delete[] pReadBack;
+
+  if (result)
+    Log_InfoPrintf("PASS: vectored %s, %u byte buffers", name, bufferSize);
+  else
+    Log_ErrorPrintf("FAIL: vectored %s, %u byte buffers", name, bufferSize);
+
+  return result;
+}
+
+static bool TestVectoredIO()
+{
+  byte* pData = CreateTestData(TEST_DATA_SIZE);
+  bool result = true;
+
+  // small buffers go through the default loop, large ones through the vectored path where there is one
+  const uint32 bufferSizes[] = {100, 65536};
+  for (uint32 i = 0; i < countof(bufferSizes); i++)
+  {
+    ByteStream* pMemoryStream = ByteStream_CreateGrowableMemoryStream();
+    result &= TestVectoredStream("memory", pMemoryStream, pData, bufferSizes[i]);
+    pMemoryStream->Release();
+
+    ByteStream* pFileStream;
+    if (ByteStream_OpenFileStream(VECTORED_TEST_FILE_NAME,
+                                  BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_WRITE | BYTESTREAM_OPEN_CREATE |
+                                    BYTESTREAM_OPEN_TRUNCATE,
+                                  &pFileStream))
+    {
+      result &= TestVectoredStream("file", pFileStream, pData, bufferSizes[i]);
+      pFileStream->Release();
+    }
+    else
+    {
+      Log_ErrorPrintf("FAIL: could not create %s", VECTORED_TEST_FILE_NAME);
+      result = false;
+    }
+  }
+
+  // size-prefixed strings go out as prefix + contents in one write
+  {
+    ByteStream* pStream = ByteStream_CreateGrowableMemoryStream();
+    BinaryWriter writer(pStream, ENDIAN_TYPE_BIG);
+    writer.WriteSizePrefixedString("hello");
+    writer.WriteSizePrefixedString("");
+    writer.SafeWriteSizePrefixedString("world", 3);
+
+    const void* buffers[2] = {"abc", "defg"};
+    const uint32 bufferLengths[2] = {3, 4};
+    writer.WriteVector(buffers, bufferLengths, 2);
+
+    pStream->SeekAbsolute(0);
+    BinaryReader reader(pStream, ENDIAN_TYPE_BIG);
+    char tail[8] = {};
+    String first, second, third;
+    if (writer.InErrorState() || !reader.SafeReadSizePrefixedString(&first) ||
+        !reader.SafeReadSizePrefixedString(&second) || !reader.SafeReadSizePrefixedString(&third) ||
+        !reader.SafeReadBytes(tail, 7) || first != "hello" || !second.IsEmpty() || third != "wor" ||
+        std::strcmp(tail, "abcdefg") != 0 || pStream->GetSize() != (4 + 5) + 4 + (4 + 3) + 7)
+    {
+      Log_ErrorPrintf("FAIL: BinaryWriter vectored writes");
+      result = false;
+    }
+
+    pStream->Release();
+  }
+
+  FileSystem::DeleteFile(VECTORED_TEST_FILE_NAME);
+  delete[] pData;
+  return result;
+}
+
+static bool WriteAtomicFile(const char* fileName, uint32 openMode, const byte* pData, uint32 dataSize)
+{
+  ByteStream* pStream;
+  if (!ByteStream_OpenFileStream(fileName,
+                                 BYTESTREAM_OPEN_WRITE | BYTESTREAM_OPEN_CREATE | BYTESTREAM_OPEN_TRUNCATE |
+                                   BYTESTREAM_OPEN_ATOMIC_UPDATE | openMode,
+                                 &pStream))
+  {
+    return false;
+  }
+
+  bool result = (pStream->Write(pData, dataSize) == dataSize && pStream->Commit());
+  pStream->Release();
+  return result;
+}
+
+class CommitTestWorkItem : public ThreadPoolWorkItemSignaled
+{
+public:
+  CommitTestWorkItem(uint32 threadIndex, const byte* pData) : m_threadIndex(threadIndex), m_pData(pData) {}
+
+protected:
+  virtual int32 ProcessWork() override
+  {
+    int32 failures = 0;
+    for (uint32 i = 0; i < COMMIT_TEST_FILES_PER_THREAD; i++)
+    {
+      SmallString fileName;
+      fileName.Format("%s_%u_%u.bin", COMMIT_TEST_FILE_NAME_PREFIX, m_threadIndex, i);
+      if (!WriteAtomicFile(fileName, BYTESTREAM_OPEN_GROUP_COMMIT, m_pData, 100 + i))
+        failures++;
+    }
+
+    return failures;
+  }
+
+private:
+  uint32 m_threadIndex;
+  const byte* m_pData;
+};
+
+static bool TestAtomicUpdateDurability()
+{
+  byte* pData = CreateTestData(TEST_DATA_SIZE);
+  bool result = true;
+
+  // each policy on its own
+  const uint32 openModes[] = {0, BYTESTREAM_OPEN_DURABLE, BYTESTREAM_OPEN_GROUP_COMMIT};
+  for (uint32 i = 0; i < countof(openModes); i++)
+  {
+    SmallString fileName;
+    fileName.Format("%s.bin", COMMIT_TEST_FILE_NAME_PREFIX);
+
+    BYTESTREAM_COMMIT_STATISTICS statistics;
+    ByteStream_ResetCommitStatistics();
+    bool committed = WriteAtomicFile(fileName, openModes[i], pData, 1000 + i);
+    ByteStream_GetCommitStatistics(&statistics);
+
+    ByteStream* pStream;
+    byte readBack[1002];
+    bool durable = (openModes[i] != 0);
+    if (!committed || statistics.CommitCount != 1 || statistics.FailedCommitCount != 0 ||
+        statistics.FileSyncCount != (durable ? 1 : 0) ||
+        !ByteStream_OpenFileStream(fileName, BYTESTREAM_OPEN_READ, &pStream))
+    {
+      Log_ErrorPrintf("FAIL: atomic update with open mode %u", openModes[i]);
+      result = false;
+      FileSystem::DeleteFile(fileName);
+      continue;
+    }
+
+    if (pStream->GetSize() != 1000 + i || pStream->Read(readBack, 1000 + i) != 1000 + i ||
+        std::memcmp(readBack, pData, 1000 + i) != 0)
+    {
+      Log_ErrorPrintf("FAIL: atomic update with open mode %u read back", openModes[i]);
+      result = false;
+    }
+
+    pStream->Release();
+    FileSystem::DeleteFile(fileName);
+  }
+
+  // concurrent group commits should share directory syncs
+  {
+    ByteStream_ResetCommitStatistics();
+
+    ThreadPool threadPool(COMMIT_TEST_THREAD_COUNT);
+    CommitTestWorkItem* pWorkItems[COMMIT_TEST_THREAD_COUNT];
+    for (uint32 i = 0; i < COMMIT_TEST_THREAD_COUNT; i++)
+    {
+      pWorkItems[i] = new CommitTestWorkItem(i, pData);
+      threadPool.EnqueueWorkItem(pWorkItems[i]);
+    }
+
+    uint32 failures = 0;
+    for (uint32 i = 0; i < COMMIT_TEST_THREAD_COUNT; i++)
+    {
+      pWorkItems[i]->WaitForCompletion();
+      failures += (uint32)pWorkItems[i]->GetReturnValue();
+      pWorkItems[i]->Release();
+    }
+
+    BYTESTREAM_COMMIT_STATISTICS statistics;
+    ByteStream_GetCommitStatistics(&statistics);
+
+    const uint32 commitCount = COMMIT_TEST_THREAD_COUNT * COMMIT_TEST_FILES_PER_THREAD;
+    if (failures > 0 || statistics.CommitCount != commitCount || statistics.DirectorySyncCount > commitCount)
+    {
+      Log_ErrorPrintf("FAIL: group commit, %u failures, %u commits, %u directory syncs", failures,
+                      (uint32)statistics.CommitCount, (uint32)statistics.DirectorySyncCount);
+      result = false;
+    }
+    else
+    {
+      Log_InfoPrintf("PASS: group commit, %u commits, %u directory syncs, mean latency %u us, max %u us",
+                     (uint32)statistics.CommitCount, (uint32)statistics.DirectorySyncCount,
+                     (uint32)(statistics.TotalLatencyMicroseconds / statistics.CommitCount),
+                     (uint32)statistics.MaxLatencyMicroseconds);
+    }
+  }
+
+  for (uint32 i = 0; i < COMMIT_TEST_THREAD_COUNT; i++)
+  {
+    for (uint32 j = 0; j < COMMIT_TEST_FILES_PER_THREAD; j++)
+    {
+      SmallString fileName;
+      fileName.Format("%s_%u_%u.bin", COMMIT_TEST_FILE_NAME_PREFIX, i, j);
+      FileSystem::DeleteFile(fileName);
+    }
+  }
+
+  delete[] pData;
+  return result;
+}
+
+DEFINE_TEST_SUITE(ByteStream)
+{
+  bool result = true;
+  result &= TestPrefetchingStream();
+  result &= TestCopyStream();
+  result &= TestVectoredIO();
+  result &= TestAtomicUpdateDurability();
+  return result;
+}
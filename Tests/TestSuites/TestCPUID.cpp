@@ -31,6 +31,9 @@ DEFINE_TEST_SUITE(CPUID)
   Log_DevPrintf("| SSE5A                         | %9s |", cpuid.SupportsSSE5A ? "Yes" : "No");
   Log_DevPrintf("| AVX                           | %9s |", cpuid.SupportsAVX ? "Yes" : "No");
   Log_DevPrintf("| AES                           | %9s |", cpuid.SupportsAES ? "Yes" : "No");
+  Log_DevPrintf("| PCLMULQDQ                     | %9s |", cpuid.SupportsPCLMULQDQ ? "Yes" : "No");
+  Log_DevPrintf("| ARMv8 CRC32                   | %9s |", cpuid.SupportsARMCRC32 ? "Yes" : "No");
+  Log_DevPrintf("| ARMv8 PMULL                   | %9s |", cpuid.SupportsARMPMULL ? "Yes" : "No");
   Log_DevPrintf("| HTT (Hyper-threading)         | %9s |", cpuid.SupportsHTT ? "Yes" : "No");
   Log_DevPrintf("=============================================");
   Log_DevPrintf("");
@@ -0,0 +1,159 @@
+#include "TestSuite.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/CRC32.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/Timer.h"
+Log_SetChannel(TestCRC32);
+
+static const uint32 TEST_DATA_SIZE = 1024 * 1024;
+static const uint32 BENCHMARK_DATA_SIZE = 64 * 1024 * 1024;
+
+static byte* CreateTestData(uint32 size)
+{
+  byte* pData = new byte[size];
+  uint32 state = 12345;
+  for (uint32 i = 0; i < size; i++)
+  {
+    state = state * 1103515245u + 12345u;
+    pData[i] = (byte)(state >> 16);
+  }
+
+  return pData;
+}
+
+// one bit at a time, straight from the definition
+static uint32 ReferenceCRC(uint32 crc, const byte* pData, size_t length)
+{
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= pData[i];
+    for (uint32 j = 0; j < 8; j++)
+      crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+  }
+
+  return ~crc;
+}
+
+// every implementation against the reference, over lengths around the block sizes and every alignment
+static bool TestImplementations(const byte* pData)
+{
+  static const uint32 lengths[] = {0, 1, 7, 8, 15, 16, 17, 63, 64, 65, 127, 128, 129, 255, 1000, 4096, 65537};
+
+  bool result = true;
+  for (uint32 implementationIndex = 0; implementationIndex < CRC32_IMPLEMENTATION_COUNT; implementationIndex++)
+  {
+    CRC32_IMPLEMENTATION implementation = (CRC32_IMPLEMENTATION)implementationIndex;
+    if (!CRC32::IsImplementationAvailable(implementation))
+    {
+      Log_InfoPrintf("SKIP: %s, not supported", CRC32::GetImplementationName(implementation));
+      continue;
+    }
+
+    bool ok = (CRC32::ComputeBufferWithImplementation(implementation, 0, "123456789", 9) == 0xCBF43926);
+    for (uint32 i = 0; i < countof(lengths) && ok; i++)
+    {
+      for (uint32 alignment = 0; alignment < 16 && ok; alignment++)
+      {
+        uint32 start = 0x1234567 * (alignment + 1);
+        uint32 expected = ReferenceCRC(start, pData + alignment, lengths[i]);
+        ok = (CRC32::ComputeBufferWithImplementation(implementation, start, pData + alignment, lengths[i]) ==
+              expected);
+      }
+    }
+
+    // whole buffer, in uneven pieces
+    uint32 expected = ReferenceCRC(0, pData, TEST_DATA_SIZE);
+    uint32 crc = 0;
+    for (uint32 offset = 0, piece = 1; offset < TEST_DATA_SIZE; offset += piece, piece = piece * 3 + 1)
+    {
+      uint32 pieceLength = Min(piece, TEST_DATA_SIZE - offset);
+      crc = CRC32::ComputeBufferWithImplementation(implementation, crc, pData + offset, pieceLength);
+    }
+    ok = ok && crc == expected;
+
+    if (ok)
+      Log_InfoPrintf("PASS: %s", CRC32::GetImplementationName(implementation));
+    else
+      Log_ErrorPrintf("FAIL: %s", CRC32::GetImplementationName(implementation));
+
+    result &= ok;
+  }
+
+  return result;
+}
+
+static bool TestCombine(const byte* pData)
+{
+  uint32 expected = ReferenceCRC(0, pData, TEST_DATA_SIZE);
+  bool ok = true;
+
+  // two halves, split at assorted points including the ends
+  static const uint32 splits[] = {0, 1, 3, 64, 1000, TEST_DATA_SIZE / 2, TEST_DATA_SIZE - 1, TEST_DATA_SIZE};
+  for (uint32 i = 0; i < countof(splits); i++)
+  {
+    uint32 crcA = CRC32::ComputeBuffer(0, pData, splits[i]);
+    uint32 crcB = CRC32::ComputeBuffer(0, pData + splits[i], TEST_DATA_SIZE - splits[i]);
+    ok &= (CRC32::CombineCRC(crcA, crcB, TEST_DATA_SIZE - splits[i]) == expected);
+  }
+
+  // many chunks, as they would come back from parallel workers
+  CRC32 combined;
+  static const uint32 CHUNK_SIZE = 40000;
+  for (uint32 offset = 0; offset < TEST_DATA_SIZE; offset += CHUNK_SIZE)
+  {
+    uint32 chunkSize = Min(CHUNK_SIZE, TEST_DATA_SIZE - offset);
+    combined.Combine(CRC32::ComputeBuffer(0, pData + offset, chunkSize), chunkSize);
+  }
+  ok &= (combined.GetCRC() == expected);
+
+  // streams: memory-backed streams are hashed in place, others through a buffer
+  ByteStream* pStream = ByteStream_CreateReadOnlyMemoryStream(pData, TEST_DATA_SIZE);
+  CRC32 streamCRC;
+  ok &= (pStream->SeekAbsolute(100) && streamCRC.HashStreamPartial(pStream, 5000) &&
+         pStream->GetPosition() == 5100 && streamCRC.GetCRC() == ReferenceCRC(0, pData + 100, 5000));
+  ok &= (!streamCRC.HashStreamPartial(pStream, TEST_DATA_SIZE));
+  streamCRC.Reset();
+  ok &= (streamCRC.HashStream(pStream, true) && streamCRC.GetCRC() == expected);
+  pStream->Release();
+
+  if (ok)
+    Log_InfoPrintf("PASS: combine");
+  else
+    Log_ErrorPrintf("FAIL: combine");
+
+  return ok;
+}
+
+// not a pass/fail test, logs the throughput of each implementation
+static void BenchmarkImplementations()
+{
+  byte* pData = CreateTestData(BENCHMARK_DATA_SIZE);
+  Timer timer;
+  for (uint32 implementationIndex = 0; implementationIndex < CRC32_IMPLEMENTATION_COUNT; implementationIndex++)
+  {
+    CRC32_IMPLEMENTATION implementation = (CRC32_IMPLEMENTATION)implementationIndex;
+    if (!CRC32::IsImplementationAvailable(implementation))
+      continue;
+
+    timer.Reset();
+    uint32 crc = CRC32::ComputeBufferWithImplementation(implementation, 0, pData, BENCHMARK_DATA_SIZE);
+    double milliseconds = timer.GetTimeMilliseconds();
+    Log_InfoPrintf("BENCH: %-12s %8.1f MB/s (crc %08X)%s", CRC32::GetImplementationName(implementation),
+                   ((double)BENCHMARK_DATA_SIZE / 1048576.0) / (Max(milliseconds, 0.001) / 1000.0), crc,
+                   (implementation == CRC32::GetImplementation()) ? ", selected" : "");
+  }
+
+  delete[] pData;
+}
+
+DEFINE_TEST_SUITE(CRC32)
+{
+  byte* pData = CreateTestData(TEST_DATA_SIZE);
+  bool result = true;
+  result &= TestImplementations(pData);
+  result &= TestCombine(pData);
+  BenchmarkImplementations();
+  delete[] pData;
+  return result;
+}
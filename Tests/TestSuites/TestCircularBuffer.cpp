@@ -0,0 +1,180 @@
+#include "TestSuite.h"
+#include "YBaseLib/CircularBuffer.h"
+#include "YBaseLib/Log.h"
+Log_SetChannel(TestCircularBuffer);
+
+static const size_t BUFFER_SIZE = 16;
+
+// bytes are numbered in the order they're written, so anything read out of order or twice shows up
+static void FillSequence(byte* pData, size_t length, uint32* pNextValue)
+{
+  for (size_t i = 0; i < length; i++)
+    pData[i] = (byte)((*pNextValue)++);
+}
+
+static bool CheckSequence(const byte* pData, size_t length, uint32* pNextValue)
+{
+  for (size_t i = 0; i < length; i++)
+  {
+    if (pData[i] != (byte)((*pNextValue)++))
+      return false;
+  }
+
+  return true;
+}
+
+static bool WriteSequence(CircularBuffer& buffer, size_t length, uint32* pNextValue)
+{
+  byte data[BUFFER_SIZE];
+  FillSequence(data, length, pNextValue);
+  return buffer.Write(data, length);
+}
+
+static bool ReadSequence(CircularBuffer& buffer, size_t length, uint32* pNextValue)
+{
+  byte data[BUFFER_SIZE];
+  return buffer.Read(data, length) && CheckSequence(data, length, pNextValue);
+}
+
+// a write which doesn't fit after the data continues at the start of the buffer
+static bool TestWriteAcrossEnd()
+{
+  CircularBuffer buffer(BUFFER_SIZE);
+  uint32 written = 0;
+  uint32 read = 0;
+  if (!WriteSequence(buffer, 12, &written) || !ReadSequence(buffer, 8, &read))
+    return false;
+
+  // 4 bytes left at the end, 8 at the start
+  if (buffer.GetBufferSpace() != 12 || !WriteSequence(buffer, 10, &written))
+    return false;
+  if (buffer.GetBufferUsed() != 14 || buffer.GetBufferSpace() != 2 || buffer.GetContiguousUsedBytes() != 8)
+    return false;
+
+  const void* pReadRegions[2];
+  size_t readRegionSizes[2];
+  if (buffer.GetReadRegions(pReadRegions, readRegionSizes) != 2 || readRegionSizes[0] != 8 ||
+      readRegionSizes[1] != 6)
+  {
+    return false;
+  }
+
+  uint32 check = read;
+  if (!CheckSequence((const byte*)pReadRegions[0], readRegionSizes[0], &check) ||
+      !CheckSequence((const byte*)pReadRegions[1], readRegionSizes[1], &check))
+  {
+    return false;
+  }
+
+  // and reads back in order across the wrap
+  return ReadSequence(buffer, 14, &read) && buffer.GetBufferUsed() == 0;
+}
+
+// moving the write pointer over both free regions, then the read pointer over both used ones
+static bool TestMovePointersAcrossRegions()
+{
+  CircularBuffer buffer(BUFFER_SIZE);
+  uint32 written = 0;
+  uint32 read = 0;
+  if (!WriteSequence(buffer, 10, &written) || !ReadSequence(buffer, 6, &read))
+    return false;
+
+  // free space is 6 bytes after the data and 6 before it
+  void* pWriteRegions[2];
+  size_t writeRegionSizes[2];
+  if (buffer.GetWriteRegions(pWriteRegions, writeRegionSizes) != 2 || writeRegionSizes[0] != 6 ||
+      writeRegionSizes[1] != 6)
+  {
+    return false;
+  }
+
+  // use all of the first region and part of the second
+  FillSequence((byte*)pWriteRegions[0], writeRegionSizes[0], &written);
+  FillSequence((byte*)pWriteRegions[1], 4, &written);
+  buffer.MoveWritePointer(writeRegionSizes[0] + 4);
+  if (buffer.GetBufferUsed() != 14 || buffer.GetBufferSpace() != 2)
+    return false;
+
+  // only the gap between the wrapped data and the start of the data is left
+  if (buffer.GetWriteRegions(pWriteRegions, writeRegionSizes) != 1 || writeRegionSizes[0] != 2)
+    return false;
+
+  // consume all of the first region and part of the second
+  const void* pReadRegions[2];
+  size_t readRegionSizes[2];
+  if (buffer.GetReadRegions(pReadRegions, readRegionSizes) != 2 || readRegionSizes[0] != 10 ||
+      readRegionSizes[1] != 4 || !CheckSequence((const byte*)pReadRegions[0], readRegionSizes[0], &read))
+  {
+    return false;
+  }
+
+  if (!CheckSequence((const byte*)pReadRegions[1], 1, &read))
+    return false;
+
+  buffer.MoveReadPointer(readRegionSizes[0] + 1);
+  if (buffer.GetBufferUsed() != 3 || buffer.GetReadRegions(pReadRegions, readRegionSizes) != 1 ||
+      readRegionSizes[0] != 3)
+  {
+    return false;
+  }
+
+  // the rest is contiguous again, with the whole buffer around it free
+  return ReadSequence(buffer, 3, &read) && buffer.GetBufferSpace() == BUFFER_SIZE &&
+         WriteSequence(buffer, BUFFER_SIZE, &written) && ReadSequence(buffer, BUFFER_SIZE, &read);
+}
+
+// a write of exactly the free space has to succeed from every starting position, and leave the buffer full
+static bool TestWriteBufferSpace()
+{
+  for (size_t start = 0; start < BUFFER_SIZE; start++)
+  {
+    for (size_t used = 1; used < BUFFER_SIZE; used++)
+    {
+      // an emptied buffer starts over, so leave a byte behind to keep the data at start
+      CircularBuffer buffer(BUFFER_SIZE);
+      uint32 written = 0;
+      uint32 read = 0;
+      if (!WriteSequence(buffer, start + 1, &written) || !ReadSequence(buffer, start, &read) ||
+          !WriteSequence(buffer, used - 1, &written))
+      {
+        return false;
+      }
+
+      size_t space = buffer.GetBufferSpace();
+      if (!WriteSequence(buffer, space, &written) || buffer.GetBufferSpace() != 0 ||
+          buffer.GetBufferUsed() != used + space)
+      {
+        Log_ErrorPrintf("Write of %u free bytes failed, %u bytes at %u", (uint32)space, (uint32)used, (uint32)start);
+        return false;
+      }
+
+      byte extra = 0;
+      if (buffer.Write(&extra, 1) || !ReadSequence(buffer, used + space, &read))
+      {
+        Log_ErrorPrintf("Full buffer wrong, %u bytes at %u", (uint32)used, (uint32)start);
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+DEFINE_TEST_SUITE(CircularBuffer)
+{
+  bool result = true;
+
+  bool ok = TestWriteAcrossEnd();
+  Log_InfoPrintf("%s: write across end", ok ? "PASS" : "FAIL");
+  result = result && ok;
+
+  ok = TestMovePointersAcrossRegions();
+  Log_InfoPrintf("%s: move pointers across regions", ok ? "PASS" : "FAIL");
+  result = result && ok;
+
+  ok = TestWriteBufferSpace();
+  Log_InfoPrintf("%s: write of exactly the free space", ok ? "PASS" : "FAIL");
+  result = result && ok;
+
+  return result;
+}
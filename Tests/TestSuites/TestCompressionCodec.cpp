@@ -0,0 +1,428 @@
+#include "TestSuite.h"
+#include "YBaseLib/CompressedByteStream.h"
+#include "YBaseLib/CompressionCodec.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/Timer.h"
+#include <cstring>
+Log_SetChannel(TestCompressionCodec);
+
+static const uint32 BENCHMARK_DATA_SIZE = 8 * 1024 * 1024;
+static const uint32 STREAM_TEST_DATA_SIZE = 300000;
+static const uint32 STREAM_TEST_RESTART_INTERVAL = 16384;
+
+// something like an asset or log file: runs of repeated words with varying numbers, and some noise
+static byte* CreateTestData(uint32 size)
+{
+  static const char* words[] = {"texture", "mesh", "material", "shader", "=", "{", "}", "\n", "0.5", "position"};
+  byte* pData = new byte[size];
+  uint32 state = 12345;
+  for (uint32 i = 0; i < size;)
+  {
+    state = state * 1103515245u + 12345u;
+    uint32 choice = (state >> 16) % 16;
+    if (choice < countof(words))
+    {
+      const char* word = words[choice];
+      for (uint32 j = 0; word[j] != '\0' && i < size; j++)
+        pData[i++] = (byte)word[j];
+    }
+    else if (choice < 14)
+    {
+      pData[i++] = (byte)('0' + (state >> 8) % 10);
+    }
+    else
+    {
+      pData[i++] = (byte)(state >> 24);
+    }
+  }
+
+  return pData;
+}
+
+static bool RoundTripBuffer(COMPRESSION_CODEC codec, uint32 compressionLevel, const byte* pData, uint32 size)
+{
+  uint32 bufferSize = CompressionCodec::GetCompressedBufferUpperBounds(codec, size, compressionLevel);
+  byte* pCompressed = new byte[bufferSize];
+  byte* pDecompressed = new byte[size + 1];
+  uint32 compressedSize = 0;
+  uint32 decompressedSize = 0;
+
+  bool result = (CompressionCodec::WriteCompressedDataToBuffer(codec, pCompressed, bufferSize, &compressedSize, pData,
+                                                               size, compressionLevel) &&
+                 CompressionCodec::ReadCompressedDataFromBuffer(codec, pDecompressed, size + 1, &decompressedSize,
+                                                                pCompressed, compressedSize) &&
+                 decompressedSize == size && std::memcmp(pDecompressed, pData, size) == 0);
+
+  // a truncated stream never reaches its end
+  if (result && compressedSize > 1)
+  {
+    result = !CompressionCodec::ReadCompressedDataFromBuffer(codec, pDecompressed, size + 1, &decompressedSize,
+                                                             pCompressed, compressedSize - 1);
+  }
+
+  delete[] pDecompressed;
+  delete[] pCompressed;
+  return result;
+}
+
+// feeds and drains the streams a few bytes at a time, so state carried between calls gets exercised
+static bool RoundTripStream(COMPRESSION_CODEC codec, uint32 compressionLevel, const byte* pData, uint32 size)
+{
+  static const uint32 INPUT_CHUNK_SIZE = 1531;
+  static const uint32 OUTPUT_CHUNK_SIZE = 97;
+
+  uint32 bufferSize = CompressionCodec::GetCompressedBufferUpperBounds(codec, size, compressionLevel);
+  byte* pCompressed = new byte[bufferSize];
+  byte* pDecompressed = new byte[size + 1];
+
+  CompressionCodecStream* pCompressor = CompressionCodec::CreateCompressor(codec, compressionLevel);
+  const byte* pInput = pData;
+  byte* pOutput = pCompressed;
+  COMPRESSION_CODEC_RESULT status = COMPRESSION_CODEC_RESULT_OK;
+  while (status == COMPRESSION_CODEC_RESULT_OK)
+  {
+    uint32 inputSize = Min(INPUT_CHUNK_SIZE, size - (uint32)(pInput - pData));
+    uint32 outputSize = Min(OUTPUT_CHUNK_SIZE, bufferSize - (uint32)(pOutput - pCompressed));
+    bool finish = (pInput + inputSize) == (pData + size);
+    status = pCompressor->Process(&pInput, &inputSize, &pOutput, &outputSize, finish);
+  }
+  delete pCompressor;
+
+  bool result = (status == COMPRESSION_CODEC_RESULT_STREAM_END);
+  uint32 compressedSize = (uint32)(pOutput - pCompressed);
+
+  CompressionCodecStream* pDecompressor = CompressionCodec::CreateDecompressor(codec);
+  pInput = pCompressed;
+  pOutput = pDecompressed;
+  status = COMPRESSION_CODEC_RESULT_OK;
+  while (result && status == COMPRESSION_CODEC_RESULT_OK)
+  {
+    uint32 inputSize = Min(OUTPUT_CHUNK_SIZE, compressedSize - (uint32)(pInput - pCompressed));
+    uint32 outputSize = Min(INPUT_CHUNK_SIZE, size + 1 - (uint32)(pOutput - pDecompressed));
+    status = pDecompressor->Process(&pInput, &inputSize, &pOutput, &outputSize, false);
+  }
+  delete pDecompressor;
+
+  result &= (status == COMPRESSION_CODEC_RESULT_STREAM_END && (uint32)(pOutput - pDecompressed) == size &&
+             std::memcmp(pDecompressed, pData, size) == 0);
+
+  delete[] pDecompressed;
+  delete[] pCompressed;
+  return result;
+}
+
+static bool TestRoundTrip()
+{
+  static const uint32 sizes[] = {0, 1, 1000, 300000};
+
+  byte* pData = CreateTestData(sizes[countof(sizes) - 1]);
+  bool result = true;
+  for (uint32 codecIndex = 0; codecIndex < COMPRESSION_CODEC_COUNT; codecIndex++)
+  {
+    COMPRESSION_CODEC codec = (COMPRESSION_CODEC)codecIndex;
+    if (!CompressionCodec::IsAvailable(codec))
+    {
+      // unavailable codecs have to fail cleanly
+      result &= (CompressionCodec::CreateCompressor(codec, 1) == nullptr &&
+                 CompressionCodec::CreateDecompressor(codec) == nullptr);
+      Log_InfoPrintf("SKIP: %s round trip, not built in", CompressionCodec::GetName(codec));
+      continue;
+    }
+
+    const uint32 levels[] = {1, CompressionCodec::GetDefaultCompressionLevel(codec),
+                             CompressionCodec::GetMaxCompressionLevel(codec)};
+    bool codecResult = true;
+    for (uint32 i = 0; i < countof(levels); i++)
+    {
+      for (uint32 j = 0; j < countof(sizes); j++)
+      {
+        codecResult &= RoundTripBuffer(codec, levels[i], pData, sizes[j]);
+        codecResult &= RoundTripStream(codec, levels[i], pData, sizes[j]);
+      }
+    }
+
+    if (codecResult)
+      Log_InfoPrintf("PASS: %s round trip", CompressionCodec::GetName(codec));
+    else
+      Log_ErrorPrintf("FAIL: %s round trip", CompressionCodec::GetName(codec));
+
+    result &= codecResult;
+  }
+
+  delete[] pData;
+  return result;
+}
+
+// levels outside a codec's range compress the same as the nearest level in it
+static bool TestLevelClamping()
+{
+  static const uint32 DATA_SIZE = 100000;
+
+  byte* pData = CreateTestData(DATA_SIZE);
+  bool result = true;
+  for (uint32 codecIndex = 0; codecIndex < COMPRESSION_CODEC_COUNT; codecIndex++)
+  {
+    COMPRESSION_CODEC codec = (COMPRESSION_CODEC)codecIndex;
+    if (!CompressionCodec::IsAvailable(codec))
+      continue;
+
+    const uint32 levels[][2] = {{0, (codec == COMPRESSION_CODEC_LZ4) ? 0u : 1u},
+                                {100, CompressionCodec::GetMaxCompressionLevel(codec)}};
+    bool codecResult = true;
+    for (uint32 i = 0; i < countof(levels); i++)
+    {
+      byte* pOutputs[2];
+      uint32 outputSizes[2];
+      for (uint32 j = 0; j < 2; j++)
+      {
+        uint32 bufferSize = CompressionCodec::GetCompressedBufferUpperBounds(codec, DATA_SIZE, levels[i][j]);
+        pOutputs[j] = new byte[bufferSize];
+        codecResult &= CompressionCodec::WriteCompressedDataToBuffer(codec, pOutputs[j], bufferSize, &outputSizes[j],
+                                                                     pData, DATA_SIZE, levels[i][j]);
+      }
+
+      codecResult &= (outputSizes[0] == outputSizes[1] && std::memcmp(pOutputs[0], pOutputs[1], outputSizes[0]) == 0);
+      delete[] pOutputs[1];
+      delete[] pOutputs[0];
+    }
+
+    if (codecResult)
+      Log_InfoPrintf("PASS: %s level clamping", CompressionCodec::GetName(codec));
+    else
+      Log_ErrorPrintf("FAIL: %s level clamping", CompressionCodec::GetName(codec));
+
+    result &= codecResult;
+  }
+
+  delete[] pData;
+  return result;
+}
+
+// writes the data through a compressing stream in uneven pieces, returning the base stream
+static GrowableMemoryByteStream* CompressThroughStream(COMPRESSION_CODEC codec, uint32 restartInterval,
+                                                       const byte* pData, uint32 size)
+{
+  GrowableMemoryByteStream* pBaseStream = ByteStream_CreateGrowableMemoryStream();
+  CompressingByteStream* pStream = ByteStream_CreateCompressingStream(
+    pBaseStream, codec, CompressionCodec::GetDefaultCompressionLevel(codec), restartInterval);
+
+  bool result = true;
+  for (uint32 position = 0; position < size;)
+  {
+    uint32 writeSize = Min(size - position, 1 + (position * 7) % 20000);
+    result &= (pStream->Write(pData + position, writeSize) == writeSize);
+    position += writeSize;
+  }
+
+  result &= (pStream->GetSize() == size && pStream->Finish());
+  pStream->Release();
+  if (!result)
+  {
+    pBaseStream->Release();
+    return nullptr;
+  }
+
+  pBaseStream->SeekAbsolute(0);
+  return pBaseStream;
+}
+
+static bool VerifyStreamRead(ByteStream* pStream, uint64 offset, uint32 size, const byte* pData)
+{
+  byte buffer[4096];
+  DebugAssert(size <= sizeof(buffer));
+  return (pStream->SeekAbsolute(offset) && pStream->Read(buffer, size) == size &&
+          std::memcmp(buffer, pData + offset, size) == 0 && pStream->GetPosition() == offset + size);
+}
+
+static bool TestCompressedStreams()
+{
+  byte* pData = CreateTestData(STREAM_TEST_DATA_SIZE);
+  bool result = true;
+  for (uint32 codecIndex = 0; codecIndex < COMPRESSION_CODEC_COUNT; codecIndex++)
+  {
+    COMPRESSION_CODEC codec = (COMPRESSION_CODEC)codecIndex;
+    if (!CompressionCodec::IsAvailable(codec))
+    {
+      GrowableMemoryByteStream* pBaseStream = ByteStream_CreateGrowableMemoryStream();
+      result &= (ByteStream_CreateCompressingStream(pBaseStream, codec, 1) == nullptr &&
+                 ByteStream_CreateDecompressingStream(pBaseStream, codec) == nullptr);
+      pBaseStream->Release();
+      Log_InfoPrintf("SKIP: %s streams, not built in", CompressionCodec::GetName(codec));
+      continue;
+    }
+
+    // without a restart interval, the output is an ordinary compressed stream
+    bool codecResult = true;
+    GrowableMemoryByteStream* pBaseStream = CompressThroughStream(codec, 0, pData, STREAM_TEST_DATA_SIZE);
+    codecResult &= (pBaseStream != nullptr);
+    if (pBaseStream != nullptr)
+    {
+      byte* pDecompressed = new byte[STREAM_TEST_DATA_SIZE];
+      uint32 decompressedSize = 0;
+      codecResult &= (CompressionCodec::ReadCompressedDataFromBuffer(codec, pDecompressed, STREAM_TEST_DATA_SIZE,
+                                                                     &decompressedSize, pBaseStream->GetMemoryPointer(),
+                                                                     (uint32)pBaseStream->GetSize()) &&
+                      decompressedSize == STREAM_TEST_DATA_SIZE &&
+                      std::memcmp(pDecompressed, pData, STREAM_TEST_DATA_SIZE) == 0);
+
+      // read it back in odd sizes, then seek backwards, which starts over
+      DecompressingByteStream* pStream = ByteStream_CreateDecompressingStream(pBaseStream, codec);
+      uint32 position = 0;
+      while (codecResult && position < STREAM_TEST_DATA_SIZE)
+      {
+        uint32 readSize = Min(STREAM_TEST_DATA_SIZE - position, (uint32)777);
+        codecResult &= (pStream->Read(pDecompressed, readSize) == readSize &&
+                        std::memcmp(pDecompressed, pData + position, readSize) == 0);
+        position += readSize;
+      }
+      codecResult &= (pStream->Read(pDecompressed, 1) == 0 && pStream->GetSize() == STREAM_TEST_DATA_SIZE);
+      codecResult &= VerifyStreamRead(pStream, 1000, 4000, pData);
+      codecResult &= VerifyStreamRead(pStream, 200000, 4000, pData);
+      codecResult &= !pStream->InErrorState();
+      pStream->Release();
+
+      // a truncated stream is an error, not a short end
+      ByteStream* pTruncatedBase =
+        ByteStream_CreateReadOnlyMemoryStream(pBaseStream->GetMemoryPointer(), (uint32)pBaseStream->GetSize() / 2);
+      pStream = ByteStream_CreateDecompressingStream(pTruncatedBase, codec);
+      codecResult &= (pStream->Read(pDecompressed, STREAM_TEST_DATA_SIZE) < STREAM_TEST_DATA_SIZE &&
+                      pStream->InErrorState());
+      pStream->Release();
+      pTruncatedBase->Release();
+
+      delete[] pDecompressed;
+      pBaseStream->Release();
+    }
+
+    // with restart points, seeks anywhere only decompress from the nearest one
+    pBaseStream = CompressThroughStream(codec, STREAM_TEST_RESTART_INTERVAL, pData, STREAM_TEST_DATA_SIZE);
+    codecResult &= (pBaseStream != nullptr);
+    if (pBaseStream != nullptr)
+    {
+      DecompressingByteStream* pStream = ByteStream_OpenSeekableDecompressingStream(pBaseStream);
+      codecResult &= (pStream != nullptr);
+      if (pStream != nullptr)
+      {
+        uint32 expectedRestartPoints =
+          (STREAM_TEST_DATA_SIZE + STREAM_TEST_RESTART_INTERVAL - 1) / STREAM_TEST_RESTART_INTERVAL;
+        codecResult &= (pStream->GetSize() == STREAM_TEST_DATA_SIZE &&
+                        pStream->GetRestartPointCount() == expectedRestartPoints);
+
+        uint32 state = 777;
+        for (uint32 i = 0; i < 200; i++)
+        {
+          state = state * 1103515245u + 12345u;
+          uint32 offset = (state >> 8) % (STREAM_TEST_DATA_SIZE - 3000);
+          codecResult &= VerifyStreamRead(pStream, offset, 3000, pData);
+        }
+
+        // across a piece boundary, and up to the end
+        codecResult &= VerifyStreamRead(pStream, STREAM_TEST_RESTART_INTERVAL * 3 - 100, 200, pData);
+        codecResult &= VerifyStreamRead(pStream, STREAM_TEST_DATA_SIZE - 1000, 1000, pData);
+        byte extraByte;
+        codecResult &= (pStream->Read(&extraByte, 1) == 0 && pStream->SeekToEnd() &&
+                        pStream->GetPosition() == STREAM_TEST_DATA_SIZE);
+        codecResult &= !pStream->SeekAbsolute(STREAM_TEST_DATA_SIZE + 1) && !pStream->InErrorState();
+        pStream->Release();
+      }
+
+      // a damaged table is refused
+      pBaseStream->GetMemoryPointer()[pBaseStream->GetSize() - 1] ^= 0xFF;
+      codecResult &= (ByteStream_OpenSeekableDecompressingStream(pBaseStream) == nullptr);
+      pBaseStream->Release();
+    }
+
+    // an empty stream still has a single, empty piece
+    pBaseStream = CompressThroughStream(codec, STREAM_TEST_RESTART_INTERVAL, pData, 0);
+    codecResult &= (pBaseStream != nullptr);
+    if (pBaseStream != nullptr)
+    {
+      byte extraByte;
+      DecompressingByteStream* pStream = ByteStream_OpenSeekableDecompressingStream(pBaseStream);
+      codecResult &= (pStream != nullptr && pStream->GetSize() == 0 && pStream->GetRestartPointCount() == 1 &&
+                      pStream->Read(&extraByte, 1) == 0 && !pStream->InErrorState());
+      if (pStream != nullptr)
+        pStream->Release();
+
+      pBaseStream->Release();
+    }
+
+    if (codecResult)
+      Log_InfoPrintf("PASS: %s streams", CompressionCodec::GetName(codec));
+    else
+      Log_ErrorPrintf("FAIL: %s streams", CompressionCodec::GetName(codec));
+
+    result &= codecResult;
+  }
+
+  delete[] pData;
+  return result;
+}
+
+// not a pass/fail test, logs the ratio and throughput of each codec at a few levels for comparison
+static bool BenchmarkCodecs()
+{
+  static const uint32 levels[COMPRESSION_CODEC_COUNT][3] = {{1, 6, 0}, {1, 3, 9}, {1, 3, 9}};
+
+  byte* pData = CreateTestData(BENCHMARK_DATA_SIZE);
+  byte* pDecompressed = new byte[BENCHMARK_DATA_SIZE];
+  bool result = true;
+  Timer timer;
+  for (uint32 codecIndex = 0; codecIndex < COMPRESSION_CODEC_COUNT; codecIndex++)
+  {
+    COMPRESSION_CODEC codec = (COMPRESSION_CODEC)codecIndex;
+    if (!CompressionCodec::IsAvailable(codec))
+      continue;
+
+    for (uint32 i = 0; i < countof(levels[codecIndex]) && levels[codecIndex][i] != 0; i++)
+    {
+      uint32 level = levels[codecIndex][i];
+      uint32 bufferSize = CompressionCodec::GetCompressedBufferUpperBounds(codec, BENCHMARK_DATA_SIZE, level);
+      byte* pCompressed = new byte[bufferSize];
+      uint32 compressedSize = 0;
+      uint32 decompressedSize = 0;
+
+      timer.Reset();
+      bool ok = CompressionCodec::WriteCompressedDataToBuffer(codec, pCompressed, bufferSize, &compressedSize, pData,
+                                                              BENCHMARK_DATA_SIZE, level);
+      double compressMilliseconds = timer.GetTimeMilliseconds();
+
+      timer.Reset();
+      ok = ok && CompressionCodec::ReadCompressedDataFromBuffer(codec, pDecompressed, BENCHMARK_DATA_SIZE,
+                                                                &decompressedSize, pCompressed, compressedSize);
+      double decompressMilliseconds = timer.GetTimeMilliseconds();
+      ok = ok && decompressedSize == BENCHMARK_DATA_SIZE &&
+           std::memcmp(pDecompressed, pData, BENCHMARK_DATA_SIZE) == 0;
+
+      if (ok)
+      {
+        double megabytes = (double)BENCHMARK_DATA_SIZE / 1048576.0;
+        Log_InfoPrintf("BENCH: %-7s level %2u: ratio %5.2f, compress %7.1f MB/s, decompress %7.1f MB/s",
+                       CompressionCodec::GetName(codec), level, (double)BENCHMARK_DATA_SIZE / (double)compressedSize,
+                       megabytes / (Max(compressMilliseconds, 0.001) / 1000.0),
+                       megabytes / (Max(decompressMilliseconds, 0.001) / 1000.0));
+      }
+      else
+      {
+        Log_ErrorPrintf("FAIL: %s level %u benchmark round trip", CompressionCodec::GetName(codec), level);
+      }
+
+      result &= ok;
+      delete[] pCompressed;
+    }
+  }
+
+  delete[] pDecompressed;
+  delete[] pData;
+  return result;
+}
+
+DEFINE_TEST_SUITE(CompressionCodec)
+{
+  bool result = true;
+  result &= TestRoundTrip();
+  result &= TestLevelClamping();
+  result &= TestCompressedStreams();
+  result &= BenchmarkCodecs();
+  return result;
+}
@@ -0,0 +1,1513 @@
+#include "TestSuite.h"
+#include "YBaseLib/Atomic.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Event.h"
+#include "YBaseLib/FileSystem.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/Mutex.h"
+#include "YBaseLib/NumericLimits.h"
+#include "YBaseLib/Sockets/BufferedStreamSocket.h"
+#include "YBaseLib/Sockets/DatagramSocket.h"
+#include "YBaseLib/Sockets/ListenSocket.h"
+#include "YBaseLib/Sockets/MessageStreamSocket.h"
+#include "YBaseLib/Sockets/SocketBufferPool.h"
+#include "YBaseLib/Sockets/SocketMultiplexer.h"
+#include "YBaseLib/Sockets/SocketTimer.h"
+#include "YBaseLib/Sockets/StreamSocket.h"
+#include "YBaseLib/Thread.h"
+#include "YBaseLib/Timer.h"
+#include <cstring>
+#ifdef Y_PLATFORM_LINUX
+#include <sys/resource.h>
+#endif
+Log_SetChannel(TestSockets);
+
+static const uint32 ECHO_MESSAGE_SIZE = 1000;
+static const uint32 ECHO_CLIENT_COUNT = 50;
+static const uint32 ECHO_CLIENT_COUNT_EPOLL = 1500;
+static const uint32 SINK_TRANSFER_SIZE = 1024 * 1024;
+static const uint32 SINK_BUFFER_SIZE = 16384;
+static const double TIMEOUT_MILLISECONDS = 10000.0;
+static const uint32 WORKER_THREAD_COUNT = 4;
+static const uint32 ZEROCOPY_WRITE_SIZE = 65536;
+static const char* SEND_FILE_TEST_FILE_NAME = "TestSocketsSendFile.bin";
+static const uint32 WHEEL_TIMER_COUNT = 4000;
+static const uint32 TIMER_DELAY_MILLISECONDS = 20;
+static const uint32 MESSAGE_COUNT = 2000;
+static const uint32 MESSAGE_MAX_SIZE = 9000;
+static const uint32 MESSAGE_BACKLOG_BUFFER_SIZE = 4 * 1024 * 1024;
+static const uint32 MESSAGE_BACKLOG_COUNT = 32768;
+static const uint32 MESSAGE_BACKLOG_SIZE = 60;
+static const uint32 MESSAGE_BENCHMARK_COUNT = 500000;
+static const uint32 MESSAGE_BENCHMARK_SIZE = 64;
+static const uint32 DATAGRAM_COUNT = 5000;
+static const uint32 DATAGRAM_MAX_SIZE = 1200;
+static const uint32 DATAGRAM_WINDOW = 64;
+static const uint32 DATAGRAM_SEGMENT_SIZE = 1000;
+static const uint32 DATAGRAM_SEGMENTED_SIZE = 20500;
+static const uint32 DATAGRAM_SEGMENTED_COUNT = 100;
+static const char* UNIX_SOCKET_TEST_PATH = "TestSocketsUnix.sock";
+static const uint32 FLOW_CONTROL_BUFFER_SIZE = 65536;
+static const uint32 FLOW_CONTROL_HIGH_WATERMARK = 32768;
+static const uint32 FLOW_CONTROL_LOW_WATERMARK = 8192;
+static const uint32 FLOW_CONTROL_WRITE_SIZE = 4096;
+
+static byte ExpectedByte(uint32 offset)
+{
+  return (byte)(offset * 7 + 3);
+}
+
+static Event s_echoDoneEvent;
+static volatile uint32 s_echoClientsDone;
+static volatile uint32 s_echoClientsFailed;
+static uint32 s_echoClientCount;
+
+// threads the echo sockets have handled events on, to check connections are spread across the event loops
+static Mutex s_echoThreadLock;
+static Thread::ThreadIdType s_echoThreadIds[WORKER_THREAD_COUNT];
+static uint32 s_echoThreadCount;
+
+static void RecordEchoThread()
+{
+  Thread::ThreadIdType threadId = Thread::GetCurrentThreadId();
+  s_echoThreadLock.Lock();
+
+  uint32 i;
+  for (i = 0; i < s_echoThreadCount; i++)
+  {
+    if (s_echoThreadIds[i] == threadId)
+      break;
+  }
+  if (i == s_echoThreadCount && s_echoThreadCount < WORKER_THREAD_COUNT)
+    s_echoThreadIds[s_echoThreadCount++] = threadId;
+
+  s_echoThreadLock.Unlock();
+}
+
+// sends back everything it receives
+class EchoServerSocket : public BufferedStreamSocket
+{
+protected:
+  virtual void OnRead() override
+  {
+    RecordEchoThread();
+
+    const void* pData;
+    size_t bytesAvailable;
+    while (AcquireReadBuffer(&pData, &bytesAvailable))
+    {
+      size_t bytesWritten = Write(pData, bytesAvailable);
+      ReleaseReadBuffer(bytesWritten);
+      if (bytesWritten < bytesAvailable)
+        break;
+    }
+  }
+};
+
+// checks the echo, and signals once every client has it all
+class EchoClientSocket : public BufferedStreamSocket
+{
+public:
+  EchoClientSocket() : m_bytesReceived(0) {}
+
+protected:
+  virtual void OnRead() override
+  {
+    RecordEchoThread();
+
+    byte buffer[256];
+    size_t bytesRead;
+    while ((bytesRead = Read(buffer, sizeof(buffer))) > 0)
+    {
+      for (size_t i = 0; i < bytesRead; i++)
+      {
+        if (buffer[i] != ExpectedByte(m_bytesReceived + (uint32)i))
+        {
+          Y_AtomicIncrement(s_echoClientsFailed);
+          break;
+        }
+      }
+
+      m_bytesReceived += (uint32)bytesRead;
+      if (m_bytesReceived == ECHO_MESSAGE_SIZE && Y_AtomicIncrement(s_echoClientsDone) == s_echoClientCount)
+        s_echoDoneEvent.Signal();
+    }
+  }
+
+private:
+  uint32 m_bytesReceived;
+};
+
+// receives into a small buffer and leaves it for the test to drain, so reads stop with data left in the socket
+class SinkSocket : public BufferedStreamSocket
+{
+public:
+  SinkSocket() : BufferedStreamSocket(SINK_BUFFER_SIZE, SINK_BUFFER_SIZE) { s_pInstance = this; }
+
+  static SinkSocket* volatile s_pInstance;
+};
+
+SinkSocket* volatile SinkSocket::s_pInstance = nullptr;
+
+// counts the flow control callbacks
+class FlowControlSocket : public BufferedStreamSocket
+{
+public:
+  FlowControlSocket()
+    : BufferedStreamSocket(FLOW_CONTROL_BUFFER_SIZE, FLOW_CONTROL_BUFFER_SIZE), WritableCount(0), DrainedCount(0)
+  {
+    SetSendWatermarks(FLOW_CONTROL_HIGH_WATERMARK, FLOW_CONTROL_LOW_WATERMARK);
+  }
+
+  volatile uint32 WritableCount;
+  volatile uint32 DrainedCount;
+
+protected:
+  virtual void OnWritable() override { WritableCount++; }
+  virtual void OnSendBufferDrained() override { DrainedCount++; }
+};
+
+// counts the zero-copy sends the kernel has finished with
+class ZeroCopyClientSocket : public StreamSocket
+{
+public:
+  static volatile uint32 s_completedCount;
+
+protected:
+  virtual void OnZeroCopyCompleted(uint32 firstCompletionID, uint32 lastCompletionID) override
+  {
+    for (uint32 i = firstCompletionID; i != lastCompletionID + 1; i++)
+      Y_AtomicIncrement(s_completedCount);
+  }
+};
+
+volatile uint32 ZeroCopyClientSocket::s_completedCount = 0;
+
+// wheel test timers only record what happened to them
+class WheelTestTimer : public SocketTimer
+{
+public:
+  uint64 Deadline;
+  bool Cancelled;
+
+protected:
+  virtual void OnTimer() override {}
+};
+
+// holds up its event loop until released, so the socket events behind it are collected together
+class StallingTimer : public SocketTimer
+{
+public:
+  Event StartedEvent;
+  Event ReleaseEvent;
+
+protected:
+  virtual void OnTimer() override
+  {
+    StartedEvent.Signal();
+    ReleaseEvent.Wait();
+  }
+};
+
+// records when and where it fired
+class RecordingTimer : public SocketTimer
+{
+public:
+  RecordingTimer() : pClock(nullptr), FireCount(0), FireMilliseconds(0.0), FireThreadId(0), pDoneEvent(nullptr) {}
+
+  const Timer* pClock;
+  volatile uint32 FireCount;
+  double FireMilliseconds;
+  Thread::ThreadIdType FireThreadId;
+  Event* pDoneEvent;
+
+protected:
+  virtual void OnTimer() override
+  {
+    FireMilliseconds = pClock->GetTimeMilliseconds();
+    FireThreadId = Thread::GetCurrentThreadId();
+    Y_AtomicIncrement(FireCount);
+    if (pDoneEvent != nullptr)
+      pDoneEvent->Signal();
+  }
+};
+
+// on the first reply, schedules a timer for itself, which has to fire on the thread the reply was read on
+class TimerClientSocket : public BufferedStreamSocket
+{
+public:
+  TimerClientSocket() : ReadThreadId(0) {}
+
+  RecordingTimer IdleTimer;
+  volatile Thread::ThreadIdType ReadThreadId;
+
+protected:
+  virtual void OnRead() override
+  {
+    byte buffer[256];
+    while (Read(buffer, sizeof(buffer)) > 0)
+      continue;
+
+    if (ReadThreadId == 0)
+    {
+      ReadThreadId = Thread::GetCurrentThreadId();
+      GetMultiplexer()->ScheduleTimer(&IdleTimer, TIMER_DELAY_MILLISECONDS, this);
+    }
+  }
+};
+
+// message i is a run of letters, so never contains the delimiter
+static uint32 GetTestMessage(uint32 index, byte* pBuffer)
+{
+  uint32 length = (index * 7919) % MESSAGE_MAX_SIZE;
+  for (uint32 i = 0; i < length; i++)
+    pBuffer[i] = (byte)('a' + (index + i) % 26);
+
+  return length;
+}
+
+// the framing used by the message sockets made for the current test, and how many the receivers expect
+static bool s_messagesDelimited;
+static uint32 s_messagesExpected;
+
+// sends every message straight back
+class MessageEchoSocket : public MessageStreamSocket
+{
+public:
+  MessageEchoSocket()
+  {
+    if (s_messagesDelimited)
+      SetDelimiterFraming("\r\n", 2);
+  }
+
+protected:
+  virtual void OnMessage(const void* pMessage, size_t length) override
+  {
+    if (!SendMessage(pMessage, length))
+      Y_AtomicIncrement(s_echoClientsFailed);
+  }
+};
+
+// counts messages, with a receive buffer holding far more than one pass over the received chunks
+class BacklogMessageSocket : public MessageStreamSocket
+{
+public:
+  BacklogMessageSocket() : MessageStreamSocket(MESSAGE_BACKLOG_BUFFER_SIZE), MessagesReceived(0) { s_pInstance = this; }
+
+  static BacklogMessageSocket* volatile s_pInstance;
+  volatile uint32 MessagesReceived;
+
+protected:
+  virtual void OnMessage(const void* pMessage, size_t length) override
+  {
+    if (++MessagesReceived == s_messagesExpected)
+      s_echoDoneEvent.Signal();
+  }
+};
+
+BacklogMessageSocket* volatile BacklogMessageSocket::s_pInstance = nullptr;
+
+// checks each echoed message is the next one expected, and counts the ones which just need to arrive
+class MessageClientSocket : public MessageStreamSocket
+{
+public:
+  MessageClientSocket()
+    : ExpectedCount(s_messagesExpected), CheckMessages(false), MessagesReceived(0),
+      m_pExpected(new byte[MESSAGE_MAX_SIZE])
+  {
+    if (s_messagesDelimited)
+      SetDelimiterFraming("\r\n", 2);
+  }
+  ~MessageClientSocket() { delete[] m_pExpected; }
+
+  uint32 ExpectedCount;
+  bool CheckMessages;
+  volatile uint32 MessagesReceived;
+
+protected:
+  virtual void OnMessage(const void* pMessage, size_t length) override
+  {
+    if (CheckMessages)
+    {
+      uint32 expectedLength = GetTestMessage(MessagesReceived, m_pExpected);
+      if (length != expectedLength || std::memcmp(pMessage, m_pExpected, length) != 0)
+        Y_AtomicIncrement(s_echoClientsFailed);
+    }
+
+    if (++MessagesReceived == ExpectedCount)
+      s_echoDoneEvent.Signal();
+  }
+
+private:
+  byte* m_pExpected;
+};
+
+// datagram i starts with its index, then bytes which depend on it. the batched test varies the length.
+static uint32 GetTestDatagramLength(uint32 index)
+{
+  return 4 + (index * 37) % (DATAGRAM_MAX_SIZE - 4);
+}
+
+static void GetTestDatagram(uint32 index, byte* pBuffer, uint32 length)
+{
+  std::memcpy(pBuffer, &index, sizeof(index));
+  for (uint32 i = sizeof(index); i < length; i++)
+    pBuffer[i] = (byte)(index + i);
+}
+
+static bool s_datagramsSegmented;
+static uint32 s_datagramsExpected;
+
+// checks datagrams arrive in order and intact, which loopback guarantees when the sender is paced
+class DatagramReceiverSocket : public DatagramSocket
+{
+public:
+  DatagramReceiverSocket() : PacketsReceived(0) {}
+
+  volatile uint32 PacketsReceived;
+
+protected:
+  virtual void OnPackets(const Packet* pPackets, uint32 count) override
+  {
+    for (uint32 i = 0; i < count; i++)
+    {
+      const byte* pData = reinterpret_cast<const byte*>(pPackets[i].pData);
+      size_t length = pPackets[i].Length;
+      uint32 index = 0;
+      if (length >= sizeof(index))
+        std::memcpy(&index, pData, sizeof(index));
+
+      bool valid = (length >= sizeof(index) && index == PacketsReceived &&
+                    (s_datagramsSegmented ? (length <= DATAGRAM_SEGMENT_SIZE) :
+                                            (length == GetTestDatagramLength(index))));
+      for (size_t j = sizeof(index); valid && j < length; j++)
+        valid = (pData[j] == (byte)(index + j));
+
+      if (!valid)
+        Y_AtomicIncrement(s_echoClientsFailed);
+
+      if (++PacketsReceived == s_datagramsExpected)
+        s_echoDoneEvent.Signal();
+    }
+  }
+};
+
+// records the length of each read, which for sequenced packets is one message each
+class PacketReaderSocket : public StreamSocket
+{
+public:
+  PacketReaderSocket() : ReadCount(0) {}
+
+  static const uint32 MAX_READS = 8;
+  size_t ReadLengths[MAX_READS];
+  volatile uint32 ReadCount;
+
+protected:
+  virtual void OnRead() override
+  {
+    byte buffer[4096];
+    size_t bytesRead;
+    while ((bytesRead = Read(buffer, sizeof(buffer))) > 0)
+    {
+      if (ReadCount < MAX_READS)
+        ReadLengths[ReadCount] = bytesRead;
+
+      ReadCount++;
+    }
+  }
+};
+
+static uint32 GetEchoClientCount(SOCKET_MULTIPLEXER_TYPE type)
+{
+  if (type != SOCKET_MULTIPLEXER_TYPE_EPOLL)
+    return ECHO_CLIENT_COUNT;
+
+  // more connections than select can handle, if the descriptor limit allows (two per connection, plus some spare)
+  uint32 clientCount = ECHO_CLIENT_COUNT_EPOLL;
+#ifdef Y_PLATFORM_LINUX
+  rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    clientCount = (uint32)Min((rlim_t)clientCount, (limit.rlim_cur > 128) ? (limit.rlim_cur - 128) / 2 : 0);
+#endif
+
+  return clientCount;
+}
+
+static bool TestEcho(SocketMultiplexer* pMultiplexer, const char* typeName)
+{
+  Error error;
+  SocketAddress address;
+  SocketAddress::Parse(SocketAddress::Type_IPv4, "127.0.0.1", 0, &address);
+  ListenSocket* pListenSocket = pMultiplexer->CreateListenSocket<EchoServerSocket>(&address, &error);
+  if (pListenSocket == nullptr)
+  {
+    Log_ErrorPrintf("FAIL: %s echo, could not listen", typeName);
+    return false;
+  }
+
+  s_echoDoneEvent.Reset();
+  s_echoClientsDone = 0;
+  s_echoClientsFailed = 0;
+  s_echoThreadCount = 0;
+  s_echoClientCount = GetEchoClientCount(pMultiplexer->GetType());
+
+  byte message[ECHO_MESSAGE_SIZE];
+  for (uint32 i = 0; i < ECHO_MESSAGE_SIZE; i++)
+    message[i] = ExpectedByte(i);
+
+  Timer timer;
+  bool result = true;
+  for (uint32 i = 0; i < s_echoClientCount && result; i++)
+  {
+    EchoClientSocket* pClient =
+      pMultiplexer->ConnectStreamSocket<EchoClientSocket>(pListenSocket->GetLocalAddress(), &error);
+    result = (pClient != nullptr && pClient->Write(message, sizeof(message)) == sizeof(message));
+    if (pClient != nullptr)
+      pClient->Release();
+  }
+
+  result = result && s_echoDoneEvent.TryWait((uint32)TIMEOUT_MILLISECONDS) && s_echoClientsFailed == 0 &&
+           pListenSocket->GetConnectionsAccepted() == s_echoClientCount &&
+           s_echoThreadCount == pMultiplexer->GetEventLoopCount();
+
+  // once everything has been echoed the connections are idle, and shouldn't be holding any buffers
+  SocketBufferPool::Statistics poolStatistics;
+  pMultiplexer->GetBufferPool()->GetStatistics(&poolStatistics);
+  while (result && poolStatistics.ChunksInUse > 0 && timer.GetTimeMilliseconds() < TIMEOUT_MILLISECONDS)
+  {
+    Thread::Sleep(1);
+    pMultiplexer->GetBufferPool()->GetStatistics(&poolStatistics);
+  }
+  result = result && poolStatistics.ChunksInUse == 0;
+
+  if (result)
+  {
+    Log_InfoPrintf("PASS: %s echo, %u connections on %u threads in %.1f ms, peak %u buffer chunks", typeName,
+                   s_echoClientCount, s_echoThreadCount, timer.GetTimeMilliseconds(), poolStatistics.PeakChunksInUse);
+  }
+  else
+  {
+    Log_ErrorPrintf("FAIL: %s echo, %u of %u connections done on %u threads, %u buffer chunks in use", typeName,
+                    s_echoClientsDone, s_echoClientCount, s_echoThreadCount, poolStatistics.ChunksInUse);
+  }
+
+  pMultiplexer->CloseAll();
+  return result;
+}
+
+static bool TestFullReceiveBuffer(SocketMultiplexer* pMultiplexer, const char* typeName)
+{
+  Error error;
+  SocketAddress address;
+  SocketAddress::Parse(SocketAddress::Type_IPv4, "127.0.0.1", 0, &address);
+  ListenSocket* pListenSocket = pMultiplexer->CreateListenSocket<SinkSocket>(&address, &error);
+  if (pListenSocket == nullptr)
+  {
+    Log_ErrorPrintf("FAIL: %s full receive buffer, could not listen", typeName);
+    return false;
+  }
+
+  SinkSocket::s_pInstance = nullptr;
+  StreamSocket* pClient = pMultiplexer->ConnectStreamSocket<StreamSocket>(pListenSocket->GetLocalAddress(), &error);
+  if (pClient == nullptr)
+  {
+    Log_ErrorPrintf("FAIL: %s full receive buffer, could not connect", typeName);
+    pMultiplexer->CloseAll();
+    return false;
+  }
+
+  byte* pData = new byte[SINK_TRANSFER_SIZE];
+  byte* pReceived = new byte[SINK_TRANSFER_SIZE];
+  for (uint32 i = 0; i < SINK_TRANSFER_SIZE; i++)
+    pData[i] = ExpectedByte(i);
+
+  // the sink only reads more from the socket once we've made room, so this stalls if it isn't re-armed
+  Timer timer;
+  size_t bytesSent = 0;
+  size_t bytesReceived = 0;
+  while (bytesReceived < SINK_TRANSFER_SIZE && timer.GetTimeMilliseconds() < TIMEOUT_MILLISECONDS)
+  {
+    if (bytesSent < SINK_TRANSFER_SIZE)
+      bytesSent += pClient->Write(pData + bytesSent, Min(SINK_TRANSFER_SIZE - bytesSent, (size_t)65536));
+
+    SinkSocket* pSink = SinkSocket::s_pInstance;
+    if (pSink != nullptr)
+      bytesReceived += pSink->Read(pReceived + bytesReceived, SINK_TRANSFER_SIZE - bytesReceived);
+  }
+
+  bool result = (bytesReceived == SINK_TRANSFER_SIZE && std::memcmp(pData, pReceived, SINK_TRANSFER_SIZE) == 0);
+  if (result)
+    Log_InfoPrintf("PASS: %s full receive buffer", typeName);
+  else
+    Log_ErrorPrintf("FAIL: %s full receive buffer, %u of %u bytes", typeName, (uint32)bytesReceived,
+                    SINK_TRANSFER_SIZE);
+
+  delete[] pReceived;
+  delete[] pData;
+  pClient->Release();
+  pMultiplexer->CloseAll();
+  return result;
+}
+
+// sends through a buffered socket in uneven vectors, so the send buffer wraps while the sink is slow to read
+static bool TestBufferedSend(SocketMultiplexer* pMultiplexer, const char* typeName)
+{
+  Error error;
+  SocketAddress address;
+  SocketAddress::Parse(SocketAddress::Type_IPv4, "127.0.0.1", 0, &address);
+  ListenSocket* pListenSocket = pMultiplexer->CreateListenSocket<SinkSocket>(&address, &error);
+  if (pListenSocket == nullptr)
+  {
+    Log_ErrorPrintf("FAIL: %s buffered send, could not listen", typeName);
+    return false;
+  }
+
+  SinkSocket::s_pInstance = nullptr;
+  BufferedStreamSocket* pClient =
+    pMultiplexer->ConnectStreamSocket<BufferedStreamSocket>(pListenSocket->GetLocalAddress(), &error);
+  if (pClient == nullptr)
+  {
+    Log_ErrorPrintf("FAIL: %s buffered send, could not connect", typeName);
+    pMultiplexer->CloseAll();
+    return false;
+  }
+
+  byte* pData = new byte[SINK_TRANSFER_SIZE];
+  byte* pReceived = new byte[SINK_TRANSFER_SIZE];
+  for (uint32 i = 0; i < SINK_TRANSFER_SIZE; i++)
+    pData[i] = ExpectedByte(i);
+
+  static const size_t pieceSizes[] = {1, 777, 5000};
+  Timer timer;
+  size_t bytesSent = 0;
+  size_t bytesReceived = 0;
+  while (bytesReceived < SINK_TRANSFER_SIZE && timer.GetTimeMilliseconds() < TIMEOUT_MILLISECONDS)
+  {
+    const void* pieces[countof(pieceSizes)];
+    size_t pieceLengths[countof(pieceSizes)];
+    size_t numPieces = 0;
+    for (size_t offset = bytesSent; numPieces < countof(pieceSizes) && offset < SINK_TRANSFER_SIZE; numPieces++)
+    {
+      pieces[numPieces] = pData + offset;
+      pieceLengths[numPieces] = Min(pieceSizes[numPieces], SINK_TRANSFER_SIZE - offset);
+      offset += pieceLengths[numPieces];
+    }
+    if (numPieces > 0)
+      bytesSent += pClient->WriteVector(pieces, pieceLengths, numPieces);
+
+    SinkSocket* pSink = SinkSocket::s_pInstance;
+    if (pSink != nullptr)
+      bytesReceived += pSink->Read(pReceived + bytesReceived, Min(SINK_TRANSFER_SIZE - bytesReceived, (size_t)3000));
+  }
+
+  bool result = (bytesReceived == SINK_TRANSFER_SIZE && std::memcmp(pData, pReceived, SINK_TRANSFER_SIZE) == 0);
+  if (result)
+    Log_InfoPrintf("PASS: %s buffered send", typeName);
+  else
+    Log_ErrorPrintf("FAIL: %s buffered send, %u of %u bytes", typeName, (uint32)bytesReceived, SINK_TRANSFER_SIZE);
+
+  delete[] pReceived;
+  delete[] pData;
+  pClient->Release();
+  pMultiplexer->CloseAll();
+  return result;
+}
+
+// writes until the sink stops reading and the queue passes the high watermark, then drains the sink and waits for the
+// socket to become writable again
+static bool TestBackpressure(SocketMultiplexer* pMultiplexer, const char* typeName)
+{
+  Error error;
+  SocketAddress address;
+  SocketAddress::Parse(SocketAddress::Type_IPv4, "127.0.0.1", 0, &address);
+  SinkSocket::s_pInstance = nullptr;
+  ListenSocket* pListenSocket = pMultiplexer->CreateListenSocket<SinkSocket>(&address, &error);
+  FlowControlSocket* pClient =
+    (pListenSocket != nullptr) ?
+      pMultiplexer->ConnectStreamSocket<FlowControlSocket>(pListenSocket->GetLocalAddress(), &error) :
+      nullptr;
+  if (pClient == nullptr)
+  {
+    Log_ErrorPrintf("FAIL: %s backpressure, could not connect", typeName);
+    pMultiplexer->CloseAll();
+    return false;
+  }
+
+  byte data[FLOW_CONTROL_WRITE_SIZE];
+  std::memset(data, 'x', sizeof(data));
+
+  // a message larger than the whole send buffer never fits, so it's refused without blocking, as nothing would unblock
+  const void* oversizedBuffers[FLOW_CONTROL_BUFFER_SIZE / FLOW_CONTROL_WRITE_SIZE + 1];
+  size_t oversizedLengths[countof(oversizedBuffers)];
+  for (uint32 i = 0; i < countof(oversizedBuffers); i++)
+  {
+    oversizedBuffers[i] = data;
+    oversizedLengths[i] = sizeof(data);
+  }
+  bool oversizedRefused = (!pClient->TryWriteVector(oversizedBuffers, oversizedLengths, countof(oversizedBuffers)) &&
+                           pClient->IsWritable());
+
+  Timer timer;
+  size_t bytesWritten = 0;
+  while (pClient->IsWritable() && timer.GetTimeMilliseconds() < TIMEOUT_MILLISECONDS)
+    bytesWritten += pClient->Write(data, sizeof(data));
+
+  bool blocked = (oversizedRefused && !pClient->IsWritable() && pClient->WritableCount == 0 &&
+                  pClient->GetQueuedSendBytes() >= FLOW_CONTROL_HIGH_WATERMARK);
+
+  size_t bytesReceived = 0;
+  byte buffer[3000];
+  while ((bytesReceived < bytesWritten || pClient->DrainedCount == 0) &&
+         timer.GetTimeMilliseconds() < TIMEOUT_MILLISECONDS)
+  {
+    SinkSocket* pSink = SinkSocket::s_pInstance;
+    size_t bytesRead = (pSink != nullptr) ? pSink->Read(buffer, sizeof(buffer)) : 0;
+    bytesReceived += bytesRead;
+    if (bytesRead == 0)
+      Thread::Sleep(1);
+  }
+
+  bool result = (blocked && bytesReceived == bytesWritten && pClient->IsWritable() && pClient->WritableCount == 1 &&
+                 pClient->DrainedCount > 0 && pClient->GetQueuedSendBytes() == 0 &&
+                 pClient->GetPeakQueuedSendBytes() >= FLOW_CONTROL_HIGH_WATERMARK &&
+                 pClient->GetTotalQueuedSendBytes() >= pClient->GetPeakQueuedSendBytes());
+  if (result)
+    Log_InfoPrintf("PASS: %s backpressure, blocked after %u bytes, %u queued at peak", typeName,
+                   (uint32)bytesWritten, (uint32)pClient->GetPeakQueuedSendBytes());
+  else
+    Log_ErrorPrintf("FAIL: %s backpressure, %s, %u of %u bytes, %u writable, %u drained", typeName,
+                    blocked ? "blocked" : "never blocked", (uint32)bytesReceived, (uint32)bytesWritten,
+                    pClient->WritableCount, pClient->DrainedCount);
+
+  pClient->Release();
+  pMultiplexer->CloseAll();
+  return result;
+}
+
+// sends a file through a buffered socket, part directly and part queued when the sink falls behind
+static bool TestSendFile(SocketMultiplexer* pMultiplexer, const char* typeName)
+{
+  byte* pData = new byte[SINK_TRANSFER_SIZE];
+  byte* pReceived = new byte[SINK_TRANSFER_SIZE];
+  for (uint32 i = 0; i < SINK_TRANSFER_SIZE; i++)
+    pData[i] = ExpectedByte(i);
+
+  ByteStream* pFile;
+  if (!ByteStream_OpenFileStream(SEND_FILE_TEST_FILE_NAME,
+                                 BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_WRITE | BYTESTREAM_OPEN_CREATE |
+                                   BYTESTREAM_OPEN_TRUNCATE,
+                                 &pFile) ||
+      pFile->Write(pData, SINK_TRANSFER_SIZE) != SINK_TRANSFER_SIZE)
+  {
+    Log_ErrorPrintf("FAIL: %s send file, could not create %s", typeName, SEND_FILE_TEST_FILE_NAME);
+    delete[] pReceived;
+    delete[] pData;
+    return false;
+  }
+
+  Error error;
+  SocketAddress address;
+  SocketAddress::Parse(SocketAddress::Type_IPv4, "127.0.0.1", 0, &address);
+  ListenSocket* pListenSocket = pMultiplexer->CreateListenSocket<SinkSocket>(&address, &error);
+  SinkSocket::s_pInstance = nullptr;
+  BufferedStreamSocket* pClient =
+    (pListenSocket != nullptr) ?
+      pMultiplexer->ConnectStreamSocket<BufferedStreamSocket>(pListenSocket->GetLocalAddress(), &error) :
+      nullptr;
+
+  // the stream is left where the write put it, the sends shouldn't move it
+  Timer timer;
+  uint64 bytesSent = 0;
+  size_t bytesReceived = 0;
+  while (pClient != nullptr && bytesReceived < SINK_TRANSFER_SIZE &&
+         timer.GetTimeMilliseconds() < TIMEOUT_MILLISECONDS)
+  {
+    if (bytesSent < SINK_TRANSFER_SIZE)
+      bytesSent += pClient->SendFile(pFile, bytesSent, SINK_TRANSFER_SIZE - bytesSent);
+
+    SinkSocket* pSink = SinkSocket::s_pInstance;
+    if (pSink != nullptr)
+      bytesReceived += pSink->Read(pReceived + bytesReceived, SINK_TRANSFER_SIZE - bytesReceived);
+  }
+
+  bool result = (bytesReceived == SINK_TRANSFER_SIZE && std::memcmp(pData, pReceived, SINK_TRANSFER_SIZE) == 0 &&
+                 pFile->GetPosition() == SINK_TRANSFER_SIZE);
+  if (result)
+    Log_InfoPrintf("PASS: %s send file", typeName);
+  else
+    Log_ErrorPrintf("FAIL: %s send file, %u of %u bytes", typeName, (uint32)bytesReceived, SINK_TRANSFER_SIZE);
+
+  if (pClient != nullptr)
+    pClient->Release();
+  pMultiplexer->CloseAll();
+  pFile->Release();
+  FileSystem::DeleteFile(SEND_FILE_TEST_FILE_NAME);
+  delete[] pReceived;
+  delete[] pData;
+  return result;
+}
+
+// zero-copy sends, which must all be reported complete. on loopback the kernel copies anyway, but still reports them.
+static bool TestZeroCopy(SocketMultiplexer* pMultiplexer, const char* typeName)
+{
+  Error error;
+  SocketAddress address;
+  SocketAddress::Parse(SocketAddress::Type_IPv4, "127.0.0.1", 0, &address);
+  ListenSocket* pListenSocket = pMultiplexer->CreateListenSocket<SinkSocket>(&address, &error);
+  if (pListenSocket == nullptr)
+  {
+    Log_ErrorPrintf("FAIL: %s zero-copy, could not listen", typeName);
+    return false;
+  }
+
+  SinkSocket::s_pInstance = nullptr;
+  ZeroCopyClientSocket::s_completedCount = 0;
+  ZeroCopyClientSocket* pClient =
+    pMultiplexer->ConnectStreamSocket<ZeroCopyClientSocket>(pListenSocket->GetLocalAddress(), &error);
+  if (pClient == nullptr)
+  {
+    Log_ErrorPrintf("FAIL: %s zero-copy, could not connect", typeName);
+    pMultiplexer->CloseAll();
+    return false;
+  }
+
+  byte* pData = new byte[SINK_TRANSFER_SIZE];
+  byte* pReceived = new byte[SINK_TRANSFER_SIZE];
+  for (uint32 i = 0; i < SINK_TRANSFER_SIZE; i++)
+    pData[i] = ExpectedByte(i);
+
+  // pData isn't touched until every pending send is complete
+  Timer timer;
+  size_t bytesSent = 0;
+  size_t bytesReceived = 0;
+  uint32 pendingCount = 0;
+  while ((bytesReceived < SINK_TRANSFER_SIZE || ZeroCopyClientSocket::s_completedCount != pendingCount) &&
+         timer.GetTimeMilliseconds() < TIMEOUT_MILLISECONDS)
+  {
+    if (bytesSent < SINK_TRANSFER_SIZE)
+    {
+      bool completionPending;
+      uint32 completionID;
+      size_t writeSize = Min(SINK_TRANSFER_SIZE - bytesSent, (size_t)ZEROCOPY_WRITE_SIZE);
+      bytesSent += pClient->WriteZeroCopy(pData + bytesSent, writeSize, &completionPending, &completionID);
+      if (completionPending)
+        pendingCount++;
+    }
+
+    SinkSocket* pSink = SinkSocket::s_pInstance;
+    if (pSink != nullptr)
+      bytesReceived += pSink->Read(pReceived + bytesReceived, SINK_TRANSFER_SIZE - bytesReceived);
+  }
+
+  bool result = (bytesReceived == SINK_TRANSFER_SIZE && std::memcmp(pData, pReceived, SINK_TRANSFER_SIZE) == 0 &&
+                 ZeroCopyClientSocket::s_completedCount == pendingCount);
+  if (result)
+  {
+    Log_InfoPrintf("PASS: %s zero-copy, %u sends completed", typeName, pendingCount);
+  }
+  else
+  {
+    Log_ErrorPrintf("FAIL: %s zero-copy, %u of %u bytes, %u of %u sends completed", typeName, (uint32)bytesReceived,
+                    SINK_TRANSFER_SIZE, ZeroCopyClientSocket::s_completedCount, pendingCount);
+  }
+
+  pClient->Release();
+  pMultiplexer->CloseAll();
+  delete[] pReceived;
+  delete[] pData;
+  return result;
+}
+
+// the wheel on its own, against a simulated clock: deadlines from the next tick to past the top level, polled at
+// uneven intervals, checking each timer comes out in order at the first poll after its deadline
+static bool TestTimerWheel()
+{
+  WheelTestTimer* pTimers = new WheelTestTimer[WHEEL_TIMER_COUNT];
+  uint64 tick = 0x123456789F0ULL;
+  SocketTimerWheel wheel(tick);
+  uint32 state = 12345;
+
+  uint32 scheduledCount = 0;
+  uint32 expectedFireCount = 0;
+  uint32 fireCount = 0;
+  uint64 lastDeadline = 0;
+  bool ok = true;
+  while (ok && (fireCount < expectedFireCount || scheduledCount < WHEEL_TIMER_COUNT))
+  {
+    // half at the start, half once the wheel has moved
+    if (scheduledCount == 0 || (fireCount > 0 && scheduledCount < WHEEL_TIMER_COUNT))
+    {
+      for (uint32 i = 0; i < WHEEL_TIMER_COUNT / 2; i++)
+      {
+        // spread over the levels: up to 2^8, 2^16, 2^24 and 2^34 ticks out
+        state = state * 1103515245u + 12345u;
+        uint32 level = (state >> 8) % 4;
+        uint32 shift = (level < 3) ? ((level + 1) * 8) : 34;
+        state = state * 1103515245u + 12345u;
+        uint64 delay = (((uint64)state * 2654435761u) & (((uint64)1 << shift) - 1)) + 1;
+
+        WheelTestTimer* pTimer = &pTimers[scheduledCount++];
+        pTimer->Deadline = tick + delay;
+        pTimer->Cancelled = false;
+        wheel.Schedule(pTimer, pTimer->Deadline);
+        expectedFireCount++;
+      }
+
+      // cancel some, once they're spread through the wheel
+      for (uint32 i = scheduledCount - WHEEL_TIMER_COUNT / 2; i < scheduledCount; i += 7)
+      {
+        wheel.Cancel(&pTimers[i]);
+        pTimers[i].Cancelled = true;
+        expectedFireCount--;
+      }
+    }
+
+    // nothing may be due before the wakeup tick
+    uint64 wakeupTick = wheel.GetNextWakeupTick();
+    state = state * 1103515245u + 12345u;
+    if (wakeupTick != Y_UINT64_MAX && wakeupTick > tick + 1 && (state & 1) != 0)
+      ok &= (wheel.PopExpiredTimer(wakeupTick - 1) == nullptr);
+
+    uint64 lastTick = Max(tick, wheel.GetCurrentTick());
+    tick = lastTick + ((uint64)state >> (8 + (state % 24)));
+
+    SocketTimer* pPopped;
+    while (ok && (pPopped = wheel.PopExpiredTimer(tick)) != nullptr)
+    {
+      WheelTestTimer* pTimer = static_cast<WheelTestTimer*>(pPopped);
+      ok &= (!pTimer->Cancelled && !pTimer->IsScheduled() && pTimer->Deadline <= tick &&
+             pTimer->Deadline > lastTick && pTimer->Deadline >= lastDeadline);
+      pTimer->Cancelled = true;
+      lastDeadline = pTimer->Deadline;
+      fireCount++;
+    }
+  }
+
+  ok &= (fireCount == expectedFireCount && wheel.GetTimerCount() == 0);
+  if (ok)
+    Log_InfoPrintf("PASS: timer wheel, %u timers fired", fireCount);
+  else
+    Log_ErrorPrintf("FAIL: timer wheel, %u of %u timers fired", fireCount, expectedFireCount);
+
+  delete[] pTimers;
+  return ok;
+}
+
+static bool TestTimers(SocketMultiplexer* pMultiplexer, const char* typeName)
+{
+  static const uint32 delays[] = {40, 10, 30, 50, 20};
+  static const uint32 CANCELLED_TIMER = 2;
+  static const uint32 MOVED_TIMER = 3;
+  static const uint32 MOVED_DELAY = 60;
+
+  Timer clock;
+  Event doneEvent;
+  RecordingTimer timers[countof(delays)];
+  for (uint32 i = 0; i < countof(delays); i++)
+  {
+    timers[i].pClock = &clock;
+    pMultiplexer->ScheduleTimer(&timers[i], delays[i]);
+  }
+
+  bool result = pMultiplexer->CancelTimer(&timers[CANCELLED_TIMER]);
+  result = result && !pMultiplexer->CancelTimer(&timers[CANCELLED_TIMER]);
+  timers[MOVED_TIMER].pDoneEvent = &doneEvent;
+  pMultiplexer->ScheduleTimer(&timers[MOVED_TIMER], MOVED_DELAY);
+
+  // the moved one is last
+  result = result && doneEvent.TryWait((uint32)TIMEOUT_MILLISECONDS);
+  for (uint32 i = 0; i < countof(delays) && result; i++)
+  {
+    uint32 delay = (i == MOVED_TIMER) ? MOVED_DELAY : delays[i];
+    result = (i == CANCELLED_TIMER) ? (timers[i].FireCount == 0) :
+                                      (timers[i].FireCount == 1 && timers[i].FireMilliseconds >= (double)(delay - 1) &&
+                                       timers[i].FireThreadId == timers[MOVED_TIMER].FireThreadId);
+  }
+
+  // a timer scheduled from a socket's handler, on the socket
+  Error error;
+  SocketAddress address;
+  SocketAddress::Parse(SocketAddress::Type_IPv4, "127.0.0.1", 0, &address);
+  ListenSocket* pListenSocket = pMultiplexer->CreateListenSocket<EchoServerSocket>(&address, &error);
+  TimerClientSocket* pClient = (pListenSocket != nullptr) ?
+                                 pMultiplexer->ConnectStreamSocket<TimerClientSocket>(pListenSocket->GetLocalAddress(),
+                                                                                      &error) :
+                                 nullptr;
+  if (result && pClient != nullptr)
+  {
+    doneEvent.Reset();
+    pClient->IdleTimer.pClock = &clock;
+    pClient->IdleTimer.pDoneEvent = &doneEvent;
+    result = (pClient->Write("ping", 4) == 4 && doneEvent.TryWait((uint32)TIMEOUT_MILLISECONDS) &&
+              pClient->IdleTimer.FireThreadId == pClient->ReadThreadId);
+  }
+  else
+  {
+    result = false;
+  }
+
+  if (result)
+    Log_InfoPrintf("PASS: %s timers", typeName);
+  else
+    Log_ErrorPrintf("FAIL: %s timers", typeName);
+
+  for (uint32 i = 0; i < countof(delays); i++)
+    pMultiplexer->CancelTimer(&timers[i]);
+  if (pClient != nullptr)
+  {
+    pMultiplexer->CancelTimer(&pClient->IdleTimer);
+    pClient->Release();
+  }
+
+  pMultiplexer->CloseAll();
+  return result;
+}
+
+// messages of assorted sizes, many spanning buffer chunks, sent in batches and echoed back with either framing
+static bool TestMessages(SocketMultiplexer* pMultiplexer, const char* typeName, bool delimited)
+{
+  const char* framingName = delimited ? "delimited" : "length-prefixed";
+  s_messagesDelimited = delimited;
+  s_messagesExpected = MESSAGE_COUNT;
+  s_echoDoneEvent.Reset();
+  s_echoClientsFailed = 0;
+
+  Error error;
+  SocketAddress address;
+  SocketAddress::Parse(SocketAddress::Type_IPv4, "127.0.0.1", 0, &address);
+  ListenSocket* pListenSocket = pMultiplexer->CreateListenSocket<MessageEchoSocket>(&address, &error);
+  MessageClientSocket* pClient =
+    (pListenSocket != nullptr) ?
+      pMultiplexer->ConnectStreamSocket<MessageClientSocket>(pListenSocket->GetLocalAddress(), &error) :
+      nullptr;
+  if (pClient == nullptr)
+  {
+    Log_ErrorPrintf("FAIL: %s %s messages, could not connect", typeName, framingName);
+    pMultiplexer->CloseAll();
+    return false;
+  }
+
+  pClient->CheckMessages = true;
+
+  // a few at a time, retrying whatever doesn't fit until the echoes make room
+  static const uint32 BATCH_SIZE = 16;
+  byte* pMessageData = new byte[BATCH_SIZE * MESSAGE_MAX_SIZE];
+  Timer timer;
+  uint32 messagesSent = 0;
+  while (messagesSent < MESSAGE_COUNT && pClient->IsConnected() && timer.GetTimeMilliseconds() < TIMEOUT_MILLISECONDS)
+  {
+    const void* pMessages[BATCH_SIZE];
+    size_t messageLengths[BATCH_SIZE];
+    uint32 batchCount = Min(BATCH_SIZE, MESSAGE_COUNT - messagesSent);
+    for (uint32 i = 0; i < batchCount; i++)
+    {
+      pMessages[i] = pMessageData + i * MESSAGE_MAX_SIZE;
+      messageLengths[i] = GetTestMessage(messagesSent + i, pMessageData + i * MESSAGE_MAX_SIZE);
+    }
+
+    uint32 sentCount = pClient->SendMessages(pMessages, messageLengths, batchCount);
+    messagesSent += sentCount;
+    if (sentCount < batchCount)
+      Thread::Sleep(1);
+  }
+
+  bool result = (messagesSent == MESSAGE_COUNT && s_echoDoneEvent.TryWait((uint32)TIMEOUT_MILLISECONDS) &&
+                 s_echoClientsFailed == 0 && pClient->MessagesReceived == MESSAGE_COUNT);
+  if (result)
+    Log_InfoPrintf("PASS: %s %s messages", typeName, framingName);
+  else
+    Log_ErrorPrintf("FAIL: %s %s messages, %u sent, %u received, %u bad", typeName, framingName, messagesSent,
+                    pClient->MessagesReceived, s_echoClientsFailed);
+
+  delete[] pMessageData;
+  pClient->Release();
+  pMultiplexer->CloseAll();
+  return result;
+}
+
+// datagrams one way over loopback, either of varying sizes sent in batches, or runs split into segments by the
+// kernel where it can, optionally coalesced again on receive
+static bool TestDatagrams(SocketMultiplexer* pMultiplexer, const char* typeName, bool segmented, bool receiveOffload)
+{
+  const char* modeName = segmented ? (receiveOffload ? "segmented, coalesced" : "segmented") : "batched";
+  uint32 segmentsPerRun = (DATAGRAM_SEGMENTED_SIZE + DATAGRAM_SEGMENT_SIZE - 1) / DATAGRAM_SEGMENT_SIZE;
+  s_datagramsSegmented = segmented;
+  s_datagramsExpected = segmented ? (DATAGRAM_SEGMENTED_COUNT * segmentsPerRun) : DATAGRAM_COUNT;
+  s_echoDoneEvent.Reset();
+  s_echoClientsFailed = 0;
+
+  Error error;
+  SocketAddress address;
+  SocketAddress::Parse(SocketAddress::Type_IPv4, "127.0.0.1", 0, &address);
+  DatagramReceiverSocket* pReceiver = pMultiplexer->CreateDatagramSocket<DatagramReceiverSocket>(&address, &error);
+  DatagramSocket* pSender = pMultiplexer->CreateDatagramSocket<DatagramSocket>(&address, &error);
+  if (pReceiver == nullptr || pSender == nullptr)
+  {
+    Log_ErrorPrintf("FAIL: %s %s datagrams, could not create sockets", typeName, modeName);
+    if (pReceiver != nullptr)
+      pReceiver->Release();
+    if (pSender != nullptr)
+      pSender->Release();
+
+    pMultiplexer->CloseAll();
+    return false;
+  }
+
+  if (receiveOffload && !pReceiver->EnableReceiveOffload())
+    Log_InfoPrintf("%s %s datagrams, receive offload not supported", typeName, modeName);
+
+  // never more than a window ahead of the receiver, so its socket buffer doesn't overflow and drop some
+  byte* pData = new byte[Max(DATAGRAM_SEGMENTED_SIZE, DATAGRAM_MAX_SIZE * (uint32)DatagramSocket::MAX_BATCH_SIZE)];
+  Timer timer;
+  uint32 packetsSent = 0;
+  while (packetsSent < s_datagramsExpected && timer.GetTimeMilliseconds() < TIMEOUT_MILLISECONDS)
+  {
+    uint32 windowLeft = pReceiver->PacketsReceived + DATAGRAM_WINDOW - packetsSent;
+    if (windowLeft < (segmented ? segmentsPerRun : 1))
+    {
+      Thread::Sleep(1);
+      continue;
+    }
+
+    if (segmented)
+    {
+      // the rest of the current run
+      uint32 segmentIndex = packetsSent % segmentsPerRun;
+      uint32 runStart = packetsSent - segmentIndex;
+      for (uint32 i = 0; i < segmentsPerRun; i++)
+      {
+        uint32 length = Min(DATAGRAM_SEGMENT_SIZE, DATAGRAM_SEGMENTED_SIZE - i * DATAGRAM_SEGMENT_SIZE);
+        GetTestDatagram(runStart + i, pData + i * DATAGRAM_SEGMENT_SIZE, length);
+      }
+
+      size_t offset = segmentIndex * DATAGRAM_SEGMENT_SIZE;
+      packetsSent += pSender->SendSegmented(pData + offset, DATAGRAM_SEGMENTED_SIZE - offset, DATAGRAM_SEGMENT_SIZE,
+                                            pReceiver->GetLocalAddress());
+    }
+    else
+    {
+      DatagramSocket::Packet packets[DatagramSocket::MAX_BATCH_SIZE];
+      uint32 batchCount =
+        Min(Min(windowLeft, (uint32)DatagramSocket::MAX_BATCH_SIZE), s_datagramsExpected - packetsSent);
+      for (uint32 i = 0; i < batchCount; i++)
+      {
+        packets[i].pData = pData + i * DATAGRAM_MAX_SIZE;
+        packets[i].Length = GetTestDatagramLength(packetsSent + i);
+        packets[i].pAddress = pReceiver->GetLocalAddress();
+        GetTestDatagram(packetsSent + i, pData + i * DATAGRAM_MAX_SIZE, (uint32)packets[i].Length);
+      }
+
+      packetsSent += pSender->SendMultiple(packets, batchCount);
+    }
+  }
+
+  bool result = (packetsSent == s_datagramsExpected && s_echoDoneEvent.TryWait((uint32)TIMEOUT_MILLISECONDS) &&
+                 s_echoClientsFailed == 0);
+  if (result)
+  {
+    Log_InfoPrintf("PASS: %s %s datagrams, %u packets in %u receive calls, %u send calls", typeName, modeName,
+                   (uint32)pReceiver->GetPacketsReceived(), (uint32)pReceiver->GetReceiveCalls(),
+                   (uint32)pSender->GetSendCalls());
+  }
+  else
+  {
+    Log_ErrorPrintf("FAIL: %s %s datagrams, %u sent, %u received, %u bad", typeName, modeName, packetsSent,
+                    pReceiver->PacketsReceived, s_echoClientsFailed);
+  }
+
+  delete[] pData;
+  pReceiver->Release();
+  pSender->Release();
+  pMultiplexer->CloseAll();
+  return result;
+}
+
+#ifndef Y_PLATFORM_WINDOWS
+// unix domain sockets: an echo through a listening path, a descriptor passed across a socket pair, and sequenced
+// packets keeping their boundaries
+static bool TestUnixSockets(SocketMultiplexer* pMultiplexer, const char* typeName)
+{
+  s_echoDoneEvent.Reset();
+  s_echoClientsDone = 0;
+  s_echoClientsFailed = 0;
+  s_echoClientCount = 1;
+
+  Error error;
+  SocketAddress address;
+  FileSystem::DeleteFile(UNIX_SOCKET_TEST_PATH);
+  SocketAddress::Parse(SocketAddress::Type_Unix, UNIX_SOCKET_TEST_PATH, 0, &address);
+  ListenSocket* pListenSocket = pMultiplexer->CreateListenSocket<EchoServerSocket>(&address, &error);
+  EchoClientSocket* pClient = (pListenSocket != nullptr) ?
+                                pMultiplexer->ConnectStreamSocket<EchoClientSocket>(&address, &error) :
+                                nullptr;
+
+  byte message[ECHO_MESSAGE_SIZE];
+  for (uint32 i = 0; i < ECHO_MESSAGE_SIZE; i++)
+    message[i] = ExpectedByte(i);
+
+  bool echoResult = (pClient != nullptr && pClient->GetLocalAddress()->GetType() == SocketAddress::Type_Unix &&
+                     pClient->Write(message, sizeof(message)) == sizeof(message) &&
+                     s_echoDoneEvent.TryWait((uint32)TIMEOUT_MILLISECONDS) && s_echoClientsFailed == 0);
+  if (pClient != nullptr)
+    pClient->Release();
+
+  pMultiplexer->CloseAll();
+  FileSystem::DeleteFile(UNIX_SOCKET_TEST_PATH);
+
+  // the write end of a pipe, sent with one byte and used from the other side after the local copy is closed. the
+  // data written behind it has to arrive too, though the read carrying the descriptor stops short of it.
+  bool passResult = false;
+  int pipeFileDescriptors[2];
+  BufferedStreamSocket* pFirst;
+  BufferedStreamSocket* pSecond;
+  if (pipe(pipeFileDescriptors) == 0)
+  {
+    if (pMultiplexer->CreateStreamSocketPair(&pFirst, &pSecond, &error))
+    {
+      StallingTimer stallTimer;
+      pMultiplexer->ScheduleTimer(&stallTimer, 0, pSecond);
+      passResult = (stallTimer.StartedEvent.TryWait((uint32)TIMEOUT_MILLISECONDS) &&
+                    pFirst->WriteWithFileDescriptors("x", 1, &pipeFileDescriptors[1], 1) == 1 &&
+                    pFirst->Write("hello", 5) == 5);
+      close(pipeFileDescriptors[1]);
+      stallTimer.ReleaseEvent.Signal();
+      pMultiplexer->CancelTimer(&stallTimer);
+
+      char streamData[8] = {};
+      size_t streamBytes = 0;
+      Timer timer;
+      while (passResult && (pSecond->GetReceivedFileDescriptorCount() == 0 || streamBytes < 6) &&
+             timer.GetTimeMilliseconds() < TIMEOUT_MILLISECONDS)
+      {
+        streamBytes += pSecond->Read(streamData + streamBytes, sizeof(streamData) - streamBytes);
+        Thread::Sleep(1);
+      }
+
+      int fileDescriptor = pSecond->TakeReceivedFileDescriptor();
+      char pipeData[8] = {};
+      passResult = (passResult && fileDescriptor >= 0 && write(fileDescriptor, "hello", 5) == 5 &&
+                    close(fileDescriptor) == 0 && read(pipeFileDescriptors[0], pipeData, sizeof(pipeData)) == 5 &&
+                    std::memcmp(pipeData, "hello", 5) == 0 && streamBytes == 6 &&
+                    std::memcmp(streamData, "xhello", 6) == 0);
+
+      pFirst->Release();
+      pSecond->Release();
+      pMultiplexer->CloseAll();
+    }
+    else
+    {
+      close(pipeFileDescriptors[1]);
+    }
+
+    close(pipeFileDescriptors[0]);
+  }
+
+  // each message read on its own, however quickly they follow each other
+  static const size_t PACKET_LENGTHS[] = {100, 1, 3000};
+  bool packetResult = false;
+  PacketReaderSocket* pSender;
+  PacketReaderSocket* pReceiver;
+  if (pMultiplexer->CreateStreamSocketPair(&pSender, &pReceiver, &error, SOCKET_STREAM_TYPE_SEQPACKET))
+  {
+    packetResult = true;
+    for (uint32 i = 0; i < countof(PACKET_LENGTHS); i++)
+      packetResult &= (pSender->Write(message, PACKET_LENGTHS[i]) == PACKET_LENGTHS[i]);
+
+    Timer timer;
+    while (packetResult && pReceiver->ReadCount < countof(PACKET_LENGTHS) &&
+           timer.GetTimeMilliseconds() < TIMEOUT_MILLISECONDS)
+    {
+      Thread::Sleep(1);
+    }
+
+    packetResult &= (pReceiver->ReadCount == countof(PACKET_LENGTHS));
+    for (uint32 i = 0; i < countof(PACKET_LENGTHS) && packetResult; i++)
+      packetResult = (pReceiver->ReadLengths[i] == PACKET_LENGTHS[i]);
+
+    pSender->Release();
+    pReceiver->Release();
+    pMultiplexer->CloseAll();
+  }
+
+  bool result = (echoResult && passResult && packetResult);
+  if (result)
+    Log_InfoPrintf("PASS: %s unix sockets", typeName);
+  else
+    Log_ErrorPrintf("FAIL: %s unix sockets, echo %s, descriptor passing %s, sequenced packets %s", typeName,
+                    echoResult ? "ok" : "failed", passResult ? "ok" : "failed", packetResult ? "ok" : "failed");
+
+  return result;
+}
+#endif
+
+// not a pass/fail test, logs the throughput of small messages one way over loopback
+static void BenchmarkMessages(SocketMultiplexer* pMultiplexer, const char* typeName)
+{
+  s_messagesDelimited = false;
+  s_messagesExpected = MESSAGE_BENCHMARK_COUNT;
+  s_echoDoneEvent.Reset();
+
+  Error error;
+  SocketAddress address;
+  SocketAddress::Parse(SocketAddress::Type_IPv4, "127.0.0.1", 0, &address);
+  ListenSocket* pListenSocket = pMultiplexer->CreateListenSocket<MessageClientSocket>(&address, &error);
+  MessageClientSocket* pClient =
+    (pListenSocket != nullptr) ?
+      pMultiplexer->ConnectStreamSocket<MessageClientSocket>(pListenSocket->GetLocalAddress(), &error) :
+      nullptr;
+  if (pClient == nullptr)
+  {
+    pMultiplexer->CloseAll();
+    return;
+  }
+
+  // the receiving end only counts
+  static const uint32 BATCH_SIZE = 64;
+  byte message[MESSAGE_BENCHMARK_SIZE];
+  std::memset(message, 'x', sizeof(message));
+  const void* pMessages[BATCH_SIZE];
+  size_t messageLengths[BATCH_SIZE];
+  for (uint32 i = 0; i < BATCH_SIZE; i++)
+  {
+    pMessages[i] = message;
+    messageLengths[i] = sizeof(message);
+  }
+
+  Timer timer;
+  uint32 messagesSent = 0;
+  while (messagesSent < MESSAGE_BENCHMARK_COUNT && pClient->IsConnected() &&
+         timer.GetTimeMilliseconds() < TIMEOUT_MILLISECONDS)
+  {
+    uint32 batchCount = Min(BATCH_SIZE, MESSAGE_BENCHMARK_COUNT - messagesSent);
+    uint32 sentCount = pClient->SendMessages(pMessages, messageLengths, batchCount);
+    messagesSent += sentCount;
+    if (sentCount < batchCount)
+      Thread::Sleep(0);
+  }
+
+  if (s_echoDoneEvent.TryWait((uint32)TIMEOUT_MILLISECONDS))
+  {
+    double seconds = Max(timer.GetTimeSeconds(), 0.000001);
+    Log_InfoPrintf("BENCH: %s messages, %u x %u bytes, %.0f messages/s, %.1f MB/s", typeName,
+                   MESSAGE_BENCHMARK_COUNT, MESSAGE_BENCHMARK_SIZE, (double)MESSAGE_BENCHMARK_COUNT / seconds,
+                   ((double)MESSAGE_BENCHMARK_COUNT * (MESSAGE_BENCHMARK_SIZE + 4) / 1048576.0) / seconds);
+  }
+
+  pClient->Release();
+  pMultiplexer->CloseAll();
+}
+
+// many small messages arriving in one burst, so a single read event leaves megabytes of frames to parse
+static bool TestMessageBacklog(SocketMultiplexer* pMultiplexer, const char* typeName)
+{
+  s_messagesDelimited = false;
+  s_messagesExpected = MESSAGE_BACKLOG_COUNT;
+  s_echoDoneEvent.Reset();
+  BacklogMessageSocket::s_pInstance = nullptr;
+
+  Error error;
+  SocketAddress address;
+  SocketAddress::Parse(SocketAddress::Type_IPv4, "127.0.0.1", 0, &address);
+  ListenSocket* pListenSocket = pMultiplexer->CreateListenSocket<BacklogMessageSocket>(&address, &error);
+  MessageClientSocket* pClient =
+    (pListenSocket != nullptr) ?
+      pMultiplexer->ConnectStreamSocket<MessageClientSocket>(pListenSocket->GetLocalAddress(), &error) :
+      nullptr;
+
+  Timer timer;
+  while (pClient != nullptr && BacklogMessageSocket::s_pInstance == nullptr &&
+         timer.GetTimeMilliseconds() < TIMEOUT_MILLISECONDS)
+  {
+    Thread::Sleep(1);
+  }
+
+  BacklogMessageSocket* pReceiver = BacklogMessageSocket::s_pInstance;
+  if (pReceiver == nullptr)
+  {
+    Log_ErrorPrintf("FAIL: %s message backlog, could not connect", typeName);
+    if (pClient != nullptr)
+      pClient->Release();
+    pMultiplexer->CloseAll();
+    return false;
+  }
+
+  // hold up the receiver's loop until everything is sitting in the kernel, which takes a few megabytes on loopback
+  StallingTimer stallTimer;
+  pMultiplexer->ScheduleTimer(&stallTimer, 0, pReceiver);
+  bool result = stallTimer.StartedEvent.TryWait((uint32)TIMEOUT_MILLISECONDS);
+
+  static const uint32 BATCH_SIZE = 64;
+  byte message[MESSAGE_BACKLOG_SIZE];
+  std::memset(message, 'm', sizeof(message));
+  const void* pMessages[BATCH_SIZE];
+  size_t messageLengths[BATCH_SIZE];
+  for (uint32 i = 0; i < BATCH_SIZE; i++)
+  {
+    pMessages[i] = message;
+    messageLengths[i] = sizeof(message);
+  }
+
+  uint32 messagesSent = 0;
+  while (result && messagesSent < MESSAGE_BACKLOG_COUNT && timer.GetTimeMilliseconds() < TIMEOUT_MILLISECONDS)
+  {
+    uint32 batchCount = Min(BATCH_SIZE, MESSAGE_BACKLOG_COUNT - messagesSent);
+    uint32 sentCount = pClient->SendMessages(pMessages, messageLengths, batchCount);
+    messagesSent += sentCount;
+    if (sentCount < batchCount)
+      Thread::Sleep(1);
+  }
+  while (result && pClient->GetQueuedSendBytes() > 0 && timer.GetTimeMilliseconds() < TIMEOUT_MILLISECONDS)
+    Thread::Sleep(1);
+
+  stallTimer.ReleaseEvent.Signal();
+  pMultiplexer->CancelTimer(&stallTimer);
+
+  result = (result && messagesSent == MESSAGE_BACKLOG_COUNT && s_echoDoneEvent.TryWait((uint32)TIMEOUT_MILLISECONDS) &&
+            pReceiver->MessagesReceived == MESSAGE_BACKLOG_COUNT);
+  if (result)
+    Log_InfoPrintf("PASS: %s message backlog", typeName);
+  else
+    Log_ErrorPrintf("FAIL: %s message backlog, %u sent, %u received", typeName, messagesSent,
+                    pReceiver->MessagesReceived);
+
+  pClient->Release();
+  pMultiplexer->CloseAll();
+  return result;
+}
+
+// connections made while worker threads run keep working once they're stopped and the caller polls instead, as do
+// their timers and connections made afterwards
+static bool TestStoppedWorkers(SocketMultiplexer* pMultiplexer, const char* typeName)
+{
+  static const uint32 CLIENTS_BEFORE_STOP = WORKER_THREAD_COUNT * 2;
+  static const uint32 CLIENTS_AFTER_STOP = 2;
+
+  Error error;
+  SocketAddress address;
+  SocketAddress::Parse(SocketAddress::Type_IPv4, "127.0.0.1", 0, &address);
+  ListenSocket* pListenSocket = pMultiplexer->CreateListenSocket<EchoServerSocket>(&address, &error);
+  if (pListenSocket == nullptr)
+  {
+    Log_ErrorPrintf("FAIL: %s stopped workers, could not listen", typeName);
+    return false;
+  }
+
+  s_echoDoneEvent.Reset();
+  s_echoClientsDone = 0;
+  s_echoClientsFailed = 0;
+  s_echoThreadCount = 0;
+  s_echoClientCount = CLIENTS_BEFORE_STOP + CLIENTS_AFTER_STOP;
+
+  byte message[ECHO_MESSAGE_SIZE];
+  for (uint32 i = 0; i < ECHO_MESSAGE_SIZE; i++)
+    message[i] = ExpectedByte(i);
+
+  // wait for the connections to be accepted, so the server ends are spread across the loops as well
+  EchoClientSocket* pClients[CLIENTS_BEFORE_STOP + CLIENTS_AFTER_STOP] = {};
+  bool result = true;
+  for (uint32 i = 0; i < CLIENTS_BEFORE_STOP && result; i++)
+  {
+    pClients[i] = pMultiplexer->ConnectStreamSocket<EchoClientSocket>(pListenSocket->GetLocalAddress(), &error);
+    result = (pClients[i] != nullptr);
+  }
+
+  Timer timer;
+  while (result && pListenSocket->GetConnectionsAccepted() < CLIENTS_BEFORE_STOP &&
+         timer.GetTimeMilliseconds() < TIMEOUT_MILLISECONDS)
+  {
+    Thread::Sleep(1);
+  }
+
+  RecordingTimer recordingTimer;
+  recordingTimer.pClock = &timer;
+  if (result)
+    pMultiplexer->ScheduleTimer(&recordingTimer, TIMER_DELAY_MILLISECONDS, pClients[CLIENTS_BEFORE_STOP - 1]);
+
+  pMultiplexer->StopWorkerThreads();
+
+  for (uint32 i = CLIENTS_BEFORE_STOP; i < countof(pClients) && result; i++)
+  {
+    pClients[i] = pMultiplexer->ConnectStreamSocket<EchoClientSocket>(pListenSocket->GetLocalAddress(), &error);
+    result = (pClients[i] != nullptr);
+  }
+  for (uint32 i = 0; i < countof(pClients) && result; i++)
+    result = (pClients[i]->Write(message, sizeof(message)) == sizeof(message));
+
+  bool echoed = false;
+  while (result && (!echoed || recordingTimer.FireCount == 0) && timer.GetTimeMilliseconds() < TIMEOUT_MILLISECONDS)
+  {
+    pMultiplexer->PollEvents(10);
+    echoed = (echoed || s_echoDoneEvent.TryWait(0));
+  }
+
+  result = (result && echoed && s_echoClientsFailed == 0 && recordingTimer.FireCount == 1 &&
+            pListenSocket->GetConnectionsAccepted() == countof(pClients));
+  if (result)
+    Log_InfoPrintf("PASS: %s stopped workers, %u connections echoed by polling", typeName, s_echoClientCount);
+  else
+    Log_ErrorPrintf("FAIL: %s stopped workers, %u of %u connections done, timer fired %u times", typeName,
+                    s_echoClientsDone, s_echoClientCount, recordingTimer.FireCount);
+
+  pMultiplexer->CancelTimer(&recordingTimer);
+  for (uint32 i = 0; i < countof(pClients); i++)
+  {
+    if (pClients[i] != nullptr)
+      pClients[i]->Release();
+  }
+
+  pMultiplexer->CloseAll();
+  return result;
+}
+
+DEFINE_TEST_SUITE(Sockets)
+{
+  static const struct
+  {
+    SOCKET_MULTIPLEXER_TYPE Type;
+    const char* Name;
+  } types[] = {{SOCKET_MULTIPLEXER_TYPE_GENERIC, "generic"}, {SOCKET_MULTIPLEXER_TYPE_EPOLL, "epoll"}};
+
+  bool result = TestTimerWheel();
+  for (uint32 i = 0; i < countof(types); i++)
+  {
+    Error error;
+    SocketMultiplexer* pMultiplexer = SocketMultiplexer::Create(&error, types[i].Type);
+    if (pMultiplexer == nullptr)
+    {
+      Log_InfoPrintf("SKIP: %s multiplexer, not supported", types[i].Name);
+      continue;
+    }
+
+    if (pMultiplexer->CreateWorkerThreads(WORKER_THREAD_COUNT) != WORKER_THREAD_COUNT)
+    {
+      Log_ErrorPrintf("FAIL: %s multiplexer worker thread", types[i].Name);
+      delete pMultiplexer;
+      result = false;
+      continue;
+    }
+
+    result &= TestEcho(pMultiplexer, types[i].Name);
+    result &= TestFullReceiveBuffer(pMultiplexer, types[i].Name);
+    result &= TestBufferedSend(pMultiplexer, types[i].Name);
+    result &= TestBackpressure(pMultiplexer, types[i].Name);
+    result &= TestSendFile(pMultiplexer, types[i].Name);
+    result &= TestZeroCopy(pMultiplexer, types[i].Name);
+    result &= TestTimers(pMultiplexer, types[i].Name);
+    result &= TestMessages(pMultiplexer, types[i].Name, false);
+    result &= TestMessages(pMultiplexer, types[i].Name, true);
+    result &= TestMessageBacklog(pMultiplexer, types[i].Name);
+    result &= TestDatagrams(pMultiplexer, types[i].Name, false, false);
+    result &= TestDatagrams(pMultiplexer, types[i].Name, true, false);
+    result &= TestDatagrams(pMultiplexer, types[i].Name, true, true);
+#ifndef Y_PLATFORM_WINDOWS
+    result &= TestUnixSockets(pMultiplexer, types[i].Name);
+#endif
+    BenchmarkMessages(pMultiplexer, types[i].Name);
+
+    // last, as it leaves the multiplexer without worker threads
+    result &= TestStoppedWorkers(pMultiplexer, types[i].Name);
+    delete pMultiplexer;
+  }
+
+  return result;
+}
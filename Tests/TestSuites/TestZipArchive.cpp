@@ -0,0 +1,896 @@
+#include "TestSuite.h"
+
+#ifdef HAVE_ZLIB
+#include "YBaseLib/Array.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/FileSystem.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/ThreadPool.h"
+#include "YBaseLib/Timer.h"
+#include "YBaseLib/ZipArchive.h"
+#include <cstring>
+Log_SetChannel(TestZipArchive);
+
+static const uint32 SMALL_ENTRY_COUNT = 64;
+static const uint32 LARGE_ENTRY_SIZE = 1024 * 1024 + 4321;
+
+// compressible, but different for every entry and offset
+static void FillEntryData(byte* pData, uint32 size, uint32 seed)
+{
+  uint32 state = seed * 2654435761u + 1;
+  for (uint32 i = 0; i < size; i++)
+  {
+    if ((i % 64) == 0)
+      state = state * 1103515245u + 12345u;
+
+    pData[i] = (byte)('a' + ((state >> 16) + (i % 7)) % 26);
+  }
+}
+
+static bool WriteEntry(ZipArchive* pArchive, const char* fileName, uint32 size, uint32 seed, bool streamed,
+                       uint32 compressionLevel = 6, COMPRESSION_CODEC codec = COMPRESSION_CODEC_DEFLATE)
+{
+  byte* pData = new byte[size];
+  FillEntryData(pData, size, seed);
+
+  uint32 openMode = BYTESTREAM_OPEN_WRITE | ((streamed) ? BYTESTREAM_OPEN_STREAMED : BYTESTREAM_OPEN_SEEKABLE);
+  ByteStream* pStream = pArchive->OpenFile(fileName, openMode, compressionLevel, codec);
+  bool result = (pStream != nullptr);
+  if (result)
+  {
+    // odd-sized writes, so streamed blocks fill up part-way through a call
+    for (uint32 offset = 0; offset < size && result;)
+    {
+      uint32 writeSize = Min(size - offset, (uint32)10007);
+      result = (pStream->Write(pData + offset, writeSize) == writeSize);
+      offset += writeSize;
+    }
+
+    pStream->Release();
+  }
+
+  delete[] pData;
+  return result;
+}
+
+static bool VerifyEntry(ZipArchive* pArchive, const char* fileName, uint32 size, uint32 seed, bool streamed)
+{
+  uint32 openMode = BYTESTREAM_OPEN_READ | ((streamed) ? BYTESTREAM_OPEN_STREAMED : BYTESTREAM_OPEN_SEEKABLE);
+  ByteStream* pStream = pArchive->OpenFile(fileName, openMode);
+  if (pStream == nullptr)
+    return false;
+
+  byte* pExpected = new byte[size];
+  byte* pData = new byte[size + 1];
+  FillEntryData(pExpected, size, seed);
+
+  bool result = (pStream->GetSize() == size && pStream->Read(pData, size) == size &&
+                 pStream->Read(pData + size, 1) == 0 && std::memcmp(pData, pExpected, size) == 0);
+
+  pStream->Release();
+  delete[] pData;
+  delete[] pExpected;
+  return result;
+}
+
+static bool TestParallelCompression()
+{
+  ByteStream* pArchiveStream = ByteStream_CreateGrowableMemoryStream();
+  ZipArchive* pArchive = ZipArchive::CreateArchive(pArchiveStream);
+  ThreadPool threadPool(4);
+  pArchive->SetCompressionThreadPool(&threadPool, 64 * 1024);
+
+  bool result = true;
+  SmallString fileName;
+  for (uint32 i = 0; i < SMALL_ENTRY_COUNT; i++)
+  {
+    fileName.Format("small/%u.txt", i);
+    result &= WriteEntry(pArchive, fileName, 1000 + i * 137, i, false, (i % 3 == 0) ? 0 : 6);
+  }
+
+  // split into blocks, buffered and streamed
+  result &= WriteEntry(pArchive, "large_buffered.bin", LARGE_ENTRY_SIZE, 1000, false);
+  result &= WriteEntry(pArchive, "large_streamed.bin", LARGE_ENTRY_SIZE, 1001, true);
+  result &= WriteEntry(pArchive, "empty.bin", 0, 1002, false);
+  result &= WriteEntry(pArchive, "small/0.txt", 5000, 1003, false);
+
+  FILESYSTEM_STAT_DATA statData;
+  result &= (pArchive->StatFile("large_buffered.bin", &statData) && statData.Size == LARGE_ENTRY_SIZE);
+
+  if (!result || !pArchive->CommitChanges())
+  {
+    Log_ErrorPrintf("FAIL: parallel compression writes");
+    result = false;
+  }
+
+  // read back through a fresh archive, so the central directory gets parsed too
+  ZipArchive* pReadArchive = ZipArchive::OpenArchiveReadOnly(pArchiveStream);
+  if (pReadArchive != nullptr)
+  {
+    for (uint32 i = 1; i < SMALL_ENTRY_COUNT; i++)
+    {
+      fileName.Format("small/%u.txt", i);
+      result &= VerifyEntry(pReadArchive, fileName, 1000 + i * 137, i, (i % 2) == 0);
+    }
+
+    result &= VerifyEntry(pReadArchive, "small/0.txt", 5000, 1003, false);
+    result &= VerifyEntry(pReadArchive, "large_buffered.bin", LARGE_ENTRY_SIZE, 1000, false);
+    result &= VerifyEntry(pReadArchive, "large_buffered.bin", LARGE_ENTRY_SIZE, 1000, true);
+    result &= VerifyEntry(pReadArchive, "large_streamed.bin", LARGE_ENTRY_SIZE, 1001, false);
+    result &= VerifyEntry(pReadArchive, "empty.bin", 0, 1002, false);
+    delete pReadArchive;
+  }
+  else
+  {
+    result = false;
+  }
+
+  if (result)
+  {
+    Log_InfoPrintf("PASS: parallel compression, archive size %u", (uint32)pArchiveStream->GetSize());
+  }
+  else
+  {
+    Log_ErrorPrintf("FAIL: parallel compression read back");
+  }
+
+  delete pArchive;
+  pArchiveStream->Release();
+  return result;
+}
+
+// collects extracted entries in memory streams
+class TestExtractSink : public ZipArchiveExtractSink
+{
+public:
+  ~TestExtractSink()
+  {
+    for (uint32 i = 0; i < m_streams.GetSize(); i++)
+      m_streams[i]->Release();
+  }
+
+  virtual bool OpenEntry(const char* filename, const FILESYSTEM_STAT_DATA* pStatData, ByteStream** ppStream) override
+  {
+    GrowableMemoryByteStream* pStream = ByteStream_CreateGrowableMemoryStream();
+    pStream->AddRef();
+    m_names.Add(filename);
+    m_streams.Add(pStream);
+    m_closed.Add(false);
+    m_succeeded.Add(false);
+    *ppStream = pStream;
+    return true;
+  }
+
+  virtual bool CloseEntry(const char* filename, ByteStream* pStream, bool success) override
+  {
+    uint32 index = FindEntry(filename);
+    if (index == m_names.GetSize() || m_streams[index] != pStream || m_closed[index])
+      return false;
+
+    m_closed[index] = true;
+    m_succeeded[index] = success;
+    return success;
+  }
+
+  uint32 GetEntryCount() const { return m_names.GetSize(); }
+
+  bool VerifyEntry(const char* filename, uint32 size, uint32 seed) const
+  {
+    uint32 index = FindEntry(filename);
+    if (index == m_names.GetSize() || !m_closed[index] || !m_succeeded[index] || m_streams[index]->GetSize() != size)
+      return false;
+
+    byte* pExpected = new byte[size];
+    FillEntryData(pExpected, size, seed);
+    bool result = (std::memcmp(m_streams[index]->GetMemoryPointer(), pExpected, size) == 0);
+    delete[] pExpected;
+    return result;
+  }
+
+  bool EntryFailed(const char* filename) const
+  {
+    uint32 index = FindEntry(filename);
+    return (index != m_names.GetSize() && m_closed[index] && !m_succeeded[index]);
+  }
+
+private:
+  uint32 FindEntry(const char* filename) const
+  {
+    uint32 i;
+    for (i = 0; i < m_names.GetSize(); i++)
+    {
+      if (m_names[i].Compare(filename))
+        break;
+    }
+    return i;
+  }
+
+  Array<String> m_names;
+  PODArray<GrowableMemoryByteStream*> m_streams;
+  PODArray<bool> m_closed;
+  PODArray<bool> m_succeeded;
+};
+
+static bool TestBulkExtraction()
+{
+  ByteStream* pArchiveStream = ByteStream_CreateGrowableMemoryStream();
+  ZipArchive* pArchive = ZipArchive::CreateArchive(pArchiveStream);
+
+  bool result = true;
+  SmallString fileName;
+  for (uint32 i = 0; i < SMALL_ENTRY_COUNT; i++)
+  {
+    fileName.Format("small/%u.txt", i);
+    result &= WriteEntry(pArchive, fileName, 1000 + i * 137, i, false, (i % 3 == 0) ? 0 : 6);
+  }
+
+  // larger than a single read, and entries either side of it
+  result &= WriteEntry(pArchive, "large/a.bin", 6 * 1024 * 1024, 2000, false);
+  result &= WriteEntry(pArchive, "large/b.bin", LARGE_ENTRY_SIZE, 2001, false, 0);
+  result &= WriteEntry(pArchive, "empty.bin", 0, 2002, false);
+  result &= pArchive->CommitChanges();
+  delete pArchive;
+
+  ZipArchive* pReadArchive = ZipArchive::OpenArchiveReadOnly(pArchiveStream);
+  ThreadPool threadPool(4);
+  for (uint32 pass = 0; pass < 2 && pReadArchive != nullptr; pass++)
+  {
+    TestExtractSink sink;
+    result &= pReadArchive->ExtractAll(&sink, (pass == 0) ? nullptr : &threadPool);
+    result &= (sink.GetEntryCount() == SMALL_ENTRY_COUNT + 3);
+    for (uint32 i = 0; i < SMALL_ENTRY_COUNT; i++)
+    {
+      fileName.Format("small/%u.txt", i);
+      result &= sink.VerifyEntry(fileName, 1000 + i * 137, i);
+    }
+    result &= sink.VerifyEntry("large/a.bin", 6 * 1024 * 1024, 2000);
+    result &= sink.VerifyEntry("large/b.bin", LARGE_ENTRY_SIZE, 2001);
+    result &= sink.VerifyEntry("empty.bin", 0, 2002);
+  }
+
+  if (pReadArchive != nullptr)
+  {
+    TestExtractSink sink;
+    result &= pReadArchive->ExtractMatching("large/*", &sink, &threadPool);
+    result &= (sink.GetEntryCount() == 2 && sink.VerifyEntry("large/b.bin", LARGE_ENTRY_SIZE, 2001));
+    delete pReadArchive;
+  }
+  else
+  {
+    result = false;
+  }
+
+  // damage the stored entry's data, only that entry should fail
+  GrowableMemoryByteStream* pDamagedStream = ByteStream_CreateGrowableMemoryStream();
+  pDamagedStream->Write(static_cast<GrowableMemoryByteStream*>(pArchiveStream)->GetMemoryPointer(),
+                        (uint32)pArchiveStream->GetSize());
+  pReadArchive = ZipArchive::OpenArchiveReadOnly(pDamagedStream);
+  if (pReadArchive != nullptr)
+  {
+    TestExtractSink sink;
+    byte* pMemory = pDamagedStream->GetMemoryPointer();
+    for (uint32 i = 0; i + 11 <= pDamagedStream->GetMemorySize(); i++)
+    {
+      if (std::memcmp(pMemory + i, "large/b.bin", 11) == 0)
+      {
+        pMemory[i + 11 + 1000] ^= 0xFF; // name is the last thing in the local header
+        break;
+      }
+    }
+
+    result &= !pReadArchive->ExtractAll(&sink, &threadPool);
+    result &= (sink.EntryFailed("large/b.bin") && sink.VerifyEntry("large/a.bin", 6 * 1024 * 1024, 2000));
+    delete pReadArchive;
+  }
+  else
+  {
+    result = false;
+  }
+
+  if (result)
+    Log_InfoPrintf("PASS: bulk extraction");
+  else
+    Log_ErrorPrintf("FAIL: bulk extraction");
+
+  pDamagedStream->Release();
+  pArchiveStream->Release();
+  return result;
+}
+
+static bool VerifyIndexedArchive(ZipArchive* pArchive, uint32 entryCount)
+{
+  bool result = pArchive->IsIndexed();
+  SmallString fileName;
+  FILESYSTEM_STAT_DATA statData;
+  for (uint32 i = 0; i < entryCount && result; i++)
+  {
+    fileName.Format("dir%u/%u.txt", i % 10, i);
+    result &= (pArchive->StatFile(fileName, &statData) && statData.Size == 20 + (i % 100));
+  }
+
+  // lookups are case-insensitive, as with the full table
+  result &= VerifyEntry(pArchive, "DIR3/1233.TXT", 20 + 33, 1233, false);
+  result &= VerifyEntry(pArchive, "dir7/7.txt", 20 + 7, 7, true);
+  result &= VerifyEntry(pArchive, "dir0/0.txt", 20, 0, false);
+  result &= !pArchive->StatFile("dir0/missing.txt", &statData);
+  result &= (pArchive->OpenFile("dir0", BYTESTREAM_OPEN_READ) == nullptr);
+
+  FileSystem::FindResultsArray findResults;
+  result &= (pArchive->FindFiles("dir4", "*", 0, &findResults) && findResults.GetSize() == entryCount / 10);
+  result &= (pArchive->FindFiles("dir4", "14.txt", 0, &findResults) && findResults.GetSize() == 1);
+
+  TestExtractSink sink;
+  result &= (pArchive->ExtractMatching("dir5/*5.txt", &sink) && sink.GetEntryCount() == entryCount / 10);
+  result &= sink.VerifyEntry("dir5/105.txt", 20 + 5, 105);
+
+  // copying out of an indexed archive works, writing to it does not
+  ByteStream* pCopyStream = ByteStream_CreateGrowableMemoryStream();
+  ZipArchive* pCopyArchive = ZipArchive::CreateArchive(pCopyStream);
+  result &= (pCopyArchive->CopyFile(pArchive, "dir2/12.txt") && pCopyArchive->CommitChanges());
+  result &= VerifyEntry(pCopyArchive, "dir2/12.txt", 20 + 12, 12, false);
+  result &= !pArchive->UpgradeToWritableArchive(pCopyStream);
+  delete pCopyArchive;
+  pCopyStream->Release();
+  return result;
+}
+
+static bool TestIndexedOpen()
+{
+  // more entries than the 16-bit count in the end record can hold
+  static const uint32 ENTRY_COUNT = 70000;
+  static const char* ARCHIVE_FILE_NAME = "TestZipArchiveIndexed.zip";
+
+  ByteStream* pArchiveStream = ByteStream_CreateGrowableMemoryStream();
+  ZipArchive* pArchive = ZipArchive::CreateArchive(pArchiveStream);
+  bool result = true;
+  SmallString fileName;
+  for (uint32 i = 0; i < ENTRY_COUNT && result; i++)
+  {
+    fileName.Format("dir%u/%u.txt", i % 10, i);
+    result &= WriteEntry(pArchive, fileName, 20 + (i % 100), i, false, (i % 2) ? 6 : 0);
+  }
+  result &= pArchive->CommitChanges();
+  delete pArchive;
+
+  ByteStream* pFileStream;
+  result &= ByteStream_OpenFileStream(ARCHIVE_FILE_NAME, BYTESTREAM_OPEN_CREATE | BYTESTREAM_OPEN_WRITE |
+                                                           BYTESTREAM_OPEN_TRUNCATE, &pFileStream);
+  if (result)
+  {
+    result &= ByteStream_CopyStream(pFileStream, pArchiveStream);
+    pFileStream->Release();
+  }
+  pArchiveStream->Release();
+
+  // in place over a mapping
+  ByteStream* pMappedStream;
+  if (result && ByteStream_OpenMappedFileStream(ARCHIVE_FILE_NAME, &pMappedStream))
+  {
+    result &= (pMappedStream->GetMemoryBasePointer() != nullptr);
+    ZipArchive* pIndexedArchive = ZipArchive::OpenArchiveIndexed(pMappedStream);
+    result &= (pIndexedArchive != nullptr && VerifyIndexedArchive(pIndexedArchive, ENTRY_COUNT));
+    delete pIndexedArchive;
+
+    // the entry count only fits in the zip64 end record, so a full parse relies on it too
+    ZipArchive* pParsedArchive = ZipArchive::OpenArchiveReadOnly(pMappedStream);
+    result &= (pParsedArchive != nullptr && !pParsedArchive->IsIndexed());
+    if (pParsedArchive != nullptr)
+    {
+      FileSystem::FindResultsArray findResults;
+      result &= (pParsedArchive->FindFiles("dir9", "*", 0, &findResults) && findResults.GetSize() == ENTRY_COUNT / 10);
+      result &= VerifyEntry(pParsedArchive, "dir9/69999.txt", 20 + 99, 69999, false);
+      delete pParsedArchive;
+    }
+    pMappedStream->Release();
+  }
+  else
+  {
+    result = false;
+  }
+
+  // copied out of a plain file stream
+  if (result && ByteStream_OpenFileStream(ARCHIVE_FILE_NAME, BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_SEEKABLE,
+                                          &pFileStream))
+  {
+    ZipArchive* pIndexedArchive = ZipArchive::OpenArchiveIndexed(pFileStream);
+    pFileStream->Release();
+    result &= (pIndexedArchive != nullptr && VerifyIndexedArchive(pIndexedArchive, ENTRY_COUNT));
+    delete pIndexedArchive;
+  }
+  else
+  {
+    result = false;
+  }
+
+  FileSystem::DeleteFile(ARCHIVE_FILE_NAME);
+
+  if (result)
+    Log_InfoPrintf("PASS: indexed open");
+  else
+    Log_ErrorPrintf("FAIL: indexed open");
+
+  return result;
+}
+
+static bool TestStoredViews()
+{
+  static const uint32 ENTRY_SIZE = 300000;
+
+  GrowableMemoryByteStream* pArchiveStream = ByteStream_CreateGrowableMemoryStream();
+  ZipArchive* pArchive = ZipArchive::CreateArchive(pArchiveStream);
+  bool result = WriteEntry(pArchive, "stored.bin", ENTRY_SIZE, 3000, false, 0);
+  result &= WriteEntry(pArchive, "deflated.bin", ENTRY_SIZE, 3001, false);
+  result &= pArchive->CommitChanges();
+  delete pArchive;
+
+  ZipArchive* pReadArchive = ZipArchive::OpenArchiveReadOnly(pArchiveStream);
+  const byte* pArchiveMemory = pArchiveStream->GetMemoryPointer();
+  uint32 dataOffset = 0;
+  if (pReadArchive != nullptr)
+  {
+    result &= VerifyEntry(pReadArchive, "stored.bin", ENTRY_SIZE, 3000, false);
+    result &= VerifyEntry(pReadArchive, "stored.bin", ENTRY_SIZE, 3000, true);
+    result &= VerifyEntry(pReadArchive, "deflated.bin", ENTRY_SIZE, 3001, false);
+
+    // memory is only handed out once the CRC has been checked
+    ByteStream* pStream = pReadArchive->OpenFile("stored.bin", BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_SEEKABLE);
+    byte buffer[16];
+    result &= (pStream != nullptr && pStream->GetMemoryBasePointer() == nullptr);
+    result &= (pStream != nullptr && pStream->SeekAbsolute(ENTRY_SIZE - 16) && pStream->Read(buffer, 16) == 16);
+    result &= (pStream != nullptr && pStream->GetMemoryBasePointer() != nullptr);
+    if (pStream != nullptr)
+      pStream->Release();
+
+    pReadArchive->SetVerifyStoredEntryCRC(false);
+    pStream = pReadArchive->OpenFile("stored.bin", BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_STREAMED);
+    result &= (pStream != nullptr && pStream->GetMemoryBasePointer() > pArchiveMemory);
+    if (pStream != nullptr)
+    {
+      dataOffset = (uint32)(pStream->GetMemoryBasePointer() - pArchiveMemory);
+      pStream->Release();
+    }
+
+    // views keep the archive's stream alive
+    pStream = pReadArchive->OpenFile("stored.bin", BYTESTREAM_OPEN_READ);
+    delete pReadArchive;
+    result &= (pStream != nullptr && pStream->Read(buffer, 16) == 16 && pStream->SeekToEnd());
+    if (pStream != nullptr)
+      pStream->Release();
+  }
+  else
+  {
+    result = false;
+  }
+
+  // damage the end of the entry, reads should fail once they get there, unless verification is off
+  GrowableMemoryByteStream* pDamagedStream = ByteStream_CreateGrowableMemoryStream();
+  pDamagedStream->Write(pArchiveMemory, (uint32)pArchiveStream->GetSize());
+  pDamagedStream->GetMemoryPointer()[dataOffset + ENTRY_SIZE - 1] ^= 0xFF;
+  pReadArchive = ZipArchive::OpenArchiveReadOnly(pDamagedStream);
+  if (pReadArchive != nullptr && dataOffset != 0)
+  {
+    byte* pData = new byte[ENTRY_SIZE];
+    ByteStream* pStream = pReadArchive->OpenFile("stored.bin", BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_SEEKABLE);
+    result &= (pStream != nullptr && pStream->Read(pData, ENTRY_SIZE - 1) == ENTRY_SIZE - 1);
+    result &= (pStream != nullptr && pStream->Read(pData, 1) == 0 && pStream->InErrorState());
+    if (pStream != nullptr)
+      pStream->Release();
+
+    pReadArchive->SetVerifyStoredEntryCRC(false);
+    pStream = pReadArchive->OpenFile("stored.bin", BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_SEEKABLE);
+    result &= (pStream != nullptr && pStream->Read(pData, ENTRY_SIZE) == ENTRY_SIZE);
+    if (pStream != nullptr)
+      pStream->Release();
+
+    delete[] pData;
+    delete pReadArchive;
+  }
+  else
+  {
+    delete pReadArchive;
+    result = false;
+  }
+
+  if (result)
+    Log_InfoPrintf("PASS: stored entry views");
+  else
+    Log_ErrorPrintf("FAIL: stored entry views");
+
+  pDamagedStream->Release();
+  pArchiveStream->Release();
+  return result;
+}
+
+static bool TestAppendCommit()
+{
+  static const uint32 ENTRY_COUNT = 16;
+
+  // starts empty, so the first commit creates the archive
+  GrowableMemoryByteStream* pArchiveStream = ByteStream_CreateGrowableMemoryStream();
+  ZipArchive* pArchive = ZipArchive::OpenArchiveForAppend(pArchiveStream);
+  bool result = (pArchive != nullptr && pArchive->IsAppending());
+  SmallString fileName;
+  for (uint32 i = 0; i < ENTRY_COUNT && result; i++)
+  {
+    fileName.Format("entries/%u.bin", i);
+    result &= WriteEntry(pArchive, fileName, LARGE_ENTRY_SIZE / 4 + i, i, (i % 2) == 0, (i % 3 == 0) ? 0 : 6);
+  }
+  result &= pArchive->CommitChanges();
+  delete pArchive;
+
+  // replacing one entry (stored) and deleting another appends the new data and a directory, nothing else is rewritten
+  uint64 initialSize = pArchiveStream->GetSize();
+  pArchive = ZipArchive::OpenArchiveForAppend(pArchiveStream);
+  // streamed entries' headers have unused room for zip64 sizes, which counts as reclaimable
+  result &= (pArchive != nullptr && pArchive->GetReclaimableBytes() < ENTRY_COUNT * 32);
+  result &= WriteEntry(pArchive, "entries/3.bin", 1000, 100, false);
+  result &= pArchive->DeleteFile("entries/4.bin");
+  result &= VerifyEntry(pArchive, "entries/3.bin", 1000, 100, false);
+  result &= VerifyEntry(pArchive, "entries/5.bin", LARGE_ENTRY_SIZE / 4 + 5, 5, true);
+  result &= pArchive->CommitChanges();
+  result &= (pArchiveStream->GetSize() > initialSize && pArchiveStream->GetSize() < initialSize + 4096);
+  result &= (pArchive->IsWritable() && pArchive->GetReclaimableBytes() > LARGE_ENTRY_SIZE / 4);
+
+  // discarding after appending has to leave the committed directory at the end
+  result &= WriteEntry(pArchive, "discarded.bin", 256 * 1024, 101, false);
+  result &= pArchive->DeleteFile("entries/6.bin");
+  result &= pArchive->DiscardChanges();
+  result &= VerifyEntry(pArchive, "entries/6.bin", LARGE_ENTRY_SIZE / 4 + 6, 6, false);
+  delete pArchive;
+
+  ZipArchive* pReadArchive = ZipArchive::OpenArchiveReadOnly(pArchiveStream);
+  FILESYSTEM_STAT_DATA statData;
+  result &= (pReadArchive != nullptr);
+  for (uint32 i = 0; i < ENTRY_COUNT && result; i++)
+  {
+    fileName.Format("entries/%u.bin", i);
+    if (i == 3)
+      result &= VerifyEntry(pReadArchive, fileName, 1000, 100, false);
+    else if (i == 4)
+      result &= !pReadArchive->StatFile(fileName, &statData);
+    else
+      result &= VerifyEntry(pReadArchive, fileName, LARGE_ENTRY_SIZE / 4 + i, i, false);
+  }
+  result &= (pReadArchive != nullptr && !pReadArchive->StatFile("discarded.bin", &statData));
+  delete pReadArchive;
+
+  // compaction drops the dead space, and appending continues in the new stream
+  pArchive = ZipArchive::OpenArchiveForAppend(pArchiveStream);
+  GrowableMemoryByteStream* pCompactStream = ByteStream_CreateGrowableMemoryStream();
+  result &= (pArchive != nullptr && pArchive->Compact(pCompactStream));
+  result &= (pCompactStream->GetSize() < pArchiveStream->GetSize() && pArchive->GetReclaimableBytes() == 0);
+  result &= WriteEntry(pArchive, "after_compact.bin", 5000, 102, false);
+  result &= pArchive->CommitChanges();
+  delete pArchive;
+
+  pReadArchive = ZipArchive::OpenArchiveReadOnly(pCompactStream);
+  result &= (pReadArchive != nullptr && VerifyEntry(pReadArchive, "after_compact.bin", 5000, 102, false));
+  result &= (pReadArchive != nullptr && VerifyEntry(pReadArchive, "entries/3.bin", 1000, 100, true));
+  result &=
+    (pReadArchive != nullptr && VerifyEntry(pReadArchive, "entries/15.bin", LARGE_ENTRY_SIZE / 4 + 15, 15, true));
+  delete pReadArchive;
+
+  if (result)
+    Log_InfoPrintf("PASS: append commit");
+  else
+    Log_ErrorPrintf("FAIL: append commit");
+
+  pCompactStream->Release();
+  pArchiveStream->Release();
+  return result;
+}
+
+// discards everything written, keeping a count
+class TestCountingSink : public ZipArchiveExtractSink
+{
+public:
+  TestCountingSink() : m_pStream(ByteStream_CreateNullStream()), m_closedCount(0), m_failedCount(0) {}
+  ~TestCountingSink() { m_pStream->Release(); }
+
+  virtual bool OpenEntry(const char* filename, const FILESYSTEM_STAT_DATA* pStatData, ByteStream** ppStream) override
+  {
+    // the caller releases the stream once the entry is closed
+    m_pStream->AddRef();
+    *ppStream = m_pStream;
+    return true;
+  }
+
+  virtual bool CloseEntry(const char* filename, ByteStream* pStream, bool success) override
+  {
+    m_closedCount++;
+    m_failedCount += (success) ? 0 : 1;
+    return success;
+  }
+
+  uint32 GetClosedCount() const { return m_closedCount; }
+  uint32 GetFailedCount() const { return m_failedCount; }
+
+private:
+  ByteStream* m_pStream;
+  uint32 m_closedCount;
+  uint32 m_failedCount;
+};
+
+static bool ReadZeroEntry(ZipArchive* pArchive, const char* fileName, uint64 size, uint32 openMode)
+{
+  static const uint32 CHUNK_SIZE = 1024 * 1024;
+
+  ByteStream* pStream = pArchive->OpenFile(fileName, openMode);
+  if (pStream == nullptr)
+    return false;
+
+  byte* pData = new byte[CHUNK_SIZE];
+  bool result = (pStream->GetSize() == size);
+  uint64 totalRead = 0;
+  while (result)
+  {
+    uint32 readSize = pStream->Read(pData, CHUNK_SIZE);
+    for (uint32 i = 0; i < readSize && result; i++)
+      result = (pData[i] == 0);
+
+    totalRead += readSize;
+    if (readSize < CHUNK_SIZE)
+      break;
+  }
+
+  result &= (totalRead == size && !pStream->InErrorState());
+  pStream->Release();
+  delete[] pData;
+  return result;
+}
+
+static bool TestZip64()
+{
+  // past the 32-bit size fields, but compresses down to a few megabytes, so header offsets stay below 4 GB and
+  // only the zip64 sizes are exercised
+  static const uint64 HUGE_ENTRY_SIZE = 0x100000000ULL + 12345;
+  static const uint32 CHUNK_SIZE = 1024 * 1024;
+
+  ByteStream* pArchiveStream = ByteStream_CreateGrowableMemoryStream();
+  ZipArchive* pArchive = ZipArchive::CreateArchive(pArchiveStream);
+  bool result = WriteEntry(pArchive, "before.txt", 1000, 1, false);
+
+  ByteStream* pStream = pArchive->OpenFile("huge.bin", BYTESTREAM_OPEN_WRITE | BYTESTREAM_OPEN_STREAMED, 1);
+  result &= (pStream != nullptr);
+  if (pStream != nullptr)
+  {
+    byte* pZeroes = new byte[CHUNK_SIZE];
+    std::memset(pZeroes, 0, CHUNK_SIZE);
+    for (uint64 offset = 0; offset < HUGE_ENTRY_SIZE && result;)
+    {
+      uint32 writeSize = (uint32)Min(HUGE_ENTRY_SIZE - offset, (uint64)CHUNK_SIZE);
+      result = (pStream->Write(pZeroes, writeSize) == writeSize);
+      offset += writeSize;
+    }
+
+    pStream->Release();
+    delete[] pZeroes;
+  }
+
+  result &= WriteEntry(pArchive, "after.txt", 1000, 2, true);
+  result &= pArchive->CommitChanges();
+  delete pArchive;
+
+  FILESYSTEM_STAT_DATA statData;
+  pArchive = (result) ? ZipArchive::OpenArchiveReadOnly(pArchiveStream) : nullptr;
+  result &= (pArchive != nullptr);
+  if (pArchive != nullptr)
+  {
+    result &= (pArchive->StatFile("huge.bin", &statData) && statData.Size == HUGE_ENTRY_SIZE);
+    result &= VerifyEntry(pArchive, "before.txt", 1000, 1, false);
+    result &= VerifyEntry(pArchive, "after.txt", 1000, 2, true);
+
+    // too large to buffer, so a seekable open falls back to streaming
+    result &= ReadZeroEntry(pArchive, "huge.bin", HUGE_ENTRY_SIZE, BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_SEEKABLE);
+
+    // copying carries the zip64 sizes into the new local header
+    ByteStream* pCopyStream = ByteStream_CreateGrowableMemoryStream();
+    ZipArchive* pCopyArchive = ZipArchive::CreateArchive(pCopyStream);
+    result &= pCopyArchive->CopyFile(pArchive, "huge.bin");
+    result &= pCopyArchive->CopyFile(pArchive, "after.txt");
+    result &= pCopyArchive->CommitChanges();
+    delete pCopyArchive;
+
+    pCopyArchive = ZipArchive::OpenArchiveIndexed(pCopyStream);
+    result &= (pCopyArchive != nullptr);
+    if (pCopyArchive != nullptr)
+    {
+      result &= (pCopyArchive->StatFile("huge.bin", &statData) && statData.Size == HUGE_ENTRY_SIZE);
+      result &= VerifyEntry(pCopyArchive, "after.txt", 1000, 2, true);
+
+      TestCountingSink sink;
+      result &= pCopyArchive->ExtractAll(&sink);
+      result &= (sink.GetClosedCount() == 2 && sink.GetFailedCount() == 0);
+      delete pCopyArchive;
+    }
+
+    pCopyStream->Release();
+    delete pArchive;
+  }
+
+  if (result)
+    Log_InfoPrintf("PASS: zip64");
+  else
+    Log_ErrorPrintf("FAIL: zip64");
+
+  pArchiveStream->Release();
+  return result;
+}
+
+static bool TestCodecs()
+{
+  ThreadPool threadPool(4);
+  bool result = true;
+  for (uint32 codecIndex = 0; codecIndex < COMPRESSION_CODEC_COUNT; codecIndex++)
+  {
+    COMPRESSION_CODEC codec = (COMPRESSION_CODEC)codecIndex;
+    const char* codecName = CompressionCodec::GetName(codec);
+    ByteStream* pArchiveStream = ByteStream_CreateGrowableMemoryStream();
+    ZipArchive* pArchive = ZipArchive::CreateArchive(pArchiveStream);
+    if (!CompressionCodec::IsAvailable(codec))
+    {
+      // stored entries don't need the codec
+      result &= (pArchive->OpenFile("a.bin", BYTESTREAM_OPEN_WRITE | BYTESTREAM_OPEN_STREAMED, 1, codec) == nullptr);
+      result &= WriteEntry(pArchive, "b.bin", 1000, 1, true, 0, codec);
+      Log_InfoPrintf("SKIP: %s entries, not built in", codecName);
+      delete pArchive;
+      pArchiveStream->Release();
+      continue;
+    }
+
+    // each way of writing an entry, mixed with deflate entries
+    bool codecResult = true;
+    uint32 level = CompressionCodec::GetDefaultCompressionLevel(codec);
+    codecResult &= WriteEntry(pArchive, "buffered.bin", LARGE_ENTRY_SIZE, 1, false, level, codec);
+    codecResult &= WriteEntry(pArchive, "streamed.bin", LARGE_ENTRY_SIZE, 2, true, level, codec);
+    codecResult &= WriteEntry(pArchive, "deflate.bin", 5000, 3, false);
+    pArchive->SetCompressionThreadPool(&threadPool, 64 * 1024);
+    codecResult &= WriteEntry(pArchive, "pool_buffered.bin", LARGE_ENTRY_SIZE, 4, false, level, codec);
+    codecResult &= WriteEntry(pArchive, "pool_streamed.bin", LARGE_ENTRY_SIZE, 5, true, level, codec);
+    codecResult &= WriteEntry(pArchive, "pool_small.bin", 1000, 6, false, level, codec);
+    codecResult &= pArchive->CommitChanges();
+    delete pArchive;
+
+    pArchive = (codecResult) ? ZipArchive::OpenArchiveReadOnly(pArchiveStream) : nullptr;
+    codecResult &= (pArchive != nullptr);
+    if (pArchive != nullptr)
+    {
+      static const char* fileNames[] = {"buffered.bin", "streamed.bin", "pool_buffered.bin", "pool_streamed.bin"};
+      static const uint32 seeds[] = {1, 2, 4, 5};
+      for (uint32 i = 0; i < countof(fileNames); i++)
+      {
+        codecResult &= VerifyEntry(pArchive, fileNames[i], LARGE_ENTRY_SIZE, seeds[i], false);
+        codecResult &= VerifyEntry(pArchive, fileNames[i], LARGE_ENTRY_SIZE, seeds[i], true);
+      }
+      codecResult &= VerifyEntry(pArchive, "deflate.bin", 5000, 3, true);
+      codecResult &= VerifyEntry(pArchive, "pool_small.bin", 1000, 6, true);
+
+      TestExtractSink sink;
+      codecResult &= (pArchive->ExtractAll(&sink, &threadPool) && sink.GetEntryCount() == 6);
+      codecResult &= sink.VerifyEntry("pool_buffered.bin", LARGE_ENTRY_SIZE, 4);
+      codecResult &= sink.VerifyEntry("streamed.bin", LARGE_ENTRY_SIZE, 2);
+      delete pArchive;
+    }
+
+    if (codecResult)
+      Log_InfoPrintf("PASS: %s entries, archive size %u", codecName, (uint32)pArchiveStream->GetSize());
+    else
+      Log_ErrorPrintf("FAIL: %s entries", codecName);
+
+    result &= codecResult;
+    pArchiveStream->Release();
+  }
+
+  return result;
+}
+
+// random seeks in a streamed entry, each followed by a short read. returns the time taken, or a negative value if the
+// data didn't match.
+static double SeekAndVerify(ZipArchive* pArchive, const char* fileName, const byte* pExpected, uint32 size,
+                            uint32 seekCount)
+{
+  ByteStream* pStream = pArchive->OpenFile(fileName, BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_STREAMED);
+  if (pStream == nullptr)
+    return -1.0;
+
+  static const uint32 READ_SIZE = 4096;
+  byte buffer[READ_SIZE];
+  bool result = true;
+  uint32 state = 4242;
+  Timer timer;
+  for (uint32 i = 0; i < seekCount && result; i++)
+  {
+    state = state * 1103515245u + 12345u;
+    uint32 offset = (state >> 4) % (size - READ_SIZE);
+    result = (pStream->SeekAbsolute(offset) && pStream->GetPosition() == offset &&
+              pStream->Read(buffer, READ_SIZE) == READ_SIZE && std::memcmp(buffer, pExpected + offset, READ_SIZE) == 0);
+  }
+
+  // relative to the end, then the whole entry from the start again, which checks the CRC
+  result = result && pStream->SeekToEnd() && pStream->GetPosition() == size && pStream->SeekRelative(-100) &&
+           pStream->Read(buffer, 100) == 100 && std::memcmp(buffer, pExpected + size - 100, 100) == 0;
+  double milliseconds = timer.GetTimeMilliseconds();
+
+  byte* pData = new byte[size];
+  result = result && pStream->SeekAbsolute(0) && pStream->Read(pData, size) == size &&
+           std::memcmp(pData, pExpected, size) == 0 && !pStream->InErrorState();
+  delete[] pData;
+
+  pStream->Release();
+  return (result) ? milliseconds : -1.0;
+}
+
+static bool TestSeekCheckpoints()
+{
+  static const uint32 DEFLATE_ENTRY_SIZE = 8 * 1024 * 1024 + 123;
+  static const uint32 OTHER_ENTRY_SIZE = 2 * 1024 * 1024 + 45;
+  static const uint32 SEEK_COUNT = 32;
+
+  ByteStream* pArchiveStream = ByteStream_CreateGrowableMemoryStream();
+  ZipArchive* pArchive = ZipArchive::CreateArchive(pArchiveStream);
+  bool result = WriteEntry(pArchive, "seek.bin", DEFLATE_ENTRY_SIZE, 2000, true);
+  result &= WriteEntry(pArchive, "seek_stored.bin", OTHER_ENTRY_SIZE, 2001, true, 0);
+  bool haveZstd = CompressionCodec::IsAvailable(COMPRESSION_CODEC_ZSTD);
+  if (haveZstd)
+    result &= WriteEntry(pArchive, "seek_zstd.bin", OTHER_ENTRY_SIZE, 2002, true, 3, COMPRESSION_CODEC_ZSTD);
+  result &= pArchive->CommitChanges();
+  delete pArchive;
+
+  pArchive = (result) ? ZipArchive::OpenArchiveReadOnly(pArchiveStream) : nullptr;
+  if (pArchive == nullptr)
+  {
+    Log_ErrorPrintf("FAIL: seek checkpoints, creating archive");
+    pArchiveStream->Release();
+    return false;
+  }
+
+  byte* pExpected = new byte[DEFLATE_ENTRY_SIZE];
+  FillEntryData(pExpected, DEFLATE_ENTRY_SIZE, 2000);
+
+  // the index is built by the first pass, and reused by the second
+  pArchive->SetSeekCheckpointInterval(256 * 1024);
+  double firstMilliseconds = SeekAndVerify(pArchive, "seek.bin", pExpected, DEFLATE_ENTRY_SIZE, SEEK_COUNT);
+  double indexedMilliseconds = SeekAndVerify(pArchive, "seek.bin", pExpected, DEFLATE_ENTRY_SIZE, SEEK_COUNT);
+  pArchive->SetSeekCheckpointInterval(0);
+  double unindexedMilliseconds = SeekAndVerify(pArchive, "seek.bin", pExpected, DEFLATE_ENTRY_SIZE, SEEK_COUNT);
+  result &= (firstMilliseconds >= 0.0 && indexedMilliseconds >= 0.0 && unindexedMilliseconds >= 0.0);
+
+  FillEntryData(pExpected, OTHER_ENTRY_SIZE, 2001);
+  result &= (SeekAndVerify(pArchive, "seek_stored.bin", pExpected, OTHER_ENTRY_SIZE, SEEK_COUNT) >= 0.0);
+  if (haveZstd)
+  {
+    FillEntryData(pExpected, OTHER_ENTRY_SIZE, 2002);
+    result &= (SeekAndVerify(pArchive, "seek_zstd.bin", pExpected, OTHER_ENTRY_SIZE, SEEK_COUNT) >= 0.0);
+  }
+
+  if (result)
+  {
+    Log_InfoPrintf("PASS: seek checkpoints, %u seeks: %.1f ms building the index, %.1f ms with it, %.1f ms without",
+                   SEEK_COUNT, firstMilliseconds, indexedMilliseconds, unindexedMilliseconds);
+  }
+  else
+  {
+    Log_ErrorPrintf("FAIL: seek checkpoints");
+  }
+
+  delete[] pExpected;
+  delete pArchive;
+  pArchiveStream->Release();
+  return result;
+}
+
+DEFINE_TEST_SUITE(ZipArchive)
+{
+  bool result = true;
+  result &= TestParallelCompression();
+  result &= TestBulkExtraction();
+  result &= TestIndexedOpen();
+  result &= TestStoredViews();
+  result &= TestAppendCommit();
+  result &= TestZip64();
+  result &= TestCodecs();
+  result &= TestSeekCheckpoints();
+  return result;
+}
+
+#endif // HAVE_ZLIB